@@ -0,0 +1,49 @@
+#ifndef CSHELL_AGG_H
+#define CSHELL_AGG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define AGG_MAX_KEYS 16
+#define AGG_MAX_SPECS 16
+
+typedef enum {
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_AVG
+} AggKind;
+
+// One output column: count, or an aggregate of a numeric field
+typedef struct {
+    AggKind kind;
+    int field;          // Counts from 1; unused for count
+} AggSpec;
+
+// agg options
+typedef struct {
+    int keys[AGG_MAX_KEYS];     // Key fields, counting from 1
+    int key_count;              // Zero groups by the whole line
+    AggSpec specs[AGG_MAX_SPECS];
+    int spec_count;
+    char delimiter;     // -d, or 0 for fields split by runs of blanks
+    const char *output_delimiter; // -o, else the delimiter or a tab
+    size_t top;         // -t: only the groups with the largest first column
+    size_t memory;      // -S: bytes of hash tables before spilling
+    int jobs;           // Threads aggregating chunks
+} AggOptions;
+
+// Group the lines of the files (stdin for none or "-") by their key
+// fields and print each group's key and columns. Chunks of input are
+// aggregated on jobs threads, each into its own open-addressing hash
+// table, and the tables are merged at the end. A table that outgrows its
+// share of the memory budget is written out to one of sixteen temp files
+// by hash, and the files are then aggregated one at a time. Groups come
+// out in order of first appearance (within each partition once anything
+// was spilled), or with top, the largest through a bounded heap. Returns
+// 0, or 1 on errors.
+int agg_run(const AggOptions *opts, char **files, int count, FILE *out);
+
+#endif // CSHELL_AGG_H
@@ -0,0 +1,14 @@
+#ifndef CSHELL_ARITH_H
+#define CSHELL_ARITH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Evaluate a shell arithmetic expression over 64-bit integers: numbers,
+// variables and NAME[subscript] elements, ( ), unary - + ! ~, * / %, + -,
+// << >>, comparisons, & ^ |, && ||, ?:, ++ -- and the assignments
+// = += -= *= /= %=. Integer variables are used as stored; only string
+// values are parsed. Returns 0, or -1 with a message in err.
+int arith_eval(const char *expr, int64_t *result, char *err, size_t err_size);
+
+#endif // CSHELL_ARITH_H
@@ -19,7 +19,17 @@ int cmd_mkdir(int argc, char **argv);
 int cmd_rmdir(int argc, char **argv);
 int cmd_touch(int argc, char **argv);
 int cmd_rm(int argc, char **argv);
+int cmd_cp(int argc, char **argv);
+int cmd_mv(int argc, char **argv);
+int cmd_find(int argc, char **argv);
+int cmd_grep(int argc, char **argv);
 int cmd_cat(int argc, char **argv);
+int cmd_head(int argc, char **argv);
+int cmd_tail(int argc, char **argv);
+int cmd_wc(int argc, char **argv);
+int cmd_sort(int argc, char **argv);
+int cmd_fields(int argc, char **argv);
+int cmd_agg(int argc, char **argv);
 int cmd_echo(int argc, char **argv);
 
 // Process management commands
@@ -28,11 +38,23 @@ int cmd_kill(int argc, char **argv);
 int cmd_bg(int argc, char **argv);
 int cmd_fg(int argc, char **argv);
 int cmd_jobs(int argc, char **argv);
+int cmd_metrics(int argc, char **argv);
+int cmd_parallel(int argc, char **argv);
+int cmd_limit(int argc, char **argv);
+int cmd_pin(int argc, char **argv);
+int cmd_spawnd(int argc, char **argv);
+int cmd_qos(int argc, char **argv);
+int cmd_coproc(int argc, char **argv);
+int cmd_coproc_send(int argc, char **argv);
+int cmd_coproc_read(int argc, char **argv);
 
 // Environment commands
 int cmd_env(int argc, char **argv);
 int cmd_export(int argc, char **argv);
 int cmd_unset(int argc, char **argv);
+int cmd_local(int argc, char **argv);
+int cmd_declare(int argc, char **argv);
+int cmd_let(int argc, char **argv);
 
 // AI commands
 int cmd_ai_help(int argc, char **argv);
@@ -0,0 +1,35 @@
+#ifndef CSHELL_COPROC_H
+#define CSHELL_COPROC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "process.h"
+
+#define COPROC_MAX 16
+#define COPROC_MAX_NAME 32
+
+// Start a named coprocess with its stdin and stdout connected to us;
+// stderr stays on the terminal. Returns 0, or -1 with errno set.
+int coproc_start(const char *name, char **args, int argc);
+
+// Queue data for the coprocess and write as much as the pipe takes now
+int coproc_send(const char *name, const char *data, size_t len);
+
+// Read one line (without the newline) into buf. Waits up to timeout_ms,
+// -1 for no limit. A line longer than the 1 MiB buffer is returned in
+// pieces. Returns the length, -1 at end of output or on error, -2 on
+// timeout.
+ssize_t coproc_read_line(const char *name, char *buf, size_t size, int timeout_ms);
+
+// Close our end of the coprocess's stdin and forget it
+int coproc_close(const char *name);
+
+// Flush queued input and drain ready output of every coprocess without
+// blocking; called from the main loop
+void coproc_service(void);
+
+Process *coproc_process(const char *name);
+void coproc_print_all(void);
+void coproc_cleanup(void);
+
+#endif // CSHELL_COPROC_H
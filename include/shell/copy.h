@@ -0,0 +1,28 @@
+#ifndef CSHELL_COPY_H
+#define CSHELL_COPY_H
+
+#include <stdbool.h>
+
+// cp and mv options
+typedef struct {
+    bool recursive;     // -r/-R: copy directories, symlinks stay symlinks
+    bool preserve;      // -p: mode, owner and timestamps
+    bool no_clobber;    // -n: never overwrite an existing file
+    bool verbose;       // -v: print each source -> destination
+    int jobs;           // Worker threads for a recursive copy
+} CopyOptions;
+
+// Copy sources to dest, or into dest when it is a directory. File data
+// goes through filecopy_file (reflink, then copy_file_range into a
+// preallocated file). A recursive copy walks the tree on a pool of
+// jobs threads that each list directories and copy files; directory
+// modes and times are fixed up once their contents are in place.
+// Returns 0, or 1 if anything failed.
+int copy_run(const CopyOptions *opts, char **sources, int count, const char *dest);
+
+// Rename sources to dest, or into dest when it is a directory. Across
+// file systems the source is copied with everything preserved and then
+// removed. Only no_clobber, verbose and jobs are used.
+int move_run(const CopyOptions *opts, char **sources, int count, const char *dest);
+
+#endif // CSHELL_COPY_H
@@ -5,22 +5,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 
-#define ENV_MAX_NAME 64
-#define ENV_MAX_VALUE 1024
-#define ENV_MAX_VARS 256
-
+// A variable is a view of one "NAME=VALUE" record in the env arena; the
+// name is the first name_len bytes, the value follows the '='
 typedef struct {
-    char name[ENV_MAX_NAME];
-    char value[ENV_MAX_VALUE];
+    char *record;
+    uint32_t name_len;
+    uint32_t value_len;
+    uint32_t hash;
 } EnvVar;
 
+// Scopes layered over the variables. A scope holds only its own
+// overrides and lookups fall through to the scope below it; popping one
+// drops its overrides without touching the rest. Command and subshell
+// scopes catch every assignment made while they are on top; a function
+// scope only holds its locals.
+typedef enum {
+    ENV_SCOPE_COMMAND,      // VAR=x cmd
+    ENV_SCOPE_SUBSHELL,     // ( ... )
+    ENV_SCOPE_FUNCTION      // local
+} EnvScopeKind;
+
+#define ENV_MAX_SCOPES 64
+
 // Environment initialization and cleanup
 int env_init(void);
 void env_cleanup(void);
 
-// Environment operations
+// Environment operations. Pointers returned by env_get stay valid until
+// the next env_set or env_unset.
 int env_set(const char *name, const char *value);
 char *env_get(const char *name);
 int env_unset(const char *name);
@@ -37,4 +52,31 @@ int env_load_from_file(const char *path);
 bool env_exists(const char *name);
 char **env_get_all(int *count);
 
-#endif // ENV_H 
\ No newline at end of file
+// Cached envp snapshot for spawning children
+unsigned long env_get_generation(void);
+char **env_get_envp(void);
+
+// Scope operations. env_scope_push returns -1 past ENV_MAX_SCOPES.
+// env_set_local binds name in the innermost function scope; a NULL value
+// makes it local but unset. Returns -1 outside a function.
+int env_scope_push(EnvScopeKind kind);
+void env_scope_pop(void);
+int env_scope_depth(void);
+int env_set_local(const char *name, const char *value);
+
+// Set or unset in the variables under all scopes
+int env_set_global(const char *name, const char *value);
+int env_unset_global(const char *name);
+
+// The variables without scopes, and the scopes' visible changes to them:
+// "NAME=VALUE" entries, or a bare "NAME" for a variable a scope unset.
+// Lets a spawner keep the base envp and send only the overlay per child.
+unsigned long env_get_base_generation(void);
+char **env_get_base_envp(void);
+char **env_get_overlay(int *count);
+
+// Time set/get/update/unset, a snapshot round trip and a command scope
+// over count scratch variables
+void env_benchmark(int count, FILE *out);
+
+#endif // ENV_H
@@ -0,0 +1,35 @@
+#ifndef CSHELL_FIELDS_H
+#define CSHELL_FIELDS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define FIELDS_MAX_RANGES 64
+
+// One item of the -f list: a field, a range of fields or a header name
+typedef struct {
+    int start;          // Fields count from 1
+    int end;            // 0 for the last field of each line
+    const char *name;   // Looked up in each file's header line instead
+} FieldRange;
+
+// fields options
+typedef struct {
+    FieldRange ranges[FIELDS_MAX_RANGES];
+    int range_count;
+    char delimiter;     // -d, or 0 for fields split by runs of blanks
+    const char *output_delimiter; // -o, else the delimiter or a space
+    bool header;        // -H: the first line of each file names the fields
+} FieldsOptions;
+
+// Print the selected fields of each line of the files (stdin for none or
+// "-"), in the order listed. A field missing from a line prints empty,
+// except at the open end of a range. Delimiters and newlines are found
+// sixty-four bytes at a time with SSE2, and the fields go out with
+// writev straight from the read buffer; adjacent spans share one iovec,
+// so selecting neighbouring fields costs no more than one. With header,
+// only the first file's header line is printed. Returns 0, or 1 on
+// errors or an unknown field name.
+int fields_run(const FieldsOptions *opts, char **files, int count, FILE *out);
+
+#endif // CSHELL_FIELDS_H
@@ -0,0 +1,36 @@
+#ifndef CSHELL_FILECOPY_H
+#define CSHELL_FILECOPY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// How data was moved, fastest first
+typedef enum {
+    FILECOPY_CLONE,         // FICLONE: shares extents, no data moves
+    FILECOPY_RANGE,         // copy_file_range: in the kernel, reflinks where supported
+    FILECOPY_SPLICE,        // splice into or out of a pipe
+    FILECOPY_SENDFILE,      // sendfile from a file to a socket or file
+    FILECOPY_READ_WRITE     // Large buffer through user space
+} FileCopyMethod;
+
+// Copy from in to out until end of input, picking the method by what out
+// is: copy_file_range to a regular file, splice to a pipe, sendfile to a
+// socket, plain reads for a terminal. A method the kernel refuses falls
+// back to the next one; the buffer copy is the last resort. Returns the
+// bytes copied, or -1 with errno set. method, if not NULL, gets the
+// method that moved the data.
+int64_t filecopy_fd(int in, int out, FileCopyMethod *method);
+const char *filecopy_method_name(FileCopyMethod method);
+
+// Copy a whole regular file st describes into an empty out. Tries a
+// FICLONE reflink first. A sparse source is copied extent by extent so
+// its holes stay holes; anything else is preallocated with fallocate and
+// goes through filecopy_fd.
+int64_t filecopy_file(int in, int out, const struct stat *st, FileCopyMethod *method);
+
+// Time cat's old 4 KB stdio loop against filecopy_fd over a size_mb
+// scratch file into a file, a pipe and /dev/null
+void filecopy_benchmark(size_t size_mb, FILE *out);
+
+#endif // CSHELL_FILECOPY_H
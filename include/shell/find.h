@@ -0,0 +1,39 @@
+#ifndef CSHELL_FIND_H
+#define CSHELL_FIND_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// A numeric test: -N is less than, N equal, +N greater than
+typedef struct {
+    bool set;
+    int cmp;            // -1, 0 or 1
+    int64_t value;
+    int64_t unit;       // Bytes per size unit, seconds per time unit
+} FindNumber;
+
+// find predicates, all of which must hold
+typedef struct {
+    const char *name;   // -name/-iname glob on the last component
+    bool icase;         // -iname
+    char type;          // -type f, d, l, p, s, b or c; 0 for any
+    FindNumber size;    // -size, rounded up to whole units like find
+    FindNumber mtime;   // -mtime/-mmin, whole units ago
+    int min_depth;
+    int max_depth;      // -1 for no limit
+    bool sorted;        // -s: print in path order instead of as found
+    bool print0;        // End each path with NUL instead of newline
+    int jobs;           // Walker threads
+} FindOptions;
+
+// Walk each path on opts->jobs threads. Every thread owns a deque of
+// directories: it works on the newest one and, when empty, steals the
+// oldest from another thread. Directories are opened with openat on
+// their parent and read with getdents64; an entry is only stat'ed when
+// d_type can't answer the predicates. Matches are written to out in
+// per-thread batches as they are found, or collected and sorted first.
+// Returns 0, or 1 if anything could not be read.
+int find_run(const FindOptions *opts, char **paths, int count, FILE *out);
+
+#endif // CSHELL_FIND_H
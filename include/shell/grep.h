@@ -0,0 +1,36 @@
+#ifndef CSHELL_GREP_H
+#define CSHELL_GREP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// grep options
+typedef struct {
+    const char *pattern;
+    bool fixed;         // -F: pattern is a plain string
+    bool extended;      // -E: POSIX extended regex, basic otherwise
+    bool icase;         // -i
+    bool invert;        // -v
+    bool line_numbers;  // -n
+    bool count;         // -c
+    bool files_only;    // -l
+    bool quiet;         // -q
+    bool recursive;     // -r
+    int with_filename;  // 1 -H, 0 -h, -1 when there is more than one file
+    bool no_messages;   // -s
+    int jobs;           // Threads searching files
+    size_t block_size;  // Bytes read at a time from stdin and pipes
+} GrepOptions;
+
+// Search the files (stdin for none or "-") for lines matching the
+// pattern. Regular files are mmap'd; the rest are read in block_size
+// blocks and searched a block of whole lines at a time. A required
+// literal is pulled out of the pattern and located with a SIMD scan,
+// and the compiled regex only runs on lines that contain it. Files are
+// searched on a pool of threads, but the output comes out in the order
+// the files were given. Returns 0 if a line matched, 1 if none did and
+// 2 on errors, like grep.
+int grep_run(const GrepOptions *opts, char **files, int count, FILE *out);
+
+#endif // CSHELL_GREP_H
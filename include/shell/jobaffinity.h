@@ -0,0 +1,50 @@
+#ifndef CSHELL_JOBAFFINITY_H
+#define CSHELL_JOBAFFINITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define JOB_AFFINITY_MAX_CPUS 1024
+#define JOB_AFFINITY_WORDS (JOB_AFFINITY_MAX_CPUS / 64)
+
+// CPU set kept independent of cpu_set_t so headers don't need _GNU_SOURCE
+typedef struct {
+    uint64_t bits[JOB_AFFINITY_WORDS];
+} JobCpuSet;
+
+// How jobs without an explicit pin are placed
+typedef enum {
+    PLACEMENT_OFF,          // Inherit the shell's affinity
+    PLACEMENT_ROUND_ROBIN,  // Next core in topology order
+    PLACEMENT_LEAST_LOADED  // Core with the fewest placed jobs, idle siblings first
+} PlacementPolicy;
+
+// CPU set helpers
+void job_cpuset_clear(JobCpuSet *set);
+void job_cpuset_add(JobCpuSet *set, int cpu);
+bool job_cpuset_has(const JobCpuSet *set, int cpu);
+bool job_cpuset_empty(const JobCpuSet *set);
+
+// Parse "0-3,8,10-11"; returns 0 on success
+int job_affinity_parse(const char *list, JobCpuSet *set);
+
+// Format a set back into list form
+const char *job_affinity_format(const JobCpuSet *set, char *buf, int size);
+
+// Placement policy
+void job_affinity_set_policy(PlacementPolicy policy);
+PlacementPolicy job_affinity_get_policy(void);
+const char *job_affinity_policy_name(PlacementPolicy policy);
+
+// Usable CPUs ordered so consecutive picks land on different physical
+// cores before reusing SMT siblings; returns the count
+int job_affinity_cpu_order(const int **order);
+
+// Pick a CPU for a new job. load[cpu] is the number of running jobs
+// already placed on each CPU.
+int job_affinity_place(const int *load);
+
+// Child side, before exec
+void job_affinity_apply_child(const JobCpuSet *set);
+
+#endif // CSHELL_JOBAFFINITY_H
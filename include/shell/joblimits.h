@@ -0,0 +1,63 @@
+#ifndef CSHELL_JOBLIMITS_H
+#define CSHELL_JOBLIMITS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Limit-hit events recorded on a job
+#define LIMIT_EVENT_MEM_MAX       0x01    // memory.max was reached
+#define LIMIT_EVENT_OOM_KILL      0x02    // OOM killer fired inside the job's cgroup
+#define LIMIT_EVENT_CPU_THROTTLED 0x04    // cpu.max quota throttled the job
+#define LIMIT_EVENT_CPU_TIME      0x08    // RLIMIT_CPU was exceeded (SIGXCPU)
+
+// Resource limits for a job; zero means unlimited
+typedef struct {
+    int cpu_percent;                // Share of one CPU, may exceed 100
+    unsigned long long mem_bytes;   // Memory ceiling
+    unsigned long cpu_seconds;      // Total CPU time (RLIMIT_CPU)
+} JobLimits;
+
+// Limits attached to a spawned job
+typedef struct {
+    char *cgroup_path;      // Child cgroup, NULL with the setrlimit fallback
+    int procs_fd;           // cgroup.procs of that cgroup, -1 if none
+} JobLimitHandle;
+
+// Defaults applied to every job
+void job_limits_get_default(JobLimits *limits);
+void job_limits_set_default(const JobLimits *limits);
+
+// Parse "512M", "2G", ... and "50%"
+int job_limits_parse_size(const char *str, unsigned long long *bytes);
+int job_limits_parse_percent(const char *str, int *percent);
+
+bool job_limits_any(const JobLimits *limits);
+
+// Delegated cgroup v2 directory in use, NULL when falling back to setrlimit
+const char *job_limits_cgroup_base(void);
+
+// Parent side, before fork: create the job's cgroup when available.
+// Returns -1 with errno set if the cgroup or its limits could not be set
+// up; the child then falls back to setrlimit, which has no CPU share, so
+// process_spawn refuses a job with one and fails with ENOTSUP.
+int job_limits_prepare(const JobLimits *limits, int job_id, JobLimitHandle *handle);
+
+// Child side, after fork: join the cgroup and/or set rlimits.
+// Only async-signal-safe calls.
+void job_limits_apply_child(const JobLimits *limits, const JobLimitHandle *handle);
+
+// Parent side, after fork: drop the cgroup.procs fd
+void job_limits_spawned(JobLimitHandle *handle);
+
+// Read limit-hit counters of a finished job; term_signal is 0 on normal
+// exit and cpu_us is the user plus system time it used
+unsigned int job_limits_collect(const JobLimits *limits, const JobLimitHandle *handle,
+                                int term_signal, uint64_t cpu_us);
+
+// Remove the job's cgroup
+void job_limits_release(JobLimitHandle *handle);
+
+// Short description of the recorded events, e.g. "mem,oom"
+const char *job_limits_describe(unsigned int events, char *buf, int size);
+
+#endif // CSHELL_JOBLIMITS_H
@@ -0,0 +1,36 @@
+#ifndef CSHELL_JOBOUTPUT_H
+#define CSHELL_JOBOUTPUT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Default ring size per job, override with CSHELL_JOB_BUFFER (bytes)
+#define JOB_OUTPUT_DEFAULT_SIZE (64 * 1024)
+
+// Captured output of a background job. The ring lives in a memfd that is
+// mapped twice back to back, so any tail of up to the ring size is one
+// contiguous span.
+typedef struct JobOutput JobOutput;
+
+// Create a capture ring; *child_fd receives the write end for the job
+JobOutput *job_output_create(size_t capacity, int *child_fd);
+
+// Hand the ring back to the capture thread, which frees it once drained
+void job_output_release(JobOutput *output);
+
+// Write the last max_bytes of captured output to fd straight from the ring
+size_t job_output_write_tail(JobOutput *output, int fd, size_t max_bytes);
+
+// Bytes captured so far, including data already overwritten
+unsigned long long job_output_total(JobOutput *output);
+
+// Replay up to replay_bytes of the tail to the terminal, then forward
+// newly captured data there as well
+size_t job_output_attach(JobOutput *output, size_t replay_bytes);
+void job_output_detach(JobOutput *output);
+
+// Wait up to timeout_ms for the job to close its end of the capture
+// pipe; false if something (e.g. a daemonized grandchild) still holds it
+bool job_output_wait_eof(JobOutput *output, int timeout_ms);
+
+#endif // CSHELL_JOBOUTPUT_H
@@ -0,0 +1,33 @@
+#ifndef CSHELL_JOBQOS_H
+#define CSHELL_JOBQOS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Scheduling class of a job
+typedef enum {
+    JOB_QOS_AUTO,           // Interactive in the foreground, the default class otherwise
+    JOB_QOS_INTERACTIVE,    // Same nice, policy and I/O priority as the shell
+    JOB_QOS_BACKGROUND,     // Nice +10, SCHED_BATCH, best-effort I/O at the lowest level
+    JOB_QOS_IDLE            // Nice 19, SCHED_IDLE, idle I/O class
+} JobQos;
+
+// Class given to background jobs
+void job_qos_set_default(JobQos qos);
+JobQos job_qos_get_default(void);
+
+// "interactive", "background", "idle"
+const char *job_qos_name(JobQos qos);
+int job_qos_parse(const char *name, JobQos *qos);
+
+// Child side, before exec
+void job_qos_apply_child(JobQos qos);
+
+// Move a running process to a class. Returns 0 when every knob took
+// effect; raising priority back may need CAP_SYS_NICE or RLIMIT_NICE.
+int job_qos_apply(pid_t pid, JobQos qos);
+
+// Describe what the kernel currently has for pid, e.g. "nice 10 batch be/7"
+const char *job_qos_describe(pid_t pid, char *buf, int size);
+
+#endif // CSHELL_JOBQOS_H
@@ -0,0 +1,32 @@
+#ifndef CSHELL_LS_H
+#define CSHELL_LS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Listing order
+typedef enum {
+    LS_SORT_NAME,
+    LS_SORT_SIZE,       // -S, largest first
+    LS_SORT_TIME,       // -t, newest first
+    LS_SORT_NONE        // -U, directory order
+} LsSort;
+
+// ls options
+typedef struct {
+    bool all;           // -a: dot files, . and ..
+    bool almost_all;    // -A: dot files without . and ..
+    bool long_format;   // -l
+    bool one_per_line;  // -1
+    bool classify;      // -F: append / * @ | =
+    bool reverse;       // -r
+    LsSort sort;
+    int color;          // 1 always, 0 never, -1 when out is a terminal
+} LsOptions;
+
+// List each path (the current directory when count is 0). Entries are
+// read with getdents64 and only stat'ed when the options need more than
+// the name and d_type. Returns 0, or 1 if any path failed.
+int ls_run(const LsOptions *opts, char **paths, int count, FILE *out);
+
+#endif // CSHELL_LS_H
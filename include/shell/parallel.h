@@ -0,0 +1,27 @@
+#ifndef CSHELL_PARALLEL_H
+#define CSHELL_PARALLEL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Parallel run options
+typedef struct {
+    int max_jobs;       // Maximum number of jobs running at once
+    bool verbose;       // Report every job's exit code, not only failures
+} ParallelOptions;
+
+// Default number of job slots (online CPUs)
+int parallel_default_jobs(void);
+
+// Run the command template once per input with bounded concurrency.
+// "{}" in the template is replaced by the input, otherwise the input is
+// appended as the last argument. With an empty template the input itself
+// is split on whitespace and run as a command.
+int parallel_run(const ParallelOptions *opts, char **tmpl, int tmpl_argc,
+                 char **inputs, int input_count);
+
+// Read one input per line
+char **parallel_read_inputs(FILE *in, int *count);
+void parallel_free_inputs(char **inputs, int count);
+
+#endif // CSHELL_PARALLEL_H
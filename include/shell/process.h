@@ -4,11 +4,24 @@
 #include <sys/types.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "joboutput.h"
+#include "joblimits.h"
+#include "jobaffinity.h"
+#include "jobqos.h"
 
 // Process constants
 #define PROCESS_MAX_PROCESSES 100
 #define PROCESS_MAX_ARGS 64
 #define PROCESS_MAX_NAME 256
+#define PROCESS_MAX_USAGE_TOTALS 64
+
+// Argument arena size classes: 256 bytes << class, freed blocks are kept
+// for reuse up to PROCESS_ARGS_POOL_DEPTH per class
+#define PROCESS_ARGS_MIN_BLOCK 256
+#define PROCESS_ARGS_CLASSES 9
+#define PROCESS_ARGS_POOL_DEPTH 16
 
 // Process states
 typedef enum {
@@ -18,30 +31,77 @@ typedef enum {
     PROCESS_STATE_ZOMBIE
 } ProcessState;
 
+// Resource usage collected from wait4()
+typedef struct {
+    uint64_t utime_us;      // User CPU time
+    uint64_t stime_us;      // System CPU time
+    long maxrss_kb;         // Peak resident set size
+    long minflt;            // Minor page faults
+    long majflt;            // Major page faults
+    long nvcsw;             // Voluntary context switches
+    long nivcsw;            // Involuntary context switches
+} ProcessUsage;
+
 // Process structure
 typedef struct {
     pid_t pid;
     int job_id;
     char name[PROCESS_MAX_NAME];
-    char **args;
+    char **args;            // NULL-terminated, pointers and strings in one block
     int argc;
+    int args_class;         // Arena size class of args, -1 if malloc'd directly
     ProcessState state;
     int exit_code;
     bool foreground;
-    time_t start_time;
-    time_t end_time;
+    uint64_t start_ns;      // CLOCK_MONOTONIC at spawn
+    uint64_t end_ns;        // CLOCK_MONOTONIC at exit, 0 while running
+    ProcessUsage usage;
+    bool accounted;         // Usage already added to the session totals
+    JobOutput *output;      // Captured stdout/stderr of background jobs
+    JobLimits limits;       // Limits the job was started with
+    JobLimitHandle limit_handle;
+    unsigned int limit_events;  // LIMIT_EVENT_* flags seen when the job ended
+    bool limits_collected;  // limit_events has been read since the job ended
+    int term_signal;        // Signal that ended the job, 0 on a normal exit
+    bool reported;          // Its end was announced, so it can be reaped
+    JobCpuSet cpus;         // CPUs the job is pinned to, empty if unpinned
+    JobQos qos;             // Scheduling class the job runs in
+    bool remote;            // Started by the spawn server, which reaps it
+    int pidfd;              // pidfd for signalling, -1 if none
 } Process;
 
+// How to start a process
+typedef struct {
+    bool foreground;
+    int out_fd;             // Target for stdout/stderr, -1 to inherit
+    int in_fd;              // stdin, -1 to inherit
+    int err_fd;             // stderr when it should differ from out_fd, -1 to follow it
+    bool capture;           // Capture output into a ring (background jobs)
+    size_t capture_size;    // Ring size, 0 for the default
+    JobLimits limits;
+    JobCpuSet cpus;         // Explicit pin; empty lets the placement policy decide
+    JobQos qos;             // JOB_QOS_AUTO picks by foreground/background
+    bool direct;            // Fork the shell itself instead of using the spawn server
+} ProcessSpawnOptions;
+
 // Process initialization and cleanup
 int process_init(void);
 void process_cleanup(void);
 
 // Process operations
+void process_spawn_options_init(ProcessSpawnOptions *opts, bool foreground);
+Process *process_spawn(const char *name, char **args, int argc, const ProcessSpawnOptions *opts);
 Process *process_create(const char *name, char **args, int argc, bool foreground);
+Process *process_create_redirected(const char *name, char **args, int argc,
+                                   bool foreground, int out_fd);
+Process *process_create_captured(const char *name, char **args, int argc,
+                                 size_t capture_size);
 int process_kill(Process *process, int signal);
 int process_wait(Process *process);
+Process *process_wait_any(const pid_t *pids, int count);
 int process_resume(Process *process);
 int process_suspend(Process *process);
+int process_set_qos(Process *process, JobQos qos);
 
 // Process status
 ProcessState process_get_state(Process *process);
@@ -54,6 +114,12 @@ Process *process_get_by_job_id(int job_id);
 // Process utilities
 void process_print(Process *process);
 void process_print_all(void);
+void process_print_long(Process *process);
+void process_print_all_long(void);
+void process_print_all_qos(void);
+void process_dump_usage(FILE *out);
+void process_report_done(void);
 void process_reap_zombies(void);
+void process_release(Process *process);
 
 #endif // CSHELL_PROCESS_H 
\ No newline at end of file
@@ -9,6 +9,8 @@
 #define SHELL_MAX_PROMPT 128
 #define SHELL_MAX_ARGS 64
 #define SHELL_MAX_HISTORY 100
+#define SHELL_MAX_FUNCTIONS 64
+#define SHELL_MAX_FUNCTION_NAME 64
 
 // Function declarations
 int shell_init(void);
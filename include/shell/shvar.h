@@ -0,0 +1,64 @@
+#ifndef CSHELL_SHVAR_H
+#define CSHELL_SHVAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Typed shell variables. They live beside the string environment: an
+// integer stays an int64_t, arrays keep their elements as separate
+// strings. A typed variable only becomes a string when it is exported
+// and a child is about to start.
+typedef enum {
+    SHVAR_NONE,         // Not a typed variable
+    SHVAR_INT,
+    SHVAR_ARRAY,        // Indexed from 0
+    SHVAR_ASSOC         // String keys, kept in insertion order
+} ShVarType;
+
+ShVarType shvar_type(const char *name);
+const char *shvar_type_name(ShVarType type);
+
+// Make name a typed variable. A string variable of the same name is
+// converted and stays exported; an existing typed variable must already
+// have that type. Returns 0, or -1 on a conflicting type.
+int shvar_declare(const char *name, ShVarType type);
+int shvar_unset(const char *name);
+
+// Integers. Reading also works on string variables and array element 0,
+// which are parsed; unset names read as 0.
+int shvar_set_int(const char *name, int64_t value);
+int64_t shvar_get_int(const char *name);
+
+// Elements. For an indexed array key is the decimal index; setting past
+// the end leaves unset holes. Setting an element of an unknown name
+// creates an indexed array.
+int shvar_set_element(const char *name, const char *key, const char *value);
+const char *shvar_get_element(const char *name, const char *key);
+int shvar_unset_element(const char *name, const char *key);
+int shvar_append(const char *name, const char *value);
+int shvar_clear(const char *name);
+
+// Set elements and their keys, in order. Pointers stay valid until the
+// variable changes; keys of an indexed array are formatted into the
+// returned table, which the caller frees along with its strings.
+int shvar_count(const char *name);
+const char **shvar_values(const char *name, int *count);
+char **shvar_keys(const char *name, int *count);
+
+// $name: an integer formatted into buf, element 0 of an array
+const char *shvar_scalar(const char *name, char *buf, size_t size);
+
+// Exporting. Exported variables are written to the environment by
+// shvar_sync_exports, called right before a child starts, and only when
+// they changed since the last sync. Arrays export their elements joined
+// by spaces.
+int shvar_export(const char *name);
+void shvar_sync_exports(void);
+
+// declare -p
+void shvar_print(const char *name);
+void shvar_print_all(void);
+void shvar_cleanup(void);
+
+#endif // CSHELL_SHVAR_H
@@ -0,0 +1,55 @@
+#ifndef CSHELL_SORT_H
+#define CSHELL_SORT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SORT_MAX_KEYS 16
+
+// One -k key: fields and characters count from 1
+typedef struct {
+    int start_field;
+    int start_char;     // 0 for the start of the field
+    int end_field;      // 0 for the end of the line
+    int end_char;       // 0 for the end of the field
+    bool numeric;       // n
+    bool reverse;       // r
+    bool fold;          // f: compare as upper case
+    bool blanks;        // b on the start: skip leading blanks of the field
+    bool end_blanks;    // b on the end, before counting end_char
+} SortKey;
+
+// sort options
+typedef struct {
+    SortKey keys[SORT_MAX_KEYS];
+    int key_count;      // Zero compares whole lines with the flags below
+    bool numeric;       // -n
+    bool reverse;       // -r
+    bool fold;          // -f
+    bool blanks;        // -b
+    bool unique;        // -u: one line of each run of equal keys
+    bool stable;        // -s: no whole-line comparison between equal keys
+    char separator;     // -t, or 0 for blank-to-non-blank transitions
+    size_t memory;      // -S: bytes of lines held in memory at once
+    int jobs;           // Threads sorting runs
+    const char *output; // -o, written only once all input is read
+    const char *temp_dir; // -T, else $TMPDIR or /tmp
+} SortOptions;
+
+// Default memory budget: an eighth of physical memory
+size_t sort_default_memory(void);
+
+// Sort the lines of the files (stdin for none or "-") in byte order. The
+// input is cut into chunks that jobs threads sort into runs while the
+// next chunk is read. Runs stay in memory while they fit in half the
+// budget and are spilled to unlinked temp files after that. The runs are
+// then merged through a loser tree, with more than one pass when there
+// are too many to open at once. Returns 0, or 2 on errors.
+int sort_run(const SortOptions *opts, char **files, int count, FILE *out);
+
+// Time sort_run in memory and with spilled runs against the system sort
+// on size_mb of generated lines
+void sort_benchmark(size_t size_mb, FILE *out);
+
+#endif // CSHELL_SORT_H
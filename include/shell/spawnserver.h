@@ -0,0 +1,49 @@
+#ifndef CSHELL_SPAWNSERVER_H
+#define CSHELL_SPAWNSERVER_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <stdbool.h>
+#include "joblimits.h"
+#include "jobaffinity.h"
+#include "jobqos.h"
+
+// What the spawn server should start
+typedef struct {
+    const char *path;           // Resolved executable
+    char **args;                // NULL-terminated argv
+    int argc;
+    int out_fd;                 // stdout/stderr target, -1 for the shell's own
+    int in_fd;                  // stdin, -1 for the shell's own
+    int err_fd;                 // stderr if not out_fd, -1 to follow out_fd
+    const JobLimits *limits;
+    const JobLimitHandle *limit_handle;
+    const JobCpuSet *cpus;
+    JobQos qos;
+    bool new_group;             // Start in a process group of its own
+} SpawnRequest;
+
+// Exit report for a child of the spawn server
+typedef struct {
+    pid_t pid;
+    int status;
+    struct rusage usage;
+} SpawnExit;
+
+// Fork the helper; call early, while the shell is still small
+int spawn_server_start(void);
+void spawn_server_stop(void);
+bool spawn_server_running(void);
+
+// Launch through the helper. Returns the pid and, when the kernel has
+// pidfd_open, a pidfd in *pidfd (else -1). Returns -1 if the helper is gone.
+pid_t spawn_server_spawn(const SpawnRequest *req, int *pidfd);
+
+// Read one pending exit report; returns 1 if one was read, 0 if none.
+// Async-signal-safe, called from the SIGCHLD handler.
+int spawn_server_read_exit(SpawnExit *exit_report);
+
+// exec with the shell's envp, running #!-less scripts under /bin/sh
+void spawn_exec(const char *path, char **args, int argc, char **envp) __attribute__((noreturn));
+
+#endif // CSHELL_SPAWNSERVER_H
@@ -0,0 +1,45 @@
+#ifndef CSHELL_SYSMON_H
+#define CSHELL_SYSMON_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Cumulative CPU time of one line of /proc/stat, in clock ticks
+typedef struct {
+    uint64_t busy;
+    uint64_t user;      // user + nice
+    uint64_t system;    // system + irq + softirq
+    uint64_t iowait;
+    uint64_t total;
+} SysmonCpu;
+
+// One reading of the system. cpus[0] is the sum over all cores.
+typedef struct {
+    SysmonCpu *cpus;
+    int cpu_count;      // Cores, not counting the sum
+    int cpu_capacity;
+    uint64_t mem_total;         // Bytes
+    uint64_t mem_free;
+    uint64_t mem_available;
+    uint64_t swap_total;
+    uint64_t swap_free;
+    double load[3];
+    int running;
+    int processes;
+} SysmonSample;
+
+// Read /proc/stat, /proc/meminfo and /proc/loadavg. The files are opened
+// on first use and re-read with pread after that; nothing is forked.
+int sysmon_sample(SysmonSample *sample);
+void sysmon_sample_free(SysmonSample *sample);
+
+// Print cores, memory, the root file system, load and processes
+int sysmon_report(FILE *out);
+
+// Redraw per-core CPU use from deltas every interval seconds, in place,
+// until interrupted or count refreshes (0 for no limit)
+int sysmon_watch(double interval, int count, FILE *out);
+
+void sysmon_cleanup(void);
+
+#endif // CSHELL_SYSMON_H
@@ -0,0 +1,44 @@
+#ifndef CSHELL_TEXTUTIL_H
+#define CSHELL_TEXTUTIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// wc counters; with none set, lines, words and bytes are shown
+typedef struct {
+    bool lines;         // -l
+    bool words;         // -w
+    bool chars;         // -m: UTF-8 characters
+    bool bytes;         // -c
+} WcOptions;
+
+// head and tail options
+typedef struct {
+    int64_t count;      // Lines, or bytes with -c
+    bool bytes;         // -c
+    bool from_start;    // tail +N: output starts at line or byte N
+    bool follow;        // tail -f
+    int headers;        // 1 always (-v), 0 never (-q), -1 with more than one file
+} HeadTailOptions;
+
+// Newlines in [p, p + len), sixteen bytes at a time
+uint64_t text_count_lines(const char *p, size_t len);
+
+// Count each file (stdin for none or "-"), with a total for several.
+// Only a byte count of a regular file is taken from fstat without
+// reading it.
+int wc_run(const WcOptions *opts, char **files, int count, FILE *out);
+
+// First count lines or bytes of each file, stopping as soon as they are out
+int head_run(const HeadTailOptions *opts, char **files, int count, FILE *out);
+
+// Last count lines or bytes of each file. A regular file is read
+// backward from the end in blocks until enough newlines are found, and
+// the rest is copied with filecopy_fd. With follow, the files are
+// watched with inotify and new data is printed as it is written, until
+// Ctrl-C.
+int tail_run(const HeadTailOptions *opts, char **files, int count, FILE *out);
+
+#endif // CSHELL_TEXTUTIL_H
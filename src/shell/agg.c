@@ -0,0 +1,874 @@
+#define _GNU_SOURCE
+#include "../../include/shell/agg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define AGG_MIN_CHUNK (64 * 1024)
+#define AGG_MAX_CHUNK (4 * 1024 * 1024)
+#define AGG_PARTITIONS 16
+#define AGG_PARTITION_SHIFT 60      // Top hash bits pick the partition
+#define AGG_FILE_BUFFER (128 * 1024)
+
+// A group; its double columns follow it
+typedef struct {
+    uint64_t hash;
+    uint64_t key;       // Offset of the key in the table's arena
+    uint64_t count;
+    uint64_t first;     // Input position of the group's first line
+    uint32_t key_len;
+} AggEntry;
+
+// Open-addressing hash table with linear probing. Slots index into a
+// packed entry array, so growing either one never moves a key.
+typedef struct {
+    uint32_t *slots;    // Entry number + 1, 0 when empty
+    size_t mask;
+    char *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    size_t stride;
+    char *keys;
+    size_t key_len;
+    size_t key_capacity;
+} AggTable;
+
+// A group as written to a partition file, followed by its columns and key
+typedef struct {
+    uint64_t hash;
+    uint64_t count;
+    uint64_t first;
+    uint32_t key_len;
+} AggRecord;
+
+typedef struct {
+    const char *start;
+    const char *end;
+} AggSpan;
+
+// Whole lines waiting for a worker
+typedef struct AggChunk {
+    struct AggChunk *next;
+    char *data;
+    size_t len;
+    uint64_t index;
+} AggChunk;
+
+struct Agg;
+
+typedef struct {
+    struct Agg *agg;
+    AggTable table;
+    AggSpan *fields;
+    char *key;          // Several key fields joined
+    size_t key_size;
+    pthread_t thread;
+} AggWorker;
+
+// State shared by the reader and the workers of one agg
+typedef struct Agg {
+    const AggOptions *opts;
+    const char *separator;
+    size_t separator_len;
+    int max_field;      // Fields each line is split into
+    size_t table_budget;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;   // A chunk was queued or the input ended
+    pthread_cond_t room;    // A worker finished a chunk
+    AggChunk *head;
+    AggChunk *tail;
+    int queued;
+    bool done;
+    uint64_t chunk_count;
+    pthread_mutex_t spill_lock;
+    FILE *partitions[AGG_PARTITIONS];
+    bool spilled;
+    int error;
+} Agg;
+
+// A group kept by -t, with its output line already formatted
+typedef struct {
+    double value;
+    uint64_t first;
+    char *line;
+    size_t len;
+} AggRanked;
+
+// Min-heap of the best top groups so far; the root goes first
+typedef struct {
+    AggRanked *items;
+    size_t count;
+    size_t capacity;
+} AggHeap;
+
+static void agg_set_error(Agg *agg, int err) {
+    pthread_mutex_lock(&agg->lock);
+    if (!agg->error) {
+        agg->error = err;
+    }
+    pthread_mutex_unlock(&agg->lock);
+}
+
+static uint64_t agg_hash(const char *p, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    h = (h ^ tail) * 0x94D049BB133111EBULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+static inline AggEntry *agg_entry(const AggTable *t, size_t i) {
+    return (AggEntry *)(t->entries + i * t->stride);
+}
+
+static inline double *agg_values(AggEntry *e) {
+    return (double *)(e + 1);
+}
+
+static bool agg_table_init(AggTable *t, size_t stride) {
+    memset(t, 0, sizeof(*t));
+    t->stride = stride;
+    t->mask = 1023;
+    t->slots = (uint32_t *)calloc(t->mask + 1, sizeof(uint32_t));
+    return t->slots != NULL;
+}
+
+static void agg_table_free(AggTable *t) {
+    free(t->slots);
+    free(t->entries);
+    free(t->keys);
+    memset(t, 0, sizeof(*t));
+}
+
+static size_t agg_table_memory(const AggTable *t) {
+    return (t->mask + 1) * sizeof(uint32_t) + t->entry_capacity * t->stride + t->key_capacity;
+}
+
+static bool agg_grow_slots(AggTable *t) {
+    size_t mask = t->mask * 2 + 1;
+    uint32_t *slots = (uint32_t *)calloc(mask + 1, sizeof(uint32_t));
+    if (!slots) {
+        return false;
+    }
+    for (size_t i = 0; i < t->entry_count; i++) {
+        size_t at = agg_entry(t, i)->hash & mask;
+        while (slots[at]) {
+            at = (at + 1) & mask;
+        }
+        slots[at] = (uint32_t)(i + 1);
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->mask = mask;
+    return true;
+}
+
+// The group for key, added with empty columns if it is new; NULL when
+// out of memory
+static AggEntry *agg_find(const Agg *agg, AggTable *t, uint64_t hash, const char *key, size_t len, uint64_t first) {
+    size_t at = hash & t->mask;
+    for (uint32_t slot; (slot = t->slots[at]) != 0; at = (at + 1) & t->mask) {
+        AggEntry *e = agg_entry(t, slot - 1);
+        if (e->hash == hash && e->key_len == len && memcmp(t->keys + e->key, key, len) == 0) {
+            return e;
+        }
+    }
+
+    // Keep the table at most half full
+    if ((t->entry_count + 1) * 2 > t->mask + 1) {
+        if (t->entry_count >= UINT32_MAX - 1 || !agg_grow_slots(t)) {
+            return NULL;
+        }
+        at = hash & t->mask;
+        while (t->slots[at]) {
+            at = (at + 1) & t->mask;
+        }
+    }
+    if (t->entry_count == t->entry_capacity) {
+        size_t capacity = t->entry_capacity ? t->entry_capacity * 2 : 256;
+        char *entries = (char *)realloc(t->entries, capacity * t->stride);
+        if (!entries) {
+            return NULL;
+        }
+        t->entries = entries;
+        t->entry_capacity = capacity;
+    }
+    if (t->key_len + len > t->key_capacity) {
+        size_t capacity = t->key_capacity ? t->key_capacity * 2 : 64 * 1024;
+        while (capacity < t->key_len + len) {
+            capacity *= 2;
+        }
+        char *keys = (char *)realloc(t->keys, capacity);
+        if (!keys) {
+            return NULL;
+        }
+        t->keys = keys;
+        t->key_capacity = capacity;
+    }
+
+    AggEntry *e = agg_entry(t, t->entry_count);
+    e->hash = hash;
+    e->key = t->key_len;
+    e->key_len = (uint32_t)len;
+    e->count = 0;
+    e->first = first;
+    double *values = agg_values(e);
+    for (int s = 0; s < agg->opts->spec_count; s++) {
+        AggKind kind = agg->opts->specs[s].kind;
+        values[s] = kind == AGG_MIN ? INFINITY : kind == AGG_MAX ? -INFINITY : 0;
+    }
+    memcpy(t->keys + t->key_len, key, len);
+    t->key_len += len;
+    t->slots[at] = (uint32_t)(++t->entry_count);
+    return e;
+}
+
+// Fold another partial result for the same group into e
+static void agg_combine(const Agg *agg, AggEntry *e, uint64_t count, uint64_t first, const double *values) {
+    e->count += count;
+    if (first < e->first) {
+        e->first = first;
+    }
+    double *into = agg_values(e);
+    for (int s = 0; s < agg->opts->spec_count; s++) {
+        switch (agg->opts->specs[s].kind) {
+            case AGG_SUM:
+            case AGG_AVG: into[s] += values[s]; break;
+            case AGG_MIN: if (values[s] < into[s]) into[s] = values[s]; break;
+            case AGG_MAX: if (values[s] > into[s]) into[s] = values[s]; break;
+            case AGG_COUNT: break;
+        }
+    }
+}
+
+// Fields of [p, end), as far as max; returns how many were found
+static int agg_split(char delim, const char *p, const char *end, AggSpan *fields, int max) {
+    int n = 0;
+    while (n < max) {
+        if (delim) {
+            const char *next = (const char *)memchr(p, delim, (size_t)(end - p));
+            fields[n].start = p;
+            fields[n].end = next ? next : end;
+            n++;
+            if (!next) {
+                break;
+            }
+            p = next + 1;
+        } else {
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (p == end) {
+                break;
+            }
+            fields[n].start = p;
+            while (p < end && *p != ' ' && *p != '\t') {
+                p++;
+            }
+            fields[n].end = p;
+            n++;
+        }
+    }
+    return n;
+}
+
+static double agg_number(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    // Plain integers, the usual case, skip strtod
+    bool negative = p < end && *p == '-';
+    const char *digits = p + negative;
+    const char *q = digits;
+    uint64_t value = 0;
+    while (q < end && q - digits < 18 && isdigit((unsigned char)*q)) {
+        value = value * 10 + (uint64_t)(*q++ - '0');
+    }
+    if (q > digits && q == end) {
+        return negative ? -(double)value : (double)value;
+    }
+
+    char buf[64];
+    size_t len = (size_t)(end - p) < sizeof(buf) - 1 ? (size_t)(end - p) : sizeof(buf) - 1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return strtod(buf, NULL);
+}
+
+static void agg_line(AggWorker *w, const char *line, const char *end, uint64_t position) {
+    Agg *agg = w->agg;
+    const AggOptions *opts = agg->opts;
+    int found = agg_split(opts->delimiter, line, end, w->fields, agg->max_field);
+
+    const char *key = line;
+    size_t len = (size_t)(end - line);
+    if (opts->key_count == 1) {
+        int k = opts->keys[0];
+        key = k <= found ? w->fields[k - 1].start : "";
+        len = k <= found ? (size_t)(w->fields[k - 1].end - key) : 0;
+    } else if (opts->key_count > 1) {
+        // Joined with the output separator, so it prints as stored
+        len = 0;
+        for (int i = 0; i < opts->key_count; i++) {
+            int k = opts->keys[i];
+            size_t field_len = k <= found ? (size_t)(w->fields[k - 1].end - w->fields[k - 1].start) : 0;
+            size_t need = len + field_len + agg->separator_len;
+            if (need > w->key_size) {
+                size_t size = w->key_size ? w->key_size : 256;
+                while (size < need) {
+                    size *= 2;
+                }
+                char *grown = (char *)realloc(w->key, size);
+                if (!grown) {
+                    agg_set_error(agg, ENOMEM);
+                    return;
+                }
+                w->key = grown;
+                w->key_size = size;
+            }
+            if (i > 0) {
+                memcpy(w->key + len, agg->separator, agg->separator_len);
+                len += agg->separator_len;
+            }
+            if (field_len) {
+                memcpy(w->key + len, w->fields[k - 1].start, field_len);
+                len += field_len;
+            }
+        }
+        key = w->key;
+    }
+
+    AggEntry *e = agg_find(agg, &w->table, agg_hash(key, len), key, len, position);
+    if (!e) {
+        agg_set_error(agg, ENOMEM);
+        return;
+    }
+    e->count++;
+    double *values = agg_values(e);
+    for (int s = 0; s < opts->spec_count; s++) {
+        const AggSpec *spec = &opts->specs[s];
+        if (spec->kind == AGG_COUNT) {
+            continue;
+        }
+        double v = spec->field <= found ?
+                   agg_number(w->fields[spec->field - 1].start, w->fields[spec->field - 1].end) : 0;
+        switch (spec->kind) {
+            case AGG_SUM:
+            case AGG_AVG: values[s] += v; break;
+            case AGG_MIN: if (v < values[s]) values[s] = v; break;
+            case AGG_MAX: if (v > values[s]) values[s] = v; break;
+            case AGG_COUNT: break;
+        }
+    }
+}
+
+static FILE *agg_temp_file(void) {
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cshell-agg-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    unlink(path);
+    FILE *file = fdopen(fd, "w+");
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, AGG_FILE_BUFFER);
+    return file;
+}
+
+// Append every group of the table to its partition file and empty it
+static bool agg_spill(Agg *agg, AggTable *t) {
+    int n = agg->opts->spec_count;
+    bool ok = true;
+    pthread_mutex_lock(&agg->spill_lock);
+    agg->spilled = true;
+    for (size_t i = 0; i < t->entry_count && ok; i++) {
+        AggEntry *e = agg_entry(t, i);
+        int p = (int)(e->hash >> AGG_PARTITION_SHIFT);
+        if (!agg->partitions[p] && !(agg->partitions[p] = agg_temp_file())) {
+            ok = false;
+            break;
+        }
+        AggRecord record;
+        memset(&record, 0, sizeof(record));
+        record.hash = e->hash;
+        record.count = e->count;
+        record.first = e->first;
+        record.key_len = e->key_len;
+        FILE *file = agg->partitions[p];
+        ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+             fwrite(agg_values(e), sizeof(double), (size_t)n, file) == (size_t)n &&
+             fwrite(t->keys + e->key, 1, e->key_len, file) == e->key_len;
+    }
+    pthread_mutex_unlock(&agg->spill_lock);
+
+    size_t stride = t->stride;
+    agg_table_free(t);
+    return agg_table_init(t, stride) && ok;
+}
+
+static void *agg_worker(void *arg) {
+    AggWorker *w = (AggWorker *)arg;
+    Agg *agg = w->agg;
+    for (;;) {
+        pthread_mutex_lock(&agg->lock);
+        while (!agg->head && !agg->done) {
+            pthread_cond_wait(&agg->ready, &agg->lock);
+        }
+        AggChunk *chunk = agg->head;
+        if (!chunk) {
+            pthread_mutex_unlock(&agg->lock);
+            break;
+        }
+        agg->head = chunk->next;
+        if (!agg->head) {
+            agg->tail = NULL;
+        }
+        pthread_mutex_unlock(&agg->lock);
+
+        // Position of a line: its chunk, then its place in the chunk
+        const char *p = chunk->data;
+        const char *end = chunk->data + chunk->len;
+        for (uint64_t line = 0; p < end; line++) {
+            const char *newline = (const char *)memchr(p, '\n', (size_t)(end - p));
+            agg_line(w, p, newline, chunk->index << 32 | line);
+            p = newline + 1;
+        }
+        if (agg_table_memory(&w->table) > agg->table_budget && !agg_spill(agg, &w->table)) {
+            agg_set_error(agg, errno ? errno : EIO);
+        }
+
+        pthread_mutex_lock(&agg->lock);
+        agg->queued--;
+        pthread_cond_signal(&agg->room);
+        pthread_mutex_unlock(&agg->lock);
+        free(chunk->data);
+        free(chunk);
+    }
+    return NULL;
+}
+
+static bool agg_queue(Agg *agg, char *data, size_t len) {
+    AggChunk *chunk = (AggChunk *)malloc(sizeof(AggChunk));
+    if (!chunk) {
+        free(data);
+        return false;
+    }
+    chunk->next = NULL;
+    chunk->data = data;
+    chunk->len = len;
+
+    pthread_mutex_lock(&agg->lock);
+    while (agg->queued >= agg->opts->jobs) {
+        pthread_cond_wait(&agg->room, &agg->lock);
+    }
+    chunk->index = agg->chunk_count++;
+    if (agg->tail) {
+        agg->tail->next = chunk;
+    } else {
+        agg->head = chunk;
+    }
+    agg->tail = chunk;
+    agg->queued++;
+    pthread_cond_signal(&agg->ready);
+    pthread_mutex_unlock(&agg->lock);
+    return true;
+}
+
+// Read every file into chunks that end at a line boundary
+static int agg_read(Agg *agg, char **files, int count) {
+    size_t chunk_size = agg->opts->memory / 4 / (size_t)agg->opts->jobs;
+    chunk_size = chunk_size < AGG_MIN_CHUNK ? AGG_MIN_CHUNK : chunk_size > AGG_MAX_CHUNK ? AGG_MAX_CHUNK : chunk_size;
+    size_t capacity = chunk_size;
+    size_t len = 0;
+    char *data = (char *)malloc(capacity);
+    if (!data) {
+        return ENOMEM;
+    }
+
+    int err = 0;
+    for (int i = 0; i < count && !err; i++) {
+        bool is_stdin = strcmp(files[i], "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO : open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            err = errno;
+            printf(COLOR_RED "agg: %s: %s\n" COLOR_RESET, files[i], strerror(err));
+            break;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        for (;;) {
+            if (len == capacity) {
+                const char *last = (const char *)memrchr(data, '\n', len);
+                size_t used = last ? (size_t)(last + 1 - data) : 0;
+                size_t rest = len - used;
+                // One line longer than the chunk: let the chunk grow
+                size_t next_capacity = rest * 2 > chunk_size ? rest * 2 : chunk_size;
+                char *next = (char *)malloc(next_capacity);
+                if (!next) {
+                    err = ENOMEM;
+                    break;
+                }
+                memcpy(next, data + used, rest);
+                if (used > 0) {
+                    if (!agg_queue(agg, data, used)) {
+                        free(next);
+                        data = NULL;
+                        err = ENOMEM;
+                        break;
+                    }
+                } else {
+                    free(data);
+                }
+                data = next;
+                len = rest;
+                capacity = next_capacity;
+            }
+            ssize_t n = read(fd, data + len, capacity - len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                err = errno;
+                printf(COLOR_RED "agg: %s: %s\n" COLOR_RESET, files[i], strerror(err));
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            len += (size_t)n;
+        }
+        if (!is_stdin) {
+            close(fd);
+        }
+        // The last line of a file always ends with a newline. A full
+        // buffer was cut before the last read, so there is room for it.
+        if (data && len > 0 && data[len - 1] != '\n') {
+            data[len++] = '\n';
+        }
+    }
+
+    if (!err && len > 0) {
+        return agg_queue(agg, data, len) ? 0 : ENOMEM;
+    }
+    free(data);
+    return err;
+}
+
+static double agg_column(const Agg *agg, AggEntry *e, int s) {
+    switch (agg->opts->specs[s].kind) {
+        case AGG_COUNT: return (double)e->count;
+        case AGG_AVG: return e->count ? agg_values(e)[s] / (double)e->count : 0;
+        default: return agg_values(e)[s];
+    }
+}
+
+static void agg_print(const Agg *agg, const AggTable *t, AggEntry *e, FILE *out) {
+    fwrite(t->keys + e->key, 1, e->key_len, out);
+    for (int s = 0; s < agg->opts->spec_count; s++) {
+        fwrite(agg->separator, 1, agg->separator_len, out);
+        if (agg->opts->specs[s].kind == AGG_COUNT) {
+            fprintf(out, "%" PRIu64, e->count);
+        } else {
+            fprintf(out, "%.15g", agg_column(agg, e, s));
+        }
+    }
+    fputc('\n', out);
+}
+
+// Whether a ranks below b: a smaller first column, or a later first line
+static bool agg_ranked_below(const AggRanked *a, const AggRanked *b) {
+    if (a->value != b->value) {
+        return a->value < b->value;
+    }
+    return a->first > b->first;
+}
+
+static void agg_heap_down(AggHeap *heap, size_t i) {
+    for (;;) {
+        size_t low = i, left = 2 * i + 1, right = left + 1;
+        if (left < heap->count && agg_ranked_below(&heap->items[left], &heap->items[low])) {
+            low = left;
+        }
+        if (right < heap->count && agg_ranked_below(&heap->items[right], &heap->items[low])) {
+            low = right;
+        }
+        if (low == i) {
+            return;
+        }
+        AggRanked swap = heap->items[i];
+        heap->items[i] = heap->items[low];
+        heap->items[low] = swap;
+        i = low;
+    }
+}
+
+// Keep e if it ranks among the best capacity groups seen so far
+static void agg_heap_offer(const Agg *agg, AggHeap *heap, const AggTable *t, AggEntry *e) {
+    AggRanked candidate = { agg_column(agg, e, 0), e->first, NULL, 0 };
+    bool full = heap->count == heap->capacity;
+    if (full && !agg_ranked_below(&heap->items[0], &candidate)) {
+        return;
+    }
+    FILE *line = open_memstream(&candidate.line, &candidate.len);
+    if (!line) {
+        return;
+    }
+    agg_print(agg, t, e, line);
+    fclose(line);
+
+    if (full) {
+        free(heap->items[0].line);
+        heap->items[0] = candidate;
+        agg_heap_down(heap, 0);
+        return;
+    }
+    size_t i = heap->count++;
+    heap->items[i] = candidate;
+    while (i > 0 && agg_ranked_below(&heap->items[i], &heap->items[(i - 1) / 2])) {
+        AggRanked swap = heap->items[i];
+        heap->items[i] = heap->items[(i - 1) / 2];
+        heap->items[(i - 1) / 2] = swap;
+        i = (i - 1) / 2;
+    }
+}
+
+static int agg_compare_first(const void *a, const void *b, void *arg) {
+    const AggTable *t = (const AggTable *)arg;
+    uint64_t x = agg_entry(t, *(const uint32_t *)a)->first;
+    uint64_t y = agg_entry(t, *(const uint32_t *)b)->first;
+    return x < y ? -1 : x > y;
+}
+
+// Print a table's groups in order of first appearance, or offer them to heap
+static void agg_emit(const Agg *agg, AggTable *t, AggHeap *heap, FILE *out) {
+    if (heap) {
+        for (size_t i = 0; i < t->entry_count; i++) {
+            agg_heap_offer(agg, heap, t, agg_entry(t, i));
+        }
+        return;
+    }
+    uint32_t *order = (uint32_t *)malloc((t->entry_count ? t->entry_count : 1) * sizeof(uint32_t));
+    if (!order) {
+        return;
+    }
+    for (size_t i = 0; i < t->entry_count; i++) {
+        order[i] = (uint32_t)i;
+    }
+    qsort_r(order, t->entry_count, sizeof(uint32_t), agg_compare_first, t);
+    for (size_t i = 0; i < t->entry_count; i++) {
+        agg_print(agg, t, agg_entry(t, order[i]), out);
+    }
+    free(order);
+}
+
+// Aggregate one partition file into a fresh table and emit it
+static int agg_partition(Agg *agg, FILE *file, AggHeap *heap, FILE *out, size_t stride) {
+    int n = agg->opts->spec_count;
+    AggTable t;
+    double values[AGG_MAX_SPECS];
+    char *key = NULL;
+    size_t key_size = 0;
+    if (!agg_table_init(&t, stride)) {
+        return ENOMEM;
+    }
+
+    rewind(file);
+    int err = 0;
+    AggRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.key_len + 1 > key_size) {
+            char *grown = (char *)realloc(key, record.key_len + 1);
+            if (!grown) {
+                err = ENOMEM;
+                break;
+            }
+            key = grown;
+            key_size = record.key_len + 1;
+        }
+        if (fread(values, sizeof(double), (size_t)n, file) != (size_t)n ||
+            fread(key, 1, record.key_len, file) != record.key_len) {
+            err = EIO;
+            break;
+        }
+        AggEntry *e = agg_find(agg, &t, record.hash, key, record.key_len, record.first);
+        if (!e) {
+            err = ENOMEM;
+            break;
+        }
+        agg_combine(agg, e, record.count, record.first, values);
+    }
+    if (!err && ferror(file)) {
+        err = EIO;
+    }
+    if (!err) {
+        agg_emit(agg, &t, heap, out);
+    }
+    free(key);
+    agg_table_free(&t);
+    return err;
+}
+
+static int agg_compare_ranked(const void *a, const void *b) {
+    const AggRanked *x = (const AggRanked *)a;
+    const AggRanked *y = (const AggRanked *)b;
+    return agg_ranked_below(x, y) ? 1 : agg_ranked_below(y, x) ? -1 : 0;
+}
+
+int agg_run(const AggOptions *opts, char **files, int count, FILE *out) {
+    static char *standard_input[] = { "-" };
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+
+    Agg agg;
+    memset(&agg, 0, sizeof(agg));
+    agg.opts = opts;
+    agg.separator = opts->output_delimiter ? opts->output_delimiter : opts->delimiter ? &opts->delimiter : "\t";
+    agg.separator_len = opts->output_delimiter ? strlen(opts->output_delimiter) : 1;
+    for (int k = 0; k < opts->key_count; k++) {
+        if (opts->keys[k] > agg.max_field) {
+            agg.max_field = opts->keys[k];
+        }
+    }
+    for (int s = 0; s < opts->spec_count; s++) {
+        if (opts->specs[s].kind != AGG_COUNT && opts->specs[s].field > agg.max_field) {
+            agg.max_field = opts->specs[s].field;
+        }
+    }
+    int jobs = opts->jobs > 0 ? opts->jobs : 1;
+    agg.table_budget = opts->memory / (size_t)jobs;
+    size_t stride = (sizeof(AggEntry) + (size_t)opts->spec_count * sizeof(double) + 7) & ~(size_t)7;
+    pthread_mutex_init(&agg.lock, NULL);
+    pthread_mutex_init(&agg.spill_lock, NULL);
+    pthread_cond_init(&agg.ready, NULL);
+    pthread_cond_init(&agg.room, NULL);
+
+    AggWorker *workers = (AggWorker *)calloc((size_t)jobs, sizeof(AggWorker));
+    int started = 0;
+    for (; workers && started < jobs; started++) {
+        AggWorker *w = &workers[started];
+        w->agg = &agg;
+        w->fields = (AggSpan *)malloc((size_t)(agg.max_field ? agg.max_field : 1) * sizeof(AggSpan));
+        if (!w->fields || !agg_table_init(&w->table, stride) ||
+            pthread_create(&w->thread, NULL, agg_worker, w) != 0) {
+            free(w->fields);
+            agg_table_free(&w->table);
+            break;
+        }
+    }
+
+    int err = started > 0 ? agg_read(&agg, files, count) : EAGAIN;
+    bool reported = err != 0 && err != ENOMEM && err != EAGAIN;
+
+    pthread_mutex_lock(&agg.lock);
+    agg.done = true;
+    pthread_cond_broadcast(&agg.ready);
+    pthread_mutex_unlock(&agg.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (!err) {
+        err = agg.error;
+    }
+
+    AggHeap heap = { NULL, 0, opts->top };
+    if (opts->top > 0) {
+        heap.items = (AggRanked *)malloc(opts->top * sizeof(AggRanked));
+        if (!heap.items) {
+            err = err ? err : ENOMEM;
+        }
+    }
+    AggHeap *ranked = opts->top > 0 ? &heap : NULL;
+
+    if (!err && !agg.spilled && started > 0) {
+        // Everything fit: fold the other tables into the first
+        AggTable *merged = &workers[0].table;
+        for (int i = 1; i < started && !err; i++) {
+            AggTable *t = &workers[i].table;
+            for (size_t j = 0; j < t->entry_count; j++) {
+                AggEntry *src = agg_entry(t, j);
+                AggEntry *e = agg_find(&agg, merged, src->hash, t->keys + src->key, src->key_len, src->first);
+                if (!e) {
+                    err = ENOMEM;
+                    break;
+                }
+                agg_combine(&agg, e, src->count, src->first, agg_values(src));
+            }
+        }
+        if (!err) {
+            agg_emit(&agg, merged, ranked, out);
+        }
+    } else if (!err) {
+        // Partitions are disjoint by hash, so each can be finished alone
+        for (int i = 0; i < started && !err; i++) {
+            if (workers[i].table.entry_count > 0 && !agg_spill(&agg, &workers[i].table)) {
+                err = errno ? errno : EIO;
+            }
+        }
+        for (int p = 0; p < AGG_PARTITIONS && !err; p++) {
+            if (agg.partitions[p]) {
+                err = agg_partition(&agg, agg.partitions[p], ranked, out, stride);
+            }
+        }
+    }
+
+    if (ranked && !err) {
+        qsort(heap.items, heap.count, sizeof(AggRanked), agg_compare_ranked);
+        for (size_t i = 0; i < heap.count; i++) {
+            fwrite(heap.items[i].line, 1, heap.items[i].len, out);
+        }
+    }
+    fflush(out);
+    if (err && !reported) {
+        printf(COLOR_RED "agg: %s\n" COLOR_RESET, strerror(err));
+    }
+
+    for (size_t i = 0; i < heap.count; i++) {
+        free(heap.items[i].line);
+    }
+    free(heap.items);
+    for (int i = 0; i < started; i++) {
+        agg_table_free(&workers[i].table);
+        free(workers[i].fields);
+        free(workers[i].key);
+    }
+    free(workers);
+    for (int p = 0; p < AGG_PARTITIONS; p++) {
+        if (agg.partitions[p]) {
+            fclose(agg.partitions[p]);
+        }
+    }
+    pthread_mutex_destroy(&agg.lock);
+    pthread_mutex_destroy(&agg.spill_lock);
+    pthread_cond_destroy(&agg.ready);
+    pthread_cond_destroy(&agg.room);
+    return err ? 1 : 0;
+}
@@ -0,0 +1,456 @@
+#include "../../include/shell/arith.h"
+#include "../../include/shell/shvar.h"
+#include "../../include/shell/env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#define ARITH_MAX_NAME 256
+#define ARITH_MAX_DEPTH 64
+
+// Recursive-descent parser state
+typedef struct {
+    const char *p;
+    char *err;
+    size_t err_size;
+    bool failed;
+    int skip;           // Inside the branch && || ?: did not take: no side effects
+    int depth;
+} Arith;
+
+// Variable or element an operator reads or writes
+typedef struct {
+    char name[ARITH_MAX_NAME];
+    char key[ARITH_MAX_NAME];
+    bool element;
+} ArithRef;
+
+static int64_t parse_assign(Arith *a);
+
+static void arith_fail(Arith *a, const char *message) {
+    if (!a->failed) {
+        snprintf(a->err, a->err_size, "%s", message);
+        a->failed = true;
+    }
+}
+
+static void skip_space(Arith *a) {
+    while (isspace((unsigned char)*a->p)) {
+        a->p++;
+    }
+}
+
+// Consume op if it is next, and not the start of a longer operator
+static bool accept(Arith *a, const char *op) {
+    skip_space(a);
+    size_t len = strlen(op);
+    if (strncmp(a->p, op, len) != 0) {
+        return false;
+    }
+    char next = a->p[len];
+    if (len == 1 && strchr("=<>&|", op[0]) && next == op[0]) {
+        return false;   // = vs ==, < vs <<, & vs &&
+    }
+    if (strchr("+-*/%<>&|^!=", op[len - 1]) && next == '=' && strcmp(op, "<<") && strcmp(op, ">>")) {
+        return false;   // + vs +=, < vs <=, ! vs !=
+    }
+    if ((strcmp(op, "+") == 0 || strcmp(op, "-") == 0) && next == op[0]) {
+        return false;   // + vs ++
+    }
+    a->p += len;
+    return true;
+}
+
+// NAME or NAME[subscript] at the cursor; false leaves the cursor alone
+static bool parse_ref(Arith *a, ArithRef *ref) {
+    skip_space(a);
+    const char *start = a->p;
+    if (!(isalpha((unsigned char)*start) || *start == '_')) {
+        return false;
+    }
+    const char *end = start + 1;
+    while (isalnum((unsigned char)*end) || *end == '_') {
+        end++;
+    }
+    size_t len = (size_t)(end - start);
+    if (len >= ARITH_MAX_NAME) {
+        arith_fail(a, "variable name too long");
+        return false;
+    }
+    memcpy(ref->name, start, len);
+    ref->name[len] = '\0';
+    ref->element = false;
+    a->p = end;
+
+    if (*a->p != '[') {
+        return true;
+    }
+
+    // Find the matching bracket; the subscript is a key for associative
+    // arrays and an expression otherwise
+    const char *sub = a->p + 1;
+    int depth = 1;
+    const char *close = sub;
+    while (*close && depth > 0) {
+        if (*close == '[') {
+            depth++;
+        } else if (*close == ']') {
+            depth--;
+        }
+        close++;
+    }
+    if (depth != 0) {
+        arith_fail(a, "missing ]");
+        return false;
+    }
+    size_t sub_len = (size_t)(close - 1 - sub);
+    if (sub_len >= ARITH_MAX_NAME) {
+        arith_fail(a, "subscript too long");
+        return false;
+    }
+    ref->element = true;
+    a->p = close;
+
+    if (shvar_type(ref->name) == SHVAR_ASSOC) {
+        while (sub_len > 0 && isspace((unsigned char)*sub)) {
+            sub++;
+            sub_len--;
+        }
+        while (sub_len > 0 && isspace((unsigned char)sub[sub_len - 1])) {
+            sub_len--;
+        }
+        memcpy(ref->key, sub, sub_len);
+        ref->key[sub_len] = '\0';
+        return true;
+    }
+
+    char expr[ARITH_MAX_NAME];
+    memcpy(expr, sub, sub_len);
+    expr[sub_len] = '\0';
+    Arith inner = { expr, a->err, a->err_size, false, a->skip, a->depth + 1 };
+    if (inner.depth > ARITH_MAX_DEPTH) {
+        arith_fail(a, "expression nested too deeply");
+        return false;
+    }
+    int64_t index = parse_assign(&inner);
+    skip_space(&inner);
+    if (!inner.failed && *inner.p) {
+        arith_fail(&inner, "syntax error in subscript");
+    }
+    if (inner.failed) {
+        a->failed = true;
+        return false;
+    }
+    snprintf(ref->key, sizeof(ref->key), "%" PRId64, index);
+    return true;
+}
+
+static int64_t ref_get(const ArithRef *ref) {
+    if (!ref->element) {
+        return shvar_get_int(ref->name);
+    }
+    const char *value = shvar_get_element(ref->name, ref->key);
+    return value ? (int64_t)strtoll(value, NULL, 10) : 0;
+}
+
+static void ref_set(Arith *a, const ArithRef *ref, int64_t value) {
+    if (a->skip > 0 || a->failed) {
+        return;
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, value);
+    int rc;
+    if (ref->element) {
+        rc = shvar_set_element(ref->name, ref->key, buf);
+    } else if (shvar_type(ref->name) == SHVAR_NONE && env_get(ref->name)) {
+        // A string variable stays a string, and exported
+        rc = env_set(ref->name, buf);
+    } else {
+        rc = shvar_set_int(ref->name, value);
+    }
+    if (rc != 0) {
+        arith_fail(a, "cannot assign");
+    }
+}
+
+static int64_t parse_unary(Arith *a);
+
+static int64_t parse_primary(Arith *a) {
+    skip_space(a);
+
+    if (accept(a, "(")) {
+        if (++a->depth > ARITH_MAX_DEPTH) {
+            arith_fail(a, "expression nested too deeply");
+            return 0;
+        }
+        int64_t value = parse_assign(a);
+        a->depth--;
+        if (!accept(a, ")")) {
+            arith_fail(a, "missing )");
+        }
+        return value;
+    }
+
+    if (isdigit((unsigned char)*a->p)) {
+        char *end;
+        int64_t value = (int64_t)strtoll(a->p, &end, 0);
+        a->p = end;
+        return value;
+    }
+
+    // ++NAME, --NAME
+    bool inc = strncmp(a->p, "++", 2) == 0;
+    bool dec = strncmp(a->p, "--", 2) == 0;
+    if (inc || dec) {
+        a->p += 2;
+        ArithRef ref;
+        if (!parse_ref(a, &ref)) {
+            arith_fail(a, "++/-- needs a variable");
+            return 0;
+        }
+        uint64_t old = (uint64_t)ref_get(&ref);
+        int64_t value = (int64_t)(inc ? old + 1 : old - 1);
+        ref_set(a, &ref, value);
+        return value;
+    }
+
+    ArithRef ref;
+    if (parse_ref(a, &ref)) {
+        int64_t value = ref_get(&ref);
+        skip_space(a);
+        if (strncmp(a->p, "++", 2) == 0 || strncmp(a->p, "--", 2) == 0) {
+            ref_set(a, &ref, (int64_t)(a->p[0] == '+' ? (uint64_t)value + 1 : (uint64_t)value - 1));
+            a->p += 2;
+        }
+        return value;
+    }
+
+    arith_fail(a, *a->p ? "syntax error" : "missing operand");
+    return 0;
+}
+
+static int64_t parse_unary(Arith *a) {
+    skip_space(a);
+    if (strncmp(a->p, "++", 2) != 0 && strncmp(a->p, "--", 2) != 0) {
+        if (accept(a, "-")) {
+            return -(uint64_t)parse_unary(a);
+        }
+        if (accept(a, "+")) {
+            return parse_unary(a);
+        }
+    }
+    if (accept(a, "!")) {
+        return !parse_unary(a);
+    }
+    if (accept(a, "~")) {
+        return ~parse_unary(a);
+    }
+    return parse_primary(a);
+}
+
+// Divide, or fail on zero unless this branch is skipped
+static int64_t arith_divide(Arith *a, int64_t left, int64_t right, bool modulo) {
+    if (right == 0) {
+        if (a->skip == 0) {
+            arith_fail(a, "division by zero");
+        }
+        return 0;
+    }
+    if (left == INT64_MIN && right == -1) {
+        return modulo ? 0 : INT64_MIN;
+    }
+    return modulo ? left % right : left / right;
+}
+
+static int64_t parse_mul(Arith *a) {
+    int64_t value = parse_unary(a);
+    for (;;) {
+        if (accept(a, "*")) {
+            value = (int64_t)((uint64_t)value * (uint64_t)parse_unary(a));
+        } else if (accept(a, "/")) {
+            value = arith_divide(a, value, parse_unary(a), false);
+        } else if (accept(a, "%")) {
+            value = arith_divide(a, value, parse_unary(a), true);
+        } else {
+            return value;
+        }
+    }
+}
+
+static int64_t parse_add(Arith *a) {
+    int64_t value = parse_mul(a);
+    for (;;) {
+        if (accept(a, "+")) {
+            value = (int64_t)((uint64_t)value + (uint64_t)parse_mul(a));
+        } else if (accept(a, "-")) {
+            value = (int64_t)((uint64_t)value - (uint64_t)parse_mul(a));
+        } else {
+            return value;
+        }
+    }
+}
+
+static int64_t parse_shift(Arith *a) {
+    int64_t value = parse_add(a);
+    for (;;) {
+        if (accept(a, "<<")) {
+            value = (int64_t)((uint64_t)value << (parse_add(a) & 63));
+        } else if (accept(a, ">>")) {
+            value >>= parse_add(a) & 63;
+        } else {
+            return value;
+        }
+    }
+}
+
+static int64_t parse_relational(Arith *a) {
+    int64_t value = parse_shift(a);
+    for (;;) {
+        if (accept(a, "<=")) {
+            value = value <= parse_shift(a);
+        } else if (accept(a, ">=")) {
+            value = value >= parse_shift(a);
+        } else if (accept(a, "<")) {
+            value = value < parse_shift(a);
+        } else if (accept(a, ">")) {
+            value = value > parse_shift(a);
+        } else {
+            return value;
+        }
+    }
+}
+
+static int64_t parse_equality(Arith *a) {
+    int64_t value = parse_relational(a);
+    for (;;) {
+        if (accept(a, "==")) {
+            value = value == parse_relational(a);
+        } else if (accept(a, "!=")) {
+            value = value != parse_relational(a);
+        } else {
+            return value;
+        }
+    }
+}
+
+static int64_t parse_bitand(Arith *a) {
+    int64_t value = parse_equality(a);
+    while (accept(a, "&")) {
+        value &= parse_equality(a);
+    }
+    return value;
+}
+
+static int64_t parse_bitxor(Arith *a) {
+    int64_t value = parse_bitand(a);
+    while (accept(a, "^")) {
+        value ^= parse_bitand(a);
+    }
+    return value;
+}
+
+static int64_t parse_bitor(Arith *a) {
+    int64_t value = parse_bitxor(a);
+    while (accept(a, "|")) {
+        value |= parse_bitxor(a);
+    }
+    return value;
+}
+
+static int64_t parse_and(Arith *a) {
+    int64_t value = parse_bitor(a);
+    while (accept(a, "&&")) {
+        a->skip += !value;
+        int64_t right = parse_bitor(a);
+        a->skip -= !value;
+        value = value && right;
+    }
+    return value;
+}
+
+static int64_t parse_or(Arith *a) {
+    int64_t value = parse_and(a);
+    while (accept(a, "||")) {
+        a->skip += !!value;
+        int64_t right = parse_and(a);
+        a->skip -= !!value;
+        value = value || right;
+    }
+    return value;
+}
+
+static int64_t parse_ternary(Arith *a) {
+    int64_t cond = parse_or(a);
+    if (!accept(a, "?")) {
+        return cond;
+    }
+    a->skip += !cond;
+    int64_t then_value = parse_assign(a);
+    a->skip -= !cond;
+    if (!accept(a, ":")) {
+        arith_fail(a, "missing : in ?:");
+        return 0;
+    }
+    a->skip += !!cond;
+    int64_t else_value = parse_ternary(a);
+    a->skip -= !!cond;
+    return cond ? then_value : else_value;
+}
+
+// NAME op= expression, or a plain expression
+static int64_t parse_assign(Arith *a) {
+    static const char *ops[] = { "=", "+=", "-=", "*=", "/=", "%=", NULL };
+
+    const char *start = a->p;
+    ArithRef ref;
+    if (parse_ref(a, &ref)) {
+        for (int i = 0; ops[i]; i++) {
+            if (!accept(a, ops[i])) {
+                continue;
+            }
+            int64_t right = parse_assign(a);
+            int64_t value = right;
+            if (i > 0) {
+                int64_t left = ref_get(&ref);
+                switch (ops[i][0]) {
+                    case '+': value = (int64_t)((uint64_t)left + (uint64_t)right); break;
+                    case '-': value = (int64_t)((uint64_t)left - (uint64_t)right); break;
+                    case '*': value = (int64_t)((uint64_t)left * (uint64_t)right); break;
+                    case '/': value = arith_divide(a, left, right, false); break;
+                    case '%': value = arith_divide(a, left, right, true); break;
+                }
+            }
+            ref_set(a, &ref, value);
+            return value;
+        }
+    }
+    if (a->failed) {
+        return 0;
+    }
+
+    a->p = start;
+    return parse_ternary(a);
+}
+
+int arith_eval(const char *expr, int64_t *result, char *err, size_t err_size) {
+    Arith a = { expr, err, err_size, false, 0, 0 };
+    int64_t value = parse_assign(&a);
+
+    // Comma-separated expressions evaluate in turn
+    while (!a.failed && accept(&a, ",")) {
+        value = parse_assign(&a);
+    }
+    skip_space(&a);
+    if (!a.failed && *a.p) {
+        arith_fail(&a, "syntax error");
+    }
+    if (a.failed) {
+        return -1;
+    }
+    *result = value;
+    return 0;
+}
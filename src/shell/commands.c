@@ -3,8 +3,24 @@
 #include "../../include/shell/process.h"
 #include "../../include/shell/env.h"
 #include "../../include/shell/ai.h"
+#include "../../include/shell/parallel.h"
+#include "../../include/shell/spawnserver.h"
+#include "../../include/shell/coproc.h"
+#include "../../include/shell/shvar.h"
+#include "../../include/shell/arith.h"
+#include "../../include/shell/ls.h"
+#include "../../include/shell/filecopy.h"
+#include "../../include/shell/sysmon.h"
+#include "../../include/shell/copy.h"
+#include "../../include/shell/find.h"
+#include "../../include/shell/grep.h"
+#include "../../include/shell/textutil.h"
+#include "../../include/shell/sort.h"
+#include "../../include/shell/fields.h"
+#include "../../include/shell/agg.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -17,12 +33,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
-#include <mach/mach.h>
-#include <mach/vm_statistics.h>
-#include <mach/mach_types.h>
-#include <mach/mach_init.h>
-#include <mach/mach_host.h>
-#include <sys/sysctl.h>
+#include <ctype.h>
 
 // Color definitions
 #define COLOR_RESET     "\033[0m"
@@ -45,6 +56,16 @@ int cmd_mkdir(int argc, char **argv);
 int cmd_rmdir(int argc, char **argv);
 int cmd_touch(int argc, char **argv);
 int cmd_rm(int argc, char **argv);
+int cmd_cp(int argc, char **argv);
+int cmd_mv(int argc, char **argv);
+int cmd_find(int argc, char **argv);
+int cmd_grep(int argc, char **argv);
+int cmd_head(int argc, char **argv);
+int cmd_tail(int argc, char **argv);
+int cmd_wc(int argc, char **argv);
+int cmd_sort(int argc, char **argv);
+int cmd_fields(int argc, char **argv);
+int cmd_agg(int argc, char **argv);
 int cmd_cat(int argc, char **argv);
 int cmd_echo(int argc, char **argv);
 int cmd_ps(int argc, char **argv);
@@ -55,11 +76,23 @@ int cmd_jobs(int argc, char **argv);
 int cmd_env(int argc, char **argv);
 int cmd_export(int argc, char **argv);
 int cmd_unset(int argc, char **argv);
+int cmd_local(int argc, char **argv);
+int cmd_declare(int argc, char **argv);
+int cmd_let(int argc, char **argv);
 int cmd_ai_help(int argc, char **argv);
 int cmd_ai_explain(int argc, char **argv);
 int cmd_ai_suggest(int argc, char **argv);
 int cmd_ai_learn(int argc, char **argv);
 int cmd_sysmon(int argc, char **argv);
+int cmd_metrics(int argc, char **argv);
+int cmd_parallel(int argc, char **argv);
+int cmd_limit(int argc, char **argv);
+int cmd_pin(int argc, char **argv);
+int cmd_spawnd(int argc, char **argv);
+int cmd_qos(int argc, char **argv);
+int cmd_coproc(int argc, char **argv);
+int cmd_coproc_send(int argc, char **argv);
+int cmd_coproc_read(int argc, char **argv);
 
 // Command table
 Command builtin_commands[] = {
@@ -73,16 +106,38 @@ Command builtin_commands[] = {
     { "rmdir", "Remove an empty directory", cmd_rmdir },
     { "touch", "Create an empty file", cmd_touch },
     { "rm", "Remove a file", cmd_rm },
+    { "cp", "Copy files and directories", cmd_cp },
+    { "mv", "Move or rename files", cmd_mv },
+    { "find", "Search a directory tree on parallel walker threads", cmd_find },
+    { "grep", "Search files for lines matching a pattern", cmd_grep },
     { "cat", "Display file contents", cmd_cat },
+    { "head", "Print the first lines of files", cmd_head },
+    { "tail", "Print the last lines of files, or follow them", cmd_tail },
+    { "wc", "Count lines, words and bytes", cmd_wc },
+    { "sort", "Sort lines in parallel, spilling to temp files", cmd_sort },
+    { "fields", "Select fields of each line by number or header name", cmd_fields },
+    { "agg", "Group lines by key fields with count, sum, min, max and avg", cmd_agg },
     { "echo", "Display a line of text", cmd_echo },
     { "ps", "List processes", cmd_ps },
     { "kill", "Terminate a process", cmd_kill },
     { "bg", "Resume a stopped job in background", cmd_bg },
     { "fg", "Resume a stopped job in foreground", cmd_fg },
     { "jobs", "List background jobs", cmd_jobs },
+    { "metrics", "Show resource usage per command and for the session", cmd_metrics },
+    { "parallel", "Run a command over many inputs on a bounded worker pool", cmd_parallel },
+    { "limit", "Run a command with CPU and memory limits", cmd_limit },
+    { "pin", "Run a command on a set of CPUs or set the job placement policy", cmd_pin },
+    { "spawnd", "Show or benchmark the spawn server", cmd_spawnd },
+    { "qos", "Show or change the scheduling class of jobs", cmd_qos },
+    { "coproc", "Start a coprocess connected to the shell by pipes", cmd_coproc },
+    { "coproc-send", "Send a line to a coprocess", cmd_coproc_send },
+    { "coproc-read", "Read a line from a coprocess", cmd_coproc_read },
     { "env", "Display environment variables", cmd_env },
     { "export", "Set an environment variable", cmd_export },
     { "unset", "Remove an environment variable", cmd_unset },
+    { "local", "Declare variables local to a function", cmd_local },
+    { "declare", "Declare integer, array and associative array variables", cmd_declare },
+    { "let", "Evaluate arithmetic expressions", cmd_let },
     { "ai", "AI assistant commands", cmd_ai_help },
     { "ai-help", "Show AI command help", cmd_ai_help },
     { "ai-explain", "Explain a command", cmd_ai_explain },
@@ -101,23 +156,46 @@ int cmd_help(int argc, char **argv) {
     printf("  " COLOR_GREEN "help" COLOR_RESET "     - Show this help message\n");
     printf("  " COLOR_GREEN "exit" COLOR_RESET "     - Exit the shell\n");
     printf("  " COLOR_GREEN "clear" COLOR_RESET "    - Clear the screen\n");
-    printf("  " COLOR_GREEN "ls" COLOR_RESET "       - List files in a directory\n");
+    printf("  " COLOR_GREEN "ls" COLOR_RESET "       - List files in a directory (-a -A -l -F -r -S -t -U -1, --color[=WHEN])\n");
     printf("  " COLOR_GREEN "cd" COLOR_RESET "       - Change directory\n");
     printf("  " COLOR_GREEN "pwd" COLOR_RESET "      - Print working directory\n");
     printf("  " COLOR_GREEN "mkdir" COLOR_RESET "    - Create a directory\n");
     printf("  " COLOR_GREEN "rmdir" COLOR_RESET "    - Remove a directory\n");
     printf("  " COLOR_GREEN "touch" COLOR_RESET "    - Create a file\n");
     printf("  " COLOR_GREEN "rm" COLOR_RESET "       - Remove a file\n");
-    printf("  " COLOR_GREEN "cat" COLOR_RESET "      - Display file contents\n");
+    printf("  " COLOR_GREEN "cp" COLOR_RESET "       - Copy files (-r recursive on -j N threads, -p preserve, -n no clobber)\n");
+    printf("  " COLOR_GREEN "mv" COLOR_RESET "       - Move or rename files (-n no clobber, -v verbose)\n");
+    printf("  " COLOR_GREEN "find" COLOR_RESET "     - Search a tree in parallel (-name -type -size -mtime -maxdepth, -s sorted)\n");
+    printf("  " COLOR_GREEN "grep" COLOR_RESET "     - Search files for a pattern (-FEivnclqr, -j N threads, --block SIZE)\n");
+    printf("  " COLOR_GREEN "cat" COLOR_RESET "      - Display file contents (- for stdin, --bench [MB] copy throughput)\n");
+    printf("  " COLOR_GREEN "head" COLOR_RESET "     - Print the first lines of files (-n N, -c N)\n");
+    printf("  " COLOR_GREEN "tail" COLOR_RESET "     - Print the last lines of files (-n N, -c N, +N, -f to follow)\n");
+    printf("  " COLOR_GREEN "wc" COLOR_RESET "       - Count lines, words, characters and bytes (-lwmc)\n");
+    printf("  " COLOR_GREEN "sort" COLOR_RESET "     - Sort lines (-nrufbs, -k KEY, -t SEP, -S SIZE, -o FILE, -j N, --bench [MB])\n");
+    printf("  " COLOR_GREEN "fields" COLOR_RESET "   - Select fields by number or header name (-f LIST, -d DELIM, -o SEP, -H)\n");
+    printf("  " COLOR_GREEN "agg" COLOR_RESET "      - Group by key fields (-k LIST, -a count,sum:N,min:N,max:N,avg:N, -t K top)\n");
     printf("  " COLOR_GREEN "echo" COLOR_RESET "     - Display a message\n");
-    printf("  " COLOR_GREEN "ps" COLOR_RESET "       - List processes\n");
+    printf("  " COLOR_GREEN "ps" COLOR_RESET "       - List processes (-l for resource usage)\n");
     printf("  " COLOR_GREEN "kill" COLOR_RESET "     - Kill a process\n");
     printf("  " COLOR_GREEN "bg" COLOR_RESET "       - Resume a process in the background\n");
     printf("  " COLOR_GREEN "fg" COLOR_RESET "       - Resume a process in the foreground\n");
-    printf("  " COLOR_GREEN "jobs" COLOR_RESET "     - List background jobs\n");
-    printf("  " COLOR_GREEN "env" COLOR_RESET "      - Display environment variables\n");
+    printf("  " COLOR_GREEN "jobs" COLOR_RESET "     - List background jobs (-l usage, -o %%N [bytes] output)\n");
+    printf("  " COLOR_GREEN "metrics" COLOR_RESET "  - Show resource usage per command [file]\n");
+    printf("  " COLOR_GREEN "sysmon" COLOR_RESET "   - System metrics, -w SECS [-n COUNT] live per-core CPU\n");
+    printf("  " COLOR_GREEN "parallel" COLOR_RESET " - Run a command per input line or ::: argument (-j N)\n");
+    printf("  " COLOR_GREEN "limit" COLOR_RESET "    - Run a command with --cpu N%% --mem SIZE --time SECS\n");
+    printf("  " COLOR_GREEN "pin" COLOR_RESET "      - Run a command on CPUS (e.g. 0-3,8), --policy off|rr|least\n");
+    printf("  " COLOR_GREEN "spawnd" COLOR_RESET "   - Spawn server status, bench [N] [MB...] spawn latency\n");
+    printf("  " COLOR_GREEN "qos" COLOR_RESET "      - Job scheduling class: qos %%N interactive|background|idle, --default\n");
+    printf("  " COLOR_GREEN "coproc" COLOR_RESET "   - Start a coprocess: coproc NAME cmd [args], -c NAME to close\n");
+    printf("  " COLOR_GREEN "coproc-send" COLOR_RESET " - Send a line to a coprocess: coproc-send NAME text\n");
+    printf("  " COLOR_GREEN "coproc-read" COLOR_RESET " - Read a line from a coprocess: coproc-read [-t MS] NAME\n");
+    printf("  " COLOR_GREEN "env" COLOR_RESET "      - Display environment variables (--save/--load FILE snapshot, --bench [N])\n");
     printf("  " COLOR_GREEN "export" COLOR_RESET "   - Set an environment variable\n");
     printf("  " COLOR_GREEN "unset" COLOR_RESET "    - Unset an environment variable\n");
+    printf("  " COLOR_GREEN "local" COLOR_RESET "    - Declare variables local to a function\n");
+    printf("  " COLOR_GREEN "declare" COLOR_RESET "  - Declare integer (-i), array (-a) or associative (-A) variables\n");
+    printf("  " COLOR_GREEN "let" COLOR_RESET "      - Evaluate arithmetic expressions\n");
     return 0;
 }
 
@@ -141,38 +219,49 @@ int cmd_clear(int argc, char **argv) {
 
 // List directory contents
 int cmd_ls(int argc, char **argv) {
-    char *dir = ".";
-    if (argc > 1) {
-        dir = argv[1];
-    }
-    
-    DIR *d = opendir(dir);
-    if (!d) {
-        printf(COLOR_RED "ls: cannot access '%s': %s\n" COLOR_RESET, dir, strerror(errno));
-        return 1;
-    }
+    LsOptions opts = { false, false, false, false, false, false, LS_SORT_NAME, -1 };
+    int i = 1;
     
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
-        
-        char path[1024];
-        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
-        
-        struct stat st;
-        if (stat(path, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                printf(COLOR_BLUE "%s/\n" COLOR_RESET, entry->d_name);
-            } else if (st.st_mode & S_IXUSR) {
-                printf(COLOR_GREEN "%s*\n" COLOR_RESET, entry->d_name);
+    // Parse options
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strncmp(argv[i], "--color", 7) == 0) {
+            const char *when = argv[i][7] == '=' ? argv[i] + 8 : "always";
+            if (strcmp(when, "always") == 0) {
+                opts.color = 1;
+            } else if (strcmp(when, "never") == 0) {
+                opts.color = 0;
+            } else if (strcmp(when, "auto") == 0) {
+                opts.color = -1;
             } else {
-                printf("%s\n", entry->d_name);
+                printf(COLOR_RED "ls: invalid --color argument: %s\n" COLOR_RESET, when);
+                return 1;
+            }
+            continue;
+        }
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            switch (*flag) {
+                case 'a': opts.all = true; break;
+                case 'A': opts.almost_all = true; break;
+                case 'l': opts.long_format = true; break;
+                case '1': opts.one_per_line = true; break;
+                case 'F': opts.classify = true; break;
+                case 'r': opts.reverse = true; break;
+                case 'S': opts.sort = LS_SORT_SIZE; break;
+                case 't': opts.sort = LS_SORT_TIME; break;
+                case 'U': opts.sort = LS_SORT_NONE; break;
+                default:
+                    printf(COLOR_RED "ls: invalid option: -%c\n" COLOR_RESET, *flag);
+                    printf("Usage: ls [-aAlFrStU1] [--color[=WHEN]] [path...]\n");
+                    return 1;
             }
         }
     }
     
-    closedir(d);
-    return 0;
+    return ls_run(&opts, argv + i, argc - i, stdout);
 }
 
 // Change directory
@@ -190,6 +279,7 @@ int cmd_cd(int argc, char **argv) {
     char cwd[1024];
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
         setenv("PWD", cwd, 1);
+        env_set("PWD", cwd);
     }
     
     return 0;
@@ -280,6 +370,241 @@ int cmd_rm(int argc, char **argv) {
     return 0;
 }
 
+// Parse cp/mv options; returns the index of the first operand or -1
+static int parse_copy_options(const char *name, const char *flags, int argc, char **argv, CopyOptions *opts) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            return i + 1;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            opts->jobs = atoi(argv[++i]);
+            if (opts->jobs <= 0) {
+                printf(COLOR_RED "%s: invalid job count: %s\n" COLOR_RESET, name, argv[i]);
+                return -1;
+            }
+            continue;
+        }
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            if (!strchr(flags, *flag)) {
+                printf(COLOR_RED "%s: invalid option: -%c\n" COLOR_RESET, name, *flag);
+                return -1;
+            }
+            switch (*flag) {
+                case 'r':
+                case 'R': opts->recursive = true; break;
+                case 'p': opts->preserve = true; break;
+                case 'n': opts->no_clobber = true; break;
+                case 'f': opts->no_clobber = false; break;
+                case 'v': opts->verbose = true; break;
+            }
+        }
+    }
+    return i;
+}
+
+// Copy files and directories
+int cmd_cp(int argc, char **argv) {
+    CopyOptions opts = { false, false, false, false, parallel_default_jobs() };
+    int i = parse_copy_options("cp", "rRpnfv", argc, argv, &opts);
+    if (i < 0 || argc - i < 2) {
+        if (i >= 0) {
+            printf(COLOR_RED "cp: missing file operand\n" COLOR_RESET);
+        }
+        printf("Usage: cp [-rpnfv] [-j N] source... dest\n");
+        return 1;
+    }
+    
+    return copy_run(&opts, argv + i, argc - i - 1, argv[argc - 1]);
+}
+
+// Move or rename files
+int cmd_mv(int argc, char **argv) {
+    CopyOptions opts = { false, false, false, false, parallel_default_jobs() };
+    int i = parse_copy_options("mv", "nfv", argc, argv, &opts);
+    if (i < 0 || argc - i < 2) {
+        if (i >= 0) {
+            printf(COLOR_RED "mv: missing file operand\n" COLOR_RESET);
+        }
+        printf("Usage: mv [-nfv] [-j N] source... dest\n");
+        return 1;
+    }
+    
+    return move_run(&opts, argv + i, argc - i - 1, argv[argc - 1]);
+}
+
+// Parse a find number: [+-]N followed by an optional unit suffix
+static bool parse_find_number(const char *arg, const char *units, const int64_t *scales,
+                              int64_t default_scale, FindNumber *number) {
+    number->set = true;
+    number->cmp = *arg == '+' ? 1 : *arg == '-' ? -1 : 0;
+    if (number->cmp != 0) {
+        arg++;
+    }
+    if (!isdigit((unsigned char)*arg)) {
+        return false;
+    }
+    char *end;
+    number->value = strtoll(arg, &end, 10);
+    number->unit = default_scale;
+    if (*end) {
+        const char *unit = strchr(units, *end);
+        if (!unit || end[1]) {
+            return false;
+        }
+        number->unit = scales[unit - units];
+    }
+    return true;
+}
+
+// Search a directory tree
+int cmd_find(int argc, char **argv) {
+    static const int64_t size_scales[] = { 1, 2, 512, 1024, 1024 * 1024, 1024 * 1024 * 1024 };
+    FindOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.max_depth = -1;
+    opts.jobs = parallel_default_jobs();
+    
+    // Starting points come before the first option
+    int paths = 1;
+    while (paths < argc && argv[paths][0] != '-') {
+        paths++;
+    }
+    
+    for (int i = paths; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+        bool ok = true;
+        
+        if (strcmp(opt, "-s") == 0) {
+            opts.sorted = true;
+            continue;
+        }
+        if (strcmp(opt, "-print0") == 0) {
+            opts.print0 = true;
+            continue;
+        }
+        if (strcmp(opt, "-print") == 0) {
+            continue;
+        }
+        if (!arg) {
+            printf(COLOR_RED "find: missing argument to '%s'\n" COLOR_RESET, opt);
+            return 1;
+        }
+        i++;
+        
+        if (strcmp(opt, "-name") == 0 || strcmp(opt, "-iname") == 0) {
+            opts.name = arg;
+            opts.icase = opt[1] == 'i';
+        } else if (strcmp(opt, "-type") == 0) {
+            opts.type = arg[0];
+            ok = arg[0] && !arg[1] && strchr("fdlpsbc", arg[0]);
+        } else if (strcmp(opt, "-size") == 0) {
+            ok = parse_find_number(arg, "cwbkMG", size_scales, 512, &opts.size);
+        } else if (strcmp(opt, "-mtime") == 0 || strcmp(opt, "-mmin") == 0) {
+            ok = parse_find_number(arg, "", NULL, opt[2] == 't' ? 86400 : 60, &opts.mtime);
+        } else if (strcmp(opt, "-maxdepth") == 0) {
+            opts.max_depth = atoi(arg);
+            ok = isdigit((unsigned char)arg[0]);
+        } else if (strcmp(opt, "-mindepth") == 0) {
+            opts.min_depth = atoi(arg);
+            ok = isdigit((unsigned char)arg[0]);
+        } else if (strcmp(opt, "-j") == 0) {
+            opts.jobs = atoi(arg);
+            ok = opts.jobs > 0;
+        } else {
+            printf(COLOR_RED "find: unknown predicate '%s'\n" COLOR_RESET, opt);
+            printf("Usage: find [path...] [-name|-iname GLOB] [-type fdlpsbc] [-size [+-]N[cwbkMG]]\n"
+                   "            [-mtime|-mmin [+-]N] [-mindepth N] [-maxdepth N] [-s] [-print0] [-j N]\n");
+            return 1;
+        }
+        if (!ok) {
+            printf(COLOR_RED "find: invalid argument '%s' to '%s'\n" COLOR_RESET, arg, opt);
+            return 1;
+        }
+    }
+    
+    fflush(stdout);
+    return find_run(&opts, argv + 1, paths - 1, stdout);
+}
+
+// Search files for a pattern
+int cmd_grep(int argc, char **argv) {
+    GrepOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.with_filename = -1;
+    opts.jobs = parallel_default_jobs();
+    opts.block_size = 1024 * 1024;
+    int i = 1;
+    
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if ((strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-j") == 0 ||
+             strcmp(argv[i], "--block") == 0) && i + 1 < argc) {
+            const char *opt = argv[i++];
+            if (opt[1] == 'e') {
+                opts.pattern = argv[i];
+            } else if (opt[1] == 'j') {
+                opts.jobs = atoi(argv[i]);
+                if (opts.jobs <= 0) {
+                    printf(COLOR_RED "grep: invalid job count: %s\n" COLOR_RESET, argv[i]);
+                    return 2;
+                }
+            } else {
+                char *end;
+                double size = strtod(argv[i], &end);
+                size *= *end == 'K' || *end == 'k' ? 1024.0 : *end == 'M' ? 1024.0 * 1024 : 1;
+                if (size < 1 || (*end && end[1])) {
+                    printf(COLOR_RED "grep: invalid block size: %s\n" COLOR_RESET, argv[i]);
+                    return 2;
+                }
+                opts.block_size = (size_t)size;
+            }
+            continue;
+        }
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            switch (*flag) {
+                case 'F': opts.fixed = true; break;
+                case 'E': opts.extended = true; break;
+                case 'G': opts.extended = false; break;
+                case 'i': opts.icase = true; break;
+                case 'v': opts.invert = true; break;
+                case 'n': opts.line_numbers = true; break;
+                case 'c': opts.count = true; break;
+                case 'l': opts.files_only = true; break;
+                case 'q': opts.quiet = true; break;
+                case 'r':
+                case 'R': opts.recursive = true; break;
+                case 'H': opts.with_filename = 1; break;
+                case 'h': opts.with_filename = 0; break;
+                case 's': opts.no_messages = true; break;
+                default:
+                    printf(COLOR_RED "grep: invalid option: -%c\n" COLOR_RESET, *flag);
+                    printf("Usage: grep [-FEivnclqrHhs] [-j N] [--block SIZE] [-e] PATTERN [file...]\n");
+                    return 2;
+            }
+        }
+    }
+    
+    if (!opts.pattern) {
+        if (i >= argc) {
+            printf("Usage: grep [-FEivnclqrHhs] [-j N] [--block SIZE] [-e] PATTERN [file...]\n");
+            return 2;
+        }
+        opts.pattern = argv[i++];
+    }
+    
+    // grep -r with no files searches the current directory
+    static char *here[] = { "." };
+    if (opts.recursive && i == argc) {
+        return grep_run(&opts, here, 1, stdout);
+    }
+    return grep_run(&opts, argv + i, argc - i, stdout);
+}
+
 // Display file contents
 int cmd_cat(int argc, char **argv) {
     if (argc < 2) {
@@ -287,22 +612,525 @@ int cmd_cat(int argc, char **argv) {
         return 1;
     }
     
+    // cat --bench [MB]: time the copy paths against a 4 KB stdio loop
+    if (strcmp(argv[1], "--bench") == 0) {
+        long size_mb = argc > 2 ? atol(argv[2]) : 256;
+        if (size_mb <= 0) {
+            printf(COLOR_RED "cat: invalid size: %s\n" COLOR_RESET, argv[2]);
+            return 1;
+        }
+        filecopy_benchmark((size_t)size_mb, stdout);
+        return 0;
+    }
+    
+    // Files go straight to the descriptor, so stdio has to be out of the way
+    fflush(stdout);
+    
+    int status = 0;
     for (int i = 1; i < argc; i++) {
-        FILE *f = fopen(argv[i], "r");
-        if (!f) {
+        bool is_stdin = strcmp(argv[i], "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO : open(argv[i], O_RDONLY | O_CLOEXEC);
+        // Errors go through stdio, flushed so they stay in order with the
+        // file contents written to the descriptor
+        if (fd < 0) {
             printf(COLOR_RED "cat: %s: %s\n" COLOR_RESET, argv[i], strerror(errno));
+            fflush(stdout);
+            status = 1;
             continue;
         }
         
-        char buf[4096];
-        size_t n;
-        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
-            fwrite(buf, 1, n, stdout);
+        if (filecopy_fd(fd, STDOUT_FILENO, NULL) < 0) {
+            int err = errno;
+            if (err != EPIPE) {
+                printf(COLOR_RED "cat: %s: %s\n" COLOR_RESET, argv[i], strerror(err));
+                fflush(stdout);
+            }
+            status = 1;
         }
         
-        fclose(f);
+        if (!is_stdin) {
+            close(fd);
+        }
     }
-    return 0;
+    return status;
+}
+
+// Parse head and tail options; returns the index of the first file or
+// -1 after printing an error
+static int parse_head_tail(const char *name, int argc, char **argv, HeadTailOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->count = 10;
+    opts->headers = -1;
+    bool is_tail = strcmp(name, "tail") == 0;
+    int i = 1;
+    
+    for (; i < argc && (argv[i][0] == '-' || (is_tail && argv[i][0] == '+')) && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *number = NULL;
+        if (argv[i][0] == '+') {
+            number = argv[i];
+            opts->bytes = false;
+        } else if (argv[i][1] >= '0' && argv[i][1] <= '9') {
+            // The old -N form
+            number = argv[i] + 1;
+            opts->bytes = false;
+        } else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-c") == 0) && i + 1 < argc) {
+            opts->bytes = argv[i][1] == 'c';
+            number = argv[++i];
+        } else if (argv[i][1] == 'n' || argv[i][1] == 'c') {
+            opts->bytes = argv[i][1] == 'c';
+            number = argv[i] + 2;
+        }
+        
+        if (number) {
+            opts->from_start = is_tail && number[0] == '+';
+            char *end;
+            long long value = strtoll(number + (number[0] == '+'), &end, 10);
+            if (end == number + (number[0] == '+') || *end || value < 0) {
+                printf(COLOR_RED "%s: invalid number: %s\n" COLOR_RESET, name, number);
+                return -1;
+            }
+            opts->count = value;
+            continue;
+        }
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            switch (*flag) {
+                case 'q': opts->headers = 0; break;
+                case 'v': opts->headers = 1; break;
+                case 'f':
+                    if (is_tail) {
+                        opts->follow = true;
+                        break;
+                    }
+                    // fallthrough
+                default:
+                    printf(COLOR_RED "%s: invalid option: -%c\n" COLOR_RESET, name, *flag);
+                    printf("Usage: %s [-n N | -c N%s] [-qv%s] [file...]\n", name,
+                           is_tail ? " | +N" : "", is_tail ? "f" : "");
+                    return -1;
+            }
+        }
+    }
+    return i;
+}
+
+// Print the first lines of files
+int cmd_head(int argc, char **argv) {
+    HeadTailOptions opts;
+    int i = parse_head_tail("head", argc, argv, &opts);
+    if (i < 0) {
+        return 1;
+    }
+    return head_run(&opts, argv + i, argc - i, stdout);
+}
+
+// Print the last lines of files
+int cmd_tail(int argc, char **argv) {
+    HeadTailOptions opts;
+    int i = parse_head_tail("tail", argc, argv, &opts);
+    if (i < 0) {
+        return 1;
+    }
+    return tail_run(&opts, argv + i, argc - i, stdout);
+}
+
+// Count lines, words and bytes
+int cmd_wc(int argc, char **argv) {
+    WcOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    int i = 1;
+    
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            switch (*flag) {
+                case 'l': opts.lines = true; break;
+                case 'w': opts.words = true; break;
+                case 'm': opts.chars = true; break;
+                case 'c': opts.bytes = true; break;
+                default:
+                    printf(COLOR_RED "wc: invalid option: -%c\n" COLOR_RESET, *flag);
+                    printf("Usage: wc [-lwmc] [file...]\n");
+                    return 1;
+            }
+        }
+    }
+    return wc_run(&opts, argv + i, argc - i, stdout);
+}
+
+// Parse a sort key, F[.C][nrfb][,F[.C][nrfb]]
+static bool parse_sort_key(const char *arg, const SortOptions *global, SortKey *key) {
+    memset(key, 0, sizeof(*key));
+    bool ordering = false;
+    char *end;
+    for (int side = 0; side < 2; side++) {
+        long field = strtol(arg, &end, 10);
+        if (end == arg || field < 1) {
+            return false;
+        }
+        long chars = 0;
+        if (*end == '.') {
+            arg = end + 1;
+            chars = strtol(arg, &end, 10);
+            if (end == arg || chars < (side == 0 ? 1 : 0)) {
+                return false;
+            }
+        }
+        if (side == 0) {
+            key->start_field = (int)field;
+            key->start_char = (int)chars;
+        } else {
+            key->end_field = (int)field;
+            key->end_char = (int)chars;
+        }
+        for (; *end && strchr("nrfb", *end); end++) {
+            ordering = true;
+            switch (*end) {
+                case 'n': key->numeric = true; break;
+                case 'r': key->reverse = true; break;
+                case 'f': key->fold = true; break;
+                case 'b':
+                    if (side == 0) {
+                        key->blanks = true;
+                    } else {
+                        key->end_blanks = true;
+                    }
+                    break;
+            }
+        }
+        if (side == 0 && *end == ',') {
+            arg = end + 1;
+            continue;
+        }
+        break;
+    }
+    if (*end) {
+        return false;
+    }
+    // A key without options of its own takes the global ones
+    if (!ordering) {
+        key->numeric = global->numeric;
+        key->reverse = global->reverse;
+        key->fold = global->fold;
+        key->blanks = global->blanks;
+        key->end_blanks = global->blanks;
+    }
+    return true;
+}
+
+// Sort lines of files
+int cmd_sort(int argc, char **argv) {
+    static const char *usage = "Usage: sort [-nrufbs] [-k KEY]... [-t SEP] [-S SIZE[K|M|G]] [-T DIR] [-o FILE] [-j N] [file...]\n"
+                               "       sort --bench [MB]\n";
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        long size_mb = argc > 2 ? atol(argv[2]) : 64;
+        if (size_mb <= 0) {
+            printf(COLOR_RED "sort: invalid size: %s\n" COLOR_RESET, argv[2]);
+            return 1;
+        }
+        sort_benchmark((size_t)size_mb, stdout);
+        return 0;
+    }
+    
+    SortOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.memory = sort_default_memory();
+    opts.jobs = parallel_default_jobs();
+    const char *keys[SORT_MAX_KEYS];
+    int i = 1;
+    
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            if (strchr("ktSToj", *flag)) {
+                // The argument is the rest of this word or the next one
+                const char *arg = flag[1] ? flag + 1 : i + 1 < argc ? argv[++i] : NULL;
+                if (!arg) {
+                    printf(COLOR_RED "sort: option requires an argument: -%c\n" COLOR_RESET, *flag);
+                    printf("%s", usage);
+                    return 2;
+                }
+                bool ok = true;
+                char *end;
+                switch (*flag) {
+                    case 'k':
+                        ok = opts.key_count < SORT_MAX_KEYS;
+                        if (ok) {
+                            keys[opts.key_count++] = arg;
+                        }
+                        break;
+                    case 't':
+                        ok = arg[0] && !arg[1];
+                        opts.separator = arg[0];
+                        break;
+                    case 'S': {
+                        double size = strtod(arg, &end);
+                        size *= *end == 'K' || *end == 'k' ? 1024.0 : *end == 'M' ? 1024.0 * 1024 :
+                                *end == 'G' ? 1024.0 * 1024 * 1024 : 1;
+                        ok = end != arg && size >= 1 && (!*end || !end[1]);
+                        opts.memory = (size_t)size;
+                        break;
+                    }
+                    case 'T': opts.temp_dir = arg; break;
+                    case 'o': opts.output = arg; break;
+                    case 'j':
+                        opts.jobs = atoi(arg);
+                        ok = opts.jobs > 0;
+                        break;
+                }
+                if (!ok) {
+                    printf(COLOR_RED "sort: invalid argument '%s' to -%c\n" COLOR_RESET, arg, *flag);
+                    return 2;
+                }
+                break;
+            }
+            switch (*flag) {
+                case 'n': opts.numeric = true; break;
+                case 'r': opts.reverse = true; break;
+                case 'u': opts.unique = true; break;
+                case 'f': opts.fold = true; break;
+                case 'b': opts.blanks = true; break;
+                case 's': opts.stable = true; break;
+                default:
+                    printf(COLOR_RED "sort: invalid option: -%c\n" COLOR_RESET, *flag);
+                    printf("%s", usage);
+                    return 2;
+            }
+        }
+    }
+    
+    // Keys take the global flags, so they are parsed once all flags are in
+    for (int k = 0; k < opts.key_count; k++) {
+        if (!parse_sort_key(keys[k], &opts, &opts.keys[k])) {
+            printf(COLOR_RED "sort: invalid key: %s\n" COLOR_RESET, keys[k]);
+            return 2;
+        }
+    }
+    
+    return sort_run(&opts, argv + i, argc - i, stdout);
+}
+
+// Parse a fields list: N, N-M, N-, -M or a header name, comma separated
+static bool parse_field_list(char *list, FieldsOptions *opts) {
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        if (opts->range_count == FIELDS_MAX_RANGES) {
+            return false;
+        }
+        FieldRange *range = &opts->ranges[opts->range_count++];
+        memset(range, 0, sizeof(*range));
+        
+        char *end = item;
+        range->start = isdigit((unsigned char)*item) ? (int)strtol(item, &end, 10) : 1;
+        range->end = range->start;
+        if (*end == '-' && (end > item || isdigit((unsigned char)end[1]) || !end[1])) {
+            const char *upper = end + 1;
+            range->end = *upper ? (int)strtol(upper, &end, 10) : 0;
+            if (!*upper) {
+                end = (char *)upper;
+            }
+        } else if (end == item) {
+            // Not a number: a name from the header line
+            if (!opts->header) {
+                return false;
+            }
+            range->name = item;
+            continue;
+        }
+        if (*end || range->start < 1 || (range->end && range->end < range->start)) {
+            return false;
+        }
+    }
+    return opts->range_count > 0;
+}
+
+// Select fields of each line
+int cmd_fields(int argc, char **argv) {
+    static const char *usage = "Usage: fields [-d DELIM] [-o SEP] [-H] -f LIST [file...]\n";
+    FieldsOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    char *list = NULL;
+    int i = 1;
+    
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-H") == 0) {
+            opts.header = true;
+            continue;
+        }
+        char opt = argv[i][1];
+        if (!strchr("fdo", opt)) {
+            printf(COLOR_RED "fields: invalid option: %s\n" COLOR_RESET, argv[i]);
+            printf("%s", usage);
+            return 1;
+        }
+        // The argument is the rest of this word or the next one
+        char *arg = argv[i][2] ? argv[i] + 2 : i + 1 < argc ? argv[++i] : NULL;
+        if (!arg) {
+            printf(COLOR_RED "fields: option requires an argument: -%c\n" COLOR_RESET, opt);
+            printf("%s", usage);
+            return 1;
+        }
+        if (opt == 'f') {
+            list = arg;
+        } else if (opt == 'o') {
+            opts.output_delimiter = arg;
+        } else if (strcmp(arg, "\\t") == 0 || (arg[0] && !arg[1])) {
+            opts.delimiter = arg[0] == '\\' ? '\t' : arg[0];
+        } else {
+            printf(COLOR_RED "fields: the delimiter must be a single character\n" COLOR_RESET);
+            return 1;
+        }
+    }
+    
+    if (!list) {
+        printf("%s", usage);
+        return 1;
+    }
+    // strtok writes into the list, and the names point into it
+    char *copy = strdup(list);
+    if (!copy || !parse_field_list(copy, &opts)) {
+        printf(COLOR_RED "fields: invalid field list: %s%s\n" COLOR_RESET, list,
+               opts.header ? "" : " (names need -H)");
+        free(copy);
+        return 1;
+    }
+    
+    int status = fields_run(&opts, argv + i, argc - i, stdout);
+    free(copy);
+    return status;
+}
+
+// Parse agg columns: count, or sum, min, max or avg with :FIELD
+static bool parse_agg_specs(char *list, AggOptions *opts) {
+    static const char *names[] = { "count", "sum", "min", "max", "avg" };
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        if (opts->spec_count == AGG_MAX_SPECS) {
+            return false;
+        }
+        AggSpec *spec = &opts->specs[opts->spec_count++];
+        char *field = strchr(item, ':');
+        if (field) {
+            *field++ = '\0';
+        }
+        size_t kind = 0;
+        while (kind < sizeof(names) / sizeof(names[0]) && strcmp(item, names[kind]) != 0) {
+            kind++;
+        }
+        if (kind == sizeof(names) / sizeof(names[0])) {
+            return false;
+        }
+        spec->kind = (AggKind)kind;
+        spec->field = field ? atoi(field) : 0;
+        // Everything but count needs a field
+        if ((spec->kind == AGG_COUNT) != (field == NULL) || (field && spec->field < 1)) {
+            return false;
+        }
+    }
+    return opts->spec_count > 0;
+}
+
+// Group lines by key fields
+int cmd_agg(int argc, char **argv) {
+    static const char *usage = "Usage: agg [-k LIST] [-a count,sum:N,min:N,max:N,avg:N] [-d DELIM] [-o SEP]\n"
+                               "           [-t K] [-S SIZE[K|M|G]] [-j N] [file...]\n";
+    AggOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.memory = sort_default_memory();
+    opts.jobs = parallel_default_jobs();
+    int i = 1;
+    
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        char opt = argv[i][1];
+        if (!strchr("kadotSj", opt)) {
+            printf(COLOR_RED "agg: invalid option: %s\n" COLOR_RESET, argv[i]);
+            printf("%s", usage);
+            return 1;
+        }
+        // The argument is the rest of this word or the next one
+        char *arg = argv[i][2] ? argv[i] + 2 : i + 1 < argc ? argv[++i] : NULL;
+        if (!arg) {
+            printf(COLOR_RED "agg: option requires an argument: -%c\n" COLOR_RESET, opt);
+            printf("%s", usage);
+            return 1;
+        }
+        
+        bool ok = true;
+        char *end;
+        switch (opt) {
+            case 'k':
+                // strtok writes into the list, so it works on a copy
+                arg = strdup(arg);
+                ok = arg != NULL;
+                for (char *item = ok ? strtok(arg, ",") : NULL; item && ok; item = strtok(NULL, ",")) {
+                    long first = strtol(item, &end, 10);
+                    long last = *end == '-' ? strtol(end + 1, &end, 10) : first;
+                    ok = !*end && first >= 1 && last >= first && opts.key_count + (last - first) < AGG_MAX_KEYS;
+                    for (long k = first; ok && k <= last; k++) {
+                        opts.keys[opts.key_count++] = (int)k;
+                    }
+                }
+                free(arg);
+                break;
+            case 'a':
+                opts.spec_count = 0;
+                arg = strdup(arg);
+                ok = arg && parse_agg_specs(arg, &opts);
+                free(arg);
+                break;
+            case 'd':
+                ok = strcmp(arg, "\\t") == 0 || (arg[0] && !arg[1]);
+                opts.delimiter = arg[0] == '\\' ? '\t' : arg[0];
+                break;
+            case 'o':
+                opts.output_delimiter = arg;
+                break;
+            case 't': {
+                long top = strtol(arg, &end, 10);
+                ok = !*end && top > 0;
+                opts.top = (size_t)top;
+                break;
+            }
+            case 'S': {
+                double size = strtod(arg, &end);
+                size *= *end == 'K' || *end == 'k' ? 1024.0 : *end == 'M' ? 1024.0 * 1024 :
+                        *end == 'G' ? 1024.0 * 1024 * 1024 : 1;
+                ok = end != arg && size >= 1 && (!*end || !end[1]);
+                opts.memory = (size_t)size;
+                break;
+            }
+            case 'j':
+                opts.jobs = atoi(arg);
+                ok = opts.jobs > 0;
+                break;
+        }
+        if (!ok) {
+            printf(COLOR_RED "agg: invalid argument to -%c\n" COLOR_RESET, opt);
+            printf("%s", usage);
+            return 1;
+        }
+    }
+    
+    if (opts.spec_count == 0) {
+        opts.specs[0].kind = AGG_COUNT;
+        opts.spec_count = 1;
+    }
+    return agg_run(&opts, argv + i, argc - i, stdout);
 }
 
 // Echo command
@@ -316,8 +1144,10 @@ int cmd_echo(int argc, char **argv) {
 
 // List processes
 int cmd_ps(int argc, char **argv) {
-    (void)argc;  // Suppress unused parameter warning
-    (void)argv;  // Suppress unused parameter warning
+    if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+        process_print_all_long();
+        return 0;
+    }
     process_print_all();
     return 0;
 }
@@ -354,6 +1184,14 @@ int cmd_kill(int argc, char **argv) {
     return 0;
 }
 
+// Parse a job reference, either "N" or "%N"
+static int parse_job_id(const char *spec) {
+    if (spec[0] == '%') {
+        spec++;
+    }
+    return atoi(spec);
+}
+
 // Background process
 int cmd_bg(int argc, char **argv) {
     if (argc < 2) {
@@ -361,7 +1199,7 @@ int cmd_bg(int argc, char **argv) {
         return 1;
     }
     
-    int job_id = atoi(argv[1]);
+    int job_id = parse_job_id(argv[1]);
     Process *process = process_get_by_job_id(job_id);
     
     if (!process) {
@@ -377,6 +1215,16 @@ int cmd_bg(int argc, char **argv) {
     return 0;
 }
 
+// Background jobs have a process group of their own, so Ctrl-C while fg
+// waits is passed on to the job's group by hand
+static volatile pid_t fg_group = 0;
+
+static void fg_forward_signal(int sig) {
+    if (fg_group > 0) {
+        kill(-fg_group, sig);
+    }
+}
+
 // Resume job in foreground
 int cmd_fg(int argc, char **argv) {
     if (argc < 2) {
@@ -385,7 +1233,7 @@ int cmd_fg(int argc, char **argv) {
     }
     
     // Get job ID
-    int job_id = atoi(argv[1]);
+    int job_id = parse_job_id(argv[1]);
     if (job_id <= 0) {
         printf(COLOR_RED "fg: invalid job ID\n" COLOR_RESET);
         return 1;
@@ -398,14 +1246,43 @@ int cmd_fg(int argc, char **argv) {
         return 1;
     }
     
+    // Replay what the job printed while in the background, then follow it live
+    job_output_attach(process->output, SIZE_MAX);
+    
+    // A job in the foreground gets the shell's priority back; without
+    // CAP_SYS_NICE the nice value may stay raised
+    if (process->state != PROCESS_STATE_TERMINATED && process->qos != JOB_QOS_INTERACTIVE) {
+        process_set_qos(process, JOB_QOS_INTERACTIVE);
+    }
+    
     // Resume process
-    if (process_resume(process) != 0) {
+    if (process->state == PROCESS_STATE_STOPPED && process_resume(process) != 0) {
+        job_output_detach(process->output);
         printf(COLOR_RED "fg: failed to resume job\n" COLOR_RESET);
         return 1;
     }
     
     // Wait for process to complete
-    int status = process_wait(process);
+    struct sigaction sa, old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fg_forward_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    fg_group = process->pid;
+    sigaction(SIGINT, &sa, &old_sa);
+    int status = process->state == PROCESS_STATE_TERMINATED
+                     ? process->exit_code
+                     : process_wait(process);
+    sigaction(SIGINT, &old_sa, NULL);
+    fg_group = 0;
+    
+    // Let the capture thread flush what is still in the pipe
+    job_output_wait_eof(process->output, 200);
+    job_output_detach(process->output);
+    
+    // It finished in the foreground, so there is nothing left to announce
+    process->reported = process->state == PROCESS_STATE_TERMINATED;
+    
     if (status < 0) {
         printf(COLOR_RED "fg: failed to wait for job\n" COLOR_RESET);
         return 1;
@@ -416,28 +1293,551 @@ int cmd_fg(int argc, char **argv) {
 
 // List jobs
 int cmd_jobs(int argc, char **argv) {
-    (void)argc;  // Suppress unused parameter warning
-    (void)argv;  // Suppress unused parameter warning
+    if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+        process_print_all_long();
+        return 0;
+    }
+    
+    // jobs -o %N [BYTES]: show the captured output of a background job
+    if (argc > 1 && strcmp(argv[1], "-o") == 0) {
+        if (argc < 3) {
+            printf(COLOR_RED "jobs: -o needs a job ID\n" COLOR_RESET);
+            return 1;
+        }
+        
+        Process *process = process_get_by_job_id(parse_job_id(argv[2]));
+        if (!process || !process->output) {
+            printf(COLOR_RED "jobs: no captured output for %s\n" COLOR_RESET, argv[2]);
+            return 1;
+        }
+        
+        size_t max_bytes = SIZE_MAX;
+        if (argc > 3) {
+            max_bytes = (size_t)strtoull(argv[3], NULL, 10);
+        }
+        
+        fflush(stdout);
+        job_output_write_tail(process->output, STDOUT_FILENO, max_bytes);
+        return 0;
+    }
+    
     process_print_all();
     return 0;
 }
 
-// List environment variables
-int cmd_env(int argc, char **argv) {
-    (void)argc;  // Suppress unused parameter warning
-    (void)argv;  // Suppress unused parameter warning
-    int count;
-    char **env_list = env_get_all(&count);
-    if (!env_list) {
-        printf(COLOR_RED "Error: Failed to get environment variables\n" COLOR_RESET);
+// Dump resource usage totals
+int cmd_metrics(int argc, char **argv) {
+    if (argc < 2) {
+        process_dump_usage(stdout);
+        return 0;
+    }
+    
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        printf(COLOR_RED "metrics: %s: %s\n" COLOR_RESET, argv[1], strerror(errno));
         return 1;
     }
+    process_dump_usage(out);
+    fclose(out);
+    return 0;
+}
 
-    for (int i = 0; i < count; i++) {
-        printf("%s\n", env_list[i]);
+// Run a command over many inputs with at most N jobs at once
+int cmd_parallel(int argc, char **argv) {
+    ParallelOptions opts = { parallel_default_jobs(), false };
+    int i = 1;
+    
+    // Parse options
+    while (i < argc && argv[i][0] == '-' && strcmp(argv[i], ":::") != 0) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            opts.max_jobs = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            opts.max_jobs = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            opts.verbose = true;
+        } else {
+            printf(COLOR_RED "parallel: unknown option %s\n" COLOR_RESET, argv[i]);
+            printf("Usage: parallel [-j N] [-v] command [args] [::: input...]\n");
+            return 1;
+        }
+        i++;
     }
-
-    // Free the environment list
+    
+    if (opts.max_jobs <= 0) {
+        printf(COLOR_RED "parallel: job count must be positive\n" COLOR_RESET);
+        return 1;
+    }
+    
+    // Command template runs up to ":::"
+    int tmpl_start = i;
+    while (i < argc && strcmp(argv[i], ":::") != 0) {
+        i++;
+    }
+    int tmpl_argc = i - tmpl_start;
+    
+    // Inputs come from the ::: list, otherwise one per line of stdin
+    if (i < argc) {
+        return parallel_run(&opts, argv + tmpl_start, tmpl_argc, argv + i + 1, argc - i - 1);
+    }
+    
+    int count = 0;
+    char **inputs = parallel_read_inputs(stdin, &count);
+    if (!inputs) {
+        printf(COLOR_RED "parallel: failed to read input\n" COLOR_RESET);
+        return 1;
+    }
+    int status = parallel_run(&opts, argv + tmpl_start, tmpl_argc, inputs, count);
+    parallel_free_inputs(inputs, count);
+    clearerr(stdin);
+    return status;
+}
+
+// Print a set of job limits
+static void print_limits(const char *label, const JobLimits *limits) {
+    printf("%s: cpu %d%%, mem %llu bytes, time %lus (0 = unlimited)\n",
+           label, limits->cpu_percent, limits->mem_bytes, limits->cpu_seconds);
+}
+
+// Run a command under CPU/memory limits, or set the defaults for all jobs
+int cmd_limit(int argc, char **argv) {
+    JobLimits limits;
+    job_limits_get_default(&limits);
+    bool set_default = false;
+    int i = 1;
+    
+    // No arguments: show the defaults and the enforcement mechanism
+    if (argc < 2) {
+        const char *base = job_limits_cgroup_base();
+        print_limits("Defaults", &limits);
+        printf("Enforcement: %s%s\n", base ? "cgroup v2 under " : "setrlimit (no delegated cgroup v2)",
+               base ? base : "");
+        return 0;
+    }
+    
+    // Parse options
+    while (i < argc && strncmp(argv[i], "--", 2) == 0) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--default") == 0) {
+            set_default = true;
+            i++;
+            continue;
+        }
+        if (strcmp(opt, "--clear") == 0) {
+            memset(&limits, 0, sizeof(limits));
+            i++;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf(COLOR_RED "limit: %s needs a value\n" COLOR_RESET, opt);
+            return 1;
+        }
+        
+        const char *value = argv[i + 1];
+        int rc = 0;
+        if (strcmp(opt, "--cpu") == 0) {
+            rc = job_limits_parse_percent(value, &limits.cpu_percent);
+        } else if (strcmp(opt, "--mem") == 0) {
+            rc = job_limits_parse_size(value, &limits.mem_bytes);
+        } else if (strcmp(opt, "--time") == 0) {
+            char *end;
+            limits.cpu_seconds = strtoul(value, &end, 10);
+            rc = (*end != '\0' && strcmp(end, "s") != 0) ? -1 : 0;
+        } else {
+            printf(COLOR_RED "limit: unknown option %s\n" COLOR_RESET, opt);
+            printf("Usage: limit [--default] [--clear] [--cpu N%%] [--mem SIZE] [--time SECS] [command...]\n");
+            return 1;
+        }
+        if (rc != 0) {
+            printf(COLOR_RED "limit: invalid value for %s: %s\n" COLOR_RESET, opt, value);
+            return 1;
+        }
+        i += 2;
+    }
+    
+    if (limits.cpu_percent > 0 && !job_limits_cgroup_base()) {
+        printf(COLOR_YELLOW "limit: no delegated cgroup v2, --cpu share is not enforced\n" COLOR_RESET);
+    }
+    
+    if (set_default) {
+        job_limits_set_default(&limits);
+        print_limits("Defaults", &limits);
+        return 0;
+    }
+    
+    if (i >= argc) {
+        printf(COLOR_RED "limit: missing command\n" COLOR_RESET);
+        return 1;
+    }
+    
+    // Trailing "&" starts the limited command as a background job
+    int cmd_argc = argc - i;
+    char **cmd_argv = argv + i;
+    bool background = strcmp(cmd_argv[cmd_argc - 1], "&") == 0;
+    if (background) {
+        cmd_argv[--cmd_argc] = NULL;
+        if (cmd_argc == 0) {
+            printf(COLOR_RED "limit: missing command\n" COLOR_RESET);
+            return 1;
+        }
+    }
+    
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, !background);
+    opts.capture = background;
+    opts.limits = limits;
+    
+    Process *process = process_spawn(cmd_argv[0], cmd_argv, cmd_argc, &opts);
+    if (!process) {
+        if (errno == ENOTSUP) {
+            printf(COLOR_RED "limit: could not set up a cgroup, --cpu share cannot be enforced\n" COLOR_RESET);
+        } else {
+            printf(COLOR_RED "limit: failed to start %s: %s\n" COLOR_RESET, cmd_argv[0], strerror(errno));
+        }
+        return 1;
+    }
+    if (limits.mem_bytes > 0 && job_limits_cgroup_base() && !process->limit_handle.cgroup_path) {
+        printf(COLOR_YELLOW "limit: could not set up a cgroup, --mem falls back to RLIMIT_AS\n" COLOR_RESET);
+    }
+    if (background) {
+        printf("[%d] %d\n", process->job_id, process->pid);
+        return 0;
+    }
+    
+    if (process->limit_events) {
+        char events[32];
+        printf(COLOR_YELLOW "limit: %s hit limits: %s\n" COLOR_RESET, process->name,
+               job_limits_describe(process->limit_events, events, sizeof(events)));
+    }
+    int status = process->exit_code;
+    process_release(process);
+    return status;
+}
+
+// Run a command pinned to a CPU list, or choose the placement policy
+int cmd_pin(int argc, char **argv) {
+    // No arguments: show the policy and the order jobs are spread in
+    if (argc < 2) {
+        const int *order;
+        int count = job_affinity_cpu_order(&order);
+        printf("Placement policy: %s\n", job_affinity_policy_name(job_affinity_get_policy()));
+        printf("CPU order:");
+        for (int i = 0; i < count; i++) {
+            printf(" %d", order[i]);
+        }
+        printf("\n");
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "--policy") == 0) {
+        if (argc < 3) {
+            printf(COLOR_RED "pin: --policy needs off, rr or least\n" COLOR_RESET);
+            return 1;
+        }
+        if (strcmp(argv[2], "off") == 0) {
+            job_affinity_set_policy(PLACEMENT_OFF);
+        } else if (strcmp(argv[2], "rr") == 0) {
+            job_affinity_set_policy(PLACEMENT_ROUND_ROBIN);
+        } else if (strcmp(argv[2], "least") == 0) {
+            job_affinity_set_policy(PLACEMENT_LEAST_LOADED);
+        } else {
+            printf(COLOR_RED "pin: unknown policy %s\n" COLOR_RESET, argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (argc < 3) {
+        printf(COLOR_RED "pin: missing command\n" COLOR_RESET);
+        printf("Usage: pin CPUS command [args] [&] | pin --policy off|rr|least\n");
+        return 1;
+    }
+    
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, true);
+    if (job_affinity_parse(argv[1], &opts.cpus) != 0) {
+        printf(COLOR_RED "pin: invalid CPU list: %s\n" COLOR_RESET, argv[1]);
+        return 1;
+    }
+    
+    // Trailing "&" starts the pinned command as a background job
+    int cmd_argc = argc - 2;
+    char **cmd_argv = argv + 2;
+    if (strcmp(cmd_argv[cmd_argc - 1], "&") == 0) {
+        cmd_argv[--cmd_argc] = NULL;
+        opts.foreground = false;
+        opts.capture = true;
+        if (cmd_argc == 0) {
+            printf(COLOR_RED "pin: missing command\n" COLOR_RESET);
+            return 1;
+        }
+    }
+    
+    Process *process = process_spawn(cmd_argv[0], cmd_argv, cmd_argc, &opts);
+    if (!process) {
+        printf(COLOR_RED "pin: failed to start %s\n" COLOR_RESET, cmd_argv[0]);
+        return 1;
+    }
+    if (!opts.foreground) {
+        printf("[%d] %d\n", process->job_id, process->pid);
+        return 0;
+    }
+    int status = process->exit_code;
+    process_release(process);
+    return status;
+}
+
+// Mean microseconds to spawn and reap /bin/true, n times
+static double spawnd_time(int n, bool direct) {
+    char true_cmd[] = "/bin/true";
+    char *args[] = { true_cmd, NULL };
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, true);
+    opts.direct = direct;
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++) {
+        Process *process = process_spawn("true", args, 1, &opts);
+        if (!process) {
+            return -1;
+        }
+        process_release(process);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    return us / n;
+}
+
+// Spawn server status and spawn latency benchmark
+int cmd_spawnd(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "status") == 0) {
+        printf("Spawn server: %s\n", spawn_server_running() ? "running" : "off");
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "bench") != 0) {
+        printf(COLOR_RED "spawnd: unknown subcommand %s\n" COLOR_RESET, argv[1]);
+        printf("Usage: spawnd [status] | spawnd bench [N] [MB...]\n");
+        return 1;
+    }
+    
+    int n = argc > 2 ? atoi(argv[2]) : 200;
+    if (n <= 0) {
+        printf(COLOR_RED "spawnd: invalid count: %s\n" COLOR_RESET, argv[2]);
+        return 1;
+    }
+    
+    // Extra resident memory to give the shell before each round
+    static const long default_sizes[] = { 0, 64, 256, 1024 };
+    int size_count = argc > 3 ? argc - 3 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+    
+    printf("%8s %12s %12s\n", "RSS(MB)", "DIRECT(us)", "SERVER(us)");
+    for (int i = 0; i < size_count; i++) {
+        long mb = argc > 3 ? atol(argv[3 + i]) : default_sizes[i];
+        
+        // Touch every page so the memory is really resident
+        char *ballast = NULL;
+        if (mb > 0) {
+            ballast = (char *)malloc((size_t)mb << 20);
+            if (!ballast) {
+                printf(COLOR_RED "spawnd: cannot allocate %ld MB\n" COLOR_RESET, mb);
+                return 1;
+            }
+            memset(ballast, 1, (size_t)mb << 20);
+        }
+        
+        double direct = spawnd_time(n, true);
+        double server = spawn_server_running() ? spawnd_time(n, false) : -1;
+        printf("%8ld %12.1f ", mb, direct);
+        if (server >= 0) {
+            printf("%12.1f\n", server);
+        } else {
+            printf("%12s\n", "-");
+        }
+        
+        free(ballast);
+    }
+    return 0;
+}
+
+// Show or change job scheduling classes
+int cmd_qos(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Background jobs: %s\n", job_qos_name(job_qos_get_default()));
+        process_print_all_qos();
+        return 0;
+    }
+    
+    if (argc < 3) {
+        printf(COLOR_RED "qos: missing class\n" COLOR_RESET);
+        printf("Usage: qos [%%N interactive|background|idle] | qos --default CLASS\n");
+        return 1;
+    }
+    
+    JobQos qos;
+    if (job_qos_parse(argv[2], &qos) != 0) {
+        printf(COLOR_RED "qos: unknown class %s\n" COLOR_RESET, argv[2]);
+        return 1;
+    }
+    
+    if (strcmp(argv[1], "--default") == 0) {
+        job_qos_set_default(qos);
+        return 0;
+    }
+    
+    int job_id = parse_job_id(argv[1]);
+    Process *process = process_get_by_job_id(job_id);
+    if (!process || process->state == PROCESS_STATE_TERMINATED) {
+        printf(COLOR_RED "qos: no running job %s\n" COLOR_RESET, argv[1]);
+        return 1;
+    }
+    
+    if (process_set_qos(process, qos) != 0) {
+        printf(COLOR_RED "qos: job %d: not every setting took effect: %s\n" COLOR_RESET,
+               job_id, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Start, list or close coprocesses
+int cmd_coproc(int argc, char **argv) {
+    if (argc < 2) {
+        coproc_print_all();
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "-c") == 0) {
+        if (argc < 3 || coproc_close(argv[2]) != 0) {
+            printf(COLOR_RED "coproc: no coprocess %s\n" COLOR_RESET, argc < 3 ? "given" : argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (argc < 3) {
+        printf(COLOR_RED "coproc: missing command\n" COLOR_RESET);
+        printf("Usage: coproc NAME command [args] | coproc -c NAME\n");
+        return 1;
+    }
+    
+    if (coproc_start(argv[1], argv + 2, argc - 2) != 0) {
+        printf(COLOR_RED "coproc: cannot start %s: %s\n" COLOR_RESET, argv[2], strerror(errno));
+        return 1;
+    }
+    
+    Process *process = coproc_process(argv[1]);
+    if (process) {
+        printf("[%d] %d\n", process->job_id, process->pid);
+    }
+    return 0;
+}
+
+// Send the remaining arguments as one line
+int cmd_coproc_send(int argc, char **argv) {
+    if (argc < 2) {
+        printf(COLOR_RED "coproc-send: missing coprocess name\n" COLOR_RESET);
+        return 1;
+    }
+    
+    char line[4096];
+    size_t len = 0;
+    for (int i = 2; i < argc; i++) {
+        int n = snprintf(line + len, sizeof(line) - len, "%s%s", i > 2 ? " " : "", argv[i]);
+        if (n < 0 || (size_t)n >= sizeof(line) - len - 1) {
+            printf(COLOR_RED "coproc-send: line too long\n" COLOR_RESET);
+            return 1;
+        }
+        len += (size_t)n;
+    }
+    line[len++] = '\n';
+    
+    if (coproc_send(argv[1], line, len) != 0) {
+        printf(COLOR_RED "coproc-send: %s: %s\n" COLOR_RESET, argv[1], strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Print one line of coprocess output
+int cmd_coproc_read(int argc, char **argv) {
+    int timeout_ms = -1;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+        timeout_ms = atoi(argv[i + 1]);
+        i += 2;
+    }
+    if (i >= argc) {
+        printf(COLOR_RED "coproc-read: missing coprocess name\n" COLOR_RESET);
+        printf("Usage: coproc-read [-t MS] NAME\n");
+        return 1;
+    }
+    
+    char line[4096];
+    ssize_t n = coproc_read_line(argv[i], line, sizeof(line), timeout_ms);
+    if (n == -2) {
+        printf(COLOR_RED "coproc-read: %s: timed out\n" COLOR_RESET, argv[i]);
+        return 1;
+    }
+    if (n < 0) {
+        if (errno == ENOENT) {
+            printf(COLOR_RED "coproc-read: no coprocess %s\n" COLOR_RESET, argv[i]);
+        }
+        return 1;
+    }
+    
+    printf("%s\n", line);
+    return 0;
+}
+
+// List environment variables
+int cmd_env(int argc, char **argv) {
+    // env --bench [N]: time the variable store with N scratch variables
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        int count = argc > 2 ? atoi(argv[2]) : 10000;
+        if (count <= 0) {
+            printf(COLOR_RED "env: invalid count: %s\n" COLOR_RESET, argv[2]);
+            return 1;
+        }
+        env_benchmark(count, stdout);
+        return 0;
+    }
+    
+    // env --save FILE / env --load FILE: binary snapshot of the session's variables
+    if (argc > 1 && (strcmp(argv[1], "--save") == 0 || strcmp(argv[1], "--load") == 0)) {
+        bool save = strcmp(argv[1], "--save") == 0;
+        if (argc < 3) {
+            printf(COLOR_RED "Usage: env %s FILE\n" COLOR_RESET, argv[1]);
+            return 1;
+        }
+        shvar_sync_exports();
+        errno = 0;
+        int count = save ? env_save_to_file(argv[2]) : env_load_from_file(argv[2]);
+        if (count < 0) {
+            printf(COLOR_RED "env: cannot %s %s: %s\n" COLOR_RESET,
+                   save ? "save" : "load", argv[2], strerror(errno ? errno : EINVAL));
+            return 1;
+        }
+        printf("%s %d variables\n", save ? "Saved" : "Loaded", count);
+        return 0;
+    }
+    
+    // Exported typed variables are only strings once synced
+    shvar_sync_exports();
+    
+    int count;
+    char **env_list = env_get_all(&count);
+    if (!env_list) {
+        printf(COLOR_RED "Error: Failed to get environment variables\n" COLOR_RESET);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        printf("%s\n", env_list[i]);
+    }
+
+    // Free the environment list
     for (int i = 0; i < count; i++) {
         free(env_list[i]);
     }
@@ -456,11 +1856,17 @@ int cmd_export(int argc, char **argv) {
     for (int i = 1; i < argc; i++) {
         char *eq = strchr(argv[i], '=');
         if (!eq) {
-            printf(COLOR_RED "export: invalid syntax: %s\n" COLOR_RESET, argv[i]);
+            // A typed variable is exported as a string from now on
+            if (shvar_export(argv[i]) != 0 && !env_exists(argv[i])) {
+                printf(COLOR_RED "export: invalid syntax: %s\n" COLOR_RESET, argv[i]);
+            }
             continue;
         }
         
         *eq = '\0';
+        if (shvar_type(argv[i]) != SHVAR_NONE) {
+            shvar_unset(argv[i]);
+        }
         if (env_set(argv[i], eq + 1) != 0) {
             printf(COLOR_RED "export: failed to set %s\n" COLOR_RESET, argv[i]);
         }
@@ -476,6 +1882,21 @@ int cmd_unset(int argc, char **argv) {
     }
     
     for (int i = 1; i < argc; i++) {
+        // NAME[KEY] removes one element of an array
+        char *bracket = strchr(argv[i], '[');
+        size_t len = strlen(argv[i]);
+        if (bracket && argv[i][len - 1] == ']') {
+            *bracket = '\0';
+            argv[i][len - 1] = '\0';
+            if (shvar_unset_element(argv[i], bracket + 1) != 0) {
+                printf(COLOR_RED "unset: no such element: %s[%s]\n" COLOR_RESET, argv[i], bracket + 1);
+            }
+            continue;
+        }
+        
+        if (shvar_unset(argv[i]) == 0) {
+            continue;
+        }
         if (env_unset(argv[i]) != 0) {
             printf(COLOR_RED "unset: failed to unset %s\n" COLOR_RESET, argv[i]);
         }
@@ -483,6 +1904,128 @@ int cmd_unset(int argc, char **argv) {
     return 0;
 }
 
+// Declare function-local variables
+int cmd_local(int argc, char **argv) {
+    if (argc < 2) {
+        printf(COLOR_RED "local: missing variable name\n" COLOR_RESET);
+        return 1;
+    }
+    
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (eq == argv[i]) {
+            printf(COLOR_RED "local: invalid syntax: %s\n" COLOR_RESET, argv[i]);
+            status = 1;
+            continue;
+        }
+        
+        // NAME alone makes it local but unset
+        if (eq) {
+            *eq = '\0';
+        }
+        int rc = env_set_local(argv[i], eq ? eq + 1 : NULL);
+        if (eq) {
+            *eq = '=';
+        }
+        if (rc != 0) {
+            printf(COLOR_RED "local: can only be used in a function\n" COLOR_RESET);
+            return 1;
+        }
+    }
+    return status;
+}
+
+// Declare typed variables: declare [-i|-a|-A] [-x] NAME[=VALUE]...,
+// declare -p [NAME...]
+int cmd_declare(int argc, char **argv) {
+    ShVarType type = SHVAR_NONE;
+    bool export = false;
+    bool print = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        for (char *flag = argv[i] + 1; *flag; flag++) {
+            switch (*flag) {
+                case 'i': type = SHVAR_INT; break;
+                case 'a': type = SHVAR_ARRAY; break;
+                case 'A': type = SHVAR_ASSOC; break;
+                case 'x': export = true; break;
+                case 'p': print = true; break;
+                default:
+                    printf(COLOR_RED "declare: invalid option: -%c\n" COLOR_RESET, *flag);
+                    printf("Usage: declare [-i|-a|-A] [-x] NAME[=VALUE]... | declare -p [NAME...]\n");
+                    return 1;
+            }
+        }
+    }
+    
+    if (print || i == argc) {
+        if (i == argc) {
+            shvar_print_all();
+        }
+        for (; i < argc; i++) {
+            shvar_print(argv[i]);
+        }
+        return 0;
+    }
+    
+    int status = 0;
+    while (i < argc) {
+        // The name, up to a subscript or an assignment
+        char name[256];
+        size_t name_len = strcspn(argv[i], "[+=");
+        if (name_len == 0 || name_len >= sizeof(name)) {
+            printf(COLOR_RED "declare: invalid name: %s\n" COLOR_RESET, argv[i]);
+            return 1;
+        }
+        memcpy(name, argv[i], name_len);
+        name[name_len] = '\0';
+        
+        if (type != SHVAR_NONE && shvar_declare(name, type) != 0) {
+            printf(COLOR_RED "declare: %s: cannot convert %s to %s\n" COLOR_RESET,
+                   name, shvar_type_name(shvar_type(name)), shvar_type_name(type));
+            return 1;
+        }
+        
+        // NAME=(a b c) spans words up to the one closing it
+        int words = 1;
+        char *eq = strchr(argv[i], '=');
+        if (eq && eq[1] == '(') {
+            while (i + words - 1 < argc - 1 && argv[i + words - 1][strlen(argv[i + words - 1]) - 1] != ')') {
+                words++;
+            }
+        }
+        if (eq && shell_execute_command(words, argv + i) != 0) {
+            status = 1;
+        }
+        
+        if (export) {
+            shvar_export(name);
+        }
+        i += words;
+    }
+    return status;
+}
+
+// Evaluate each argument as an arithmetic expression. Succeeds when the
+// last one is not zero.
+int cmd_let(int argc, char **argv) {
+    if (argc < 2) {
+        printf(COLOR_RED "let: missing expression\n" COLOR_RESET);
+        return 1;
+    }
+    
+    int64_t value = 0;
+    for (int i = 1; i < argc; i++) {
+        char err[128];
+        if (arith_eval(argv[i], &value, err, sizeof(err)) != 0) {
+            printf(COLOR_RED "let: %s: %s\n" COLOR_RESET, argv[i], err);
+            return 1;
+        }
+    }
+    return value != 0 ? 0 : 1;
+}
+
 // AI commands
 int cmd_ai_help(int argc, char **argv) {
     (void)argc;  // Suppress unused parameter warning
@@ -539,83 +2082,31 @@ int cmd_ai_learn(int argc, char **argv) {
 
 // System monitoring command
 int cmd_sysmon(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
-    
-    // Get CPU usage using sysctl
-    int mib[2] = {CTL_HW, HW_NCPU};
-    int num_cpu;
-    size_t len = sizeof(num_cpu);
-    if (sysctl(mib, 2, &num_cpu, &len, NULL, 0) == 0) {
-        printf("CPU Cores: %d\n", num_cpu);
-    }
-
-    // Get memory usage using mach
-    mach_port_t host_port = mach_host_self();
-    mach_msg_type_number_t host_size = sizeof(vm_statistics64_data_t) / sizeof(integer_t);
-    vm_size_t page_size;
-    vm_statistics64_data_t vm_stats;
-    
-    host_page_size(host_port, &page_size);
-    
-    if (host_statistics64(host_port, HOST_VM_INFO64, (host_info64_t)&vm_stats, &host_size) == KERN_SUCCESS) {
-        unsigned long long total_mem = 0;
-        int mib[2] = {CTL_HW, HW_MEMSIZE};
-        size_t len = sizeof(total_mem);
-        if (sysctl(mib, 2, &total_mem, &len, NULL, 0) == 0) {
-            unsigned long long free_mem = vm_stats.free_count * page_size;
-            unsigned long long used_mem = total_mem - free_mem;
-            float mem_usage = (float)used_mem / total_mem * 100.0f;
-            
-            printf("\nMemory Usage: %.1f%%\n", mem_usage);
-            printf("Total Memory: %.2f GB\n", total_mem / 1024.0f / 1024.0f / 1024.0f);
-            printf("Used Memory: %.2f GB\n", used_mem / 1024.0f / 1024.0f / 1024.0f);
-            printf("Free Memory: %.2f GB\n", free_mem / 1024.0f / 1024.0f / 1024.0f);
-        }
-    }
-
-    // Get disk usage
-    FILE *df = popen("df -h /", "r");
-    if (df) {
-        char line[256];
-        // Skip header
-        fgets(line, sizeof(line), df);
-        if (fgets(line, sizeof(line), df)) {
-            char filesystem[256], size[32], used[32], avail[32], use_percent[32], mounted[256];
-            sscanf(line, "%s %s %s %s %s %s",
-                   filesystem, size, used, avail, use_percent, mounted);
-            printf("\nDisk Usage:\n");
-            printf("Filesystem: %s\n", filesystem);
-            printf("Size: %s\n", size);
-            printf("Used: %s\n", used);
-            printf("Available: %s\n", avail);
-            printf("Use%%: %s\n", use_percent);
-            printf("Mounted on: %s\n", mounted);
-        }
-        pclose(df);
-    }
-
-    // Get load average using sysctl
-    struct loadavg load;
-    int mib_load[2] = {CTL_VM, VM_LOADAVG};
-    size_t load_size = sizeof(load);
-    if (sysctl(mib_load, 2, &load, &load_size, NULL, 0) == 0) {
-        printf("\nLoad Average (1/5/15 min): %.2f %.2f %.2f\n",
-               (double)load.ldavg[0] / load.fscale,
-               (double)load.ldavg[1] / load.fscale,
-               (double)load.ldavg[2] / load.fscale);
-    }
-
-    // Get process count
-    FILE *ps = popen("ps aux | wc -l", "r");
-    if (ps) {
-        char line[32];
-        if (fgets(line, sizeof(line), ps)) {
-            int process_count = atoi(line) - 1; // Subtract header line
-            printf("Total Processes: %d\n", process_count);
-        }
-        pclose(ps);
+    double interval = 0;
+    int count = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            char *end;
+            interval = strtod(argv[++i], &end);
+            if (*end != '\0' || interval < 0.1) {
+                printf(COLOR_RED "sysmon: invalid interval: %s\n" COLOR_RESET, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+            if (count <= 0) {
+                printf(COLOR_RED "sysmon: invalid count: %s\n" COLOR_RESET, argv[i]);
+                return 1;
+            }
+        } else {
+            printf(COLOR_RED "Usage: sysmon [-w INTERVAL [-n COUNT]]\n" COLOR_RESET);
+            return 1;
+        }
     }
-
-    return 0;
-} 
\ No newline at end of file
+    
+    if (interval > 0) {
+        return sysmon_watch(interval, count, stdout);
+    }
+    return sysmon_report(stdout);
+}
@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+#include "../../include/shell/coproc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+// Stop reading a coprocess whose output nobody collects past this much;
+// the pipe then fills and the child blocks
+#define COPROC_MAX_BUFFER (1 << 20)
+#define COPROC_READ_CHUNK 4096
+
+// Growable byte queue, consumed from the front
+typedef struct {
+    char *data;
+    size_t start;
+    size_t len;
+    size_t cap;
+} CoprocBuffer;
+
+// One coprocess
+typedef struct {
+    char name[COPROC_MAX_NAME];
+    pid_t pid;
+    int to_fd;              // Its stdin, non-blocking, -1 once closed
+    int from_fd;            // Its stdout, non-blocking, -1 at EOF
+    CoprocBuffer in;        // Read from the coprocess, not yet consumed
+    CoprocBuffer out;       // Sent to the coprocess, not yet written
+} Coproc;
+
+static Coproc coprocs[COPROC_MAX];
+static int coproc_count = 0;
+
+// Make room for n more bytes at the end
+static int buffer_reserve(CoprocBuffer *buf, size_t n) {
+    if (buf->start + buf->len + n <= buf->cap) {
+        return 0;
+    }
+
+    // Slide the live bytes down before growing
+    if (buf->start > 0) {
+        memmove(buf->data, buf->data + buf->start, buf->len);
+        buf->start = 0;
+        if (buf->len + n <= buf->cap) {
+            return 0;
+        }
+    }
+
+    size_t cap = buf->cap ? buf->cap : COPROC_READ_CHUNK;
+    while (cap < buf->len + n) {
+        cap *= 2;
+    }
+    char *data = (char *)realloc(buf->data, cap);
+    if (!data) {
+        return -1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+static void buffer_consume(CoprocBuffer *buf, size_t n) {
+    buf->start += n;
+    buf->len -= n;
+    if (buf->len == 0) {
+        buf->start = 0;
+    }
+}
+
+static void buffer_free(CoprocBuffer *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static Coproc *coproc_find(const char *name) {
+    for (int i = 0; i < coproc_count; i++) {
+        if (strcmp(coprocs[i].name, name) == 0) {
+            return &coprocs[i];
+        }
+    }
+    return NULL;
+}
+
+// write() that reports a closed pipe as EPIPE instead of killing the shell
+static ssize_t write_nosigpipe(int fd, const void *data, size_t len) {
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old);
+
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EPIPE) {
+        // Swallow the SIGPIPE this write raised before unblocking
+        struct timespec zero = { 0, 0 };
+        sigtimedwait(&pipe_set, NULL, &zero);
+        errno = EPIPE;
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return n;
+}
+
+static void coproc_close_input(Coproc *coproc) {
+    if (coproc->to_fd >= 0) {
+        close(coproc->to_fd);
+        coproc->to_fd = -1;
+    }
+    buffer_free(&coproc->out);
+}
+
+// Write queued input until the pipe is full
+static int coproc_flush(Coproc *coproc) {
+    while (coproc->out.len > 0) {
+        ssize_t n = write_nosigpipe(coproc->to_fd, coproc->out.data + coproc->out.start,
+                                    coproc->out.len);
+        if (n > 0) {
+            buffer_consume(&coproc->out, (size_t)n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return 0;
+        } else {
+            // The coprocess closed its stdin; queued input can never arrive
+            coproc_close_input(coproc);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Read whatever output is ready
+static void coproc_fill(Coproc *coproc) {
+    while (coproc->from_fd >= 0 && coproc->in.len < COPROC_MAX_BUFFER) {
+        if (buffer_reserve(&coproc->in, COPROC_READ_CHUNK) != 0) {
+            return;
+        }
+        char *dst = coproc->in.data + coproc->in.start + coproc->in.len;
+        size_t room = coproc->in.cap - coproc->in.start - coproc->in.len;
+        ssize_t n = read(coproc->from_fd, dst, room);
+        if (n > 0) {
+            coproc->in.len += (size_t)n;
+            if ((size_t)n < room) {
+                return;     // Drained
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return;
+        } else {
+            close(coproc->from_fd);
+            coproc->from_fd = -1;
+        }
+    }
+}
+
+// Start a named coprocess
+int coproc_start(const char *name, char **args, int argc) {
+    if (!name || !name[0] || strlen(name) >= COPROC_MAX_NAME || argc <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (coproc_find(name)) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (coproc_count >= COPROC_MAX) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // Close-on-exec so later children don't hold the coprocess's pipes open
+    int to[2], from[2];
+    if (pipe2(to, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    if (pipe2(from, O_CLOEXEC) != 0) {
+        close(to[0]);
+        close(to[1]);
+        return -1;
+    }
+
+    // Queries are interactive work even though the coprocess runs in the background
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, false);
+    opts.in_fd = to[0];
+    opts.out_fd = from[1];
+    opts.err_fd = STDERR_FILENO;
+    opts.qos = JOB_QOS_INTERACTIVE;
+    Process *process = process_spawn(args[0], args, argc, &opts);
+
+    int saved_errno = errno;
+    close(to[0]);
+    close(from[1]);
+    if (!process) {
+        close(to[1]);
+        close(from[0]);
+        errno = saved_errno;
+        return -1;
+    }
+
+    fcntl(to[1], F_SETFL, fcntl(to[1], F_GETFL) | O_NONBLOCK);
+    fcntl(from[0], F_SETFL, fcntl(from[0], F_GETFL) | O_NONBLOCK);
+
+    Coproc *coproc = &coprocs[coproc_count++];
+    memset(coproc, 0, sizeof(*coproc));
+    strncpy(coproc->name, name, COPROC_MAX_NAME - 1);
+    coproc->pid = process->pid;
+    coproc->to_fd = to[1];
+    coproc->from_fd = from[0];
+    return 0;
+}
+
+// Queue data for the coprocess
+int coproc_send(const char *name, const char *data, size_t len) {
+    Coproc *coproc = coproc_find(name);
+    if (!coproc) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (coproc->to_fd < 0) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    // Nothing queued: write straight from the caller's buffer
+    if (coproc->out.len == 0) {
+        while (len > 0) {
+            ssize_t n = write_nosigpipe(coproc->to_fd, data, len);
+            if (n > 0) {
+                data += n;
+                len -= (size_t)n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && errno == EAGAIN) {
+                break;
+            } else {
+                coproc_close_input(coproc);
+                errno = EPIPE;
+                return -1;
+            }
+        }
+        if (len == 0) {
+            return 0;
+        }
+    }
+
+    if (buffer_reserve(&coproc->out, len) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(coproc->out.data + coproc->out.start + coproc->out.len, data, len);
+    coproc->out.len += len;
+    return 0;
+}
+
+static int64_t coproc_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Read one line from the coprocess
+ssize_t coproc_read_line(const char *name, char *buf, size_t size, int timeout_ms) {
+    Coproc *coproc = coproc_find(name);
+    if (!coproc || size == 0) {
+        errno = coproc ? EINVAL : ENOENT;
+        return -1;
+    }
+
+    int64_t deadline = timeout_ms >= 0 ? coproc_now_ms() + timeout_ms : -1;
+    size_t scanned = 0;
+
+    for (;;) {
+        char *start = coproc->in.data + coproc->in.start;
+        char *nl = coproc->in.len > scanned
+                       ? (char *)memchr(start + scanned, '\n', coproc->in.len - scanned)
+                       : NULL;
+        scanned = coproc->in.len;
+
+        // A full line, the unterminated tail once the output has ended, or
+        // a line too long to buffer, which comes back cut at the limit
+        if (nl || (coproc->from_fd < 0 && coproc->in.len > 0) || coproc->in.len >= COPROC_MAX_BUFFER) {
+            size_t line = nl ? (size_t)(nl - start) : coproc->in.len;
+            size_t copy = line < size - 1 ? line : size - 1;
+            memcpy(buf, start, copy);
+            buf[copy] = '\0';
+            buffer_consume(&coproc->in, nl ? line + 1 : line);
+            return (ssize_t)copy;
+        }
+        if (coproc->from_fd < 0) {
+            return -1;
+        }
+
+        int wait_ms = -1;
+        if (deadline >= 0) {
+            int64_t left = deadline - coproc_now_ms();
+            if (left <= 0) {
+                return -2;
+            }
+            wait_ms = (int)left;
+        }
+
+        struct pollfd pfds[2];
+        int nfds = 0;
+        pfds[nfds].fd = coproc->from_fd;
+        pfds[nfds].events = POLLIN;
+        nfds++;
+        if (coproc->out.len > 0 && coproc->to_fd >= 0) {
+            pfds[nfds].fd = coproc->to_fd;
+            pfds[nfds].events = POLLOUT;
+            nfds++;
+        }
+
+        int ready = poll(pfds, nfds, wait_ms);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready == 0) {
+            return -2;
+        }
+        if (nfds > 1 && pfds[1].revents) {
+            coproc_flush(coproc);
+        }
+        if (pfds[0].revents) {
+            coproc_fill(coproc);
+        }
+    }
+}
+
+// Close our end of the coprocess's stdin and forget it
+int coproc_close(const char *name) {
+    Coproc *coproc = coproc_find(name);
+    if (!coproc) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    coproc_close_input(coproc);
+    if (coproc->from_fd >= 0) {
+        close(coproc->from_fd);
+    }
+    buffer_free(&coproc->in);
+
+    int i = (int)(coproc - coprocs);
+    if (i < coproc_count - 1) {
+        coprocs[i] = coprocs[coproc_count - 1];
+    }
+    coproc_count--;
+    return 0;
+}
+
+// Move queued input and ready output without blocking
+void coproc_service(void) {
+    for (int i = 0; i < coproc_count; i++) {
+        if (coprocs[i].out.len > 0 && coprocs[i].to_fd >= 0) {
+            coproc_flush(&coprocs[i]);
+        }
+        coproc_fill(&coprocs[i]);
+    }
+}
+
+Process *coproc_process(const char *name) {
+    Coproc *coproc = coproc_find(name);
+    return coproc ? process_get_by_pid(coproc->pid) : NULL;
+}
+
+void coproc_print_all(void) {
+    printf("NAME                PID S   QUEUED BUFFERED COMMAND\n");
+    for (int i = 0; i < coproc_count; i++) {
+        Process *process = process_get_by_pid(coprocs[i].pid);
+        char state = '?';
+        if (process) {
+            state = process->state == PROCESS_STATE_RUNNING ? 'R'
+                  : process->state == PROCESS_STATE_STOPPED ? 'S' : 'T';
+        }
+        printf("%-16s %6d %c %8zu %8zu %s\n",
+               coprocs[i].name,
+               coprocs[i].pid,
+               state,
+               coprocs[i].out.len,
+               coprocs[i].in.len,
+               process ? process->name : "-");
+    }
+}
+
+void coproc_cleanup(void) {
+    while (coproc_count > 0) {
+        coproc_close(coprocs[0].name);
+    }
+}
@@ -0,0 +1,545 @@
+#define _GNU_SOURCE
+#include "../../include/shell/copy.h"
+#include "../../include/shell/filecopy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+// One path still to copy
+typedef struct CopyJob {
+    struct CopyJob *next;
+    char *src;
+    char *dst;
+} CopyJob;
+
+// Directory whose mode and times are set after its contents
+typedef struct {
+    char *path;
+    mode_t mode;
+    struct timespec times[2];
+} CopyDir;
+
+// State shared by the workers of one copy
+typedef struct {
+    const CopyOptions *opts;
+    const char *prog;
+    mode_t umask;
+    dev_t top_dev;      // The destination directory, never copied into itself
+    ino_t top_ino;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    CopyJob *stack;     // LIFO keeps the walk depth-first
+    int pending;        // Queued or being worked on
+    int errors;
+    CopyDir *dirs;
+    int dir_count;
+    int dir_capacity;
+} CopyTree;
+
+static void copy_error(CopyTree *tree, const char *fmt, ...) {
+    char msg[PATH_MAX * 2 + 128];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    pthread_mutex_lock(&tree->lock);
+    printf(COLOR_RED "%s: %s\n" COLOR_RESET, tree->prog, msg);
+    tree->errors++;
+    pthread_mutex_unlock(&tree->lock);
+}
+
+static char *copy_join(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    bool slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = (char *)malloc(dir_len + slash + name_len + 1);
+    if (path) {
+        memcpy(path, dir, dir_len);
+        if (slash) {
+            path[dir_len] = '/';
+        }
+        memcpy(path + dir_len + slash, name, name_len + 1);
+    }
+    return path;
+}
+
+// Last component, ignoring trailing slashes: "a/b/" gives "b"
+static char *copy_basename(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    size_t start = len;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    return strndup(path + start, len - start);
+}
+
+static void copy_push(CopyTree *tree, CopyJob *first, CopyJob *last, int count) {
+    pthread_mutex_lock(&tree->lock);
+    last->next = tree->stack;
+    tree->stack = first;
+    tree->pending += count;
+    if (count > 1) {
+        pthread_cond_broadcast(&tree->ready);
+    } else {
+        pthread_cond_signal(&tree->ready);
+    }
+    pthread_mutex_unlock(&tree->lock);
+}
+
+static void copy_remember_dir(CopyTree *tree, const char *path, const struct stat *st) {
+    pthread_mutex_lock(&tree->lock);
+    if (tree->dir_count == tree->dir_capacity) {
+        int capacity = tree->dir_capacity ? tree->dir_capacity * 2 : 64;
+        CopyDir *dirs = (CopyDir *)realloc(tree->dirs, (size_t)capacity * sizeof(CopyDir));
+        if (!dirs) {
+            pthread_mutex_unlock(&tree->lock);
+            return;
+        }
+        tree->dirs = dirs;
+        tree->dir_capacity = capacity;
+    }
+    CopyDir *dir = &tree->dirs[tree->dir_count];
+    dir->path = strdup(path);
+    dir->mode = tree->opts->preserve ? st->st_mode & 07777 : st->st_mode & 07777 & ~tree->umask;
+    dir->times[0] = st->st_atim;
+    dir->times[1] = st->st_mtim;
+    if (dir->path) {
+        tree->dir_count++;
+    }
+    pthread_mutex_unlock(&tree->lock);
+}
+
+// Owner, mode and times of st onto the destination, through fd when it
+// is open and by path (not following a symlink) otherwise
+static void copy_attributes(CopyTree *tree, int fd, const char *dst, const struct stat *st) {
+    int rc = fd >= 0 ? fchown(fd, st->st_uid, st->st_gid) :
+                       fchownat(AT_FDCWD, dst, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW);
+    if (rc != 0 && errno != EPERM) {
+        copy_error(tree, "failed to preserve ownership for '%s': %s", dst, strerror(errno));
+    }
+    if (!S_ISLNK(st->st_mode)) {
+        rc = fd >= 0 ? fchmod(fd, st->st_mode & 07777) : chmod(dst, st->st_mode & 07777);
+        if (rc != 0) {
+            copy_error(tree, "failed to preserve permissions for '%s': %s", dst, strerror(errno));
+        }
+    }
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    rc = fd >= 0 ? futimens(fd, times) : utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+    if (rc != 0) {
+        copy_error(tree, "failed to preserve times for '%s': %s", dst, strerror(errno));
+    }
+}
+
+static void copy_regular(CopyTree *tree, const char *src, const char *dst, const struct stat *st) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        copy_error(tree, "cannot open '%s' for reading: %s", src, strerror(errno));
+        return;
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (tree->opts->no_clobber) {
+        flags |= O_EXCL;
+    }
+    int out = open(dst, flags, st->st_mode & 0777);
+    if (out < 0) {
+        if (!(tree->opts->no_clobber && errno == EEXIST)) {
+            copy_error(tree, "cannot create regular file '%s': %s", dst, strerror(errno));
+        }
+        close(in);
+        return;
+    }
+
+    if (filecopy_file(in, out, st, NULL) < 0) {
+        copy_error(tree, "error copying '%s' to '%s': %s", src, dst, strerror(errno));
+    } else if (tree->opts->preserve) {
+        copy_attributes(tree, out, dst, st);
+    }
+    close(in);
+    if (close(out) != 0) {
+        copy_error(tree, "error writing '%s': %s", dst, strerror(errno));
+    }
+}
+
+static void copy_symlink(CopyTree *tree, const char *src, const char *dst, const struct stat *st) {
+    char target[PATH_MAX];
+    ssize_t len = readlink(src, target, sizeof(target) - 1);
+    if (len < 0) {
+        copy_error(tree, "cannot read symbolic link '%s': %s", src, strerror(errno));
+        return;
+    }
+    target[len] = '\0';
+
+    if (symlink(target, dst) != 0) {
+        if (errno != EEXIST || tree->opts->no_clobber) {
+            if (errno != EEXIST) {
+                copy_error(tree, "cannot create symbolic link '%s': %s", dst, strerror(errno));
+            }
+            return;
+        }
+        if (unlink(dst) != 0 || symlink(target, dst) != 0) {
+            copy_error(tree, "cannot create symbolic link '%s': %s", dst, strerror(errno));
+            return;
+        }
+    }
+    if (tree->opts->preserve) {
+        copy_attributes(tree, -1, dst, st);
+    }
+}
+
+// Create dst and queue every entry of src below it
+static void copy_directory(CopyTree *tree, const char *src, const char *dst, const struct stat *st) {
+    if (st->st_dev == tree->top_dev && st->st_ino == tree->top_ino) {
+        copy_error(tree, "cannot copy a directory, '%s', into itself", src);
+        return;
+    }
+
+    // Owner-writable until the fix-up, so the workers can fill it
+    if (mkdir(dst, (st->st_mode & 07777) | S_IRWXU) != 0) {
+        struct stat existing;
+        if (errno != EEXIST || stat(dst, &existing) != 0 || !S_ISDIR(existing.st_mode)) {
+            copy_error(tree, "cannot create directory '%s': %s", dst, strerror(errno));
+            return;
+        }
+    }
+    if (tree->top_ino == 0) {
+        struct stat created;
+        if (stat(dst, &created) == 0) {
+            tree->top_dev = created.st_dev;
+            tree->top_ino = created.st_ino;
+        }
+    }
+    copy_remember_dir(tree, dst, st);
+
+    int fd = open(src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        copy_error(tree, "cannot open directory '%s': %s", src, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    // Queue the whole directory under one lock
+    CopyJob *first = NULL, *last = NULL;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' ||
+            (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        CopyJob *job = (CopyJob *)malloc(sizeof(CopyJob));
+        if (!job) {
+            break;
+        }
+        job->src = copy_join(src, entry->d_name);
+        job->dst = copy_join(dst, entry->d_name);
+        job->next = first;
+        first = job;
+        if (!last) {
+            last = job;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    if (count > 0) {
+        copy_push(tree, first, last, count);
+    }
+}
+
+// Copy one path of any type
+static void copy_entry(CopyTree *tree, const char *src, const char *dst) {
+    struct stat st;
+    int rc = tree->opts->recursive ? lstat(src, &st) : stat(src, &st);
+    if (rc != 0) {
+        copy_error(tree, "cannot stat '%s': %s", src, strerror(errno));
+        return;
+    }
+    if (tree->opts->verbose) {
+        printf("'%s' -> '%s'\n", src, dst);
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        if (!tree->opts->recursive) {
+            copy_error(tree, "-r not specified; omitting directory '%s'", src);
+            return;
+        }
+        copy_directory(tree, src, dst, &st);
+    } else if (S_ISREG(st.st_mode)) {
+        copy_regular(tree, src, dst, &st);
+    } else if (S_ISLNK(st.st_mode)) {
+        copy_symlink(tree, src, dst, &st);
+    } else if (S_ISFIFO(st.st_mode)) {
+        if (mkfifo(dst, st.st_mode & 07777) != 0) {
+            if (!(errno == EEXIST && tree->opts->no_clobber)) {
+                copy_error(tree, "cannot create fifo '%s': %s", dst, strerror(errno));
+            }
+        } else if (tree->opts->preserve) {
+            copy_attributes(tree, -1, dst, &st);
+        }
+    } else {
+        copy_error(tree, "cannot copy special file '%s'", src);
+    }
+}
+
+static void *copy_worker(void *arg) {
+    CopyTree *tree = (CopyTree *)arg;
+
+    pthread_mutex_lock(&tree->lock);
+    for (;;) {
+        while (!tree->stack && tree->pending > 0) {
+            pthread_cond_wait(&tree->ready, &tree->lock);
+        }
+        if (!tree->stack) {
+            break;
+        }
+        CopyJob *job = tree->stack;
+        tree->stack = job->next;
+        pthread_mutex_unlock(&tree->lock);
+
+        if (job->src && job->dst) {
+            copy_entry(tree, job->src, job->dst);
+        }
+        free(job->src);
+        free(job->dst);
+        free(job);
+
+        pthread_mutex_lock(&tree->lock);
+        if (--tree->pending == 0) {
+            pthread_cond_broadcast(&tree->ready);
+        }
+    }
+    pthread_mutex_unlock(&tree->lock);
+    return NULL;
+}
+
+// Longest path first, so every directory is fixed before its parent
+static int copy_dir_compare(const void *a, const void *b) {
+    size_t la = strlen(((const CopyDir *)a)->path);
+    size_t lb = strlen(((const CopyDir *)b)->path);
+    return la < lb ? 1 : la > lb ? -1 : 0;
+}
+
+// Whether dst lies below the directory src, compared by resolved paths
+static bool copy_inside(const char *src, const char *dst) {
+    char *real_src = realpath(src, NULL);
+    if (!real_src) {
+        return false;
+    }
+
+    // dst usually does not exist yet: resolve its parent instead
+    char *real_dst = realpath(dst, NULL);
+    if (!real_dst) {
+        char *parent = strdup(dst);
+        size_t parent_len = parent ? strlen(parent) : 0;
+        while (parent_len > 1 && parent[parent_len - 1] == '/') {
+            parent[--parent_len] = '\0';
+        }
+        char *slash = parent ? strrchr(parent, '/') : NULL;
+        char *base = copy_basename(dst);
+        char *real_parent = NULL;
+        if (parent && base) {
+            if (slash) {
+                slash[slash == parent] = '\0';
+            }
+            real_parent = realpath(slash ? parent : ".", NULL);
+        }
+        if (real_parent) {
+            real_dst = copy_join(real_parent, base);
+        }
+        free(real_parent);
+        free(parent);
+        free(base);
+    }
+
+    size_t len = strlen(real_src);
+    bool inside = real_dst && strncmp(real_dst, real_src, len) == 0 &&
+                  (real_dst[len] == '/' || (len == 1 && real_src[0] == '/'));
+    free(real_src);
+    free(real_dst);
+    return inside;
+}
+
+// Copy one top-level operand, recursively on the worker pool
+static int copy_path(const CopyOptions *opts, const char *prog, const char *src, const char *dst) {
+    CopyTree tree;
+    memset(&tree, 0, sizeof(tree));
+    tree.opts = opts;
+    tree.prog = prog;
+    tree.umask = umask(0);
+    umask(tree.umask);
+    pthread_mutex_init(&tree.lock, NULL);
+    pthread_cond_init(&tree.ready, NULL);
+
+    struct stat src_st, dst_st;
+    if (stat(src, &src_st) == 0 && stat(dst, &dst_st) == 0 &&
+        src_st.st_dev == dst_st.st_dev && src_st.st_ino == dst_st.st_ino) {
+        copy_error(&tree, "'%s' and '%s' are the same file", src, dst);
+    } else if (opts->recursive && copy_inside(src, dst)) {
+        copy_error(&tree, "cannot copy a directory, '%s', into itself, '%s'", src, dst);
+    } else if (!opts->recursive) {
+        copy_entry(&tree, src, dst);
+    } else {
+        CopyJob *job = (CopyJob *)malloc(sizeof(CopyJob));
+        if (job) {
+            job->src = strdup(src);
+            job->dst = strdup(dst);
+            job->next = NULL;
+            copy_push(&tree, job, job, 1);
+        }
+
+        // The calling thread is one of the workers
+        int extra = opts->jobs > 1 ? opts->jobs - 1 : 0;
+        pthread_t *threads = (pthread_t *)calloc((size_t)extra + 1, sizeof(pthread_t));
+        int started = 0;
+        for (int i = 0; threads && i < extra; i++) {
+            if (pthread_create(&threads[started], NULL, copy_worker, &tree) == 0) {
+                started++;
+            }
+        }
+        copy_worker(&tree);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    qsort(tree.dirs, (size_t)tree.dir_count, sizeof(CopyDir), copy_dir_compare);
+    for (int i = 0; i < tree.dir_count; i++) {
+        CopyDir *dir = &tree.dirs[i];
+        if (chmod(dir->path, dir->mode) != 0) {
+            copy_error(&tree, "failed to set permissions for '%s': %s", dir->path, strerror(errno));
+        }
+        if (opts->preserve) {
+            utimensat(AT_FDCWD, dir->path, dir->times, 0);
+        }
+        free(dir->path);
+    }
+    free(tree.dirs);
+
+    pthread_mutex_destroy(&tree.lock);
+    pthread_cond_destroy(&tree.ready);
+    return tree.errors ? 1 : 0;
+}
+
+// Destination of each operand: inside dest when it is a directory
+static char *copy_target(const char *prog, const char *src, const char *dest, int count) {
+    struct stat st;
+    if (stat(dest, &st) == 0 && S_ISDIR(st.st_mode)) {
+        char *base = copy_basename(src);
+        char *target = base ? copy_join(dest, base) : NULL;
+        free(base);
+        return target;
+    }
+    if (count > 1) {
+        printf(COLOR_RED "%s: target '%s' is not a directory\n" COLOR_RESET, prog, dest);
+        return NULL;
+    }
+    return strdup(dest);
+}
+
+int copy_run(const CopyOptions *opts, char **sources, int count, const char *dest) {
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        char *target = copy_target("cp", sources[i], dest, count);
+        if (!target) {
+            return 1;
+        }
+        status |= copy_path(opts, "cp", sources[i], target);
+        free(target);
+    }
+    return status;
+}
+
+// Remove name under dirfd and everything below it
+static int move_remove(int dirfd, const char *name) {
+    if (unlinkat(dirfd, name, 0) == 0) {
+        return 0;
+    }
+    if (errno != EISDIR && errno != EPERM) {
+        return -1;
+    }
+
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' ||
+            (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (move_remove(fd, entry->d_name) != 0) {
+            rc = -1;
+        }
+    }
+    closedir(dir);
+    return rc == 0 ? unlinkat(dirfd, name, AT_REMOVEDIR) : -1;
+}
+
+int move_run(const CopyOptions *opts, char **sources, int count, const char *dest) {
+    CopyOptions copy = *opts;
+    copy.recursive = true;
+    copy.preserve = true;
+    copy.verbose = false;
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        const char *src = sources[i];
+        char *target = copy_target("mv", src, dest, count);
+        if (!target) {
+            return 1;
+        }
+
+        struct stat st;
+        if (opts->no_clobber && lstat(target, &st) == 0) {
+            free(target);
+            continue;
+        }
+
+        bool moved = false;
+        if (rename(src, target) == 0) {
+            moved = true;
+        } else if (errno != EXDEV) {
+            printf(COLOR_RED "mv: cannot move '%s' to '%s': %s\n" COLOR_RESET, src, target, strerror(errno));
+        } else if (copy_path(&copy, "mv", src, target) != 0) {
+            // The source stays when the copy is incomplete
+        } else if (move_remove(AT_FDCWD, src) != 0) {
+            printf(COLOR_RED "mv: cannot remove '%s': %s\n" COLOR_RESET, src, strerror(errno));
+        } else {
+            moved = true;
+        }
+        if (moved && opts->verbose) {
+            printf("renamed '%s' -> '%s'\n", src, target);
+        }
+        status |= moved ? 0 : 1;
+        free(target);
+    }
+    return status;
+}
@@ -6,16 +6,483 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// Global environment variables
-static EnvVar env_vars[ENV_MAX_VARS];
+// Smallest sizes the tables grow from
+#define ENV_MIN_VARS 64
+#define ENV_MIN_INDEX 128
+#define ENV_CHUNK_SIZE (64 * 1024)
+#define ENV_SCOPE_MIN_VARS 8
+#define ENV_SCOPE_CHUNK_SIZE 1024
+
+// Binary snapshot: header, entries, the hash index, then the packed
+// NAME=VALUE records. Native byte order; the version also pins env_hash.
+#define ENV_SNAPSHOT_MAGIC "CSHENV\0"
+#define ENV_SNAPSHOT_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             // Entries
+    uint32_t index_size;        // Index slots, a power of two or 0
+    uint32_t reserved;
+    uint64_t strings_offset;    // File offset of the records
+    uint64_t strings_size;
+} EnvSnapshotHeader;
+
+typedef struct {
+    uint32_t offset;            // Record offset within the strings
+    uint32_t name_len;
+    uint32_t value_len;
+    uint32_t hash;
+} EnvSnapshotEntry;
+
+// Arena chunk holding "NAME=VALUE" records
+typedef struct EnvChunk {
+    struct EnvChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} EnvChunk;
+
+// Variables in insertion order; unset moves the last one into the gap
+static EnvVar *env_vars = NULL;
 static int env_count = 0;
+static int env_capacity = 0;
+
+// Open-addressing index with linear probing. A slot holds an index into
+// env_vars plus one, 0 marks an empty slot. Size is a power of two.
+static uint32_t *env_index = NULL;
+static uint32_t env_index_size = 0;
+
+// One layer of overrides. Its tables are allocated by the first override,
+// and records it replaces stay in its chunks until it is popped.
+typedef struct {
+    EnvScopeKind kind;
+    EnvVar *vars;               // A record with no '=' hides the name
+    int count;
+    int capacity;
+    uint32_t *index;
+    uint32_t index_size;
+    EnvChunk *chunks;
+} EnvScope;
+
+static EnvScope env_scopes[ENV_MAX_SCOPES];
+static int env_scope_count = 0;
+static int env_scope_overrides = 0;     // Across all scopes; 0 means the base is the view
+
+// Record storage; replaced and removed records are garbage until the
+// next compaction
+static EnvChunk *env_chunks = NULL;
+static size_t env_arena_live = 0;
+static size_t env_arena_garbage = 0;
+
+// Mapped snapshot whose records are used in place until changed
+static char *env_snapshot = NULL;
+static size_t env_snapshot_size = 0;
+
+// Bumped on every change; the envp snapshot is rebuilt only when it moves.
+// The base generation only moves when the variables under the scopes do.
+static unsigned long env_generation = 1;
+static unsigned long env_base_generation = 1;
+static char **envp_cache = NULL;
+static unsigned long envp_cache_generation = 0;
+static char **envp_base_cache = NULL;
+static unsigned long envp_base_cache_generation = 0;
+
+// FNV-1a over the name
+static uint32_t env_hash(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Slot for name in an index over vars, or the empty slot where it would go
+static uint32_t env_probe(const EnvVar *vars, const uint32_t *index, uint32_t size,
+                          const char *name, size_t len, uint32_t hash) {
+    uint32_t mask = size - 1;
+    uint32_t slot = hash & mask;
+    while (index[slot]) {
+        const EnvVar *var = &vars[index[slot] - 1];
+        if (var->hash == hash && var->name_len == len && memcmp(var->record, name, len) == 0) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Index slot for name, or the empty slot where it would go
+static uint32_t env_slot(const char *name, size_t len, uint32_t hash) {
+    return env_probe(env_vars, env_index, env_index_size, name, len, hash);
+}
+
+// Position of name in env_vars, or -1
+static int env_find(const char *name, size_t len, uint32_t hash) {
+    if (env_count == 0) {
+        return -1;
+    }
+    uint32_t slot = env_slot(name, len, hash);
+    return env_index[slot] ? (int)env_index[slot] - 1 : -1;
+}
+
+// Index of size slots over count vars
+static uint32_t *env_index_build(const EnvVar *vars, int count, uint32_t size) {
+    uint32_t *index = (uint32_t *)calloc(size, sizeof(uint32_t));
+    if (!index) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        uint32_t slot = vars[i].hash & (size - 1);
+        while (index[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        index[slot] = (uint32_t)i + 1;
+    }
+    return index;
+}
+
+// Rebuild the index at a new size
+static int env_rehash(uint32_t size) {
+    uint32_t *index = env_index_build(env_vars, env_count, size);
+    if (!index) {
+        return -1;
+    }
+    free(env_index);
+    env_index = index;
+    env_index_size = size;
+    return 0;
+}
+
+// Make room for count variables, keeping the index at most half full
+static int env_reserve(int count) {
+    if (count > env_capacity) {
+        int capacity = env_capacity ? env_capacity : ENV_MIN_VARS;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        EnvVar *vars = (EnvVar *)realloc(env_vars, (size_t)capacity * sizeof(EnvVar));
+        if (!vars) {
+            return -1;
+        }
+        env_vars = vars;
+        env_capacity = capacity;
+    }
+    
+    uint32_t size = env_index_size ? env_index_size : ENV_MIN_INDEX;
+    while ((uint64_t)count * 2 > size) {
+        size *= 2;
+    }
+    if (size != env_index_size) {
+        return env_rehash(size);
+    }
+    return 0;
+}
+
+// Bump-allocate from the arena
+static char *env_arena_alloc(size_t size) {
+    EnvChunk *chunk = env_chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > ENV_CHUNK_SIZE ? size : ENV_CHUNK_SIZE;
+        chunk = (EnvChunk *)malloc(sizeof(EnvChunk) + chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = env_chunks;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        env_chunks = chunk;
+    }
+    
+    char *p = chunk->data + chunk->used;
+    chunk->used += size;
+    env_arena_live += size;
+    return p;
+}
+
+// Make sure the next size bytes of records land in a single chunk
+static int env_arena_reserve(size_t size) {
+    if (env_chunks && env_chunks->size - env_chunks->used >= size) {
+        return 0;
+    }
+    EnvChunk *chunk = (EnvChunk *)malloc(sizeof(EnvChunk) + size);
+    if (!chunk) {
+        return -1;
+    }
+    chunk->next = env_chunks;
+    chunk->used = 0;
+    chunk->size = size;
+    env_chunks = chunk;
+    return 0;
+}
+
+static void env_arena_free_all(void) {
+    while (env_chunks) {
+        EnvChunk *next = env_chunks->next;
+        free(env_chunks);
+        env_chunks = next;
+    }
+    env_arena_live = 0;
+    env_arena_garbage = 0;
+}
+
+// Size of a variable's record, including the '=' and the NUL
+static size_t env_record_size(const EnvVar *var) {
+    return var->name_len + var->value_len + 2;
+}
+
+// Records still in the mapped snapshot are not arena garbage when dropped
+static void env_record_drop(const EnvVar *var) {
+    if (!(env_snapshot && var->record >= env_snapshot &&
+          var->record < env_snapshot + env_snapshot_size)) {
+        env_arena_garbage += env_record_size(var);
+    }
+}
+
+static void env_snapshot_unmap(void) {
+    if (env_snapshot) {
+        munmap(env_snapshot, env_snapshot_size);
+        env_snapshot = NULL;
+        env_snapshot_size = 0;
+    }
+}
+
+// Copy every live record into one fresh chunk once garbage dominates
+static void env_arena_compact(void) {
+    if (env_arena_garbage < ENV_CHUNK_SIZE || env_arena_garbage * 2 < env_arena_live) {
+        return;
+    }
+    
+    // Snapshot records come along too, after which the mapping can go
+    size_t live = 0;
+    for (int i = 0; i < env_count; i++) {
+        live += env_record_size(&env_vars[i]);
+    }
+    EnvChunk *chunk = (EnvChunk *)malloc(sizeof(EnvChunk) + live + ENV_CHUNK_SIZE);
+    if (!chunk) {
+        return;
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+    chunk->size = live + ENV_CHUNK_SIZE;
+    
+    for (int i = 0; i < env_count; i++) {
+        size_t size = env_record_size(&env_vars[i]);
+        memcpy(chunk->data + chunk->used, env_vars[i].record, size);
+        env_vars[i].record = chunk->data + chunk->used;
+        chunk->used += size;
+    }
+    
+    env_arena_free_all();
+    env_snapshot_unmap();
+    env_chunks = chunk;
+    env_arena_live = chunk->used;
+}
+
+// The variables under the scopes changed
+static void env_base_changed(void) {
+    env_base_generation++;
+    env_generation++;
+}
+
+// Set a base variable from a name view and a value view
+static int env_base_set_n(const char *name, size_t name_len, const char *value, size_t value_len) {
+    if (name_len == 0 || memchr(name, '=', name_len)) {
+        return -1;
+    }
+    
+    char *record = env_arena_alloc(name_len + value_len + 2);
+    if (!record) {
+        return -1;
+    }
+    memcpy(record, name, name_len);
+    record[name_len] = '=';
+    memcpy(record + name_len + 1, value, value_len);
+    record[name_len + 1 + value_len] = '\0';
+    
+    uint32_t hash = env_hash(name, name_len);
+    int i = env_count > 0 ? (int)env_index[env_slot(name, name_len, hash)] - 1 : -1;
+    if (i >= 0) {
+        // Replace the record; the old one becomes garbage
+        env_record_drop(&env_vars[i]);
+        env_vars[i].record = record;
+        env_vars[i].value_len = (uint32_t)value_len;
+    } else {
+        if (env_reserve(env_count + 1) != 0) {
+            env_arena_garbage += name_len + value_len + 2;
+            return -1;
+        }
+        uint32_t slot = env_slot(name, name_len, hash);
+        EnvVar *var = &env_vars[env_count];
+        var->record = record;
+        var->name_len = (uint32_t)name_len;
+        var->value_len = (uint32_t)value_len;
+        var->hash = hash;
+        env_index[slot] = (uint32_t)++env_count;
+    }
+    
+    env_base_changed();
+    env_arena_compact();
+    return 0;
+}
+
+// Does this override hide its name instead of setting it
+static bool env_var_hidden(const EnvVar *var) {
+    return var->record[var->name_len] != '=';
+}
+
+// A scope's override for name, or NULL
+static EnvVar *env_scope_find(const EnvScope *scope, const char *name, size_t len, uint32_t hash) {
+    if (scope->count == 0) {
+        return NULL;
+    }
+    uint32_t slot = env_probe(scope->vars, scope->index, scope->index_size, name, len, hash);
+    return scope->index[slot] ? &scope->vars[scope->index[slot] - 1] : NULL;
+}
+
+// Innermost binding of name: an override, possibly hidden, or a base variable
+static const EnvVar *env_resolve(const char *name, size_t len, uint32_t hash) {
+    for (int d = env_scope_count - 1; d >= 0 && env_scope_overrides > 0; d--) {
+        const EnvVar *var = env_scope_find(&env_scopes[d], name, len, hash);
+        if (var) {
+            return var;
+        }
+    }
+    int i = env_find(name, len, hash);
+    return i >= 0 ? &env_vars[i] : NULL;
+}
+
+// Visible variable named by a view, or NULL
+static const EnvVar *env_lookup_n(const char *name, size_t len) {
+    const EnvVar *var = env_resolve(name, len, env_hash(name, len));
+    return var && !env_var_hidden(var) ? var : NULL;
+}
+
+// Scope an assignment to name lands in, or -1 for the base: the innermost
+// scope that already binds it, else the innermost command or subshell
+// scope. Function scopes only take their locals.
+static int env_scope_target(const char *name, size_t len, uint32_t hash) {
+    for (int d = env_scope_count - 1; d >= 0; d--) {
+        if (env_scopes[d].kind != ENV_SCOPE_FUNCTION ||
+            env_scope_find(&env_scopes[d], name, len, hash)) {
+            return d;
+        }
+    }
+    return -1;
+}
+
+// Bind name in a scope; a NULL value hides it
+static int env_scope_put(EnvScope *scope, const char *name, size_t len, uint32_t hash,
+                         const char *value, size_t value_len) {
+    size_t size = value ? len + value_len + 2 : len + 1;
+    EnvChunk *chunk = scope->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > ENV_SCOPE_CHUNK_SIZE ? size : ENV_SCOPE_CHUNK_SIZE;
+        chunk = (EnvChunk *)malloc(sizeof(EnvChunk) + chunk_size);
+        if (!chunk) {
+            return -1;
+        }
+        chunk->next = scope->chunks;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        scope->chunks = chunk;
+    }
+    char *record = chunk->data + chunk->used;
+    
+    EnvVar *var = env_scope_find(scope, name, len, hash);
+    if (!var) {
+        if (scope->count == scope->capacity) {
+            int capacity = scope->capacity ? scope->capacity * 2 : ENV_SCOPE_MIN_VARS;
+            EnvVar *vars = (EnvVar *)realloc(scope->vars, (size_t)capacity * sizeof(EnvVar));
+            if (!vars) {
+                return -1;
+            }
+            scope->vars = vars;
+            scope->capacity = capacity;
+        }
+        if ((uint32_t)(scope->count + 1) * 2 > scope->index_size) {
+            uint32_t index_size = scope->index_size ? scope->index_size * 2 : ENV_SCOPE_MIN_VARS * 2;
+            uint32_t *index = env_index_build(scope->vars, scope->count, index_size);
+            if (!index) {
+                return -1;
+            }
+            free(scope->index);
+            scope->index = index;
+            scope->index_size = index_size;
+        }
+        uint32_t slot = env_probe(scope->vars, scope->index, scope->index_size, name, len, hash);
+        var = &scope->vars[scope->count];
+        var->name_len = (uint32_t)len;
+        var->hash = hash;
+        scope->index[slot] = (uint32_t)++scope->count;
+        env_scope_overrides++;
+    }
+    
+    chunk->used += size;
+    memcpy(record, name, len);
+    if (value) {
+        record[len] = '=';
+        memcpy(record + len + 1, value, value_len);
+        record[len + 1 + value_len] = '\0';
+    } else {
+        record[len] = '\0';
+    }
+    var->record = record;
+    var->value_len = value ? (uint32_t)value_len : 0;
+    env_generation++;
+    return 0;
+}
+
+// Set from a name view and a value view, in whichever scope owns the name
+static int env_set_n(const char *name, size_t name_len, const char *value, size_t value_len) {
+    if (env_scope_count > 0) {
+        if (name_len == 0 || memchr(name, '=', name_len)) {
+            return -1;
+        }
+        uint32_t hash = env_hash(name, name_len);
+        int d = env_scope_target(name, name_len, hash);
+        if (d >= 0) {
+            return env_scope_put(&env_scopes[d], name, name_len, hash, value, value_len);
+        }
+    }
+    return env_base_set_n(name, name_len, value, value_len);
+}
+
+// Import a NAME=VALUE vector in one pass: count and size first so the
+// tables and the arena grow once, then split each entry without writing
+// to it. Returns the number imported.
+static int env_import(char **vector) {
+    int count = 0;
+    size_t bytes = 0;
+    for (char **entry = vector; *entry; entry++) {
+        bytes += strlen(*entry) + 1;
+        count++;
+    }
+    
+    env_reserve(env_count + count);
+    env_arena_reserve(bytes);
+    
+    int imported = 0;
+    for (char **entry = vector; *entry; entry++) {
+        const char *eq = strchr(*entry, '=');
+        if (eq && env_set_n(*entry, (size_t)(eq - *entry), eq + 1, strlen(eq + 1)) == 0) {
+            imported++;
+        }
+    }
+    return imported;
+}
 
 // Initialize environment variables
 int env_init(void) {
-    // Clear environment array
-    memset(env_vars, 0, sizeof(env_vars));
-    env_count = 0;
+    // Start from an empty store
+    env_cleanup();
+    env_base_changed();
     
     // Set basic environment variables
     struct passwd *pw = getpwuid(getuid());
@@ -35,23 +502,38 @@ int env_init(void) {
     // Load system environment variables
     extern char **environ;
     if (environ) {
-        for (char **env = environ; *env != NULL; env++) {
-            char *equals = strchr(*env, '=');
-            if (equals) {
-                *equals = '\0';
-                env_set(*env, equals + 1);
-                *equals = '=';
-            }
-        }
+        env_import(environ);
     }
     
     return 0;
 }
 
+// Drop the base variables, leaving any scopes in place
+static void env_base_free(void) {
+    free(env_vars);
+    env_vars = NULL;
+    env_count = 0;
+    env_capacity = 0;
+    free(env_index);
+    env_index = NULL;
+    env_index_size = 0;
+    env_arena_free_all();
+    env_snapshot_unmap();
+    env_base_changed();
+    free(envp_cache);
+    envp_cache = NULL;
+    envp_cache_generation = 0;
+    free(envp_base_cache);
+    envp_base_cache = NULL;
+    envp_base_cache_generation = 0;
+}
+
 // Clean up environment variables
 void env_cleanup(void) {
-    // Nothing to do for this simple implementation
-    env_count = 0;
+    while (env_scope_count > 0) {
+        env_scope_pop();
+    }
+    env_base_free();
 }
 
 // Set an environment variable
@@ -60,73 +542,192 @@ int env_set(const char *name, const char *value) {
         return -1;
     }
     
-    // Check name length
-    if (strlen(name) >= ENV_MAX_NAME) {
+    return env_set_n(name, strlen(name), value, strlen(value));
+}
+
+// Get an environment variable
+char *env_get(const char *name) {
+    if (!name) {
+        return NULL;
+    }
+    
+    const EnvVar *var = env_lookup_n(name, strlen(name));
+    return var ? var->record + var->name_len + 1 : NULL;
+}
+
+// Does a variable exist
+bool env_exists(const char *name) {
+    return name && env_lookup_n(name, strlen(name)) != NULL;
+}
+
+// Remove a base variable
+static int env_base_unset(const char *name, size_t len) {
+    if (env_count == 0) {
         return -1;
     }
     
-    // Check value length
-    if (strlen(value) >= ENV_MAX_VALUE) {
+    uint32_t mask = env_index_size - 1;
+    uint32_t slot = env_slot(name, len, env_hash(name, len));
+    if (!env_index[slot]) {
         return -1;
     }
+    int i = (int)env_index[slot] - 1;
+    env_record_drop(&env_vars[i]);
     
-    // Check if variable already exists
-    for (int i = 0; i < env_count; i++) {
-        if (strcmp(env_vars[i].name, name) == 0) {
-            // Update existing variable
-            strncpy(env_vars[i].value, value, ENV_MAX_VALUE - 1);
-            return 0;
+    // Backward-shift deletion: pull later entries of the probe run into
+    // the hole unless that would move them before their home slot
+    uint32_t hole = slot;
+    uint32_t next = slot;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (!env_index[next]) {
+            break;
+        }
+        uint32_t home = env_vars[env_index[next] - 1].hash & mask;
+        bool stays = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!stays) {
+            env_index[hole] = env_index[next];
+            hole = next;
         }
     }
+    env_index[hole] = 0;
     
-    // Check if we have room for a new variable
-    if (env_count >= ENV_MAX_VARS) {
-        return -1;
+    // Fill the gap in env_vars with the last variable
+    int last = env_count - 1;
+    if (i != last) {
+        const EnvVar *moved = &env_vars[last];
+        uint32_t moved_slot = moved->hash & mask;
+        while (env_index[moved_slot] != (uint32_t)last + 1) {
+            moved_slot = (moved_slot + 1) & mask;
+        }
+        env_vars[i] = *moved;
+        env_index[moved_slot] = (uint32_t)i + 1;
     }
-    
-    // Add new variable
-    strncpy(env_vars[env_count].name, name, ENV_MAX_NAME - 1);
-    strncpy(env_vars[env_count].value, value, ENV_MAX_VALUE - 1);
-    env_count++;
-    
+    env_count--;
+    env_base_changed();
+    env_arena_compact();
     return 0;
 }
 
-// Get an environment variable
-char *env_get(const char *name) {
+// Unset an environment variable; inside a scope that owns it the name is
+// only hidden until the scope is popped
+int env_unset(const char *name) {
     if (!name) {
-        return NULL;
+        return -1;
     }
     
-    // Look for variable
+    size_t len = strlen(name);
+    if (env_scope_count > 0) {
+        uint32_t hash = env_hash(name, len);
+        int d = env_scope_target(name, len, hash);
+        if (d >= 0) {
+            const EnvVar *var = env_resolve(name, len, hash);
+            if (!var || env_var_hidden(var)) {
+                return -1;
+            }
+            return env_scope_put(&env_scopes[d], name, len, hash, NULL, 0);
+        }
+    }
+    return env_base_unset(name, len);
+}
+
+int env_set_global(const char *name, const char *value) {
+    if (!name || !value) {
+        return -1;
+    }
+    return env_base_set_n(name, strlen(name), value, strlen(value));
+}
+
+int env_unset_global(const char *name) {
+    return name ? env_base_unset(name, strlen(name)) : -1;
+}
+
+// Fill out with the visible records: the base in order with overrides
+// applied in place, then names only scopes define. out needs room for
+// env_count + env_scope_overrides entries. Returns the number filled.
+static int env_visible(char **out) {
     for (int i = 0; i < env_count; i++) {
-        if (strcmp(env_vars[i].name, name) == 0) {
-            return env_vars[i].value;
+        out[i] = env_vars[i].record;
+    }
+    int n = env_count;
+    
+    for (int d = env_scope_count - 1; d >= 0 && env_scope_overrides > 0; d--) {
+        const EnvScope *scope = &env_scopes[d];
+        for (int k = 0; k < scope->count; k++) {
+            const EnvVar *var = &scope->vars[k];
+            if (env_resolve(var->record, var->name_len, var->hash) != var) {
+                continue;   // An inner scope rebinds it
+            }
+            int i = env_find(var->record, var->name_len, var->hash);
+            if (i >= 0) {
+                out[i] = env_var_hidden(var) ? NULL : var->record;
+            } else if (!env_var_hidden(var)) {
+                out[n++] = var->record;
+            }
         }
     }
     
-    return NULL;
+    // Close the gaps hidden variables left
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (out[i]) {
+            out[kept++] = out[i];
+        }
+    }
+    return kept;
 }
 
-// Unset an environment variable
-int env_unset(const char *name) {
+// Open a scope
+int env_scope_push(EnvScopeKind kind) {
+    if (env_scope_count >= ENV_MAX_SCOPES) {
+        return -1;
+    }
+    EnvScope *scope = &env_scopes[env_scope_count++];
+    memset(scope, 0, sizeof(*scope));
+    scope->kind = kind;
+    return 0;
+}
+
+// Drop the innermost scope and everything it bound
+void env_scope_pop(void) {
+    if (env_scope_count == 0) {
+        return;
+    }
+    EnvScope *scope = &env_scopes[--env_scope_count];
+    if (scope->count > 0) {
+        env_scope_overrides -= scope->count;
+        env_generation++;
+    }
+    free(scope->vars);
+    free(scope->index);
+    while (scope->chunks) {
+        EnvChunk *next = scope->chunks->next;
+        free(scope->chunks);
+        scope->chunks = next;
+    }
+    memset(scope, 0, sizeof(*scope));
+}
+
+int env_scope_depth(void) {
+    return env_scope_count;
+}
+
+// Bind name in the innermost function scope
+int env_set_local(const char *name, const char *value) {
     if (!name) {
         return -1;
     }
+    size_t len = strlen(name);
+    if (len == 0 || memchr(name, '=', len)) {
+        return -1;
+    }
     
-    // Look for variable
-    for (int i = 0; i < env_count; i++) {
-        if (strcmp(env_vars[i].name, name) == 0) {
-            // Move all variables after this one up
-            for (int j = i; j < env_count - 1; j++) {
-                strncpy(env_vars[j].name, env_vars[j + 1].name, ENV_MAX_NAME);
-                strncpy(env_vars[j].value, env_vars[j + 1].value, ENV_MAX_VALUE);
-            }
-            env_count--;
-            return 0;
+    for (int d = env_scope_count - 1; d >= 0; d--) {
+        if (env_scopes[d].kind == ENV_SCOPE_FUNCTION) {
+            return env_scope_put(&env_scopes[d], name, len, env_hash(name, len),
+                                 value, value ? strlen(value) : 0);
         }
     }
-    
     return -1;
 }
 
@@ -136,20 +737,22 @@ char **env_list(int *count) {
         return NULL;
     }
     
-    *count = env_count;
-    if (*count == 0) {
+    // Allocate array for variable pointers
+    char **list = (char **)malloc((size_t)(env_count + env_scope_overrides + 1) * sizeof(char *));
+    if (!list) {
+        *count = 0;
         return NULL;
     }
     
-    // Allocate array for variable pointers
-    char **list = (char **)malloc(env_count * sizeof(char *));
-    if (!list) {
+    *count = env_visible(list);
+    if (*count == 0) {
+        free(list);
         return NULL;
     }
     
-    // Allocate strings for each variable
-    for (int i = 0; i < env_count; i++) {
-        list[i] = (char *)malloc(ENV_MAX_NAME + ENV_MAX_VALUE + 2);
+    // Copy each record, already in NAME=VALUE form
+    for (int i = 0; i < *count; i++) {
+        list[i] = strdup(list[i]);
         if (!list[i]) {
             // Free allocations so far
             for (int j = 0; j < i; j++) {
@@ -158,95 +761,90 @@ char **env_list(int *count) {
             free(list);
             return NULL;
         }
-        
-        // Format variable as NAME=VALUE
-        snprintf(list[i], ENV_MAX_NAME + ENV_MAX_VALUE + 2, 
-                 "%s=%s", env_vars[i].name, env_vars[i].value);
     }
     
     return list;
 }
 
+// Append n bytes to a growing expansion buffer
+static int expand_append(char **buf, size_t *len, size_t *cap, const char *s, size_t n) {
+    if (*len + n + 1 > *cap) {
+        size_t new_cap = *cap * 2;
+        while (new_cap < *len + n + 1) {
+            new_cap *= 2;
+        }
+        char *grown = (char *)realloc(*buf, new_cap);
+        if (!grown) {
+            return -1;
+        }
+        *buf = grown;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    return 0;
+}
+
 // Expand environment variables in a string
 char *env_expand(const char *str) {
     if (!str) {
         return NULL;
     }
     
-    // Allocate buffer for result (overestimate size)
-    char *result = (char *)malloc(strlen(str) * 2);
+    // Grown as values are substituted
+    size_t cap = strlen(str) + 16;
+    size_t len = 0;
+    char *result = (char *)malloc(cap);
     if (!result) {
         return NULL;
     }
     
     const char *p = str;
-    char *r = result;
+    int rc = 0;
     
-    while (*p) {
+    while (*p && rc == 0) {
+        const char *name = NULL;
+        size_t name_len = 0;
+        
         if (*p == '$' && *(p+1) == '{') {
             // Found ${VAR} format
-            p += 2;
-            const char *end = strchr(p, '}');
+            const char *end = strchr(p + 2, '}');
             if (!end) {
                 // No closing brace, copy as-is
-                *r++ = '$';
-                *r++ = '{';
+                rc = expand_append(&result, &len, &cap, p, 2);
+                p += 2;
                 continue;
             }
-            
-            // Extract variable name
-            int name_len = end - p;
-            char name[ENV_MAX_NAME];
-            if (name_len >= ENV_MAX_NAME) {
-                name_len = ENV_MAX_NAME - 1;
-            }
-            strncpy(name, p, name_len);
-            name[name_len] = '\0';
-            
-            // Get variable value
-            char *value = env_get(name);
-            if (value) {
-                // Copy value to result
-                strcpy(r, value);
-                r += strlen(value);
-            }
-            
-            // Skip past variable
+            name = p + 2;
+            name_len = (size_t)(end - name);
             p = end + 1;
         } else if (*p == '$' && (isalpha(*(p+1)) || *(p+1) == '_')) {
             // Found $VAR format
-            p++;
-            const char *start = p;
-            
-            // Find end of variable name
+            name = ++p;
             while (isalnum(*p) || *p == '_') {
                 p++;
             }
-            
-            // Extract variable name
-            int name_len = p - start;
-            char name[ENV_MAX_NAME];
-            if (name_len >= ENV_MAX_NAME) {
-                name_len = ENV_MAX_NAME - 1;
-            }
-            strncpy(name, start, name_len);
-            name[name_len] = '\0';
-            
-            // Get variable value
-            char *value = env_get(name);
-            if (value) {
-                // Copy value to result
-                strcpy(r, value);
-                r += strlen(value);
-            }
+            name_len = (size_t)(p - name);
         } else {
             // Copy character as-is
-            *r++ = *p++;
+            rc = expand_append(&result, &len, &cap, p++, 1);
+            continue;
+        }
+        
+        // Substitute the value, if any
+        const EnvVar *var = env_lookup_n(name, name_len);
+        if (var) {
+            rc = expand_append(&result, &len, &cap, var->record + var->name_len + 1, var->value_len);
         }
     }
     
+    if (rc != 0) {
+        free(result);
+        return NULL;
+    }
+    
     // Null-terminate result
-    *r = '\0';
+    result[len] = '\0';
     
     return result;
 }
@@ -257,95 +855,220 @@ int env_export(const char *name) {
         return -1;
     }
     
-    // Find variable
-    for (int i = 0; i < env_count; i++) {
-        if (strcmp(env_vars[i].name, name) == 0) {
-            // Export to host environment
-            setenv(name, env_vars[i].value, 1);
-            return 0;
-        }
+    // Find variable and export it to the host environment
+    char *value = env_get(name);
+    if (!value) {
+        return -1;
     }
-    
-    return -1;
+    setenv(name, value, 1);
+    return 0;
 }
 
 // Import environment variables from host system
 int env_import_from_host(void) {
     extern char **environ;
-    int imported = 0;
-    
-    // Loop through host environment
-    for (char **env = environ; *env; env++) {
-        // Split into name and value
-        char *eq = strchr(*env, '=');
-        if (!eq) {
-            continue;
-        }
-        
-        // Extract name
-        int name_len = eq - *env;
-        if (name_len >= ENV_MAX_NAME) {
-            continue;
-        }
-        
-        char name[ENV_MAX_NAME];
-        strncpy(name, *env, name_len);
-        name[name_len] = '\0';
-        
-        // Extract value
-        const char *value = eq + 1;
-        
-        // Set in our environment
-        if (env_set(name, value) == 0) {
-            imported++;
+    return environ ? env_import(environ) : 0;
+}
+
+// Write all of a buffer
+static int env_write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
+        p += n;
+        len -= (size_t)n;
     }
-    
-    return imported;
+    return 0;
 }
 
-// Save environment to a file
+// Save environment to a binary snapshot
 int env_save_to_file(const char *path) {
     if (!path) {
         return -1;
     }
     
-    // Open file for writing
-    FILE *file = fopen(path, "w");
-    if (!file) {
+    // Lay the records out back to back
+    size_t strings_size = 0;
+    for (int i = 0; i < env_count; i++) {
+        strings_size += env_record_size(&env_vars[i]);
+    }
+    if (strings_size > UINT32_MAX) {
         return -1;
     }
     
-    // Write variables to file
+    // The index goes out as is, its entry numbers match the entry table
+    EnvSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ENV_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = ENV_SNAPSHOT_VERSION;
+    header.count = (uint32_t)env_count;
+    header.index_size = env_count > 0 ? env_index_size : 0;
+    header.strings_offset = sizeof(header) + (uint64_t)env_count * sizeof(EnvSnapshotEntry) +
+                            (uint64_t)header.index_size * sizeof(uint32_t);
+    header.strings_size = strings_size;
+    
+    // Build the whole file in memory and write it at once
+    size_t file_size = (size_t)header.strings_offset + strings_size;
+    char *image = (char *)malloc(file_size);
+    if (!image) {
+        return -1;
+    }
+    memcpy(image, &header, sizeof(header));
+    EnvSnapshotEntry *entries = (EnvSnapshotEntry *)(image + sizeof(header));
+    memcpy(entries + env_count, env_index, (size_t)header.index_size * sizeof(uint32_t));
+    char *strings = image + header.strings_offset;
+    uint32_t offset = 0;
     for (int i = 0; i < env_count; i++) {
-        fprintf(file, "%s=%s\n", env_vars[i].name, env_vars[i].value);
+        size_t size = env_record_size(&env_vars[i]);
+        entries[i].offset = offset;
+        entries[i].name_len = env_vars[i].name_len;
+        entries[i].value_len = env_vars[i].value_len;
+        entries[i].hash = env_vars[i].hash;
+        memcpy(strings + offset, env_vars[i].record, size);
+        offset += (uint32_t)size;
     }
     
-    fclose(file);
-    return env_count;
+    // Write a temporary file and rename it so readers never see half a snapshot
+    size_t path_len = strlen(path);
+    char *tmp_path = (char *)malloc(path_len + 5);
+    if (!tmp_path) {
+        free(image);
+        return -1;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    
+    int rc = -1;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        rc = env_write_all(fd, image, file_size);
+        if (close(fd) != 0) {
+            rc = -1;
+        }
+        if (rc == 0) {
+            rc = rename(tmp_path, path);
+        }
+        if (rc != 0) {
+            unlink(tmp_path);
+        }
+    }
+    
+    free(tmp_path);
+    free(image);
+    return rc == 0 ? env_count : -1;
 }
 
-// Load environment from a file
-int env_load_from_file(const char *path) {
-    if (!path) {
+// Check a mapped snapshot before anything points into it
+static bool env_snapshot_valid(const char *map, size_t size) {
+    if (size < sizeof(EnvSnapshotHeader)) {
+        return false;
+    }
+    const EnvSnapshotHeader *header = (const EnvSnapshotHeader *)map;
+    if (memcmp(header->magic, ENV_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != ENV_SNAPSHOT_VERSION) {
+        return false;
+    }
+    
+    uint64_t count = header->count;
+    uint64_t index_size = header->index_size;
+    if ((index_size & (index_size - 1)) != 0 || index_size < count * 2 ||
+        header->strings_offset != sizeof(*header) + count * sizeof(EnvSnapshotEntry) +
+                                  index_size * sizeof(uint32_t) ||
+        header->strings_offset + header->strings_size > size) {
+        return false;
+    }
+    
+    const EnvSnapshotEntry *entries = (const EnvSnapshotEntry *)(map + sizeof(*header));
+    const char *strings = map + header->strings_offset;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t end = (uint64_t)entries[i].offset + entries[i].name_len + entries[i].value_len + 2;
+        if (entries[i].name_len == 0 || end > header->strings_size ||
+            strings[entries[i].offset + entries[i].name_len] != '=' || strings[end - 1] != '\0') {
+            return false;
+        }
+    }
+    
+    const uint32_t *index = (const uint32_t *)(entries + count);
+    uint64_t used = 0;
+    for (uint64_t slot = 0; slot < index_size; slot++) {
+        if (index[slot] > count) {
+            return false;
+        }
+        used += index[slot] != 0;
+    }
+    return used == count;
+}
+
+// Restore a binary snapshot: map it and use the records in place. A
+// variable only gets an arena copy when it is changed.
+static int env_load_snapshot(int fd, size_t size) {
+    char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (!env_snapshot_valid(map, size)) {
+        munmap(map, size);
         return -1;
     }
     
-    // Open file for reading
-    FILE *file = fopen(path, "r");
-    if (!file) {
+    const EnvSnapshotHeader *header = (const EnvSnapshotHeader *)map;
+    const EnvSnapshotEntry *entries = (const EnvSnapshotEntry *)(map + sizeof(*header));
+    const uint32_t *index = (const uint32_t *)(entries + header->count);
+    char *strings = map + header->strings_offset;
+    
+    // The snapshot replaces the base variables; scopes stay on top
+    int count = (int)header->count;
+    int capacity = count > ENV_MIN_VARS ? count : ENV_MIN_VARS;
+    uint32_t index_size = header->index_size ? header->index_size : ENV_MIN_INDEX;
+    EnvVar *vars = (EnvVar *)malloc((size_t)capacity * sizeof(EnvVar));
+    uint32_t *new_index = (uint32_t *)calloc(index_size, sizeof(uint32_t));
+    if (!vars || !new_index) {
+        free(vars);
+        free(new_index);
+        munmap(map, size);
         return -1;
     }
     
-    char line[ENV_MAX_NAME + ENV_MAX_VALUE + 2];
+    env_base_free();
+    env_vars = vars;
+    env_capacity = capacity;
+    env_index = new_index;
+    env_index_size = index_size;
+    env_snapshot = map;
+    env_snapshot_size = size;
+    
+    for (int i = 0; i < count; i++) {
+        env_vars[i].record = strings + entries[i].offset;
+        env_vars[i].name_len = entries[i].name_len;
+        env_vars[i].value_len = entries[i].value_len;
+        env_vars[i].hash = entries[i].hash;
+    }
+    if (header->index_size) {
+        memcpy(env_index, index, (size_t)index_size * sizeof(uint32_t));
+    }
+    env_count = count;
+    env_base_changed();
+    return count;
+}
+
+// Merge NAME=VALUE lines from an older text file
+static int env_load_text(FILE *file) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
     int loaded = 0;
     
-    // Read lines from file
-    while (fgets(line, sizeof(line), file)) {
+    // Read lines from file, however long
+    while ((line_len = getline(&line, &line_cap, file)) >= 0) {
         // Remove newline
-        char *nl = strchr(line, '\n');
-        if (nl) {
-            *nl = '\0';
+        if (line_len > 0 && line[line_len - 1] == '\n') {
+            line[--line_len] = '\0';
         }
         
         // Split into name and value
@@ -354,25 +1077,44 @@ int env_load_from_file(const char *path) {
             continue;
         }
         
-        // Extract name
-        int name_len = eq - line;
-        if (name_len >= ENV_MAX_NAME) {
-            continue;
-        }
-        
-        char name[ENV_MAX_NAME];
-        strncpy(name, line, name_len);
-        name[name_len] = '\0';
-        
-        // Extract value
-        const char *value = eq + 1;
-        
         // Set in our environment
-        if (env_set(name, value) == 0) {
+        if (env_set_n(line, (size_t)(eq - line), eq + 1, (size_t)(line + line_len - eq - 1)) == 0) {
             loaded++;
         }
     }
     
+    free(line);
+    return loaded;
+}
+
+// Load environment from a file: a binary snapshot replaces the current
+// variables, a text file of NAME=VALUE lines is merged into them
+int env_load_from_file(const char *path) {
+    if (!path) {
+        return -1;
+    }
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct stat st;
+    char magic[sizeof(((EnvSnapshotHeader *)0)->magic)];
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(EnvSnapshotHeader) &&
+        pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+        memcmp(magic, ENV_SNAPSHOT_MAGIC, sizeof(magic)) == 0) {
+        int loaded = env_load_snapshot(fd, (size_t)st.st_size);
+        close(fd);
+        return loaded;
+    }
+    
+    FILE *file = fdopen(fd, "r");
+    if (!file) {
+        close(fd);
+        return -1;
+    }
+    int loaded = env_load_text(file);
     fclose(file);
     return loaded;
 }
@@ -380,16 +1122,16 @@ int env_load_from_file(const char *path) {
 // Get all environment variables
 char **env_get_all(int *count) {
     // Allocate memory for variable pointers
-    char **env_list = (char **)malloc(sizeof(char *) * (env_count + 1));
+    char **env_list = (char **)malloc(sizeof(char *) * (env_count + env_scope_overrides + 1));
     if (!env_list) {
         *count = 0;
         return NULL;
     }
     
-    // Create formatted strings for each variable
-    for (int i = 0; i < env_count; i++) {
-        size_t len = strlen(env_vars[i].name) + strlen(env_vars[i].value) + 2; // +2 for '=' and '\0'
-        env_list[i] = (char *)malloc(len);
+    // Copy each visible NAME=VALUE record
+    int visible = env_visible(env_list);
+    for (int i = 0; i < visible; i++) {
+        env_list[i] = strdup(env_list[i]);
         if (!env_list[i]) {
             // Free previously allocated memory on error
             for (int j = 0; j < i; j++) {
@@ -399,10 +1141,185 @@ char **env_get_all(int *count) {
             *count = 0;
             return NULL;
         }
-        snprintf(env_list[i], len, "%s=%s", env_vars[i].name, env_vars[i].value);
     }
     
-    *count = env_count;
-    env_list[env_count] = NULL; // NULL terminate the list
+    *count = visible;
+    env_list[visible] = NULL; // NULL terminate the list
     return env_list;
-} 
\ No newline at end of file
+}
+
+// Current environment generation
+unsigned long env_get_generation(void) {
+    return env_generation;
+}
+
+unsigned long env_get_base_generation(void) {
+    return env_base_generation;
+}
+
+// NULL-terminated NAME=VALUE array of the base variables, rebuilt only
+// after a change. The entries point at the arena records, so only the
+// table is built; the result stays valid until the next env_set/env_unset.
+char **env_get_base_envp(void) {
+    if (envp_base_cache && envp_base_cache_generation == env_base_generation) {
+        return envp_base_cache;
+    }
+    
+    char **envp = (char **)malloc((size_t)(env_count + 1) * sizeof(char *));
+    if (!envp) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < env_count; i++) {
+        envp[i] = env_vars[i].record;
+    }
+    envp[env_count] = NULL;
+    
+    free(envp_base_cache);
+    envp_base_cache = envp;
+    envp_base_cache_generation = env_base_generation;
+    return envp_base_cache;
+}
+
+// envp for execve as the innermost scope sees it. Without overrides this
+// is the base table; with them the table is patched, never the records.
+char **env_get_envp(void) {
+    if (env_scope_overrides == 0) {
+        return env_get_base_envp();
+    }
+    if (envp_cache && envp_cache_generation == env_generation) {
+        return envp_cache;
+    }
+    
+    char **envp = (char **)malloc((size_t)(env_count + env_scope_overrides + 1) * sizeof(char *));
+    if (!envp) {
+        return NULL;
+    }
+    envp[env_visible(envp)] = NULL;
+    
+    free(envp_cache);
+    envp_cache = envp;
+    envp_cache_generation = env_generation;
+    return envp_cache;
+}
+
+// Visible overrides of the base: NAME=VALUE records, and bare names for
+// base variables a scope hides. The table is the caller's to free.
+char **env_get_overlay(int *count) {
+    char **overlay = (char **)malloc((size_t)(env_scope_overrides + 1) * sizeof(char *));
+    if (!overlay) {
+        *count = 0;
+        return NULL;
+    }
+    
+    int n = 0;
+    for (int d = env_scope_count - 1; d >= 0 && env_scope_overrides > 0; d--) {
+        const EnvScope *scope = &env_scopes[d];
+        for (int k = 0; k < scope->count; k++) {
+            const EnvVar *var = &scope->vars[k];
+            if (env_resolve(var->record, var->name_len, var->hash) != var) {
+                continue;
+            }
+            if (!env_var_hidden(var) || env_find(var->record, var->name_len, var->hash) >= 0) {
+                overlay[n++] = var->record;
+            }
+        }
+    }
+    overlay[n] = NULL;
+    *count = n;
+    return overlay;
+}
+
+// Mean nanoseconds per operation since start
+static double env_bench_ns(const struct timespec *start, int ops) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+    return ns / ops;
+}
+
+// Time set, get, overwrite, snapshot save/restore, a command scope and
+// unset over count scratch variables
+void env_benchmark(int count, FILE *out) {
+    char name[32];
+    char value[64];
+    struct timespec start;
+    int base = env_count;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "CSHELL_BENCH_%d", i);
+        snprintf(value, sizeof(value), "value-%d", i);
+        env_set(name, value);
+    }
+    double set_ns = env_bench_ns(&start, count);
+    
+    int found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "CSHELL_BENCH_%d", i);
+        found += env_get(name) != NULL;
+    }
+    double get_ns = env_bench_ns(&start, count);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "CSHELL_BENCH_%d", i);
+        env_set(name, "overwritten");
+    }
+    double update_ns = env_bench_ns(&start, count);
+    
+    // Round trip the whole store through a snapshot; the restore holds the
+    // same variables, so the session is unchanged
+    char path[] = "/tmp/cshell-env-XXXXXX";
+    double save_us = -1, load_us = -1;
+    int saved = -1;
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        saved = env_save_to_file(path);
+        if (saved >= 0) {
+            save_us = env_bench_ns(&start, 1000);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (env_load_from_file(path) >= 0) {
+                load_us = env_bench_ns(&start, 1000);
+            }
+        }
+        unlink(path);
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "CSHELL_BENCH_%d", i);
+        found -= env_get(name) == NULL;
+    }
+    double reget_ns = env_bench_ns(&start, count);
+    
+    // VAR=x cmd over the full store: push, override, read, pop
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        env_scope_push(ENV_SCOPE_COMMAND);
+        env_set("CSHELL_BENCH_0", "scoped");
+        found -= env_get("CSHELL_BENCH_0") == NULL;
+        env_scope_pop();
+    }
+    double scope_ns = env_bench_ns(&start, count);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "CSHELL_BENCH_%d", i);
+        env_unset(name);
+    }
+    double unset_ns = env_bench_ns(&start, count);
+    
+    fprintf(out, "%d variables (%d found, %d before and after)\n", count, found, base);
+    fprintf(out, "  set     %8.1f ns/op\n", set_ns);
+    fprintf(out, "  get     %8.1f ns/op\n", get_ns);
+    fprintf(out, "  update  %8.1f ns/op\n", update_ns);
+    fprintf(out, "  save    %8.1f us (%d variables)\n", save_us, saved);
+    fprintf(out, "  restore %8.1f us\n", load_us);
+    fprintf(out, "  get     %8.1f ns/op after restore\n", reget_ns);
+    fprintf(out, "  scope   %8.1f ns/op (push, set, get, pop)\n", scope_ns);
+    fprintf(out, "  unset   %8.1f ns/op\n", unset_ns);
+}
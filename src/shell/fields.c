@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include "../../include/shell/fields.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define FIELDS_BLOCK (1024 * 1024)  // Bytes read at a time
+#define FIELDS_IOV 1024             // Spans gathered for one writev
+
+// A field of the current line
+typedef struct {
+    const char *start;
+    const char *end;
+} FieldSpan;
+
+// State of one fields run
+typedef struct {
+    const FieldsOptions *opts;
+    FieldRange ranges[FIELDS_MAX_RANGES];   // With names resolved for this file
+    const char *separator;
+    size_t separator_len;
+    bool join_delimiters;   // The separator is the input delimiter
+    int max_field;          // Highest field needed, 0 for all
+    FieldSpan *fields;
+    int field_count;
+    int field_capacity;
+    bool header_pending;    // The next line is a file's header
+    bool print_header;
+    int fd;
+    struct iovec iov[FIELDS_IOV];
+    int iov_count;
+    int error;
+} Fields;
+
+static void fields_flush(Fields *f) {
+    struct iovec *iov = f->iov;
+    int count = f->iov_count;
+    while (count > 0 && !f->error) {
+        ssize_t n = writev(f->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            f->error = errno;
+            break;
+        }
+        // Skip what went out, part of an iovec included
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    f->iov_count = 0;
+}
+
+// Queue a span, growing the last one when it ends where this one starts
+static void fields_span(Fields *f, const char *p, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (f->iov_count > 0) {
+        struct iovec *last = &f->iov[f->iov_count - 1];
+        if ((const char *)last->iov_base + last->iov_len == p) {
+            last->iov_len += len;
+            return;
+        }
+    }
+    if (f->iov_count == FIELDS_IOV) {
+        fields_flush(f);
+    }
+    f->iov[f->iov_count].iov_base = (void *)p;
+    f->iov[f->iov_count].iov_len = len;
+    f->iov_count++;
+}
+
+static void fields_add(Fields *f, const char *start, const char *end) {
+    if (f->max_field > 0 && f->field_count >= f->max_field) {
+        f->field_count++;
+        return;
+    }
+    if (f->field_count == f->field_capacity) {
+        int capacity = f->field_capacity ? f->field_capacity * 2 : 64;
+        FieldSpan *fields = (FieldSpan *)realloc(f->fields, (size_t)capacity * sizeof(FieldSpan));
+        if (!fields) {
+            f->error = ENOMEM;
+            return;
+        }
+        f->fields = fields;
+        f->field_capacity = capacity;
+    }
+    f->fields[f->field_count].start = start;
+    f->fields[f->field_count].end = end;
+    f->field_count++;
+}
+
+// Turn the -f names into field numbers from a header line
+static bool fields_resolve(Fields *f) {
+    for (int r = 0; r < f->opts->range_count; r++) {
+        const FieldRange *range = &f->opts->ranges[r];
+        f->ranges[r] = *range;
+        if (!range->name) {
+            continue;
+        }
+        size_t len = strlen(range->name);
+        int stored = f->field_count < f->field_capacity ? f->field_count : f->field_capacity;
+        int found = 0;
+        for (int k = 0; k < stored && !found; k++) {
+            if ((size_t)(f->fields[k].end - f->fields[k].start) == len &&
+                memcmp(f->fields[k].start, range->name, len) == 0) {
+                found = k + 1;
+            }
+        }
+        if (!found) {
+            printf(COLOR_RED "fields: no field named '%s'\n" COLOR_RESET, range->name);
+            return false;
+        }
+        f->ranges[r].start = f->ranges[r].end = found;
+    }
+    return true;
+}
+
+// Queue the selected fields of one line; newline points at its '\n' in
+// the buffer, or is NULL for a last line without one
+static void fields_line(Fields *f, const char *newline) {
+    if (f->header_pending) {
+        f->header_pending = false;
+        if (!fields_resolve(f)) {
+            f->error = -1;
+            return;
+        }
+        if (!f->print_header) {
+            return;
+        }
+    }
+
+    int previous = 0;       // Field printed last, 0 before the first
+    bool any = false;
+    for (int r = 0; r < f->opts->range_count; r++) {
+        const FieldRange *range = &f->ranges[r];
+        int last = range->end ? range->end : f->field_count;
+        for (int k = range->start; k <= last; k++) {
+            bool present = k <= f->field_count;
+            if (any) {
+                // Neighbours in the input keep the delimiter between them
+                if (f->join_delimiters && present && previous == k - 1 && previous > 0) {
+                    fields_span(f, f->fields[previous - 1].end, 1);
+                } else {
+                    fields_span(f, f->separator, f->separator_len);
+                }
+            }
+            if (present) {
+                const FieldSpan *field = &f->fields[k - 1];
+                fields_span(f, field->start, (size_t)(field->end - field->start));
+            }
+            previous = present ? k : 0;
+            any = true;
+        }
+    }
+    fields_span(f, newline ? newline : "\n", 1);
+}
+
+// Bit i set for each byte equal to c, or a blank when c is 0, and in
+// *newlines for each '\n', over the 64 bytes at p
+static uint64_t fields_masks(const char *p, char c, uint64_t *newlines) {
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i delim = _mm_set1_epi8(c ? c : ' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    uint64_t hits = 0, lines = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i match = _mm_cmpeq_epi8(block, delim);
+        if (!c) {
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(block, tab));
+        }
+        hits |= (uint64_t)(unsigned)_mm_movemask_epi8(match) << (16 * i);
+        lines |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, nl)) << (16 * i);
+    }
+    *newlines = lines;
+    return hits;
+#else
+    uint64_t hits = 0, lines = 0;
+    for (int i = 0; i < 64; i++) {
+        bool match = c ? p[i] == c : p[i] == ' ' || p[i] == '\t';
+        hits |= (uint64_t)match << i;
+        lines |= (uint64_t)(p[i] == '\n') << i;
+    }
+    *newlines = lines;
+    return hits;
+#endif
+}
+
+// The same for the last n < 64 bytes of a buffer
+static uint64_t fields_masks_tail(const char *p, size_t n, char c, uint64_t *newlines) {
+    uint64_t hits = 0, lines = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool match = c ? p[i] == c : p[i] == ' ' || p[i] == '\t';
+        hits |= (uint64_t)match << i;
+        lines |= (uint64_t)(p[i] == '\n') << i;
+    }
+    *newlines = lines;
+    return hits;
+}
+
+// Queue the fields of every whole line in buf, and of the last partial
+// one at eof. Returns where the first unfinished line starts.
+static size_t fields_scan(Fields *f, const char *buf, size_t len, bool eof) {
+    const char c = f->opts->delimiter;
+    size_t line_start = 0;
+    size_t field_start = 0;
+    uint64_t carry = 0;     // Whether the byte before the window was in a field
+    f->field_count = 0;
+
+    for (size_t base = 0; base < len && !f->error; base += 64) {
+        size_t n = len - base < 64 ? len - base : 64;
+        uint64_t valid = n == 64 ? ~0ULL : (1ULL << n) - 1;
+        uint64_t newlines;
+        uint64_t hits = n == 64 ? fields_masks(buf + base, c, &newlines) :
+                                  fields_masks_tail(buf + base, n, c, &newlines);
+
+        uint64_t starts = 0, ends = 0;
+        if (c) {
+            ends = hits | newlines;
+        } else {
+            // Fields are runs of non-blanks: events where they begin and end
+            uint64_t word = ~(hits | newlines) & valid;
+            uint64_t before = word << 1 | carry;
+            starts = word & ~before;
+            ends = ~word & before & valid;
+            carry = (word >> (n - 1)) & 1;
+        }
+
+        for (uint64_t events = starts | ends | newlines; events; events &= events - 1) {
+            int bit = __builtin_ctzll(events);
+            uint64_t mask = 1ULL << bit;
+            size_t pos = base + (size_t)bit;
+            if (starts & mask) {
+                field_start = pos;
+                continue;
+            }
+            if (ends & mask) {
+                fields_add(f, buf + field_start, buf + pos);
+                field_start = pos + 1;
+            }
+            if (newlines & mask) {
+                fields_line(f, buf + pos);
+                f->field_count = 0;
+                line_start = field_start = pos + 1;
+            }
+        }
+    }
+
+    if (!eof || line_start == len || f->error) {
+        return line_start;
+    }
+    if (c || carry) {
+        fields_add(f, buf + field_start, buf + len);
+    }
+    fields_line(f, NULL);
+    f->field_count = 0;
+    return len;
+}
+
+static int fields_file(Fields *f, int fd, char **buf, size_t *capacity) {
+    size_t len = 0;
+    for (;;) {
+        if (len == *capacity) {
+            // One line is bigger than the buffer
+            char *grown = (char *)realloc(*buf, *capacity * 2);
+            if (!grown) {
+                return ENOMEM;
+            }
+            *buf = grown;
+            *capacity *= 2;
+        }
+        ssize_t n = read(fd, *buf + len, *capacity - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        len += (size_t)n;
+
+        size_t used = fields_scan(f, *buf, len, n == 0);
+        // The queued spans point into the buffer, so they go out first
+        fields_flush(f);
+        if (f->error) {
+            return f->error;
+        }
+        memmove(*buf, *buf + used, len - used);
+        len -= used;
+        if (n == 0) {
+            return 0;
+        }
+    }
+}
+
+int fields_run(const FieldsOptions *opts, char **files, int count, FILE *out) {
+    static char *standard_input[] = { "-" };
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+
+    Fields f;
+    memset(&f, 0, sizeof(f));
+    f.opts = opts;
+    memcpy(f.ranges, opts->ranges, (size_t)opts->range_count * sizeof(FieldRange));
+    f.separator = opts->output_delimiter ? opts->output_delimiter : opts->delimiter ? &opts->delimiter : " ";
+    f.separator_len = opts->output_delimiter ? strlen(opts->output_delimiter) : 1;
+    f.join_delimiters = opts->delimiter && f.separator_len == 1 && f.separator[0] == opts->delimiter;
+    // Fields past the last one named are never needed, unless a header
+    // has to be searched or a range is open
+    for (int r = 0; r < opts->range_count && !opts->header; r++) {
+        if (opts->ranges[r].end == 0) {
+            f.max_field = 0;
+            break;
+        }
+        if (opts->ranges[r].end > f.max_field) {
+            f.max_field = opts->ranges[r].end;
+        }
+    }
+    f.print_header = true;
+    fflush(out);
+    f.fd = fileno(out);
+
+    size_t capacity = FIELDS_BLOCK;
+    char *buf = (char *)malloc(capacity);
+    if (!buf) {
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        bool is_stdin = strcmp(files[i], "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO : open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            printf(COLOR_RED "fields: %s: %s\n" COLOR_RESET, files[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        f.header_pending = opts->header;
+
+        int err = fields_file(&f, fd, &buf, &capacity);
+        if (!is_stdin) {
+            close(fd);
+        }
+        if (err) {
+            if (err > 0 && err != EPIPE) {
+                printf(COLOR_RED "fields: %s: %s\n" COLOR_RESET, files[i], strerror(err));
+            }
+            status = 1;
+            break;
+        }
+        if (opts->header && !f.header_pending) {
+            f.print_header = false;
+        }
+    }
+    free(f.fields);
+    free(buf);
+    return status;
+}
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include "../../include/shell/filecopy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+
+// Bytes asked of the kernel per call; it may move fewer
+#define FILECOPY_CHUNK (1 << 30)
+#define FILECOPY_SPLICE_CHUNK (1 << 20)
+#define FILECOPY_BUFFER (256 * 1024)
+
+// Errors meaning "not this method for these files"
+static bool filecopy_unsupported(int err) {
+    return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP ||
+           err == EBADF || err == ESPIPE || err == EPERM;
+}
+
+// Wait until a non-blocking out can take more
+static bool filecopy_wait(int fd, short events) {
+    struct pollfd pfd = { fd, events, 0 };
+    return poll(&pfd, 1, -1) >= 0 || errno == EINTR;
+}
+
+// One kernel-side method until end of input. Returns 1 when it refused
+// before moving anything, so the caller can try the next one.
+static int filecopy_kernel(FileCopyMethod method, int in, int out, int64_t *total) {
+    for (;;) {
+        ssize_t n;
+        switch (method) {
+            case FILECOPY_RANGE:
+                n = copy_file_range(in, NULL, out, NULL, FILECOPY_CHUNK, 0);
+                break;
+            case FILECOPY_SPLICE:
+                n = splice(in, NULL, out, NULL, FILECOPY_SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+            default:
+                n = sendfile(out, in, NULL, FILECOPY_CHUNK);
+                break;
+        }
+        if (n > 0) {
+            *total += n;
+            continue;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN && filecopy_wait(out, POLLOUT)) {
+            continue;
+        }
+        if (*total == 0 && filecopy_unsupported(errno)) {
+            return 1;
+        }
+        return -1;
+    }
+}
+
+static int filecopy_buffered(int in, int out, int64_t *total) {
+    char *buf = (char *)malloc(FILECOPY_BUFFER);
+    if (!buf) {
+        return -1;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int rc = 0;
+    for (;;) {
+        ssize_t n = read(in, buf, FILECOPY_BUFFER);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR || (errno == EAGAIN && filecopy_wait(in, POLLIN))) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out, buf + off, (size_t)(n - off));
+            if (w < 0) {
+                if (errno == EINTR || (errno == EAGAIN && filecopy_wait(out, POLLOUT))) {
+                    continue;
+                }
+                rc = -1;
+                break;
+            }
+            off += w;
+        }
+        if (rc != 0) {
+            break;
+        }
+        *total += n;
+    }
+
+    int saved = errno;
+    free(buf);
+    errno = saved;
+    return rc;
+}
+
+int64_t filecopy_fd(int in, int out, FileCopyMethod *method) {
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) != 0 || fstat(out, &out_st) != 0) {
+        return -1;
+    }
+
+    // Methods worth trying for this pair, in order
+    FileCopyMethod order[3];
+    int count = 0;
+    if (S_ISREG(out_st.st_mode) && S_ISREG(in_st.st_mode)) {
+        order[count++] = FILECOPY_RANGE;
+        order[count++] = FILECOPY_SENDFILE;
+    } else if (S_ISFIFO(out_st.st_mode) || S_ISFIFO(in_st.st_mode)) {
+        order[count++] = FILECOPY_SPLICE;
+    } else if (S_ISSOCK(out_st.st_mode) && S_ISREG(in_st.st_mode)) {
+        order[count++] = FILECOPY_SENDFILE;
+    } else if (S_ISREG(out_st.st_mode)) {
+        order[count++] = FILECOPY_SENDFILE;
+    }
+
+    int64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        int rc = filecopy_kernel(order[i], in, out, &total);
+        if (rc == 0) {
+            if (method) {
+                *method = order[i];
+            }
+            return total;
+        }
+        if (rc < 0) {
+            return -1;
+        }
+    }
+
+    // Terminals, character devices and anything the kernel refused
+    if (method) {
+        *method = FILECOPY_READ_WRITE;
+    }
+    return filecopy_buffered(in, out, &total) == 0 ? total : -1;
+}
+
+// Copy only the data extents SEEK_DATA/SEEK_HOLE report, leaving holes
+// in out. Returns -1 when the file system can't say or won't copy.
+static int64_t filecopy_sparse(int in, int out, off_t size) {
+    int64_t total = 0;
+    off_t data = 0;
+    while (data < size && (data = lseek(in, data, SEEK_DATA)) >= 0) {
+        off_t hole = lseek(in, data, SEEK_HOLE);
+        if (hole < 0) {
+            return -1;
+        }
+        loff_t in_off = data, out_off = data;
+        while (in_off < hole) {
+            ssize_t n = copy_file_range(in, &in_off, out, &out_off, (size_t)(hole - in_off), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return -1;
+            }
+            total += n;
+        }
+        data = hole;
+    }
+    if (data < 0 && errno != ENXIO) {
+        return -1;
+    }
+    return ftruncate(out, size) == 0 ? total : -1;
+}
+
+int64_t filecopy_file(int in, int out, const struct stat *st, FileCopyMethod *method) {
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0) {
+        if (method) {
+            *method = FILECOPY_CLONE;
+        }
+        return st->st_size;
+    }
+#endif
+
+    // A sparse source keeps its holes; anything else gets its blocks
+    // reserved in one go
+    if (st->st_size > 0 && (int64_t)st->st_blocks * 512 < st->st_size) {
+        int64_t total = filecopy_sparse(in, out, st->st_size);
+        if (total >= 0) {
+            if (method) {
+                *method = FILECOPY_RANGE;
+            }
+            return total;
+        }
+        if (lseek(in, 0, SEEK_SET) != 0 || lseek(out, 0, SEEK_SET) != 0) {
+            return -1;
+        }
+    } else if (st->st_size > 0) {
+        fallocate(out, 0, 0, st->st_size);
+    }
+    int64_t total = filecopy_fd(in, out, method);
+    if (total >= 0 && total < st->st_size && ftruncate(out, total) != 0) {
+        return -1;
+    }
+    return total;
+}
+
+const char *filecopy_method_name(FileCopyMethod method) {
+    switch (method) {
+        case FILECOPY_CLONE: return "reflink";
+        case FILECOPY_RANGE: return "copy_file_range";
+        case FILECOPY_SPLICE: return "splice";
+        case FILECOPY_SENDFILE: return "sendfile";
+        default: return "read/write";
+    }
+}
+
+// cat before filecopy: 4 KB through stdio
+static int64_t filecopy_stdio(int in, int out) {
+    FILE *f = fdopen(dup(in), "r");
+    FILE *o = fdopen(dup(out), "w");
+    int64_t total = 0;
+    if (f && o) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            fwrite(buf, 1, n, o);
+            total += (int64_t)n;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    if (o) {
+        fclose(o);
+    }
+    return total;
+}
+
+// Child that reads a pipe to the end and throws it away
+static pid_t filecopy_drain(int fd, int write_end) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(write_end);
+        char buf[65536];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        _exit(0);
+    }
+    return pid;
+}
+
+static double filecopy_elapsed(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// One timed copy of src into a destination of the given kind
+static double filecopy_time(const char *src, const char *kind, bool old, FileCopyMethod *method) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+
+    int out = -1;
+    int pipe_fds[2] = { -1, -1 };
+    pid_t drain = -1;
+    char dst[] = "/tmp/cshell-cat-dst-XXXXXX";
+    if (strcmp(kind, "file") == 0) {
+        out = mkstemp(dst);
+    } else if (strcmp(kind, "pipe") == 0) {
+        if (pipe(pipe_fds) == 0) {
+            drain = filecopy_drain(pipe_fds[0], pipe_fds[1]);
+            close(pipe_fds[0]);
+            out = pipe_fds[1];
+        }
+    } else {
+        out = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    }
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t copied = old ? filecopy_stdio(in, out) : filecopy_fd(in, out, method);
+    if (strcmp(kind, "file") == 0) {
+        fsync(out);
+    }
+    close(out);
+    if (drain > 0) {
+        waitpid(drain, NULL, 0);
+    }
+    double seconds = filecopy_elapsed(&start);
+
+    close(in);
+    if (strcmp(kind, "file") == 0) {
+        unlink(dst);
+    }
+    return copied < 0 ? -1 : seconds;
+}
+
+void filecopy_benchmark(size_t size_mb, FILE *out) {
+    char src[] = "/tmp/cshell-cat-src-XXXXXX";
+    int fd = mkstemp(src);
+    if (fd < 0) {
+        fprintf(out, "cat: cannot create scratch file: %s\n", strerror(errno));
+        return;
+    }
+
+    // Fill the source with non-zero data so nothing is sparse
+    char *block = (char *)malloc(1 << 20);
+    if (!block) {
+        close(fd);
+        unlink(src);
+        return;
+    }
+    for (size_t i = 0; i < (1 << 20); i++) {
+        block[i] = (char)('a' + i % 26);
+    }
+    for (size_t i = 0; i < size_mb; i++) {
+        if (write(fd, block, 1 << 20) != (1 << 20)) {
+            break;
+        }
+    }
+    free(block);
+    fsync(fd);
+    close(fd);
+
+    // The drain child must not die of a closed pipe in the shell
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    static const char *kinds[] = { "file", "pipe", "/dev/null" };
+    fprintf(out, "%zu MB, best of 3 (MB/s)\n", size_mb);
+    fprintf(out, "  %-10s %12s %12s  %s\n", "to", "4KB stdio", "filecopy", "method");
+    for (int k = 0; k < 3; k++) {
+        double best_old = -1, best_new = -1;
+        FileCopyMethod method = FILECOPY_READ_WRITE;
+        for (int run = 0; run < 3; run++) {
+            double s = filecopy_time(src, kinds[k], true, NULL);
+            if (s > 0 && (best_old < 0 || s < best_old)) {
+                best_old = s;
+            }
+            s = filecopy_time(src, kinds[k], false, &method);
+            if (s > 0 && (best_new < 0 || s < best_new)) {
+                best_new = s;
+            }
+        }
+        fprintf(out, "  %-10s %12.0f %12.0f  %s\n", kinds[k],
+                best_old > 0 ? (double)size_mb / best_old : 0.0,
+                best_new > 0 ? (double)size_mb / best_new : 0.0,
+                filecopy_method_name(method));
+    }
+
+    signal(SIGPIPE, old_pipe);
+    unlink(src);
+}
@@ -0,0 +1,591 @@
+#define _GNU_SOURCE
+#include "../../include/shell/find.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define FIND_DIRENT_BUFFER (64 * 1024)
+#define FIND_OUT_BUFFER (64 * 1024)
+#define FIND_SPINS 64
+
+struct find_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// An open directory its queued subdirectories are opened relative to
+typedef struct {
+    int fd;
+    atomic_int refs;
+} FindDir;
+
+// A directory still to read
+typedef struct {
+    FindDir *parent;    // NULL for a starting point
+    char *path;
+    size_t name_off;    // Where the last component starts in path
+    int depth;
+} FindJob;
+
+// Double-ended queue of jobs: the owner pushes and pops at the bottom,
+// thieves take from the top
+typedef struct {
+    pthread_mutex_t lock;
+    FindJob **jobs;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} FindDeque;
+
+typedef struct FindTree FindTree;
+
+// One walker thread
+typedef struct {
+    FindTree *tree;
+    int index;
+    FindDeque deque;
+    uint32_t seed;
+    char *dirents;
+    char *path;
+    size_t path_cap;
+    char *out;          // Matches not yet written, or all of them when sorted
+    size_t out_len;
+    size_t out_cap;
+    int errors;
+} FindWorker;
+
+struct FindTree {
+    const FindOptions *opts;
+    FILE *out;
+    pthread_mutex_t out_lock;
+    FindWorker *workers;
+    int worker_count;
+    atomic_long pending;    // Directories queued or being read
+    time_t now;
+    bool need_stat;
+};
+
+static void find_dir_release(FindDir *dir) {
+    if (dir && atomic_fetch_sub(&dir->refs, 1) == 1) {
+        close(dir->fd);
+        free(dir);
+    }
+}
+
+static void find_job_free(FindJob *job) {
+    find_dir_release(job->parent);
+    free(job->path);
+    free(job);
+}
+
+static bool find_push(FindDeque *deque, FindJob *job) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail - deque->head == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 256;
+        FindJob **jobs = (FindJob **)malloc(capacity * sizeof(FindJob *));
+        if (!jobs) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        size_t count = deque->tail - deque->head;
+        for (size_t i = 0; i < count; i++) {
+            jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
+        }
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->head = 0;
+        deque->tail = count;
+        deque->capacity = capacity;
+    }
+    deque->jobs[deque->tail++ % deque->capacity] = job;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+// Newest job, so the owner walks depth-first and stays near its parents
+static FindJob *find_pop(FindDeque *deque) {
+    FindJob *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        job = deque->jobs[--deque->tail % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Oldest job, usually closest to the root and so the largest subtree
+static FindJob *find_steal_from(FindDeque *deque) {
+    FindJob *job = NULL;
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return NULL;
+    }
+    if (deque->tail > deque->head) {
+        job = deque->jobs[deque->head++ % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static FindJob *find_steal(FindWorker *worker) {
+    FindTree *tree = worker->tree;
+    if (tree->worker_count < 2) {
+        return NULL;
+    }
+    // xorshift: a different first victim each time
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+    int start = (int)(worker->seed % (uint32_t)tree->worker_count);
+    for (int i = 0; i < tree->worker_count; i++) {
+        int victim = (start + i) % tree->worker_count;
+        if (victim != worker->index) {
+            FindJob *job = find_steal_from(&tree->workers[victim].deque);
+            if (job) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void find_flush(FindWorker *worker) {
+    if (worker->out_len == 0) {
+        return;
+    }
+    pthread_mutex_lock(&worker->tree->out_lock);
+    fwrite(worker->out, 1, worker->out_len, worker->tree->out);
+    pthread_mutex_unlock(&worker->tree->out_lock);
+    worker->out_len = 0;
+}
+
+static void find_error(FindWorker *worker, const char *path, int err) {
+    find_flush(worker);
+    pthread_mutex_lock(&worker->tree->out_lock);
+    fflush(worker->tree->out);
+    printf(COLOR_RED "find: '%s': %s\n" COLOR_RESET, path, strerror(err));
+    fflush(stdout);
+    pthread_mutex_unlock(&worker->tree->out_lock);
+    worker->errors++;
+}
+
+// Queue a match. Streaming output goes out in batches so lines from
+// different threads never interleave; sorted output is kept whole.
+static void find_emit(FindWorker *worker, const char *path, size_t len) {
+    if (worker->out_len + len + 1 > worker->out_cap) {
+        if (!worker->tree->opts->sorted && worker->out_len > 0) {
+            find_flush(worker);
+        }
+        if (worker->out_len + len + 1 > worker->out_cap) {
+            size_t cap = worker->out_cap * 2;
+            while (cap < worker->out_len + len + 1) {
+                cap *= 2;
+            }
+            char *out = (char *)realloc(worker->out, cap);
+            if (!out) {
+                return;
+            }
+            worker->out = out;
+            worker->out_cap = cap;
+        }
+    }
+    memcpy(worker->out + worker->out_len, path, len);
+    worker->out_len += len;
+    worker->out[worker->out_len++] = worker->tree->opts->sorted || worker->tree->opts->print0 ? '\0' : '\n';
+}
+
+static bool find_number_matches(const FindNumber *test, int64_t value) {
+    // Whole units, rounded up as find does for sizes
+    int64_t units = value <= 0 ? 0 : (value + test->unit - 1) / test->unit;
+    return test->cmp < 0 ? units < test->value : test->cmp > 0 ? units > test->value : units == test->value;
+}
+
+static char find_type_char(mode_t mode) {
+    if (S_ISREG(mode)) return 'f';
+    if (S_ISDIR(mode)) return 'd';
+    if (S_ISLNK(mode)) return 'l';
+    if (S_ISFIFO(mode)) return 'p';
+    if (S_ISSOCK(mode)) return 's';
+    if (S_ISBLK(mode)) return 'b';
+    if (S_ISCHR(mode)) return 'c';
+    return '?';
+}
+
+static char find_dtype_char(unsigned char type) {
+    switch (type) {
+        case DT_REG: return 'f';
+        case DT_DIR: return 'd';
+        case DT_LNK: return 'l';
+        case DT_FIFO: return 'p';
+        case DT_SOCK: return 's';
+        case DT_BLK: return 'b';
+        case DT_CHR: return 'c';
+        default: return 0;
+    }
+}
+
+// Everything but the name test, against metadata from stat
+static bool find_stat_matches(const FindTree *tree, const struct stat *st) {
+    const FindOptions *opts = tree->opts;
+    if (opts->type && find_type_char(st->st_mode) != opts->type) {
+        return false;
+    }
+    if (opts->size.set && !find_number_matches(&opts->size, (int64_t)st->st_size)) {
+        return false;
+    }
+    if (opts->mtime.set) {
+        // Age in whole units, rounded down
+        int64_t age = (int64_t)(tree->now - st->st_mtime);
+        int64_t units = age < 0 ? -1 : age / opts->mtime.unit;
+        int cmp = opts->mtime.cmp;
+        int64_t value = opts->mtime.value;
+        if (cmp < 0 ? !(units < value) : cmp > 0 ? !(units > value) : units != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool find_name_matches(const FindOptions *opts, const char *name) {
+    return !opts->name || fnmatch(opts->name, name, opts->icase ? FNM_CASEFOLD : 0) == 0;
+}
+
+static bool find_path_reserve(FindWorker *worker, size_t len) {
+    if (len <= worker->path_cap) {
+        return true;
+    }
+    size_t cap = worker->path_cap ? worker->path_cap : 4096;
+    while (cap < len) {
+        cap *= 2;
+    }
+    char *path = (char *)realloc(worker->path, cap);
+    if (!path) {
+        return false;
+    }
+    worker->path = path;
+    worker->path_cap = cap;
+    return true;
+}
+
+// Read one directory: test every entry and queue the subdirectories
+static void find_scan(FindWorker *worker, FindJob *job) {
+    FindTree *tree = worker->tree;
+    const FindOptions *opts = tree->opts;
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+
+    int fd = job->parent ? openat(job->parent->fd, job->path + job->name_off, flags) : open(job->path, flags);
+    find_dir_release(job->parent);
+    job->parent = NULL;
+    if (fd < 0) {
+        find_error(worker, job->path, errno);
+        return;
+    }
+
+    FindDir *dir = (FindDir *)malloc(sizeof(FindDir));
+    if (!dir) {
+        close(fd);
+        return;
+    }
+    dir->fd = fd;
+    atomic_init(&dir->refs, 1);
+
+    size_t base_len = strlen(job->path);
+    bool slash = base_len > 0 && job->path[base_len - 1] != '/';
+    size_t prefix = base_len + slash;
+    if (!find_path_reserve(worker, prefix + 256)) {
+        find_dir_release(dir);
+        return;
+    }
+    memcpy(worker->path, job->path, base_len);
+    if (slash) {
+        worker->path[base_len] = '/';
+    }
+
+    int depth = job->depth + 1;
+    bool descend = opts->max_depth < 0 || depth < opts->max_depth;
+    bool test = depth >= opts->min_depth;
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, worker->dirents, FIND_DIRENT_BUFFER)) > 0) {
+        for (long pos = 0; pos < n; ) {
+            struct find_dirent64 *d = (struct find_dirent64 *)(worker->dirents + pos);
+            pos += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t name_len = strlen(name);
+            if (!find_path_reserve(worker, prefix + name_len + 1)) {
+                continue;
+            }
+            memcpy(worker->path + prefix, name, name_len + 1);
+
+            // Cheapest tests first; stat only when d_type can't decide
+            char type = find_dtype_char(d->d_type);
+            bool matches = test && find_name_matches(opts, name);
+            if (matches || (descend && !type)) {
+                struct stat st;
+                if (tree->need_stat || !type) {
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                        find_error(worker, worker->path, errno);
+                        continue;
+                    }
+                    type = find_type_char(st.st_mode);
+                    matches = matches && find_stat_matches(tree, &st);
+                } else {
+                    matches = matches && (!opts->type || type == opts->type);
+                }
+            }
+            if (matches) {
+                find_emit(worker, worker->path, prefix + name_len);
+            }
+
+            if (descend && type == 'd') {
+                FindJob *child = (FindJob *)malloc(sizeof(FindJob));
+                if (!child || !(child->path = strndup(worker->path, prefix + name_len))) {
+                    free(child);
+                    continue;
+                }
+                child->name_off = prefix;
+                child->depth = depth;
+                child->parent = dir;
+                atomic_fetch_add(&dir->refs, 1);
+                atomic_fetch_add(&tree->pending, 1);
+                if (!find_push(&worker->deque, child)) {
+                    atomic_fetch_sub(&tree->pending, 1);
+                    find_job_free(child);
+                }
+            }
+        }
+    }
+    if (n < 0) {
+        find_error(worker, job->path, errno);
+    }
+    find_dir_release(dir);
+}
+
+static void *find_worker(void *arg) {
+    FindWorker *worker = (FindWorker *)arg;
+    FindTree *tree = worker->tree;
+    int idle = 0;
+
+    for (;;) {
+        FindJob *job = find_pop(&worker->deque);
+        if (!job) {
+            job = find_steal(worker);
+        }
+        if (!job) {
+            if (atomic_load(&tree->pending) == 0) {
+                break;
+            }
+            // Others are still reading and may queue more
+            if (++idle < FIND_SPINS) {
+                sched_yield();
+            } else {
+                struct timespec nap = { 0, 50000 };
+                nanosleep(&nap, NULL);
+            }
+            continue;
+        }
+        idle = 0;
+        find_scan(worker, job);
+        find_job_free(job);
+        atomic_fetch_sub(&tree->pending, 1);
+    }
+
+    if (!tree->opts->sorted) {
+        find_flush(worker);
+    }
+    return NULL;
+}
+
+// Byte order with '/' first, so a directory's entries follow it directly
+static int find_path_compare(const void *a, const void *b) {
+    const unsigned char *x = *(const unsigned char * const *)a;
+    const unsigned char *y = *(const unsigned char * const *)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    int cx = *x == '/' ? 1 : *x ? *x + 1 : 0;
+    int cy = *y == '/' ? 1 : *y ? *y + 1 : 0;
+    return cx - cy;
+}
+
+// Gather every thread's matches, sort them and print
+static void find_print_sorted(FindTree *tree) {
+    size_t count = 0;
+    for (int i = 0; i < tree->worker_count; i++) {
+        FindWorker *worker = &tree->workers[i];
+        for (size_t pos = 0; pos < worker->out_len; pos++) {
+            count += worker->out[pos] == '\0';
+        }
+    }
+    char **paths = (char **)malloc((count ? count : 1) * sizeof(char *));
+    if (!paths) {
+        return;
+    }
+    size_t n = 0;
+    for (int i = 0; i < tree->worker_count; i++) {
+        FindWorker *worker = &tree->workers[i];
+        for (size_t pos = 0; pos < worker->out_len; pos += strlen(worker->out + pos) + 1) {
+            paths[n++] = worker->out + pos;
+        }
+    }
+    qsort(paths, count, sizeof(char *), find_path_compare);
+    char end = tree->opts->print0 ? '\0' : '\n';
+    for (size_t i = 0; i < count; i++) {
+        fputs(paths[i], tree->out);
+        fputc(end, tree->out);
+    }
+    free(paths);
+}
+
+// Walk one starting point on the thread pool
+static int find_walk(FindTree *tree, const char *path) {
+    const FindOptions *opts = tree->opts;
+    FindWorker *first = &tree->workers[0];
+    int errors = 0;
+
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        find_error(first, path, errno);
+        return 1;
+    }
+
+    // The starting point itself, tested by its last component
+    if (opts->min_depth == 0) {
+        size_t len = strlen(path);
+        while (len > 1 && path[len - 1] == '/') {
+            len--;
+        }
+        char *base = strndup(path, len);
+        const char *slash = base ? strrchr(base, '/') : NULL;
+        const char *name = slash && slash[1] ? slash + 1 : base;
+        if (base && find_name_matches(opts, name) && find_stat_matches(tree, &st)) {
+            find_emit(first, path, strlen(path));
+            if (!opts->sorted) {
+                find_flush(first);
+            }
+        }
+        free(base);
+    }
+    if (!S_ISDIR(st.st_mode) || opts->max_depth == 0) {
+        if (opts->sorted) {
+            find_print_sorted(tree);
+        } else {
+            find_flush(first);
+        }
+        first->out_len = 0;
+        return first->errors;
+    }
+
+    FindJob *job = (FindJob *)malloc(sizeof(FindJob));
+    if (!job || !(job->path = strdup(path))) {
+        free(job);
+        return 1;
+    }
+    job->parent = NULL;
+    job->name_off = 0;
+    job->depth = 0;
+    atomic_store(&tree->pending, 1);
+    find_push(&first->deque, job);
+
+    pthread_t *threads = (pthread_t *)calloc((size_t)tree->worker_count, sizeof(pthread_t));
+    int started = 0;
+    for (int i = 1; threads && i < tree->worker_count; i++) {
+        if (pthread_create(&threads[i], NULL, find_worker, &tree->workers[i]) == 0) {
+            started = i;
+        } else {
+            break;
+        }
+    }
+    find_worker(first);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    if (opts->sorted) {
+        find_print_sorted(tree);
+    }
+    for (int i = 0; i < tree->worker_count; i++) {
+        errors += tree->workers[i].errors;
+        tree->workers[i].errors = 0;
+        tree->workers[i].out_len = 0;
+    }
+    return errors;
+}
+
+int find_run(const FindOptions *opts, char **paths, int count, FILE *out) {
+    FindTree tree;
+    memset(&tree, 0, sizeof(tree));
+    tree.opts = opts;
+    tree.out = out;
+    tree.now = time(NULL);
+    tree.need_stat = opts->size.set || opts->mtime.set;
+    tree.worker_count = opts->jobs > 0 ? opts->jobs : 1;
+    pthread_mutex_init(&tree.out_lock, NULL);
+
+    tree.workers = (FindWorker *)calloc((size_t)tree.worker_count, sizeof(FindWorker));
+    if (!tree.workers) {
+        return 1;
+    }
+    int ready = 0;
+    for (int i = 0; i < tree.worker_count; i++) {
+        FindWorker *worker = &tree.workers[i];
+        worker->tree = &tree;
+        worker->index = i;
+        worker->seed = 2463534242u + (uint32_t)i * 2654435761u;
+        worker->dirents = (char *)malloc(FIND_DIRENT_BUFFER);
+        worker->out_cap = FIND_OUT_BUFFER;
+        worker->out = (char *)malloc(worker->out_cap);
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        ready += worker->dirents && worker->out;
+    }
+
+    int errors = 0;
+    if (ready == tree.worker_count) {
+        static char *dot[] = { "." };
+        if (count == 0) {
+            paths = dot;
+            count = 1;
+        }
+        for (int i = 0; i < count; i++) {
+            errors += find_walk(&tree, paths[i]);
+        }
+    } else {
+        errors = 1;
+    }
+    fflush(out);
+
+    for (int i = 0; i < tree.worker_count; i++) {
+        FindWorker *worker = &tree.workers[i];
+        free(worker->dirents);
+        free(worker->out);
+        free(worker->path);
+        free(worker->deque.jobs);
+        pthread_mutex_destroy(&worker->deque.lock);
+    }
+    free(tree.workers);
+    pthread_mutex_destroy(&tree.out_lock);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,777 @@
+#define _GNU_SOURCE
+#include "../../include/shell/grep.h"
+#include "../../include/shell/textutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <regex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define GREP_BINARY_PROBE (32 * 1024)  // Bytes checked for NUL
+#define GREP_STREAM_BUFFER (256 * 1024) // Output kept before writing it out
+
+// The pattern, compiled once and shared by every thread
+typedef struct {
+    char *literal;      // Bytes every matching line contains, lowercase with -i
+    size_t literal_len;
+    bool literal_only;  // The literal is the whole pattern; no regex needed
+    bool icase;
+    bool has_regex;
+    regex_t regex;
+} GrepPattern;
+
+// Output of one file, written in file order
+typedef struct {
+    char *out;
+    size_t len;
+    size_t cap;
+    bool done;
+    bool matched;
+    bool failed;
+} GrepSlot;
+
+typedef struct {
+    const GrepOptions *opts;
+    GrepPattern pattern;
+    char **files;
+    int count;
+    bool with_name;
+    FILE *out;
+    atomic_int next;        // Next file to claim
+    atomic_bool stop;       // -q has its answer
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int printing;           // The slot whose output may go straight out
+    GrepSlot *slots;
+} GrepRun;
+
+// Search state for one file
+typedef struct {
+    GrepRun *run;
+    GrepSlot *slot;
+    int index;
+    const char *name;
+    uint64_t matches;
+    uint64_t lines;         // Newlines before the current position
+    bool binary;
+    bool stop;
+} GrepSearch;
+
+static inline unsigned char grep_lower(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static inline unsigned char grep_upper(unsigned char c) {
+    return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+// How rarely a byte turns up in text, roughly: the scan stops on every
+// occurrence of the literal, so rare bytes make a better prefilter
+static int grep_rarity(unsigned char c) {
+    static const char common[] = " etaoinsrhldcumfpgwybvkxjqz";
+    const char *at = c ? strchr(common, grep_lower(c)) : NULL;
+    return at ? (int)(at - common) + 1 : (int)sizeof(common) + 4;
+}
+
+static int grep_score(const char *run, size_t len) {
+    int score = 0;
+    for (size_t i = 0; i < len; i++) {
+        score += grep_rarity((unsigned char)run[i]);
+    }
+    return score;
+}
+
+// The run of characters every match of the regex must contain that
+// should be rarest, favouring long runs. Anything optional, repeated,
+// bracketed or grouped ends a run, and an alternation means nothing is
+// required. whole is set when the pattern is nothing but that run.
+static char *grep_required_literal(const char *pattern, bool extended, bool icase, size_t *len, bool *whole) {
+    size_t pattern_len = strlen(pattern);
+    char *best = (char *)malloc(pattern_len + 1);
+    char *run = (char *)malloc(pattern_len + 1);
+    size_t best_len = 0, run_len = 0;
+    *whole = true;
+    if (!best || !run || (extended ? strchr(pattern, '|') != NULL : strstr(pattern, "\\|") != NULL)) {
+        free(run);
+        free(best);
+        *len = 0;
+        *whole = false;
+        return NULL;
+    }
+
+    const char *specials = extended ? ".[]()*+?{}^$|" : ".[*^$";
+    for (const char *p = pattern; *p; ) {
+        const char *next = p + 1;
+        unsigned char c = (unsigned char)*p;
+        bool literal = true;
+
+        if (*p == '\\' && p[1]) {
+            c = (unsigned char)p[1];
+            next = p + 2;
+            if (!extended && c == '(') {
+                // Skip the whole group: it may be optional
+                int depth = 1;
+                while (*next && depth > 0) {
+                    if (next[0] == '\\' && next[1] == '(') {
+                        depth++;
+                    } else if (next[0] == '\\' && next[1] == ')') {
+                        depth--;
+                    }
+                    next += next[0] == '\\' && next[1] ? 2 : 1;
+                }
+                literal = false;
+            } else if (!extended && c == '{') {
+                // Interval: its digits are not text
+                const char *close = strstr(next, "\\}");
+                next = close ? close + 2 : next + strlen(next);
+                literal = false;
+            } else if (isalnum(c) || strchr("<>`'", c) || (!extended && strchr("(){}|+?", c))) {
+                literal = false;
+            }
+        } else if (strchr(specials, *p)) {
+            literal = false;
+            if (*p == '[') {
+                const char *q = p + 1;
+                if (*q == '^') {
+                    q++;
+                }
+                if (*q == ']') {
+                    q++;
+                }
+                while (*q && *q != ']') {
+                    if (q[0] == '[' && (q[1] == ':' || q[1] == '.' || q[1] == '=')) {
+                        char close = q[1];
+                        q += 2;
+                        while (*q && !(q[0] == close && q[1] == ']')) {
+                            q++;
+                        }
+                        q += *q ? 2 : 0;
+                        continue;
+                    }
+                    q++;
+                }
+                next = *q ? q + 1 : q;
+            } else if (*p == '{') {
+                const char *close = strchr(next, '}');
+                next = close ? close + 1 : next + strlen(next);
+            } else if (*p == '(') {
+                int depth = 1;
+                while (*next && depth > 0) {
+                    if (*next == '\\' && next[1]) {
+                        next++;
+                    } else if (*next == '(') {
+                        depth++;
+                    } else if (*next == ')') {
+                        depth--;
+                    }
+                    next++;
+                }
+            }
+        }
+
+        // A quantifier after an item makes it optional or repeated
+        bool quantified = *next == '*' ||
+                          (extended && (*next == '?' || *next == '+' || *next == '{')) ||
+                          (!extended && next[0] == '\\' && (next[1] == '?' || next[1] == '+' || next[1] == '{'));
+        if (literal && !quantified && !(icase && c >= 0x80)) {
+            run[run_len++] = (char)(icase ? grep_lower(c) : c);
+        } else {
+            *whole = false;
+            if (run_len > 0 && grep_score(run, run_len) > grep_score(best, best_len)) {
+                memcpy(best, run, run_len);
+                best_len = run_len;
+            }
+            run_len = 0;
+        }
+        p = next;
+    }
+    if (run_len > 0 && grep_score(run, run_len) > grep_score(best, best_len)) {
+        memcpy(best, run, run_len);
+        best_len = run_len;
+    }
+    free(run);
+
+    best[best_len] = '\0';
+    *len = best_len;
+    return best;
+}
+
+static int grep_compile(GrepPattern *pattern, const GrepOptions *opts) {
+    memset(pattern, 0, sizeof(*pattern));
+    pattern->icase = opts->icase;
+
+    if (opts->fixed) {
+        size_t len = strlen(opts->pattern);
+        pattern->literal = strdup(opts->pattern);
+        if (!pattern->literal) {
+            return -1;
+        }
+        for (size_t i = 0; opts->icase && i < len; i++) {
+            pattern->literal[i] = (char)grep_lower((unsigned char)pattern->literal[i]);
+        }
+        pattern->literal_len = len;
+        pattern->literal_only = true;
+        return 0;
+    }
+
+    pattern->literal = grep_required_literal(opts->pattern, opts->extended, opts->icase,
+                                             &pattern->literal_len, &pattern->literal_only);
+    if (pattern->literal_only) {
+        return 0;
+    }
+    int flags = REG_NEWLINE | (opts->extended ? REG_EXTENDED : 0) | (opts->icase ? REG_ICASE : 0);
+    int rc = regcomp(&pattern->regex, opts->pattern, flags);
+    if (rc != 0) {
+        char msg[256];
+        regerror(rc, &pattern->regex, msg, sizeof(msg));
+        printf(COLOR_RED "grep: %s\n" COLOR_RESET, msg);
+        free(pattern->literal);
+        pattern->literal = NULL;
+        return -1;
+    }
+    pattern->has_regex = true;
+    return 0;
+}
+
+static void grep_pattern_free(GrepPattern *pattern) {
+    if (pattern->has_regex) {
+        regfree(&pattern->regex);
+    }
+    free(pattern->literal);
+}
+
+static bool grep_equal(const char *text, const char *literal, size_t len, bool icase) {
+    if (!icase) {
+        return memcmp(text, literal, len) == 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (grep_lower((unsigned char)text[i]) != (unsigned char)literal[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// First occurrence of the literal in [p, end). Sixteen candidate
+// positions at a time are kept only if both the first and the last byte
+// of the literal are in place; the rest is compared for those alone.
+static const char *grep_find_literal(const GrepPattern *pattern, const char *p, const char *end) {
+    size_t n = pattern->literal_len;
+    const char *literal = pattern->literal;
+    if ((size_t)(end - p) < n) {
+        return NULL;
+    }
+    if (n == 1 && !pattern->icase) {
+        return (const char *)memchr(p, literal[0], (size_t)(end - p));
+    }
+    const char *limit = end - n + 1;    // Candidates start before this
+
+#ifdef __SSE2__
+    unsigned char first = (unsigned char)literal[0];
+    unsigned char last = (unsigned char)literal[n - 1];
+    const __m128i first_lo = _mm_set1_epi8((char)first);
+    const __m128i last_lo = _mm_set1_epi8((char)last);
+    const __m128i first_up = _mm_set1_epi8((char)(pattern->icase ? grep_upper(first) : first));
+    const __m128i last_up = _mm_set1_epi8((char)(pattern->icase ? grep_upper(last) : last));
+    for (; p + 16 <= limit; p += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *)p);
+        __m128i tail = _mm_loadu_si128((const __m128i *)(p + n - 1));
+        __m128i eq_head = _mm_or_si128(_mm_cmpeq_epi8(head, first_lo), _mm_cmpeq_epi8(head, first_up));
+        __m128i eq_tail = _mm_or_si128(_mm_cmpeq_epi8(tail, last_lo), _mm_cmpeq_epi8(tail, last_up));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(eq_head, eq_tail));
+        while (mask) {
+            const char *candidate = p + __builtin_ctz(mask);
+            if (n <= 2 || grep_equal(candidate + 1, literal + 1, n - 2, pattern->icase)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    if (!pattern->icase) {
+        return (const char *)memmem(p, (size_t)(end - p), literal, n);
+    }
+    for (; p < limit; p++) {
+        if (grep_lower((unsigned char)*p) == (unsigned char)literal[0] && grep_equal(p + 1, literal + 1, n - 1, true)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static bool grep_regex_matches(const GrepPattern *pattern, const char *start, const char *stop) {
+    regmatch_t match;
+    match.rm_so = 0;
+    match.rm_eo = stop - start;
+    return regexec(&pattern->regex, start, 1, &match, REG_STARTEND) == 0;
+}
+
+// The next matching line at or after p, which starts a line. Returns its
+// start and sets *line_end to its newline (or end), or NULL for none.
+static const char *grep_next_line(const GrepPattern *pattern, const char *p, const char *end, const char **line_end) {
+    while (p < end) {
+        const char *start, *stop;
+        if (pattern->literal_len > 0) {
+            // Only lines holding the literal can match
+            const char *hit = grep_find_literal(pattern, p, end);
+            if (!hit) {
+                return NULL;
+            }
+            start = (const char *)memrchr(p, '\n', (size_t)(hit - p));
+            start = start ? start + 1 : p;
+            stop = (const char *)memchr(hit, '\n', (size_t)(end - hit));
+            stop = stop ? stop : end;
+            if (pattern->literal_only || grep_regex_matches(pattern, start, stop)) {
+                *line_end = stop;
+                return start;
+            }
+            p = stop + 1;
+        } else if (pattern->has_regex) {
+            // One regexec over the rest of the buffer, not one per line
+            regmatch_t match;
+            match.rm_so = 0;
+            match.rm_eo = end - p;
+            if (regexec(&pattern->regex, p, 1, &match, REG_STARTEND) != 0) {
+                return NULL;
+            }
+            start = (const char *)memrchr(p, '\n', (size_t)match.rm_so);
+            start = start ? start + 1 : p;
+            if (start == end) {
+                // An empty match after the last newline is not a line
+                return NULL;
+            }
+            stop = (const char *)memchr(p + match.rm_so, '\n', (size_t)(end - p - match.rm_so));
+            *line_end = stop ? stop : end;
+            return start;
+        } else {
+            // The empty pattern matches every line
+            stop = (const char *)memchr(p, '\n', (size_t)(end - p));
+            *line_end = stop ? stop : end;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void grep_write(GrepSearch *search, const char *data, size_t len) {
+    GrepSlot *slot = search->slot;
+    if (slot->len + len > slot->cap) {
+        size_t cap = slot->cap ? slot->cap : 4096;
+        while (cap < slot->len + len) {
+            cap *= 2;
+        }
+        char *out = (char *)realloc(slot->out, cap);
+        if (!out) {
+            return;
+        }
+        slot->out = out;
+        slot->cap = cap;
+    }
+    memcpy(slot->out + slot->len, data, len);
+    slot->len += len;
+}
+
+// Hand buffered output over when this file is the one being printed
+static void grep_stream(GrepSearch *search) {
+    GrepRun *run = search->run;
+    pthread_mutex_lock(&run->lock);
+    if (run->printing == search->index && search->slot->len > 0) {
+        fwrite(search->slot->out, 1, search->slot->len, run->out);
+        fflush(run->out);
+        search->slot->len = 0;
+    }
+    pthread_mutex_unlock(&run->lock);
+}
+
+static void grep_error(GrepSearch *search, const char *path, const char *msg) {
+    search->slot->failed = true;
+    if (!search->run->opts->no_messages) {
+        char line[PATH_MAX + 256];
+        int len = snprintf(line, sizeof(line), COLOR_RED "grep: %s: %s\n" COLOR_RESET, path, msg);
+        grep_write(search, line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+// One selected line
+static void grep_select(GrepSearch *search, const char *start, const char *stop, const char **counted) {
+    const GrepOptions *opts = search->run->opts;
+    search->matches++;
+    if (opts->quiet) {
+        atomic_store(&search->run->stop, true);
+        search->stop = true;
+        return;
+    }
+    if (opts->files_only) {
+        search->stop = true;
+        return;
+    }
+    if (opts->count) {
+        return;
+    }
+    if (search->binary) {
+        char line[PATH_MAX + 64];
+        int len = snprintf(line, sizeof(line), "grep: %s: binary file matches\n", search->name);
+        grep_write(search, line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+        search->stop = true;
+        return;
+    }
+
+    if (search->run->with_name) {
+        grep_write(search, search->name, strlen(search->name));
+        grep_write(search, ":", 1);
+    }
+    if (opts->line_numbers) {
+        search->lines += text_count_lines(*counted, (size_t)(start - *counted));
+        *counted = start;
+        char number[32];
+        int len = snprintf(number, sizeof(number), "%" PRIu64 ":", search->lines + 1);
+        grep_write(search, number, (size_t)len);
+    }
+    grep_write(search, start, (size_t)(stop - start));
+    grep_write(search, "\n", 1);
+    if (search->slot->len >= GREP_STREAM_BUFFER) {
+        grep_stream(search);
+    }
+}
+
+// Search [buf, buf + len), which holds whole lines
+static void grep_lines(GrepSearch *search, const char *buf, size_t len) {
+    const GrepOptions *opts = search->run->opts;
+    const GrepPattern *pattern = &search->run->pattern;
+    const char *p = buf;
+    const char *end = buf + len;
+    const char *counted = buf;
+
+    while (p < end && !search->stop && !atomic_load(&search->run->stop)) {
+        const char *line_end;
+        const char *line = grep_next_line(pattern, p, end, &line_end);
+        if (opts->invert) {
+            // Every line before the next match is selected
+            const char *upto = line ? line : end;
+            while (p < upto && !search->stop) {
+                const char *stop = (const char *)memchr(p, '\n', (size_t)(upto - p));
+                stop = stop ? stop : upto;
+                grep_select(search, p, stop, &counted);
+                p = stop + 1;
+            }
+            if (!line) {
+                break;
+            }
+        } else {
+            if (!line) {
+                break;
+            }
+            grep_select(search, line, line_end, &counted);
+        }
+        p = line_end < end ? line_end + 1 : end;
+    }
+    if (opts->line_numbers) {
+        search->lines += text_count_lines(counted, (size_t)(end - counted));
+    }
+}
+
+static bool grep_is_binary(const char *buf, size_t len) {
+    return memchr(buf, '\0', len < GREP_BINARY_PROBE ? len : GREP_BINARY_PROBE) != NULL;
+}
+
+// Read a stream a block at a time, searching whole lines as they arrive
+static void grep_blocks(GrepSearch *search, int fd, const char *path) {
+    size_t cap = search->run->opts->block_size;
+    char *buf = (char *)malloc(cap);
+    if (!buf) {
+        grep_error(search, path, strerror(ENOMEM));
+        return;
+    }
+
+    size_t have = 0;
+    bool first = true;
+    bool eof = false;
+    while (!eof && !search->stop && !atomic_load(&search->run->stop)) {
+        ssize_t n = read(fd, buf + have, cap - have);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            grep_error(search, path, strerror(errno));
+            break;
+        }
+        eof = n == 0;
+        if (first && n > 0) {
+            search->binary = grep_is_binary(buf, (size_t)n);
+            first = false;
+        }
+        have += (size_t)n;
+
+        // Keep a partial last line for the next block
+        size_t usable = have;
+        if (!eof) {
+            const char *newline = (const char *)memrchr(buf, '\n', have);
+            if (!newline) {
+                if (have == cap) {
+                    char *grown = (char *)realloc(buf, cap * 2);
+                    if (!grown) {
+                        grep_error(search, path, strerror(ENOMEM));
+                        break;
+                    }
+                    buf = grown;
+                    cap *= 2;
+                }
+                continue;
+            }
+            usable = (size_t)(newline - buf) + 1;
+        }
+        grep_lines(search, buf, usable);
+        memmove(buf, buf + usable, have - usable);
+        have -= usable;
+        grep_stream(search);
+    }
+    free(buf);
+}
+
+static void grep_file(GrepSearch *search, const char *path) {
+    bool is_stdin = strcmp(path, "-") == 0;
+    search->name = is_stdin ? "(standard input)" : path;
+    // O_NONBLOCK so a FIFO without a writer cannot hang the open
+    int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        grep_error(search, path, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        grep_error(search, path, strerror(errno));
+    } else if (S_ISDIR(st.st_mode)) {
+        grep_error(search, path, "Is a directory");
+    } else if (S_ISREG(st.st_mode) && st.st_size > 0 && !is_stdin) {
+        char *map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            grep_blocks(search, fd, path);
+        } else {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            search->binary = grep_is_binary(map, (size_t)st.st_size);
+            grep_lines(search, map, (size_t)st.st_size);
+            munmap(map, (size_t)st.st_size);
+        }
+    } else if (!S_ISREG(st.st_mode) || is_stdin) {
+        // A FIFO or device named on the command line is read like stdin
+        if (!is_stdin) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        }
+        grep_blocks(search, fd, path);
+    }
+    if (!is_stdin) {
+        close(fd);
+    }
+
+    const GrepOptions *opts = search->run->opts;
+    char line[PATH_MAX + 64];
+    int len = 0;
+    if (opts->quiet) {
+        len = 0;
+    } else if (opts->count) {
+        len = search->run->with_name ?
+              snprintf(line, sizeof(line), "%s:%" PRIu64 "\n", search->name, search->matches) :
+              snprintf(line, sizeof(line), "%" PRIu64 "\n", search->matches);
+    } else if (opts->files_only && search->matches > 0) {
+        len = snprintf(line, sizeof(line), "%s\n", search->name);
+    }
+    if (len > 0) {
+        grep_write(search, line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+    search->slot->matched = search->matches > 0;
+}
+
+static void *grep_worker(void *arg) {
+    GrepRun *run = (GrepRun *)arg;
+    for (;;) {
+        int index = atomic_fetch_add(&run->next, 1);
+        if (index >= run->count) {
+            break;
+        }
+        GrepSearch search;
+        memset(&search, 0, sizeof(search));
+        search.run = run;
+        search.slot = &run->slots[index];
+        search.index = index;
+        if (!atomic_load(&run->stop)) {
+            grep_file(&search, run->files[index]);
+        }
+
+        pthread_mutex_lock(&run->lock);
+        search.slot->done = true;
+        pthread_cond_broadcast(&run->done);
+        pthread_mutex_unlock(&run->lock);
+    }
+    return NULL;
+}
+
+// Regular files under path, in directory order
+static void grep_collect(const char *path, char ***files, int *count, int *capacity) {
+    struct stat st;
+    if (*count == *capacity) {
+        int cap = *capacity ? *capacity * 2 : 64;
+        char **grown = (char **)realloc(*files, (size_t)cap * sizeof(char *));
+        if (!grown) {
+            return;
+        }
+        *files = grown;
+        *capacity = cap;
+    }
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        (*files)[(*count)++] = strdup(path);
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        (*files)[(*count)++] = strdup(path);
+        return;
+    }
+    size_t path_len = strlen(path);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' ||
+            (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        char *child = (char *)malloc(path_len + strlen(entry->d_name) + 2);
+        if (!child) {
+            continue;
+        }
+        sprintf(child, path_len > 0 && path[path_len - 1] == '/' ? "%s%s" : "%s/%s", path, entry->d_name);
+        // Like grep -r: symlinks are only followed on the command line,
+        // and FIFOs, sockets and devices are skipped
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            type = lstat(child, &st) != 0 ? DT_UNKNOWN :
+                   S_ISDIR(st.st_mode) ? DT_DIR :
+                   S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            grep_collect(child, files, count, capacity);
+            free(child);
+        } else if (type == DT_REG) {
+            if (*count == *capacity) {
+                int cap = *capacity * 2;
+                char **grown = (char **)realloc(*files, (size_t)cap * sizeof(char *));
+                if (!grown) {
+                    free(child);
+                    continue;
+                }
+                *files = grown;
+                *capacity = cap;
+            }
+            (*files)[(*count)++] = child;
+        } else {
+            free(child);
+        }
+    }
+    closedir(dir);
+}
+
+int grep_run(const GrepOptions *opts, char **files, int count, FILE *out) {
+    GrepRun run;
+    memset(&run, 0, sizeof(run));
+    run.opts = opts;
+    run.out = out;
+    if (grep_compile(&run.pattern, opts) != 0) {
+        return 2;
+    }
+
+    // The file list, with directories expanded for -r
+    static char *standard_input[] = { "-" };
+    char **list = NULL;
+    int list_count = 0, list_capacity = 0;
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+    if (opts->recursive) {
+        for (int i = 0; i < count; i++) {
+            grep_collect(files[i], &list, &list_count, &list_capacity);
+        }
+        run.files = list;
+        run.count = list_count;
+    } else {
+        run.files = files;
+        run.count = count;
+    }
+    run.with_name = opts->with_filename >= 0 ? opts->with_filename : run.count > 1 || opts->recursive;
+
+    run.slots = (GrepSlot *)calloc(run.count ? (size_t)run.count : 1, sizeof(GrepSlot));
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.done, NULL);
+    atomic_init(&run.next, 0);
+    atomic_init(&run.stop, false);
+
+    int threads = opts->jobs < run.count ? opts->jobs : run.count;
+    pthread_t *workers = (pthread_t *)calloc(threads > 0 ? (size_t)threads : 1, sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; run.slots && workers && i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, grep_worker, &run) == 0) {
+            started++;
+        }
+    }
+    if (started == 0 && run.slots) {
+        grep_worker(&run);
+    }
+
+    // Print each file's output in order once it is complete. The worker
+    // on the file being printed writes its output out as it goes.
+    bool matched = false, failed = false;
+    fflush(out);
+    for (int i = 0; run.slots && i < run.count; i++) {
+        GrepSlot *slot = &run.slots[i];
+        pthread_mutex_lock(&run.lock);
+        run.printing = i;
+        while (!slot->done) {
+            pthread_cond_wait(&run.done, &run.lock);
+        }
+        pthread_mutex_unlock(&run.lock);
+        fwrite(slot->out, 1, slot->len, out);
+        free(slot->out);
+        matched |= slot->matched;
+        failed |= slot->failed;
+    }
+    fflush(out);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(run.slots);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.done);
+    for (int i = 0; i < list_count; i++) {
+        free(list[i]);
+    }
+    free(list);
+    grep_pattern_free(&run.pattern);
+
+    // A match wins over errors only with -q, as in grep
+    if (matched && (!failed || opts->quiet)) {
+        return 0;
+    }
+    return failed ? 2 : 1;
+}
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include "../../include/shell/jobaffinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Placement state
+static PlacementPolicy placement_policy = PLACEMENT_OFF;
+static int next_round_robin = 0;
+
+// Topology order, built on first use
+static int cpu_order[JOB_AFFINITY_MAX_CPUS];
+static int cpu_order_count = -1;
+static JobCpuSet cpu_siblings[JOB_AFFINITY_MAX_CPUS];
+
+void job_cpuset_clear(JobCpuSet *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+void job_cpuset_add(JobCpuSet *set, int cpu) {
+    if (cpu >= 0 && cpu < JOB_AFFINITY_MAX_CPUS) {
+        set->bits[cpu / 64] |= 1ULL << (cpu % 64);
+    }
+}
+
+bool job_cpuset_has(const JobCpuSet *set, int cpu) {
+    if (cpu < 0 || cpu >= JOB_AFFINITY_MAX_CPUS) {
+        return false;
+    }
+    return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+bool job_cpuset_empty(const JobCpuSet *set) {
+    for (int i = 0; i < JOB_AFFINITY_WORDS; i++) {
+        if (set->bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse a CPU list
+int job_affinity_parse(const char *list, JobCpuSet *set) {
+    job_cpuset_clear(set);
+    const char *p = list;
+
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= JOB_AFFINITY_MAX_CPUS) {
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= JOB_AFFINITY_MAX_CPUS) {
+                return -1;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            job_cpuset_add(set, (int)cpu);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return -1;
+        } else {
+            break;
+        }
+    }
+
+    return job_cpuset_empty(set) ? -1 : 0;
+}
+
+// Format a CPU set as a list with ranges
+const char *job_affinity_format(const JobCpuSet *set, char *buf, int size) {
+    int len = 0;
+    buf[0] = '\0';
+
+    for (int cpu = 0; cpu < JOB_AFFINITY_MAX_CPUS && len < size; cpu++) {
+        if (!job_cpuset_has(set, cpu)) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < JOB_AFFINITY_MAX_CPUS && job_cpuset_has(set, last + 1)) {
+            last++;
+        }
+        if (last == cpu) {
+            len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", cpu);
+        } else {
+            len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", cpu, last);
+        }
+        cpu = last;
+    }
+
+    if (len == 0) {
+        snprintf(buf, size, "-");
+    }
+    return buf;
+}
+
+void job_affinity_set_policy(PlacementPolicy policy) {
+    placement_policy = policy;
+    next_round_robin = 0;
+}
+
+PlacementPolicy job_affinity_get_policy(void) {
+    return placement_policy;
+}
+
+const char *job_affinity_policy_name(PlacementPolicy policy) {
+    switch (policy) {
+        case PLACEMENT_OFF:          return "off";
+        case PLACEMENT_ROUND_ROBIN:  return "rr";
+        case PLACEMENT_LEAST_LOADED: return "least";
+    }
+    return "?";
+}
+
+// Build the CPU order: first thread of every core, then second threads, ...
+static void build_cpu_order(void) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < n && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    int rank[JOB_AFFINITY_MAX_CPUS];
+    int count = 0;
+    int limit = CPU_SETSIZE < JOB_AFFINITY_MAX_CPUS ? CPU_SETSIZE : JOB_AFFINITY_MAX_CPUS;
+
+    for (int cpu = 0; cpu < limit; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        // Position of this CPU among its SMT siblings
+        char path[128];
+        char list[256];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        job_cpuset_clear(&cpu_siblings[cpu]);
+        FILE *f = fopen(path, "r");
+        if (f) {
+            if (fgets(list, sizeof(list), f)) {
+                job_affinity_parse(list, &cpu_siblings[cpu]);
+            }
+            fclose(f);
+        }
+        job_cpuset_add(&cpu_siblings[cpu], cpu);
+
+        rank[cpu] = 0;
+        for (int other = 0; other < cpu; other++) {
+            if (job_cpuset_has(&cpu_siblings[cpu], other)) {
+                rank[cpu]++;
+            }
+        }
+        cpu_order[count++] = cpu;
+    }
+
+    // Stable insertion sort by sibling rank keeps CPU numbers ascending within a rank
+    for (int i = 1; i < count; i++) {
+        int cpu = cpu_order[i];
+        int j = i;
+        while (j > 0 && rank[cpu_order[j - 1]] > rank[cpu]) {
+            cpu_order[j] = cpu_order[j - 1];
+            j--;
+        }
+        cpu_order[j] = cpu;
+    }
+
+    cpu_order_count = count;
+}
+
+int job_affinity_cpu_order(const int **order) {
+    if (cpu_order_count < 0) {
+        build_cpu_order();
+    }
+    *order = cpu_order;
+    return cpu_order_count;
+}
+
+// Pick a CPU for a new job
+int job_affinity_place(const int *load) {
+    const int *order;
+    int count = job_affinity_cpu_order(&order);
+    if (count <= 0) {
+        return -1;
+    }
+
+    if (placement_policy == PLACEMENT_ROUND_ROBIN) {
+        int cpu = order[next_round_robin % count];
+        next_round_robin = (next_round_robin + 1) % count;
+        return cpu;
+    }
+
+    if (placement_policy == PLACEMENT_LEAST_LOADED) {
+        // Jobs on the CPU itself weigh most, jobs on its SMT siblings break ties
+        int best = order[0];
+        long best_score = -1;
+        for (int i = 0; i < count; i++) {
+            int cpu = order[i];
+            long score = (long)load[cpu] * JOB_AFFINITY_MAX_CPUS;
+            for (int j = 0; j < count; j++) {
+                int other = order[j];
+                if (other != cpu && job_cpuset_has(&cpu_siblings[cpu], other)) {
+                    score += load[other];
+                }
+            }
+            if (best_score < 0 || score < best_score) {
+                best = cpu;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+
+    return -1;
+}
+
+// Restrict the child to the set, before exec
+void job_affinity_apply_child(const JobCpuSet *set) {
+    if (job_cpuset_empty(set)) {
+        return;
+    }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    int limit = CPU_SETSIZE < JOB_AFFINITY_MAX_CPUS ? CPU_SETSIZE : JOB_AFFINITY_MAX_CPUS;
+    for (int cpu = 0; cpu < limit; cpu++) {
+        if (job_cpuset_has(set, cpu)) {
+            CPU_SET(cpu, &mask);
+        }
+    }
+    sched_setaffinity(0, sizeof(mask), &mask);
+}
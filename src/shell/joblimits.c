@@ -0,0 +1,345 @@
+#include "../../include/shell/joblimits.h"
+#include "../../include/shell/env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+// Period used for cpu.max, in microseconds
+#define JOB_LIMITS_CPU_PERIOD 100000
+
+// How far rusage may fall short of RLIMIT_CPU for a job it killed, in microseconds
+#define JOB_LIMITS_CPU_SLACK 50000
+
+// Defaults applied to every job
+static JobLimits default_limits = { 0, 0, 0 };
+
+// Delegated cgroup v2 directory: -1 not probed yet, 0 unavailable, 1 usable
+static int cgroup_state = -1;
+static char cgroup_base[PATH_MAX / 2];
+
+void job_limits_get_default(JobLimits *limits) {
+    *limits = default_limits;
+}
+
+void job_limits_set_default(const JobLimits *limits) {
+    default_limits = *limits;
+}
+
+bool job_limits_any(const JobLimits *limits) {
+    return limits && (limits->cpu_percent > 0 || limits->mem_bytes > 0 || limits->cpu_seconds > 0);
+}
+
+// Parse a size with an optional K/M/G/T suffix
+int job_limits_parse_size(const char *str, unsigned long long *bytes) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (errno != 0 || end == str) {
+        return -1;
+    }
+
+    switch (*end) {
+        case 'T': case 't': value <<= 10; // fall through
+        case 'G': case 'g': value <<= 10; // fall through
+        case 'M': case 'm': value <<= 10; // fall through
+        case 'K': case 'k': value <<= 10; end++; break;
+        case '\0': break;
+        default: return -1;
+    }
+    if (*end == 'B' || *end == 'b') {
+        end++;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    *bytes = value;
+    return 0;
+}
+
+// Parse "50%" or "50"
+int job_limits_parse_percent(const char *str, int *percent) {
+    char *end;
+    long value = strtol(str, &end, 10);
+    if (end == str || value <= 0 || value > 100000) {
+        return -1;
+    }
+    if (*end == '%') {
+        end++;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    *percent = (int)value;
+    return 0;
+}
+
+// Read a small file into buf; returns bytes read or -1
+static ssize_t read_small_file(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+// Write a string to a cgroup control file
+static int write_control(const char *dir, const char *file, const char *value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+// Does the subtree_control of dir enable both cpu and memory?
+static bool controllers_enabled(const char *dir) {
+    char path[PATH_MAX];
+    char buf[256];
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", dir);
+    if (read_small_file(path, buf, sizeof(buf)) < 0) {
+        return false;
+    }
+
+    bool cpu = false, memory = false;
+    for (char *tok = strtok(buf, " \n"); tok; tok = strtok(NULL, " \n")) {
+        if (strcmp(tok, "cpu") == 0) {
+            cpu = true;
+        } else if (strcmp(tok, "memory") == 0) {
+            memory = true;
+        }
+    }
+    return cpu && memory;
+}
+
+// Find a cgroup v2 directory we may create children in
+static void probe_cgroup(void) {
+    cgroup_state = 0;
+
+    // CSHELL_CGROUP names a delegated subtree explicitly, otherwise try our own cgroup
+    char *configured = env_get("CSHELL_CGROUP");
+    if (configured && configured[0]) {
+        strncpy(cgroup_base, configured, sizeof(cgroup_base) - 1);
+    } else {
+        char buf[PATH_MAX];
+        if (read_small_file("/proc/self/cgroup", buf, sizeof(buf)) < 0) {
+            return;
+        }
+        char *line = strstr(buf, "0::");
+        if (!line) {
+            return;
+        }
+        line += 3;
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(cgroup_base, sizeof(cgroup_base), "/sys/fs/cgroup%s",
+                 strcmp(line, "/") == 0 ? "" : line);
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup_base);
+    if (access(path, W_OK) != 0) {
+        return;
+    }
+
+    if (!controllers_enabled(cgroup_base)) {
+        write_control(cgroup_base, "cgroup.subtree_control", "+cpu +memory");
+        if (!controllers_enabled(cgroup_base)) {
+            return;
+        }
+    }
+
+    cgroup_state = 1;
+}
+
+const char *job_limits_cgroup_base(void) {
+    if (cgroup_state < 0) {
+        probe_cgroup();
+    }
+    return cgroup_state == 1 ? cgroup_base : NULL;
+}
+
+// Create the job's cgroup and open its cgroup.procs for the child
+int job_limits_prepare(const JobLimits *limits, int job_id, JobLimitHandle *handle) {
+    handle->cgroup_path = NULL;
+    handle->procs_fd = -1;
+
+    const char *base = job_limits_cgroup_base();
+    if (!base || (limits->cpu_percent <= 0 && limits->mem_bytes == 0)) {
+        return 0;
+    }
+
+    char path[PATH_MAX / 2 + 64];
+    snprintf(path, sizeof(path), "%s/cshell-%d-job%d", base, (int)getpid(), job_id);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    // A cgroup without its limits written would let the job run unlimited
+    char value[64];
+    int rc = 0;
+    if (limits->cpu_percent > 0) {
+        snprintf(value, sizeof(value), "%ld %d",
+                 (long)limits->cpu_percent * JOB_LIMITS_CPU_PERIOD / 100, JOB_LIMITS_CPU_PERIOD);
+        rc = write_control(path, "cpu.max", value);
+    }
+    if (rc == 0 && limits->mem_bytes > 0) {
+        snprintf(value, sizeof(value), "%llu", limits->mem_bytes);
+        rc = write_control(path, "memory.max", value);
+    }
+
+    char procs[PATH_MAX];
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+    if (rc == 0) {
+        handle->procs_fd = open(procs, O_WRONLY | O_CLOEXEC);
+    }
+    if (handle->procs_fd < 0) {
+        int saved_errno = errno;
+        rmdir(path);
+        errno = saved_errno;
+        return -1;
+    }
+
+    handle->cgroup_path = strdup(path);
+    return 0;
+}
+
+// Join the cgroup or fall back to rlimits, in the child before exec
+void job_limits_apply_child(const JobLimits *limits, const JobLimitHandle *handle) {
+    bool joined = false;
+    if (handle->procs_fd >= 0) {
+        // Format our pid by hand, snprintf is not async-signal-safe
+        char digits[24];
+        int len = 0;
+        for (pid_t pid = getpid(); pid > 0; pid /= 10) {
+            digits[len++] = (char)('0' + pid % 10);
+        }
+        char buf[24];
+        for (int i = 0; i < len; i++) {
+            buf[i] = digits[len - 1 - i];
+        }
+        joined = write(handle->procs_fd, buf, len) == len;
+        close(handle->procs_fd);
+    }
+
+    if (!joined && limits->mem_bytes > 0) {
+        struct rlimit rl = { limits->mem_bytes, limits->mem_bytes };
+        setrlimit(RLIMIT_AS, &rl);
+    }
+
+    // No cgroup knob for a total CPU budget, RLIMIT_CPU covers both cases
+    if (limits->cpu_seconds > 0) {
+        struct rlimit rl = { limits->cpu_seconds, limits->cpu_seconds + 1 };
+        setrlimit(RLIMIT_CPU, &rl);
+    }
+}
+
+void job_limits_spawned(JobLimitHandle *handle) {
+    if (handle->procs_fd >= 0) {
+        close(handle->procs_fd);
+        handle->procs_fd = -1;
+    }
+}
+
+// Value of "key N" in a flat-keyed cgroup file
+static long long read_counter(const char *dir, const char *file, const char *key) {
+    char path[PATH_MAX];
+    char buf[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if (read_small_file(path, buf, sizeof(buf)) < 0) {
+        return 0;
+    }
+
+    size_t key_len = strlen(key);
+    char *line = buf;
+    while (line && *line) {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+            return atoll(line + key_len + 1);
+        }
+        line = strchr(line, '\n');
+        if (line) {
+            line++;
+        }
+    }
+    return 0;
+}
+
+// Read limit-hit counters; called when the job is collected
+unsigned int job_limits_collect(const JobLimits *limits, const JobLimitHandle *handle,
+                                int term_signal, uint64_t cpu_us) {
+    unsigned int events = 0;
+
+    if (handle->cgroup_path) {
+        if (read_counter(handle->cgroup_path, "memory.events", "max") > 0) {
+            events |= LIMIT_EVENT_MEM_MAX;
+        }
+        if (read_counter(handle->cgroup_path, "memory.events", "oom_kill") > 0) {
+            events |= LIMIT_EVENT_OOM_KILL;
+        }
+        if (read_counter(handle->cgroup_path, "cpu.stat", "nr_throttled") > 0) {
+            events |= LIMIT_EVENT_CPU_THROTTLED;
+        }
+    }
+
+    // RLIMIT_CPU delivers SIGXCPU at the soft limit and SIGKILL at the hard
+    // one. Either may also come from kill, so blame the limit only when the
+    // job used its CPU time; rusage lags the kernel's own count by up to a
+    // few ticks.
+    if (limits->cpu_seconds > 0 && (term_signal == SIGXCPU || term_signal == SIGKILL) &&
+        cpu_us + JOB_LIMITS_CPU_SLACK >= (uint64_t)limits->cpu_seconds * 1000000) {
+        events |= LIMIT_EVENT_CPU_TIME;
+    }
+
+    return events;
+}
+
+void job_limits_release(JobLimitHandle *handle) {
+    job_limits_spawned(handle);
+    if (handle->cgroup_path) {
+        rmdir(handle->cgroup_path);
+        free(handle->cgroup_path);
+        handle->cgroup_path = NULL;
+    }
+}
+
+const char *job_limits_describe(unsigned int events, char *buf, int size) {
+    static const struct {
+        unsigned int flag;
+        const char *name;
+    } names[] = {
+        { LIMIT_EVENT_MEM_MAX, "mem" },
+        { LIMIT_EVENT_OOM_KILL, "oom" },
+        { LIMIT_EVENT_CPU_THROTTLED, "cpu" },
+        { LIMIT_EVENT_CPU_TIME, "time" },
+    };
+
+    int len = 0;
+    buf[0] = '\0';
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if ((events & names[i].flag) && len < size) {
+            len += snprintf(buf + len, size - len, "%s%s", len ? "," : "", names[i].name);
+        }
+    }
+    if (len == 0) {
+        snprintf(buf, size, "-");
+    }
+    return buf;
+}
@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include "../../include/shell/joboutput.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Capture ring for one job
+struct JobOutput {
+    int mem_fd;                 // memfd backing the ring
+    int pipe_fd;                // Read end of the job's stdout/stderr, -1 at EOF
+    char *base;                 // Ring mapped twice, 2 * capacity bytes
+    size_t capacity;
+    unsigned long long head;    // Total bytes captured
+    bool passthrough;
+    bool eof;
+    bool released;
+    pthread_mutex_t lock;
+    pthread_cond_t eof_cond;
+    struct JobOutput *next;
+};
+
+// Active rings, drained by a single capture thread
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static JobOutput *registry = NULL;
+static int wake_pipe[2] = { -1, -1 };
+static bool capture_running = false;
+
+// Free a ring; only the capture thread calls this
+static void job_output_free(JobOutput *output) {
+    if (output->pipe_fd >= 0) {
+        close(output->pipe_fd);
+    }
+    munmap(output->base, output->capacity * 2);
+    close(output->mem_fd);
+    pthread_mutex_destroy(&output->lock);
+    pthread_cond_destroy(&output->eof_cond);
+    free(output);
+}
+
+// Move whatever is readable from the pipe into the ring
+static void job_output_fill(JobOutput *output) {
+    pthread_mutex_lock(&output->lock);
+
+    // The mirror mapping lets a full ring's worth land contiguously
+    char *dst = output->base + (output->head % output->capacity);
+    ssize_t n = read(output->pipe_fd, dst, output->capacity);
+
+    if (n > 0) {
+        output->head += (unsigned long long)n;
+        if (output->passthrough) {
+            ssize_t off = 0;
+            while (off < n) {
+                ssize_t w = write(STDOUT_FILENO, dst + off, n - off);
+                if (w < 0 && errno != EINTR) {
+                    break;
+                }
+                if (w > 0) {
+                    off += w;
+                }
+            }
+        }
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+        close(output->pipe_fd);
+        output->pipe_fd = -1;
+        output->eof = true;
+        pthread_cond_broadcast(&output->eof_cond);
+    }
+
+    pthread_mutex_unlock(&output->lock);
+}
+
+// Capture thread: poll every open job pipe and append to its ring
+static void *job_output_thread(void *arg) {
+    (void)arg;
+    struct pollfd *pfds = NULL;
+    JobOutput **polled = NULL;
+    int slots = 0;
+
+    for (;;) {
+        // Drop released rings and collect the pipes still open
+        pthread_mutex_lock(&registry_lock);
+        int count = 1;
+        for (JobOutput **link = &registry; *link;) {
+            JobOutput *output = *link;
+            if (output->released) {
+                *link = output->next;
+                job_output_free(output);
+                continue;
+            }
+            if (output->pipe_fd >= 0) {
+                count++;
+            }
+            link = &output->next;
+        }
+
+        if (count > slots) {
+            slots = count * 2;
+            pfds = (struct pollfd *)realloc(pfds, slots * sizeof(struct pollfd));
+            polled = (JobOutput **)realloc(polled, slots * sizeof(JobOutput *));
+            if (!pfds || !polled) {
+                pthread_mutex_unlock(&registry_lock);
+                return NULL;
+            }
+        }
+
+        pfds[0].fd = wake_pipe[0];
+        pfds[0].events = POLLIN;
+        int n = 1;
+        for (JobOutput *output = registry; output; output = output->next) {
+            if (output->pipe_fd >= 0) {
+                pfds[n].fd = output->pipe_fd;
+                pfds[n].events = POLLIN;
+                polled[n] = output;
+                n++;
+            }
+        }
+        pthread_mutex_unlock(&registry_lock);
+
+        if (poll(pfds, n, -1) < 0) {
+            continue;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        // Rings are only freed by this thread, so the pointers stay valid
+        for (int i = 1; i < n; i++) {
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                job_output_fill(polled[i]);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Nudge the capture thread to rescan the registry
+static void job_output_wake(void) {
+    char c = 0;
+    if (write(wake_pipe[1], &c, 1) < 0) {
+        // Pipe full means a wakeup is already pending
+    }
+}
+
+// Start the capture thread on first use
+static int job_output_start(void) {
+    if (capture_running) {
+        return 0;
+    }
+
+    if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        return -1;
+    }
+
+    // Signals stay with the main thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, job_output_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0) {
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+        wake_pipe[0] = wake_pipe[1] = -1;
+        return -1;
+    }
+
+    pthread_detach(thread);
+    capture_running = true;
+    return 0;
+}
+
+// Create a capture ring
+JobOutput *job_output_create(size_t capacity, int *child_fd) {
+    if (!child_fd || job_output_start() != 0) {
+        return NULL;
+    }
+
+    // Both halves of the mirror must be page aligned
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (capacity == 0) {
+        capacity = JOB_OUTPUT_DEFAULT_SIZE;
+    }
+    capacity = (capacity + page - 1) / page * page;
+
+    JobOutput *output = (JobOutput *)calloc(1, sizeof(JobOutput));
+    if (!output) {
+        return NULL;
+    }
+    output->capacity = capacity;
+    output->pipe_fd = -1;
+
+    output->mem_fd = memfd_create("cshell-job", MFD_CLOEXEC);
+    if (output->mem_fd < 0 || ftruncate(output->mem_fd, (off_t)capacity) != 0) {
+        goto fail;
+    }
+
+    // Reserve 2 * capacity and map the memfd into both halves
+    output->base = mmap(NULL, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (output->base == MAP_FAILED) {
+        output->base = NULL;
+        goto fail;
+    }
+    if (mmap(output->base, capacity, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, output->mem_fd, 0) == MAP_FAILED ||
+        mmap(output->base + capacity, capacity, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, output->mem_fd, 0) == MAP_FAILED) {
+        goto fail;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        goto fail;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    output->pipe_fd = fds[0];
+    *child_fd = fds[1];
+
+    pthread_mutex_init(&output->lock, NULL);
+    pthread_cond_init(&output->eof_cond, NULL);
+
+    pthread_mutex_lock(&registry_lock);
+    output->next = registry;
+    registry = output;
+    pthread_mutex_unlock(&registry_lock);
+    job_output_wake();
+
+    return output;
+
+fail:
+    if (output->base) {
+        munmap(output->base, capacity * 2);
+    }
+    if (output->mem_fd >= 0) {
+        close(output->mem_fd);
+    }
+    free(output);
+    return NULL;
+}
+
+// Hand the ring back to the capture thread
+void job_output_release(JobOutput *output) {
+    if (!output) {
+        return;
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    output->released = true;
+    pthread_mutex_unlock(&registry_lock);
+    job_output_wake();
+}
+
+// Write the captured tail to fd; caller holds output->lock
+static size_t job_output_write_tail_locked(JobOutput *output, int fd, size_t max_bytes) {
+    size_t avail = output->head < output->capacity ? (size_t)output->head : output->capacity;
+    size_t len = max_bytes < avail ? max_bytes : avail;
+    const char *start = output->base + ((output->head - len) % output->capacity);
+
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = write(fd, start + off, len - off);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += (size_t)w;
+    }
+    return off;
+}
+
+// Write the captured tail to fd
+size_t job_output_write_tail(JobOutput *output, int fd, size_t max_bytes) {
+    if (!output) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&output->lock);
+    size_t written = job_output_write_tail_locked(output, fd, max_bytes);
+    pthread_mutex_unlock(&output->lock);
+    return written;
+}
+
+// Bytes captured so far
+unsigned long long job_output_total(JobOutput *output) {
+    if (!output) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&output->lock);
+    unsigned long long total = output->head;
+    pthread_mutex_unlock(&output->lock);
+    return total;
+}
+
+// Replay the tail to the terminal and forward everything after it
+size_t job_output_attach(JobOutput *output, size_t replay_bytes) {
+    if (!output) {
+        return 0;
+    }
+
+    // Holding the lock keeps the capture thread from slipping data in
+    // between the replay and the switch to passthrough
+    pthread_mutex_lock(&output->lock);
+    size_t written = job_output_write_tail_locked(output, STDOUT_FILENO, replay_bytes);
+    output->passthrough = true;
+    pthread_mutex_unlock(&output->lock);
+    return written;
+}
+
+// Stop forwarding output to the terminal
+void job_output_detach(JobOutput *output) {
+    if (!output) {
+        return;
+    }
+
+    pthread_mutex_lock(&output->lock);
+    output->passthrough = false;
+    pthread_mutex_unlock(&output->lock);
+}
+
+// Wait for the job to close its output
+bool job_output_wait_eof(JobOutput *output, int timeout_ms) {
+    if (!output) {
+        return true;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&output->lock);
+    while (!output->eof) {
+        if (pthread_cond_timedwait(&output->eof_cond, &output->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    bool eof = output->eof;
+    pthread_mutex_unlock(&output->lock);
+    return eof;
+}
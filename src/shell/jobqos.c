@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include "../../include/shell/jobqos.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// ioprio_set(2) encoding, glibc has no wrapper or constants
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_VALUE(cls, data) (((cls) << IOPRIO_CLASS_SHIFT) | (data))
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_NONE 0
+#define IOPRIO_CLASS_RT   1
+#define IOPRIO_CLASS_BE   2
+#define IOPRIO_CLASS_IDLE 3
+
+// Nice increment for background jobs
+#define JOB_QOS_BACKGROUND_NICE 10
+
+// Class given to background jobs
+static JobQos default_qos = JOB_QOS_BACKGROUND;
+
+void job_qos_set_default(JobQos qos) {
+    default_qos = qos == JOB_QOS_AUTO ? JOB_QOS_BACKGROUND : qos;
+}
+
+JobQos job_qos_get_default(void) {
+    return default_qos;
+}
+
+const char *job_qos_name(JobQos qos) {
+    switch (qos) {
+        case JOB_QOS_AUTO:        return "auto";
+        case JOB_QOS_INTERACTIVE: return "interactive";
+        case JOB_QOS_BACKGROUND:  return "background";
+        case JOB_QOS_IDLE:        return "idle";
+    }
+    return "?";
+}
+
+int job_qos_parse(const char *name, JobQos *qos) {
+    if (strcmp(name, "interactive") == 0 || strcmp(name, "fg") == 0) {
+        *qos = JOB_QOS_INTERACTIVE;
+    } else if (strcmp(name, "background") == 0 || strcmp(name, "bg") == 0) {
+        *qos = JOB_QOS_BACKGROUND;
+    } else if (strcmp(name, "idle") == 0) {
+        *qos = JOB_QOS_IDLE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Scheduler policy and I/O priority for a class
+static int qos_policy(JobQos qos) {
+    switch (qos) {
+        case JOB_QOS_BACKGROUND: return SCHED_BATCH;
+        case JOB_QOS_IDLE:       return SCHED_IDLE;
+        default:                 return SCHED_OTHER;
+    }
+}
+
+static int qos_ioprio(JobQos qos) {
+    switch (qos) {
+        case JOB_QOS_BACKGROUND: return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7);
+        case JOB_QOS_IDLE:       return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+        default:                 return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);  // Follows nice
+    }
+}
+
+static int set_ioprio(pid_t pid, int ioprio) {
+#ifdef SYS_ioprio_set
+    return (int)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)pid, ioprio);
+#else
+    (void)pid;
+    (void)ioprio;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Child side, before exec; the child starts with the shell's settings
+void job_qos_apply_child(JobQos qos) {
+    if (qos != JOB_QOS_BACKGROUND && qos != JOB_QOS_IDLE) {
+        return;
+    }
+
+    if (qos == JOB_QOS_IDLE) {
+        setpriority(PRIO_PROCESS, 0, 19);
+    } else {
+        errno = 0;
+        int current = getpriority(PRIO_PROCESS, 0);
+        if (errno == 0) {
+            setpriority(PRIO_PROCESS, 0, current + JOB_QOS_BACKGROUND_NICE);
+        }
+    }
+
+    struct sched_param param = { 0 };
+    sched_setscheduler(0, qos_policy(qos), &param);
+    set_ioprio(0, qos_ioprio(qos));
+}
+
+// Move a running process to a class
+int job_qos_apply(pid_t pid, JobQos qos) {
+    if (qos == JOB_QOS_AUTO) {
+        qos = JOB_QOS_INTERACTIVE;
+    }
+
+    // Nice is relative to the shell's own
+    errno = 0;
+    int base = getpriority(PRIO_PROCESS, 0);
+    if (errno != 0) {
+        base = 0;
+    }
+    int nice_value = base;
+    if (qos == JOB_QOS_BACKGROUND) {
+        nice_value = base + JOB_QOS_BACKGROUND_NICE;
+    } else if (qos == JOB_QOS_IDLE) {
+        nice_value = 19;
+    }
+    if (nice_value > 19) {
+        nice_value = 19;
+    }
+
+    int rc = 0;
+
+    // Policy first: leaving SCHED_IDLE is checked against the current nice
+    struct sched_param param = { 0 };
+    if (sched_setscheduler(pid, qos_policy(qos), &param) != 0) {
+        rc = -1;
+    }
+    if (setpriority(PRIO_PROCESS, pid, nice_value) != 0) {
+        rc = -1;
+    }
+    if (set_ioprio(pid, qos_ioprio(qos)) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+const char *job_qos_describe(pid_t pid, char *buf, int size) {
+    errno = 0;
+    int nice_value = getpriority(PRIO_PROCESS, pid);
+    if (errno != 0) {
+        snprintf(buf, size, "-");
+        return buf;
+    }
+
+    const char *policy;
+    switch (sched_getscheduler(pid)) {
+        case SCHED_OTHER: policy = "other"; break;
+        case SCHED_BATCH: policy = "batch"; break;
+        case SCHED_IDLE:  policy = "idle"; break;
+        case SCHED_FIFO:  policy = "fifo"; break;
+        case SCHED_RR:    policy = "rr"; break;
+        default:          policy = "?"; break;
+    }
+
+    char io[16] = "?";
+#ifdef SYS_ioprio_get
+    int ioprio = (int)syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, (int)pid);
+    if (ioprio >= 0) {
+        static const char *classes[] = { "none", "rt", "be", "idle" };
+        int cls = ioprio >> IOPRIO_CLASS_SHIFT;
+        int data = ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1);
+        if (cls == IOPRIO_CLASS_BE || cls == IOPRIO_CLASS_RT) {
+            snprintf(io, sizeof(io), "%s/%d", classes[cls], data);
+        } else if (cls >= 0 && cls <= IOPRIO_CLASS_IDLE) {
+            snprintf(io, sizeof(io), "%s", classes[cls]);
+        }
+    }
+#endif
+
+    snprintf(buf, size, "nice %d %s %s", nice_value, policy, io);
+    return buf;
+}
@@ -0,0 +1,874 @@
+#define _GNU_SOURCE
+#include "../../include/shell/ls.h"
+#include "../../include/shell/env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define LS_DIRENT_BUFFER (256 * 1024)
+#define LS_OUT_BUFFER (64 * 1024)
+#define LS_ID_CACHE 16
+
+// One directory entry. Names live in the list's arena; offsets stay
+// valid as it grows.
+typedef struct {
+    uint32_t name;
+    uint16_t name_len;
+    uint8_t type;       // DT_*
+    uint8_t stated;
+} LsEntry;
+
+// Metadata, only fetched when the options ask for it
+typedef struct {
+    mode_t mode;
+    nlink_t nlink;
+    uid_t uid;
+    gid_t gid;
+    uint64_t size;
+    uint64_t blocks;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+} LsStat;
+
+// The entries of one directory, or the file operands
+typedef struct {
+    int dirfd;
+    LsEntry *entries;
+    LsStat *stats;      // Parallel to entries when metadata is needed
+    int count;
+    int capacity;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+} LsList;
+
+// Buffered output
+typedef struct {
+    FILE *f;
+    char buf[LS_OUT_BUFFER];
+    size_t len;
+} LsOut;
+
+// Indices into LS_COLORS type codes
+enum {
+    LS_COLOR_DIR,
+    LS_COLOR_LINK,
+    LS_COLOR_EXEC,
+    LS_COLOR_FILE,
+    LS_COLOR_FIFO,
+    LS_COLOR_SOCK,
+    LS_COLOR_BLK,
+    LS_COLOR_CHR,
+    LS_COLOR_COUNT
+};
+
+static const char *ls_color_keys[LS_COLOR_COUNT] = { "di", "ln", "ex", "fi", "pi", "so", "bd", "cd" };
+static const char *ls_color_defaults[LS_COLOR_COUNT] = { "01;34", "01;36", "01;32", NULL, "33", "01;35", "01;33", "01;33" };
+
+// Suffix pattern from LS_COLORS: "*.ext" goes in the hash by extension,
+// any other "*suffix" is checked in turn
+typedef struct {
+    const char *suffix;
+    size_t len;
+    const char *code;
+} LsSuffix;
+
+// LS_COLORS parsed once; parsed again only if the variable changes
+static struct {
+    char *source;       // The LS_COLORS value parsed
+    char *codes;        // Copy cut into NUL-terminated keys and codes
+    const char *types[LS_COLOR_COUNT];
+    LsSuffix *exts;     // Open-addressing table, size a power of two
+    uint32_t ext_size;
+    LsSuffix *others;
+    int other_count;
+    bool parsed;
+} ls_colors;
+
+static uint32_t ls_hash(const char *s, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void ls_colors_free(void) {
+    free(ls_colors.source);
+    free(ls_colors.codes);
+    free(ls_colors.exts);
+    free(ls_colors.others);
+    memset(&ls_colors, 0, sizeof(ls_colors));
+}
+
+static void ls_colors_load(void) {
+    const char *value = env_get("LS_COLORS");
+    if (ls_colors.parsed && (value ? ls_colors.source && strcmp(value, ls_colors.source) == 0 : !ls_colors.source)) {
+        return;
+    }
+    ls_colors_free();
+    ls_colors.parsed = true;
+    memcpy(ls_colors.types, ls_color_defaults, sizeof(ls_colors.types));
+    if (!value || !*value) {
+        return;
+    }
+
+    ls_colors.source = strdup(value);
+    ls_colors.codes = strdup(value);
+    if (!ls_colors.source || !ls_colors.codes) {
+        return;
+    }
+
+    // Size the extension table for every entry at half load
+    uint32_t entries = 1;
+    for (const char *p = value; *p; p++) {
+        entries += *p == ':';
+    }
+    uint32_t size = 16;
+    while (size < entries * 2) {
+        size *= 2;
+    }
+    ls_colors.exts = (LsSuffix *)calloc(size, sizeof(LsSuffix));
+    ls_colors.others = (LsSuffix *)calloc(entries, sizeof(LsSuffix));
+    if (!ls_colors.exts || !ls_colors.others) {
+        return;
+    }
+    ls_colors.ext_size = size;
+
+    char *save = NULL;
+    for (char *item = strtok_r(ls_colors.codes, ":", &save); item; item = strtok_r(NULL, ":", &save)) {
+        char *eq = strchr(item, '=');
+        if (!eq) {
+            continue;
+        }
+        *eq = '\0';
+        const char *code = eq + 1;
+
+        if (item[0] != '*') {
+            for (int i = 0; i < LS_COLOR_COUNT; i++) {
+                if (strcmp(item, ls_color_keys[i]) == 0) {
+                    ls_colors.types[i] = *code ? code : NULL;
+                }
+            }
+            continue;
+        }
+
+        const char *suffix = item + 1;
+        size_t len = strlen(suffix);
+        if (suffix[0] == '.' && !strchr(suffix + 1, '.')) {
+            uint32_t slot = ls_hash(suffix, len) & (size - 1);
+            while (ls_colors.exts[slot].suffix &&
+                   !(ls_colors.exts[slot].len == len && memcmp(ls_colors.exts[slot].suffix, suffix, len) == 0)) {
+                slot = (slot + 1) & (size - 1);
+            }
+            ls_colors.exts[slot] = (LsSuffix){ suffix, len, code };
+        } else if (len > 0) {
+            ls_colors.others[ls_colors.other_count++] = (LsSuffix){ suffix, len, code };
+        }
+    }
+}
+
+// Color for a regular file by its name
+static const char *ls_suffix_color(const char *name, size_t len) {
+    for (int i = 0; i < ls_colors.other_count; i++) {
+        const LsSuffix *s = &ls_colors.others[i];
+        if (s->len <= len && memcmp(name + len - s->len, s->suffix, s->len) == 0) {
+            return s->code;
+        }
+    }
+
+    const char *dot = memrchr(name, '.', len);
+    if (!dot || ls_colors.ext_size == 0) {
+        return NULL;
+    }
+    size_t ext_len = len - (size_t)(dot - name);
+    uint32_t slot = ls_hash(dot, ext_len) & (ls_colors.ext_size - 1);
+    while (ls_colors.exts[slot].suffix) {
+        if (ls_colors.exts[slot].len == ext_len && memcmp(ls_colors.exts[slot].suffix, dot, ext_len) == 0) {
+            return ls_colors.exts[slot].code;
+        }
+        slot = (slot + 1) & (ls_colors.ext_size - 1);
+    }
+    return NULL;
+}
+
+static void ls_flush(LsOut *out) {
+    fwrite(out->buf, 1, out->len, out->f);
+    out->len = 0;
+}
+
+static void ls_write(LsOut *out, const char *s, size_t len) {
+    if (out->len + len > sizeof(out->buf)) {
+        ls_flush(out);
+        if (len > sizeof(out->buf)) {
+            fwrite(s, 1, len, out->f);
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, s, len);
+    out->len += len;
+}
+
+static void ls_puts(LsOut *out, const char *s) {
+    ls_write(out, s, strlen(s));
+}
+
+static void ls_pad(LsOut *out, size_t count) {
+    static const char spaces[] = "                                ";
+    while (count > 0) {
+        size_t n = count < sizeof(spaces) - 1 ? count : sizeof(spaces) - 1;
+        ls_write(out, spaces, n);
+        count -= n;
+    }
+}
+
+static int ls_add(LsList *list, const char *name, size_t len, uint8_t type) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 256;
+        LsEntry *entries = (LsEntry *)realloc(list->entries, (size_t)capacity * sizeof(LsEntry));
+        if (!entries) {
+            return -1;
+        }
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    if (list->names_len + len + 1 > list->names_cap) {
+        size_t cap = list->names_cap ? list->names_cap * 2 : 16384;
+        while (cap < list->names_len + len + 1) {
+            cap *= 2;
+        }
+        char *names = (char *)realloc(list->names, cap);
+        if (!names) {
+            return -1;
+        }
+        list->names = names;
+        list->names_cap = cap;
+    }
+
+    memcpy(list->names + list->names_len, name, len + 1);
+    list->entries[list->count++] = (LsEntry){ (uint32_t)list->names_len, (uint16_t)len, type, 0 };
+    list->names_len += len + 1;
+    return 0;
+}
+
+static void ls_list_free(LsList *list) {
+    if (list->dirfd >= 0 && list->dirfd != AT_FDCWD) {
+        close(list->dirfd);
+    }
+    free(list->entries);
+    free(list->stats);
+    free(list->names);
+}
+
+static bool ls_hidden(const LsOptions *opts, const char *name) {
+    if (name[0] != '.') {
+        return false;
+    }
+    if (opts->all) {
+        return false;
+    }
+    bool dots = name[1] == '\0' || (name[1] == '.' && name[2] == '\0');
+    return !opts->almost_all || dots;
+}
+
+#ifdef SYS_getdents64
+// The kernel's record: a directory is read many entries per syscall
+struct ls_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int ls_read_dir(const LsOptions *opts, LsList *list) {
+    char *buf = (char *)malloc(LS_DIRENT_BUFFER);
+    if (!buf) {
+        return -1;
+    }
+
+    int rc = 0;
+    for (;;) {
+        long n = syscall(SYS_getdents64, list->dirfd, buf, LS_DIRENT_BUFFER);
+        if (n <= 0) {
+            rc = n < 0 ? -1 : 0;
+            break;
+        }
+        for (long pos = 0; pos < n; ) {
+            struct ls_dirent64 *d = (struct ls_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+            if (!ls_hidden(opts, d->d_name) && ls_add(list, d->d_name, strlen(d->d_name), d->d_type) != 0) {
+                rc = -1;
+                break;
+            }
+        }
+        if (rc != 0) {
+            break;
+        }
+    }
+    free(buf);
+    return rc;
+}
+#else
+static int ls_read_dir(const LsOptions *opts, LsList *list) {
+    int fd = dup(list->dirfd);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    struct dirent *entry;
+    int rc = 0;
+    while (rc == 0 && (entry = readdir(d)) != NULL) {
+        if (!ls_hidden(opts, entry->d_name)) {
+            rc = ls_add(list, entry->d_name, strlen(entry->d_name), entry->d_type);
+        }
+    }
+    closedir(d);
+    return rc;
+}
+#endif
+
+static uint8_t ls_type_of(mode_t mode) {
+    switch (mode & S_IFMT) {
+        case S_IFDIR: return DT_DIR;
+        case S_IFLNK: return DT_LNK;
+        case S_IFREG: return DT_REG;
+        case S_IFIFO: return DT_FIFO;
+        case S_IFSOCK: return DT_SOCK;
+        case S_IFBLK: return DT_BLK;
+        case S_IFCHR: return DT_CHR;
+        default: return DT_UNKNOWN;
+    }
+}
+
+// Stat one entry relative to its directory, asking only for what the
+// listing shows
+static int ls_stat(LsList *list, int i, bool full) {
+    LsEntry *entry = &list->entries[i];
+    LsStat *st = &list->stats[i];
+    const char *name = list->names + entry->name;
+
+#ifdef STATX_BASIC_STATS
+    unsigned int mask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+    if (full) {
+        mask |= STATX_NLINK | STATX_UID | STATX_GID | STATX_BLOCKS;
+    }
+    struct statx stx;
+    if (statx(list->dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &stx) != 0) {
+        return -1;
+    }
+    st->mode = stx.stx_mode;
+    st->nlink = stx.stx_nlink;
+    st->uid = stx.stx_uid;
+    st->gid = stx.stx_gid;
+    st->size = stx.stx_size;
+    st->blocks = stx.stx_blocks;
+    st->mtime = stx.stx_mtime.tv_sec;
+    st->mtime_nsec = stx.stx_mtime.tv_nsec;
+#else
+    (void)full;
+    struct stat sb;
+    if (fstatat(list->dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+        return -1;
+    }
+    st->mode = sb.st_mode;
+    st->nlink = sb.st_nlink;
+    st->uid = sb.st_uid;
+    st->gid = sb.st_gid;
+    st->size = (uint64_t)sb.st_size;
+    st->blocks = (uint64_t)sb.st_blocks;
+    st->mtime = sb.st_mtim.tv_sec;
+    st->mtime_nsec = (uint32_t)sb.st_mtim.tv_nsec;
+#endif
+    entry->stated = 1;
+    entry->type = ls_type_of(st->mode);
+    return 0;
+}
+
+// Fetch metadata where the listing needs it: everything for -l, -S and
+// -t; for plain listings only entries d_type left unknown and, when
+// executables are colored or marked, regular files
+static void ls_fetch(const LsOptions *opts, LsList *list, bool color) {
+    bool all = opts->long_format || opts->sort == LS_SORT_SIZE || opts->sort == LS_SORT_TIME;
+    bool exec = opts->classify || (color && ls_colors.types[LS_COLOR_EXEC]);
+
+    if (!list->stats && list->count > 0) {
+        list->stats = (LsStat *)calloc((size_t)list->count, sizeof(LsStat));
+        if (!list->stats) {
+            return;
+        }
+    }
+    for (int i = 0; i < list->count; i++) {
+        LsEntry *entry = &list->entries[i];
+        if (entry->stated) {
+            continue;
+        }
+        if (all || entry->type == DT_UNKNOWN || (exec && entry->type == DT_REG)) {
+            ls_stat(list, i, opts->long_format);
+        }
+    }
+}
+
+static const LsOptions *ls_sort_opts;
+static const LsList *ls_sort_list;
+
+static int ls_compare(const void *a, const void *b) {
+    const LsEntry *x = &ls_sort_list->entries[*(const uint32_t *)a];
+    const LsEntry *y = &ls_sort_list->entries[*(const uint32_t *)b];
+    int rc = 0;
+    if (ls_sort_list->stats && (ls_sort_opts->sort == LS_SORT_SIZE || ls_sort_opts->sort == LS_SORT_TIME)) {
+        const LsStat *sx = &ls_sort_list->stats[*(const uint32_t *)a];
+        const LsStat *sy = &ls_sort_list->stats[*(const uint32_t *)b];
+        if (ls_sort_opts->sort == LS_SORT_SIZE) {
+            rc = sx->size < sy->size ? 1 : sx->size > sy->size ? -1 : 0;
+        } else if (sx->mtime != sy->mtime) {
+            rc = sx->mtime < sy->mtime ? 1 : -1;
+        } else {
+            rc = sx->mtime_nsec < sy->mtime_nsec ? 1 : sx->mtime_nsec > sy->mtime_nsec ? -1 : 0;
+        }
+    }
+    if (rc == 0) {
+        rc = strcmp(ls_sort_list->names + x->name, ls_sort_list->names + y->name);
+    }
+    return ls_sort_opts->reverse ? -rc : rc;
+}
+
+// Listing order as indices into the entries
+static uint32_t *ls_order(const LsOptions *opts, const LsList *list) {
+    uint32_t *order = (uint32_t *)malloc((size_t)(list->count ? list->count : 1) * sizeof(uint32_t));
+    if (!order) {
+        return NULL;
+    }
+    for (int i = 0; i < list->count; i++) {
+        order[i] = (uint32_t)i;
+    }
+    if (opts->sort != LS_SORT_NONE) {
+        ls_sort_opts = opts;
+        ls_sort_list = list;
+        qsort(order, (size_t)list->count, sizeof(uint32_t), ls_compare);
+    } else if (opts->reverse) {
+        for (int i = 0, j = list->count - 1; i < j; i++, j--) {
+            uint32_t t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+    }
+    return order;
+}
+
+static bool ls_is_exec(const LsList *list, int i) {
+    return list->entries[i].stated && (list->stats[i].mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+}
+
+static const char *ls_entry_color(const LsList *list, int i) {
+    const LsEntry *entry = &list->entries[i];
+    switch (entry->type) {
+        case DT_DIR: return ls_colors.types[LS_COLOR_DIR];
+        case DT_LNK: return ls_colors.types[LS_COLOR_LINK];
+        case DT_FIFO: return ls_colors.types[LS_COLOR_FIFO];
+        case DT_SOCK: return ls_colors.types[LS_COLOR_SOCK];
+        case DT_BLK: return ls_colors.types[LS_COLOR_BLK];
+        case DT_CHR: return ls_colors.types[LS_COLOR_CHR];
+        default: break;
+    }
+    if (ls_is_exec(list, i) && ls_colors.types[LS_COLOR_EXEC]) {
+        return ls_colors.types[LS_COLOR_EXEC];
+    }
+    const char *color = ls_suffix_color(list->names + entry->name, entry->name_len);
+    return color ? color : ls_colors.types[LS_COLOR_FILE];
+}
+
+static char ls_indicator(const LsList *list, int i) {
+    switch (list->entries[i].type) {
+        case DT_DIR: return '/';
+        case DT_LNK: return '@';
+        case DT_FIFO: return '|';
+        case DT_SOCK: return '=';
+        case DT_REG: return ls_is_exec(list, i) ? '*' : '\0';
+        default: return '\0';
+    }
+}
+
+// Display width of a name: UTF-8 continuation bytes take no column
+static size_t ls_width(const char *name, size_t len) {
+    size_t width = 0;
+    for (size_t i = 0; i < len; i++) {
+        width += ((unsigned char)name[i] & 0xC0) != 0x80;
+    }
+    return width;
+}
+
+// Name with its color and indicator; returns the columns it took
+static size_t ls_put_name(const LsOptions *opts, LsOut *out, const LsList *list, int i, bool color) {
+    const LsEntry *entry = &list->entries[i];
+    const char *name = list->names + entry->name;
+    const char *code = color ? ls_entry_color(list, i) : NULL;
+    if (code) {
+        ls_puts(out, "\033[");
+        ls_puts(out, code);
+        ls_puts(out, "m");
+    }
+    ls_write(out, name, entry->name_len);
+    if (code) {
+        ls_puts(out, "\033[0m");
+    }
+
+    size_t width = ls_width(name, entry->name_len);
+    char mark = opts->classify ? ls_indicator(list, i) : '\0';
+    if (mark) {
+        ls_write(out, &mark, 1);
+        width++;
+    }
+    return width;
+}
+
+// Pick the most columns that fit the terminal, filling down each column
+static void ls_print_columns(const LsOptions *opts, LsOut *out, const LsList *list,
+                             const uint32_t *order, bool color, size_t term_width) {
+    int n = list->count;
+    size_t *widths = (size_t *)malloc((size_t)n * sizeof(size_t));
+    if (!widths) {
+        return;
+    }
+    size_t min_width = SIZE_MAX;
+    size_t max_width = 0;
+    for (int k = 0; k < n; k++) {
+        const LsEntry *entry = &list->entries[order[k]];
+        widths[k] = ls_width(list->names + entry->name, entry->name_len) +
+                    (opts->classify && ls_indicator(list, (int)order[k]) ? 1 : 0);
+        if (widths[k] < min_width) {
+            min_width = widths[k];
+        }
+        if (widths[k] > max_width) {
+            max_width = widths[k];
+        }
+    }
+
+    // Fewer columns than fit the widest name always works; try more
+    // first, down to that
+    int lower = (int)(term_width / (max_width + 2));
+    int upper = (int)(term_width / (min_width + 2));
+    if (lower < 1) {
+        lower = 1;
+    }
+    if (upper > n) {
+        upper = n;
+    }
+    if (upper < lower) {
+        upper = lower;
+    }
+
+    size_t *col_widths = (size_t *)malloc((size_t)upper * sizeof(size_t));
+    if (!col_widths) {
+        free(widths);
+        return;
+    }
+    int cols = lower;
+    for (int c = upper; c > lower; c--) {
+        int rows = (n + c - 1) / c;
+        size_t total = 0;
+        bool fits = true;
+        for (int col = 0; col < c && fits; col++) {
+            size_t w = 0;
+            for (int row = 0; row < rows; row++) {
+                int k = col * rows + row;
+                if (k < n && widths[k] > w) {
+                    w = widths[k];
+                }
+            }
+            total += w + (col + 1 < c ? 2 : 0);
+            fits = total <= term_width;
+        }
+        if (fits) {
+            cols = c;
+            break;
+        }
+    }
+
+    int rows = (n + cols - 1) / cols;
+    for (int col = 0; col < cols; col++) {
+        col_widths[col] = 0;
+        for (int row = 0; row < rows; row++) {
+            int k = col * rows + row;
+            if (k < n && widths[k] > col_widths[col]) {
+                col_widths[col] = widths[k];
+            }
+        }
+    }
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            int k = col * rows + row;
+            if (k >= n) {
+                break;
+            }
+            size_t used = ls_put_name(opts, out, list, (int)order[k], color);
+            if (col + 1 < cols && k + rows < n) {
+                ls_pad(out, col_widths[col] + 2 - used);
+            }
+        }
+        ls_write(out, "\n", 1);
+    }
+    free(col_widths);
+    free(widths);
+}
+
+// Cached id to name lookups
+typedef struct {
+    unsigned id;
+    char name[32];
+} LsIdName;
+
+static const char *ls_id_name(LsIdName *cache, int *count, unsigned id, bool group) {
+    for (int i = 0; i < *count; i++) {
+        if (cache[i].id == id) {
+            return cache[i].name;
+        }
+    }
+    LsIdName *slot = &cache[*count < LS_ID_CACHE ? (*count)++ : (int)(id % LS_ID_CACHE)];
+    slot->id = id;
+    const char *name = NULL;
+    if (group) {
+        struct group *gr = getgrgid((gid_t)id);
+        name = gr ? gr->gr_name : NULL;
+    } else {
+        struct passwd *pw = getpwuid((uid_t)id);
+        name = pw ? pw->pw_name : NULL;
+    }
+    if (name) {
+        snprintf(slot->name, sizeof(slot->name), "%s", name);
+    } else {
+        snprintf(slot->name, sizeof(slot->name), "%u", id);
+    }
+    return slot->name;
+}
+
+static void ls_print_long(const LsOptions *opts, LsOut *out, const LsList *list,
+                          const uint32_t *order, bool color, bool total) {
+    static LsIdName users[LS_ID_CACHE];
+    static LsIdName groups[LS_ID_CACHE];
+    static int user_count = 0;
+    static int group_count = 0;
+
+    // Field widths and the block total
+    int link_w = 1, user_w = 1, group_w = 1, size_w = 1;
+    uint64_t blocks = 0;
+    char buf[64];
+    for (int k = 0; k < list->count; k++) {
+        int i = (int)order[k];
+        if (!list->entries[i].stated) {
+            continue;
+        }
+        const LsStat *st = &list->stats[i];
+        blocks += st->blocks;
+        int w = snprintf(buf, sizeof(buf), "%lu", (unsigned long)st->nlink);
+        link_w = w > link_w ? w : link_w;
+        w = (int)strlen(ls_id_name(users, &user_count, st->uid, false));
+        user_w = w > user_w ? w : user_w;
+        w = (int)strlen(ls_id_name(groups, &group_count, st->gid, true));
+        group_w = w > group_w ? w : group_w;
+        w = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)st->size);
+        size_w = w > size_w ? w : size_w;
+    }
+    if (total) {
+        int n = snprintf(buf, sizeof(buf), "total %llu\n", (unsigned long long)(blocks / 2));
+        ls_write(out, buf, (size_t)n);
+    }
+
+    time_t now = time(NULL);
+    char when[32] = "";
+    time_t when_minute = 0;
+    for (int k = 0; k < list->count; k++) {
+        int i = (int)order[k];
+        const LsEntry *entry = &list->entries[i];
+        if (!entry->stated) {
+            ls_puts(out, "?????????? ? ? ? ?            ");
+            ls_put_name(opts, out, list, i, color);
+            ls_write(out, "\n", 1);
+            continue;
+        }
+        const LsStat *st = &list->stats[i];
+
+        char mode[11];
+        static const char types[] = { [DT_DIR] = 'd', [DT_LNK] = 'l', [DT_FIFO] = 'p', [DT_SOCK] = 's',
+                                      [DT_BLK] = 'b', [DT_CHR] = 'c', [DT_REG] = '-' };
+        mode[0] = entry->type < sizeof(types) && types[entry->type] ? types[entry->type] : '?';
+        const char *rwx = "rwxrwxrwx";
+        for (int b = 0; b < 9; b++) {
+            mode[1 + b] = st->mode & (1u << (8 - b)) ? rwx[b] : '-';
+        }
+        if (st->mode & S_ISUID) {
+            mode[3] = mode[3] == 'x' ? 's' : 'S';
+        }
+        if (st->mode & S_ISGID) {
+            mode[6] = mode[6] == 'x' ? 's' : 'S';
+        }
+        if (st->mode & S_ISVTX) {
+            mode[9] = mode[9] == 'x' ? 't' : 'T';
+        }
+        mode[10] = '\0';
+
+        // Recent files show the time, older ones the year. Files tend to
+        // share a minute, so the last one formatted is reused.
+        time_t mtime = (time_t)st->mtime;
+        if (mtime / 60 != when_minute || k == 0) {
+            struct tm tm;
+            localtime_r(&mtime, &tm);
+            bool recent = mtime <= now + 3600 && now - mtime < 182 * 24 * 3600;
+            strftime(when, sizeof(when), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+            when_minute = mtime / 60;
+        }
+
+        char line[256];
+        int n = snprintf(line, sizeof(line), "%s %*lu %-*s %-*s %*llu %s ",
+                         mode, link_w, (unsigned long)st->nlink,
+                         user_w, ls_id_name(users, &user_count, st->uid, false),
+                         group_w, ls_id_name(groups, &group_count, st->gid, true),
+                         size_w, (unsigned long long)st->size, when);
+        ls_write(out, line, (size_t)(n < (int)sizeof(line) ? n : (int)sizeof(line) - 1));
+        ls_put_name(opts, out, list, i, color);
+
+        if (entry->type == DT_LNK) {
+            char target[4096];
+            ssize_t len = readlinkat(list->dirfd, list->names + entry->name, target, sizeof(target));
+            if (len >= 0) {
+                ls_puts(out, " -> ");
+                ls_write(out, target, (size_t)len);
+            }
+        }
+        ls_write(out, "\n", 1);
+    }
+}
+
+static void ls_print(const LsOptions *opts, LsOut *out, LsList *list, bool color,
+                     bool columns, size_t term_width, bool total) {
+    ls_fetch(opts, list, color);
+    uint32_t *order = ls_order(opts, list);
+    if (!order) {
+        return;
+    }
+
+    if (opts->long_format) {
+        ls_print_long(opts, out, list, order, color, total);
+    } else if (columns && list->count > 0) {
+        ls_print_columns(opts, out, list, order, color, term_width);
+    } else {
+        for (int k = 0; k < list->count; k++) {
+            ls_put_name(opts, out, list, (int)order[k], color);
+            ls_write(out, "\n", 1);
+        }
+    }
+    free(order);
+}
+
+static size_t ls_terminal_width(FILE *out) {
+    struct winsize ws;
+    if (ioctl(fileno(out), TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        return ws.ws_col;
+    }
+    const char *columns = env_get("COLUMNS");
+    int width = columns ? atoi(columns) : 0;
+    return width > 0 ? (size_t)width : 80;
+}
+
+int ls_run(const LsOptions *opts, char **paths, int count, FILE *out_file) {
+    static char *dot[] = { "." };
+    if (count == 0) {
+        paths = dot;
+        count = 1;
+    }
+
+    bool tty = isatty(fileno(out_file));
+    bool color = opts->color > 0 || (opts->color < 0 && tty);
+    bool columns = tty && !opts->one_per_line && !opts->long_format;
+    size_t term_width = columns ? ls_terminal_width(out_file) : 80;
+    if (color) {
+        ls_colors_load();
+    }
+
+    LsOut *out = (LsOut *)malloc(sizeof(LsOut));
+    if (!out) {
+        return 1;
+    }
+    out->f = out_file;
+    out->len = 0;
+    fflush(out_file);
+
+    // File operands are listed together first, then each directory
+    int status = 0;
+    LsList files = { AT_FDCWD, NULL, NULL, 0, 0, NULL, 0, 0 };
+    int *dirs = (int *)malloc((size_t)count * sizeof(int));
+    int dir_count = 0;
+    if (!dirs) {
+        free(out);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        int fd = open(paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            close(fd);
+            dirs[dir_count++] = i;
+            continue;
+        }
+        struct stat st;
+        if (errno != ENOTDIR || lstat(paths[i], &st) != 0) {
+            ls_flush(out);
+            printf(COLOR_RED "ls: cannot access '%s': %s\n" COLOR_RESET, paths[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        ls_add(&files, paths[i], strlen(paths[i]), ls_type_of(st.st_mode));
+    }
+    if (files.count > 0) {
+        ls_print(opts, out, &files, color, columns, term_width, false);
+    }
+
+    for (int d = 0; d < dir_count; d++) {
+        const char *path = paths[dirs[d]];
+        LsList list = { -1, NULL, NULL, 0, 0, NULL, 0, 0 };
+        list.dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (list.dirfd < 0 || ls_read_dir(opts, &list) != 0) {
+            ls_flush(out);
+            printf(COLOR_RED "ls: cannot open directory '%s': %s\n" COLOR_RESET, path, strerror(errno));
+            ls_list_free(&list);
+            status = 1;
+            continue;
+        }
+
+        if (count > 1) {
+            if (files.count > 0 || d > 0) {
+                ls_write(out, "\n", 1);
+            }
+            ls_puts(out, path);
+            ls_write(out, ":\n", 2);
+        }
+        ls_print(opts, out, &list, color, columns, term_width, true);
+        ls_list_free(&list);
+    }
+
+    ls_flush(out);
+    fflush(out_file);
+    ls_list_free(&files);
+    free(dirs);
+    free(out);
+    return status;
+}
@@ -0,0 +1,328 @@
+#include "../../include/shell/parallel.h"
+#include "../../include/shell/process.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+#define COLOR_YELLOW    "\033[33m"
+
+// Exit status is the number of failed jobs, capped like GNU parallel
+#define PARALLEL_MAX_EXIT 101
+
+// Per-input job state
+typedef struct {
+    pid_t pid;
+    FILE *output;       // Captured stdout and stderr
+    int exit_code;
+} ParallelJob;
+
+// Default number of job slots
+int parallel_default_jobs(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Replace every "{}" in arg with input
+static char *parallel_substitute(const char *arg, const char *input) {
+    size_t input_len = strlen(input);
+    size_t len = 0;
+    for (const char *p = arg; *p; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            len += input_len;
+            p++;
+        } else {
+            len++;
+        }
+    }
+
+    char *result = (char *)malloc(len + 1);
+    if (!result) {
+        return NULL;
+    }
+
+    char *r = result;
+    for (const char *p = arg; *p; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(r, input, input_len);
+            r += input_len;
+            p++;
+        } else {
+            *r++ = *p;
+        }
+    }
+    *r = '\0';
+    return result;
+}
+
+static void parallel_free_args(char **args, int argc) {
+    for (int i = 0; i < argc; i++) {
+        free(args[i]);
+    }
+}
+
+// Build the argument vector for one input; returns argc or -1
+static int parallel_build_args(char **tmpl, int tmpl_argc, const char *input,
+                               char **args, int max_args) {
+    int argc = 0;
+
+    // No template: the input is the command line
+    if (tmpl_argc == 0) {
+        char *copy = strdup(input);
+        if (!copy) {
+            return -1;
+        }
+        char *save = NULL;
+        for (char *tok = strtok_r(copy, " \t", &save); tok && argc < max_args - 1;
+             tok = strtok_r(NULL, " \t", &save)) {
+            args[argc++] = strdup(tok);
+        }
+        free(copy);
+    } else {
+        bool substituted = false;
+        for (int i = 0; i < tmpl_argc && argc < max_args - 1; i++) {
+            if (strstr(tmpl[i], "{}")) {
+                args[argc++] = parallel_substitute(tmpl[i], input);
+                substituted = true;
+            } else {
+                args[argc++] = strdup(tmpl[i]);
+            }
+        }
+        if (!substituted && argc < max_args - 1) {
+            args[argc++] = strdup(input);
+        }
+    }
+    args[argc] = NULL;
+
+    for (int i = 0; i < argc; i++) {
+        if (!args[i]) {
+            parallel_free_args(args, argc);
+            return -1;
+        }
+    }
+    return argc;
+}
+
+// Copy a job's captured output to stdout in one piece
+static void parallel_flush_output(FILE *output) {
+    char buf[65536];
+    ssize_t n;
+
+    fflush(stdout);
+    if (lseek(fileno(output), 0, SEEK_SET) < 0) {
+        return;
+    }
+    while ((n = read(fileno(output), buf, sizeof(buf))) > 0) {
+        ssize_t off = 0;
+        while (off < n) {
+            ssize_t w = write(STDOUT_FILENO, buf + off, n - off);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            off += w;
+        }
+    }
+}
+
+// Start one job; returns false if the process table has no room
+static bool parallel_start(ParallelJob *job, char **tmpl, int tmpl_argc, const char *input) {
+    char *args[PROCESS_MAX_ARGS];
+    int argc = parallel_build_args(tmpl, tmpl_argc, input, args, PROCESS_MAX_ARGS);
+    if (argc <= 0) {
+        job->exit_code = EXIT_FAILURE;
+        return true;
+    }
+
+    job->output = tmpfile();
+    if (!job->output) {
+        parallel_free_args(args, argc);
+        job->exit_code = EXIT_FAILURE;
+        return true;
+    }
+
+    // The user is waiting on the batch, so workers keep interactive priority
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, false);
+    opts.out_fd = fileno(job->output);
+    opts.qos = JOB_QOS_INTERACTIVE;
+    Process *process = process_spawn(args[0], args, argc, &opts);
+    if (!process) {
+        int err = errno;
+        fclose(job->output);
+        job->output = NULL;
+        if (err == EAGAIN) {
+            parallel_free_args(args, argc);
+            return false;
+        }
+        printf(COLOR_RED "parallel: %s: %s\n" COLOR_RESET, args[0], strerror(err));
+        parallel_free_args(args, argc);
+        job->exit_code = 127;
+        return true;
+    }
+    parallel_free_args(args, argc);
+
+    job->pid = process->pid;
+    return true;
+}
+
+// Run the command template over all inputs
+int parallel_run(const ParallelOptions *opts, char **tmpl, int tmpl_argc,
+                 char **inputs, int input_count) {
+    if (!opts || opts->max_jobs <= 0 || input_count <= 0) {
+        return 0;
+    }
+
+    ParallelJob *jobs = (ParallelJob *)calloc(input_count, sizeof(ParallelJob));
+    pid_t *running = (pid_t *)malloc(opts->max_jobs * sizeof(pid_t));
+    int *running_job = (int *)malloc(opts->max_jobs * sizeof(int));
+    if (!jobs || !running || !running_job) {
+        free(jobs);
+        free(running);
+        free(running_job);
+        return -1;
+    }
+
+    int next = 0;
+    int nrunning = 0;
+
+    while (next < input_count || nrunning > 0) {
+        // Fill free slots
+        while (nrunning < opts->max_jobs && next < input_count) {
+            ParallelJob *job = &jobs[next];
+            if (!parallel_start(job, tmpl, tmpl_argc, inputs[next])) {
+                if (nrunning > 0) {
+                    // Process table is full, wait for a slot
+                    break;
+                }
+                printf(COLOR_RED "parallel: cannot start job %d: process table full\n" COLOR_RESET,
+                       next + 1);
+                job->exit_code = EXIT_FAILURE;
+                next++;
+                continue;
+            }
+            if (job->pid > 0) {
+                running[nrunning] = job->pid;
+                running_job[nrunning] = next;
+                nrunning++;
+            }
+            next++;
+        }
+
+        if (nrunning == 0) {
+            continue;
+        }
+
+        // Collect one finished job
+        Process *done = process_wait_any(running, nrunning);
+        if (!done) {
+            // Their exits can no longer be seen: count the running jobs and
+            // the ones never started as failed, with what output there is
+            printf(COLOR_RED "parallel: lost track of %d running jobs\n" COLOR_RESET, nrunning);
+            for (int k = 0; k < nrunning; k++) {
+                ParallelJob *job = &jobs[running_job[k]];
+                job->exit_code = EXIT_FAILURE;
+                parallel_flush_output(job->output);
+                fclose(job->output);
+                job->output = NULL;
+            }
+            for (; next < input_count; next++) {
+                jobs[next].exit_code = EXIT_FAILURE;
+            }
+            break;
+        }
+
+        int slot = 0;
+        while (slot < nrunning && running[slot] != done->pid) {
+            slot++;
+        }
+        ParallelJob *job = &jobs[running_job[slot]];
+        job->exit_code = done->exit_code;
+        process_release(done);
+
+        parallel_flush_output(job->output);
+        fclose(job->output);
+        job->output = NULL;
+
+        running[slot] = running[nrunning - 1];
+        running_job[slot] = running_job[nrunning - 1];
+        nrunning--;
+    }
+
+    // Report exit codes
+    int failed = 0;
+    for (int i = 0; i < input_count; i++) {
+        if (jobs[i].exit_code != 0) {
+            failed++;
+        }
+        if (opts->verbose || jobs[i].exit_code != 0) {
+            printf("%s[%d] exit %d: %s\n" COLOR_RESET,
+                   jobs[i].exit_code != 0 ? COLOR_YELLOW : "",
+                   i + 1, jobs[i].exit_code, inputs[i]);
+        }
+        if (jobs[i].output) {
+            fclose(jobs[i].output);
+        }
+    }
+    if (failed > 0) {
+        printf(COLOR_YELLOW "parallel: %d of %d jobs failed\n" COLOR_RESET, failed, input_count);
+    }
+
+    free(jobs);
+    free(running);
+    free(running_job);
+    return failed > PARALLEL_MAX_EXIT ? PARALLEL_MAX_EXIT : failed;
+}
+
+// Read one input per line
+char **parallel_read_inputs(FILE *in, int *count) {
+    int capacity = 64;
+    char **inputs = (char **)malloc(capacity * sizeof(char *));
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+
+    *count = 0;
+    if (!inputs) {
+        return NULL;
+    }
+
+    while ((len = getline(&line, &line_cap, in)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            char **grown = (char **)realloc(inputs, capacity * sizeof(char *));
+            if (!grown) {
+                break;
+            }
+            inputs = grown;
+        }
+        inputs[(*count)++] = strdup(line);
+    }
+
+    free(line);
+    return inputs;
+}
+
+void parallel_free_inputs(char **inputs, int count) {
+    if (!inputs) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        free(inputs[i]);
+    }
+    free(inputs);
+}
@@ -1,47 +1,227 @@
 #include "../../include/shell/process.h"
+#include "../../include/shell/env.h"
+#include "../../include/shell/shvar.h"
+#include "../../include/shell/spawnserver.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <time.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/syscall.h>
 
 // Global process table
 static Process process_table[PROCESS_MAX_PROCESSES];
 static int process_count = 0;
 static int next_job_id = 1;
 
+// Per-command and session-wide resource usage totals
+typedef struct {
+    char name[PROCESS_MAX_NAME];
+    int runs;
+    uint64_t wall_ns;
+    ProcessUsage usage;
+} ProcessUsageTotal;
+
+static ProcessUsageTotal usage_totals[PROCESS_MAX_USAGE_TOTALS];
+static int usage_total_count = 0;
+static ProcessUsageTotal session_usage;
+
+// Recycled argument blocks, one free list per size class. The first
+// pointer-sized word of a free block links to the next one.
+static void *args_pool[PROCESS_ARGS_CLASSES];
+static int args_pool_depth[PROCESS_ARGS_CLASSES];
+
+// Pack argv into a single block: pointer table, NULL, then string bytes
+static char **args_pack(char **args, int argc, int *size_class) {
+    size_t table = (size_t)(argc + 1) * sizeof(char *);
+    size_t total = table;
+    for (int i = 0; i < argc; i++) {
+        total += strlen(args[i]) + 1;
+    }
+    
+    // Smallest class that fits, or a plain allocation for huge argv
+    int cls = 0;
+    while (cls < PROCESS_ARGS_CLASSES && ((size_t)PROCESS_ARGS_MIN_BLOCK << cls) < total) {
+        cls++;
+    }
+    
+    char *block;
+    if (cls == PROCESS_ARGS_CLASSES) {
+        cls = -1;
+        block = (char *)malloc(total);
+    } else if (args_pool[cls]) {
+        block = (char *)args_pool[cls];
+        args_pool[cls] = *(void **)block;
+        args_pool_depth[cls]--;
+    } else {
+        block = (char *)malloc((size_t)PROCESS_ARGS_MIN_BLOCK << cls);
+    }
+    if (!block) {
+        return NULL;
+    }
+    
+    char **table_ptr = (char **)block;
+    char *strings = block + table;
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(args[i]) + 1;
+        memcpy(strings, args[i], len);
+        table_ptr[i] = strings;
+        strings += len;
+    }
+    table_ptr[argc] = NULL;
+    
+    *size_class = cls;
+    return table_ptr;
+}
+
+// Return an argument block to its pool in O(1)
+static void args_release(char **args, int size_class) {
+    if (!args) {
+        return;
+    }
+    
+    if (size_class < 0 || args_pool_depth[size_class] >= PROCESS_ARGS_POOL_DEPTH) {
+        free(args);
+        return;
+    }
+    
+    *(void **)args = args_pool[size_class];
+    args_pool[size_class] = args;
+    args_pool_depth[size_class]++;
+}
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+static uint64_t process_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Convert a timeval to microseconds
+static uint64_t timeval_to_us(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000ULL + (uint64_t)tv->tv_usec;
+}
+
+// Add one usage sample to a running total
+static void usage_accumulate(ProcessUsageTotal *total, const Process *process) {
+    total->runs++;
+    total->wall_ns += process->end_ns - process->start_ns;
+    total->usage.utime_us += process->usage.utime_us;
+    total->usage.stime_us += process->usage.stime_us;
+    if (process->usage.maxrss_kb > total->usage.maxrss_kb) {
+        total->usage.maxrss_kb = process->usage.maxrss_kb;
+    }
+    total->usage.minflt += process->usage.minflt;
+    total->usage.majflt += process->usage.majflt;
+    total->usage.nvcsw += process->usage.nvcsw;
+    total->usage.nivcsw += process->usage.nivcsw;
+}
+
+// Fold a finished process into the per-command and session totals
+static void usage_account(Process *process) {
+    if (process->accounted) {
+        return;
+    }
+    process->accounted = true;
+
+    usage_accumulate(&session_usage, process);
+
+    for (int i = 0; i < usage_total_count; i++) {
+        if (strcmp(usage_totals[i].name, process->name) == 0) {
+            usage_accumulate(&usage_totals[i], process);
+            return;
+        }
+    }
+
+    // Table full: the session total still has it
+    if (usage_total_count >= PROCESS_MAX_USAGE_TOTALS) {
+        return;
+    }
+
+    ProcessUsageTotal *total = &usage_totals[usage_total_count++];
+    memset(total, 0, sizeof(*total));
+    strncpy(total->name, process->name, PROCESS_MAX_NAME - 1);
+    usage_accumulate(total, process);
+}
+
+// Record a status change reported by wait4()
+static void process_update_status(Process *process, int status, const struct rusage *ru) {
+    if (WIFSTOPPED(status)) {
+        process->state = PROCESS_STATE_STOPPED;
+        return;
+    }
+
+    if (WIFEXITED(status)) {
+        process->exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        process->exit_code = WTERMSIG(status);
+        process->term_signal = WTERMSIG(status);
+    }
+    process->state = PROCESS_STATE_TERMINATED;
+    process->end_ns = process_now_ns();
+
+    // Capture resource usage
+    process->usage.utime_us = timeval_to_us(&ru->ru_utime);
+    process->usage.stime_us = timeval_to_us(&ru->ru_stime);
+    process->usage.maxrss_kb = ru->ru_maxrss;
+    process->usage.minflt = ru->ru_minflt;
+    process->usage.majflt = ru->ru_majflt;
+    process->usage.nvcsw = ru->ru_nvcsw;
+    process->usage.nivcsw = ru->ru_nivcsw;
+
+    usage_account(process);
+}
+
+// Note which limits a finished job ran into. This reads the job's cgroup
+// files, so it runs from the main loop rather than the SIGCHLD handler.
+static void process_collect_limits(Process *process) {
+    if (process->state != PROCESS_STATE_TERMINATED || process->limits_collected) {
+        return;
+    }
+    process->limit_events = job_limits_collect(&process->limits, &process->limit_handle,
+                                               process->term_signal,
+                                               process->usage.utime_us + process->usage.stime_us);
+    process->limits_collected = true;
+}
+
 // Signal handler for child processes
 static void sigchld_handler(int sig) {
     (void)sig; // Suppress unused parameter warning
+    int saved_errno = errno;
+    
+    // Children of the spawn server are reaped there and reported to us
+    SpawnExit report;
+    while (spawn_server_read_exit(&report)) {
+        Process *process = process_get_by_pid(report.pid);
+        if (process && process->state != PROCESS_STATE_TERMINATED) {
+            process_update_status(process, report.status, &report.usage);
+        }
+    }
     
     // Check all processes for terminated children
     for (int i = 0; i < process_count; i++) {
-        if (process_table[i].pid > 0) {
+        if (process_table[i].pid > 0 && !process_table[i].remote &&
+            process_table[i].state != PROCESS_STATE_TERMINATED) {
             int status;
-            pid_t pid = waitpid(process_table[i].pid, &status, WNOHANG);
+            struct rusage ru;
+            pid_t pid = wait4(process_table[i].pid, &status, WNOHANG, &ru);
             
             if (pid == process_table[i].pid) {
-                // Process has terminated, update its status
-                if (WIFEXITED(status)) {
-                    process_table[i].exit_code = WEXITSTATUS(status);
-                    process_table[i].state = PROCESS_STATE_TERMINATED;
-                } else if (WIFSIGNALED(status)) {
-                    process_table[i].exit_code = WTERMSIG(status);
-                    process_table[i].state = PROCESS_STATE_TERMINATED;
-                } else if (WIFSTOPPED(status)) {
-                    process_table[i].state = PROCESS_STATE_STOPPED;
-                }
-                
-                // Set end time
-                process_table[i].end_time = time(NULL);
+                // Process has changed state, update its status
+                process_update_status(&process_table[i], status, &ru);
             }
         }
     }
+    
+    errno = saved_errno;
 }
 
 // Initialize process subsystem
@@ -50,6 +230,9 @@ int process_init(void) {
     memset(process_table, 0, sizeof(process_table));
     process_count = 0;
     next_job_id = 1;
+    memset(usage_totals, 0, sizeof(usage_totals));
+    usage_total_count = 0;
+    memset(&session_usage, 0, sizeof(session_usage));
     
     // Set up signal handler for child processes
     struct sigaction sa;
@@ -59,9 +242,31 @@ int process_init(void) {
     sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
     sigaction(SIGCHLD, &sa, NULL);
     
+    // Fork the spawn server now, while the shell is still small;
+    // CSHELL_SPAWN_SERVER=0 keeps the plain fork path
+    const char *mode = env_get("CSHELL_SPAWN_SERVER");
+    if (!mode || strcmp(mode, "0") != 0) {
+        spawn_server_start();
+    }
+    
     return 0;
 }
 
+// Free the resources owned by a table entry
+static void process_free_entry(Process *process) {
+    args_release(process->args, process->args_class);
+    process->args = NULL;
+    if (process->output) {
+        job_output_release(process->output);
+        process->output = NULL;
+    }
+    job_limits_release(&process->limit_handle);
+    if (process->pidfd >= 0) {
+        close(process->pidfd);
+        process->pidfd = -1;
+    }
+}
+
 // Clean up process subsystem
 void process_cleanup(void) {
     // Kill any remaining processes
@@ -70,103 +275,365 @@ void process_cleanup(void) {
             process_table[i].state == PROCESS_STATE_STOPPED) {
             kill(process_table[i].pid, SIGTERM);
         }
-        // Free arguments
-        if (process_table[i].args) {
-            for (int j = 0; j < process_table[i].argc; j++) {
-                free(process_table[i].args[j]);
+        process_free_entry(&process_table[i]);
+    }
+    
+    process_count = 0;
+    
+    // Drain the argument pools
+    for (int cls = 0; cls < PROCESS_ARGS_CLASSES; cls++) {
+        while (args_pool[cls]) {
+            void *next = *(void **)args_pool[cls];
+            free(args_pool[cls]);
+            args_pool[cls] = next;
+        }
+        args_pool_depth[cls] = 0;
+    }
+    
+    spawn_server_stop();
+}
+
+// Pin a new job to the CPU the placement policy picks, counting the
+// running jobs already placed on each CPU
+static void process_place(Process *process) {
+    static int load[JOB_AFFINITY_MAX_CPUS];
+    memset(load, 0, sizeof(load));
+    
+    for (int i = 0; i < process_count; i++) {
+        if (process_table[i].state != PROCESS_STATE_RUNNING ||
+            job_cpuset_empty(&process_table[i].cpus)) {
+            continue;
+        }
+        for (int cpu = 0; cpu < JOB_AFFINITY_MAX_CPUS; cpu++) {
+            if (job_cpuset_has(&process_table[i].cpus, cpu)) {
+                load[cpu]++;
             }
-            free(process_table[i].args);
         }
     }
     
-    process_count = 0;
+    int cpu = job_affinity_place(load);
+    if (cpu >= 0) {
+        job_cpuset_add(&process->cpus, cpu);
+    }
+}
+
+// Resolve a command against the shell's PATH the way execvp would
+static const char *process_resolve(const char *cmd, char *buf, size_t size) {
+    if (strchr(cmd, '/')) {
+        return cmd;
+    }
+    
+    const char *path = env_get("PATH");
+    if (!path) {
+        path = "/bin:/usr/bin";
+    }
+    
+    const char *dir = path;
+    while (dir) {
+        const char *end = strchr(dir, ':');
+        int len = end ? (int)(end - dir) : (int)strlen(dir);
+        
+        // An empty PATH entry means the current directory
+        snprintf(buf, size, "%.*s%s%s", len, dir, len ? "/" : "", cmd);
+        
+        struct stat st;
+        if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0) {
+            return buf;
+        }
+        dir = end ? end + 1 : NULL;
+    }
+    
+    return NULL;
+}
+
+// Wait for a job the spawn server reaps; its exit arrives via SIGCHLD
+static void process_wait_remote(Process *process) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    
+    while (process->state != PROCESS_STATE_TERMINATED && spawn_server_running()) {
+        sigsuspend(&old);
+    }
+    
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Parent side once the child exists: drop fds meant for the child and
+// wait for foreground jobs
+static Process *process_started(Process *process, int capture_fd, bool foreground) {
+    if (capture_fd >= 0) {
+        close(capture_fd);
+    }
+    job_limits_spawned(&process->limit_handle);
+    
+    // Wait for foreground process
+    if (foreground) {
+        if (process->remote) {
+            process_wait_remote(process);
+        } else {
+            int status;
+            struct rusage ru;
+            if (wait4(process->pid, &status, 0, &ru) == process->pid) {
+                process_update_status(process, status, &ru);
+            }
+        }
+        process_collect_limits(process);
+    }
+    
+    return process;
+}
+
+// Fill spawn options with the defaults
+void process_spawn_options_init(ProcessSpawnOptions *opts, bool foreground) {
+    memset(opts, 0, sizeof(*opts));
+    opts->foreground = foreground;
+    opts->out_fd = -1;
+    opts->in_fd = -1;
+    opts->err_fd = -1;
+    job_limits_get_default(&opts->limits);
 }
 
 // Create a new process
 Process *process_create(const char *name, char **args, int argc, bool foreground) {
-    if (!name || !args || argc <= 0 || argc >= PROCESS_MAX_ARGS) {
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, foreground);
+    return process_spawn(name, args, argc, &opts);
+}
+
+// Create a new process, sending its stdout and stderr to out_fd when out_fd >= 0
+Process *process_create_redirected(const char *name, char **args, int argc,
+                                   bool foreground, int out_fd) {
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, foreground);
+    opts.out_fd = out_fd;
+    return process_spawn(name, args, argc, &opts);
+}
+
+// Create a background process whose stdout and stderr go to a capture ring
+Process *process_create_captured(const char *name, char **args, int argc,
+                                 size_t capture_size) {
+    ProcessSpawnOptions opts;
+    process_spawn_options_init(&opts, false);
+    opts.capture = true;
+    opts.capture_size = capture_size;
+    return process_spawn(name, args, argc, &opts);
+}
+
+// Start a process as described by opts
+Process *process_spawn(const char *name, char **args, int argc, const ProcessSpawnOptions *opts) {
+    if (!name || !args || !opts || argc <= 0) {
+        errno = EINVAL;
         return NULL;
     }
     
     // Check if we have space for a new process
     if (process_count >= PROCESS_MAX_PROCESSES) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    
+    // Look the command up in our PATH, not the host's
+    char path_buf[4096];
+    const char *path = process_resolve(args[0], path_buf, sizeof(path_buf));
+    if (!path) {
+        errno = ENOENT;
         return NULL;
     }
     
+    // Children see the shell's variables; the snapshot is only rebuilt
+    // after an env change. Exported typed variables become strings here.
+    shvar_sync_exports();
+    char **envp = env_get_envp();
+    
     // Allocate a new process entry
     Process *process = &process_table[process_count];
     memset(process, 0, sizeof(Process));
+    process->pidfd = -1;
     
     // Copy name
     strncpy(process->name, name, PROCESS_MAX_NAME - 1);
     
-    // Allocate and copy arguments
-    process->args = (char **)malloc(argc * sizeof(char *));
+    // Pack arguments into one block from the arena
+    process->args = args_pack(args, argc, &process->args_class);
     if (!process->args) {
         return NULL;
     }
-    for (int i = 0; i < argc; i++) {
-        process->args[i] = strdup(args[i]);
-    }
     process->argc = argc;
     
     // Initialize other fields
     process->state = PROCESS_STATE_RUNNING;
     process->exit_code = 0;
     process->job_id = next_job_id++;
-    process->foreground = foreground;
-    process->start_time = time(NULL);
-    process->end_time = 0;
+    process->foreground = opts->foreground;
+    process->start_ns = process_now_ns();
+    process->end_ns = 0;
+    process->limits = opts->limits;
+    process->limit_handle.procs_fd = -1;
+    
+    // Per-job cgroup when limits are set and a delegated subtree exists.
+    // If it cannot be set up, memory and CPU time fall back to setrlimit
+    // in the child, but a CPU share cannot, so the job is not started.
+    if (job_limits_any(&process->limits) &&
+        job_limits_prepare(&process->limits, process->job_id, &process->limit_handle) != 0 &&
+        process->limits.cpu_percent > 0) {
+        process_free_entry(process);
+        errno = ENOTSUP;
+        return NULL;
+    }
+    
+    // Background jobs write into a capture ring; without one they still
+    // run, writing to the terminal
+    int out_fd = opts->out_fd;
+    int capture_fd = -1;
+    if (opts->capture) {
+        process->output = job_output_create(opts->capture_size, &capture_fd);
+        if (process->output) {
+            out_fd = capture_fd;
+        }
+    }
+    int err_fd = opts->err_fd >= 0 ? opts->err_fd : out_fd;
+    
+    // Background jobs must not compete with the shell for terminal input
+    int in_fd = opts->in_fd;
+    int null_fd = -1;
+    if (!opts->foreground && in_fd < 0) {
+        null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        in_fd = null_fd;
+    }
+    
+    // Background jobs are de-prioritized unless told otherwise
+    process->qos = opts->qos;
+    if (process->qos == JOB_QOS_AUTO) {
+        process->qos = opts->foreground ? JOB_QOS_INTERACTIVE : job_qos_get_default();
+    }
+    
+    // Explicit pin, or a CPU chosen by the placement policy
+    process->cpus = opts->cpus;
+    if (job_cpuset_empty(&process->cpus) && job_affinity_get_policy() != PLACEMENT_OFF) {
+        process_place(process);
+    }
+    
+    // Keep SIGCHLD out until the entry is in the table, otherwise a child
+    // that exits immediately is never seen by the handler
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    
+    // Let the spawn server fork its small image instead of ours. If it has
+    // gone away we fall back to forking the shell.
+    if (!opts->direct && spawn_server_running()) {
+        SpawnRequest req = {
+            path, process->args, process->argc, out_fd, in_fd, err_fd,
+            &process->limits, &process->limit_handle, &process->cpus, process->qos,
+            !opts->foreground
+        };
+        int pidfd;
+        pid_t pid = spawn_server_spawn(&req, &pidfd);
+        if (pid > 0) {
+            if (null_fd >= 0) {
+                close(null_fd);
+            }
+            process->pid = pid;
+            process->remote = true;
+            process->pidfd = pidfd;
+            process_count++;
+            sigprocmask(SIG_SETMASK, &old, NULL);
+            return process_started(process, capture_fd, opts->foreground);
+        }
+        if (spawn_server_running()) {
+            // The server is fine but its fork failed
+            int saved_errno = errno;
+            sigprocmask(SIG_SETMASK, &old, NULL);
+            if (capture_fd >= 0) {
+                close(capture_fd);
+            }
+            if (null_fd >= 0) {
+                close(null_fd);
+            }
+            process_free_entry(process);
+            errno = saved_errno;
+            return NULL;
+        }
+    }
+    
+    // Make sure buffered output is not duplicated into the child
+    fflush(stdout);
+    fflush(stderr);
     
     // Fork the process
     pid_t pid = fork();
     if (pid < 0) {
         // Error forking
-        for (int i = 0; i < argc; i++) {
-            free(process->args[i]);
+        int saved_errno = errno;
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        if (capture_fd >= 0) {
+            close(capture_fd);
+        }
+        if (null_fd >= 0) {
+            close(null_fd);
         }
-        free(process->args);
+        process_free_entry(process);
+        errno = saved_errno;
         return NULL;
     } else if (pid == 0) {
-        // Child process
-        execvp(args[0], args);
-        // If exec fails
-        exit(EXIT_FAILURE);
+        // Child process; background jobs leave the terminal's group so
+        // Ctrl-C at the prompt misses them
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        if (!opts->foreground) {
+            setpgid(0, 0);
+        }
+        int child_fds[3] = { in_fd, out_fd, err_fd };
+        for (int i = 0; i < 3; i++) {
+            if (child_fds[i] >= 0) {
+                dup2(child_fds[i], i);
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            if (child_fds[i] > STDERR_FILENO) {
+                close(child_fds[i]);
+            }
+        }
+        job_limits_apply_child(&process->limits, &process->limit_handle);
+        job_affinity_apply_child(&process->cpus);
+        job_qos_apply_child(process->qos);
+        spawn_exec(path, process->args, process->argc, envp);
     } else {
         // Parent process
+        if (!opts->foreground) {
+            setpgid(pid, pid);
+        }
+        if (null_fd >= 0) {
+            close(null_fd);
+        }
         process->pid = pid;
         process_count++;
+        sigprocmask(SIG_SETMASK, &old, NULL);
         
-        // Wait for foreground process
-        if (foreground) {
-            process->state = PROCESS_STATE_RUNNING;
-            int status;
-            waitpid(pid, &status, 0);
-            
-            if (WIFEXITED(status)) {
-                process->exit_code = WEXITSTATUS(status);
-                process->state = PROCESS_STATE_TERMINATED;
-            } else if (WIFSIGNALED(status)) {
-                process->exit_code = WTERMSIG(status);
-                process->state = PROCESS_STATE_TERMINATED;
-            } else if (WIFSTOPPED(status)) {
-                process->state = PROCESS_STATE_STOPPED;
-            }
-            
-            process->end_time = time(NULL);
-        }
-        
-        return process;
+        return process_started(process, capture_fd, opts->foreground);
     }
 }
 
+// Signal a process, through its pidfd when we have one so a recycled
+// pid can never be hit
+static int process_signal(Process *process, int sig) {
+#ifdef SYS_pidfd_send_signal
+    if (process->pidfd >= 0) {
+        return (int)syscall(SYS_pidfd_send_signal, process->pidfd, sig, NULL, 0);
+    }
+#endif
+    return kill(process->pid, sig);
+}
+
 // Kill a process
 int process_kill(Process *process, int signal) {
     if (!process || process->state != PROCESS_STATE_RUNNING) {
         return -1;
     }
     
-    return kill(process->pid, signal);
+    return process_signal(process, signal);
 }
 
 // Wait for a process to terminate
@@ -175,34 +642,73 @@ int process_wait(Process *process) {
         return -1;
     }
     
-    int status;
-    pid_t pid = waitpid(process->pid, &status, 0);
-    
-    if (pid == process->pid) {
-        if (WIFEXITED(status)) {
-            process->exit_code = WEXITSTATUS(status);
-            process->state = PROCESS_STATE_TERMINATED;
-        } else if (WIFSIGNALED(status)) {
-            process->exit_code = WTERMSIG(status);
-            process->state = PROCESS_STATE_TERMINATED;
-        } else if (WIFSTOPPED(status)) {
-            process->state = PROCESS_STATE_STOPPED;
+    if (process->remote) {
+        process_wait_remote(process);
+    } else {
+        int status;
+        struct rusage ru;
+        if (wait4(process->pid, &status, 0, &ru) == process->pid) {
+            process_update_status(process, status, &ru);
         }
-        
-        process->end_time = time(NULL);
+    }
+    
+    // The SIGCHLD handler may have collected it first
+    if (process->state == PROCESS_STATE_TERMINATED) {
+        process_collect_limits(process);
         return process->exit_code;
     }
     
     return -1;
 }
 
+// Wait until one of the given processes has terminated
+Process *process_wait_any(const pid_t *pids, int count) {
+    if (!pids || count <= 0) {
+        return NULL;
+    }
+    
+    // Block SIGCHLD while scanning so a wakeup cannot slip in between the
+    // scan and sigsuspend()
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    
+    Process *done = NULL;
+    while (!done) {
+        bool any_alive = false;
+        for (int i = 0; i < count; i++) {
+            Process *process = process_get_by_pid(pids[i]);
+            if (!process) {
+                continue;
+            }
+            if (process->state == PROCESS_STATE_TERMINATED) {
+                done = process;
+                break;
+            }
+            any_alive = true;
+        }
+        
+        if (done || !any_alive) {
+            break;
+        }
+        sigsuspend(&old);
+    }
+    
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (done) {
+        process_collect_limits(done);
+    }
+    return done;
+}
+
 // Resume a stopped process
 int process_resume(Process *process) {
     if (!process || process->state != PROCESS_STATE_STOPPED) {
         return -1;
     }
     
-    if (kill(process->pid, SIGCONT) == 0) {
+    if (process_signal(process, SIGCONT) == 0) {
         process->state = PROCESS_STATE_RUNNING;
         return 0;
     }
@@ -216,7 +722,7 @@ int process_suspend(Process *process) {
         return -1;
     }
     
-    if (kill(process->pid, SIGSTOP) == 0) {
+    if (process_signal(process, SIGSTOP) == 0) {
         process->state = PROCESS_STATE_STOPPED;
         return 0;
     }
@@ -224,6 +730,17 @@ int process_suspend(Process *process) {
     return -1;
 }
 
+// Move a job to another scheduling class
+int process_set_qos(Process *process, JobQos qos) {
+    if (!process || process->state == PROCESS_STATE_TERMINATED) {
+        return -1;
+    }
+    
+    int rc = job_qos_apply(process->pid, qos);
+    process->qos = qos;
+    return rc;
+}
+
 // Get process state
 ProcessState process_get_state(Process *process) {
     if (!process) {
@@ -264,19 +781,24 @@ Process *process_get_by_job_id(int job_id) {
     return NULL;
 }
 
+// Single-character process state
+static char process_state_char(const Process *process) {
+    switch (process->state) {
+        case PROCESS_STATE_RUNNING:    return 'R';
+        case PROCESS_STATE_STOPPED:    return 'S';
+        case PROCESS_STATE_TERMINATED: return 'T';
+        case PROCESS_STATE_ZOMBIE:     return 'Z';
+    }
+    return '?';
+}
+
 // Print process information
 void process_print(Process *process) {
     if (!process) {
         return;
     }
     
-    char state_char = '?';
-    switch (process->state) {
-        case PROCESS_STATE_RUNNING:    state_char = 'R'; break;
-        case PROCESS_STATE_STOPPED:    state_char = 'S'; break;
-        case PROCESS_STATE_TERMINATED: state_char = 'T'; break;
-        case PROCESS_STATE_ZOMBIE:     state_char = 'Z'; break;
-    }
+    char state_char = process_state_char(process);
     
     printf("[%d] %5d %c %s\n", 
            process->job_id, 
@@ -293,17 +815,173 @@ void process_print_all(void) {
     }
 }
 
-// Reap zombie processes
+// Print process information with timing and resource usage
+void process_print_long(Process *process) {
+    if (!process) {
+        return;
+    }
+    
+    uint64_t end_ns = process->end_ns ? process->end_ns : process_now_ns();
+    double elapsed = (double)(end_ns - process->start_ns) / 1e9;
+    
+    process_collect_limits(process);
+    char limits[32];
+    job_limits_describe(process->limit_events, limits, sizeof(limits));
+    char cpus[32];
+    job_affinity_format(&process->cpus, cpus, sizeof(cpus));
+    
+    printf("[%d] %5d %c %10.3f %8.3f %8.3f %8ld %7ld %6ld %6ld %6ld %-8s %-8s %-11s %s\n",
+           process->job_id,
+           process->pid,
+           process_state_char(process),
+           elapsed,
+           process->usage.utime_us / 1e6,
+           process->usage.stime_us / 1e6,
+           process->usage.maxrss_kb,
+           process->usage.minflt,
+           process->usage.majflt,
+           process->usage.nvcsw,
+           process->usage.nivcsw,
+           limits,
+           cpus,
+           job_qos_name(process->qos),
+           process->name);
+}
+
+// Print all processes with timing and resource usage
+void process_print_all_long(void) {
+    printf("JOB   PID  S    ELAPSED     USER      SYS   MAXRSS  MINFLT MAJFLT   VCSW  IVCSW LIMITS   CPUS     QOS         COMMAND\n");
+    for (int i = 0; i < process_count; i++) {
+        process_print_long(&process_table[i]);
+    }
+}
+
+// Print the scheduling class of every job next to what the kernel reports
+void process_print_all_qos(void) {
+    printf("JOB   PID  S CLASS       KERNEL                 COMMAND\n");
+    for (int i = 0; i < process_count; i++) {
+        Process *process = &process_table[i];
+        char kernel[48] = "-";
+        if (process->state != PROCESS_STATE_TERMINATED) {
+            job_qos_describe(process->pid, kernel, sizeof(kernel));
+        }
+        printf("[%d] %5d %c %-11s %-22s %s\n",
+               process->job_id,
+               process->pid,
+               process_state_char(process),
+               job_qos_name(process->qos),
+               kernel,
+               process->name);
+    }
+}
+
+// Print one usage total row
+static void usage_print_total(FILE *out, const ProcessUsageTotal *total, const char *name) {
+    fprintf(out, "%5d %10.3f %8.3f %8.3f %8ld %8ld %6ld %7ld %7ld %s\n",
+            total->runs,
+            (double)total->wall_ns / 1e9,
+            total->usage.utime_us / 1e6,
+            total->usage.stime_us / 1e6,
+            total->usage.maxrss_kb,
+            total->usage.minflt,
+            total->usage.majflt,
+            total->usage.nvcsw,
+            total->usage.nivcsw,
+            name);
+}
+
+// Total CPU time of a usage row
+static uint64_t usage_cpu_us(const ProcessUsageTotal *total) {
+    return total->usage.utime_us + total->usage.stime_us;
+}
+
+// Dump per-command and session resource usage, heaviest CPU users first
+void process_dump_usage(FILE *out) {
+    if (!out) {
+        return;
+    }
+    
+    // Order rows by CPU time without disturbing the totals table
+    int order[PROCESS_MAX_USAGE_TOTALS];
+    for (int i = 0; i < usage_total_count; i++) {
+        int j = i;
+        while (j > 0 && usage_cpu_us(&usage_totals[order[j - 1]]) < usage_cpu_us(&usage_totals[i])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    
+    fprintf(out, " RUNS       WALL     USER      SYS   MAXRSS   MINFLT MAJFLT    VCSW   IVCSW COMMAND\n");
+    for (int i = 0; i < usage_total_count; i++) {
+        const ProcessUsageTotal *total = &usage_totals[order[i]];
+        usage_print_total(out, total, total->name);
+    }
+    usage_print_total(out, &session_usage, "(session)");
+}
+
+// Remove a single terminated process from the table
+void process_release(Process *process) {
+    if (!process || process->state != PROCESS_STATE_TERMINATED) {
+        return;
+    }
+    
+    int i = (int)(process - process_table);
+    if (i < 0 || i >= process_count) {
+        return;
+    }
+    
+    // The SIGCHLD handler walks the table, keep it out while we compact
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    
+    process_free_entry(&process_table[i]);
+    
+    // Move last process to this slot
+    if (i < process_count - 1) {
+        process_table[i] = process_table[process_count - 1];
+    }
+    process_count--;
+    
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Announce background jobs that ended since the last prompt
+void process_report_done(void) {
+    for (int i = 0; i < process_count; i++) {
+        Process *process = &process_table[i];
+        if (process->state != PROCESS_STATE_TERMINATED || process->foreground ||
+            process->reported) {
+            continue;
+        }
+        
+        if (process->term_signal) {
+            printf("[%d] Killed (%s) %s\n", process->job_id,
+                   strsignal(process->term_signal), process->name);
+        } else if (process->exit_code) {
+            printf("[%d] Exit %d %s\n", process->job_id, process->exit_code, process->name);
+        } else {
+            printf("[%d] Done %s\n", process->job_id, process->name);
+        }
+        process->reported = true;
+    }
+}
+
+// Reap finished foreground processes and background jobs whose end has
+// been reported
 void process_reap_zombies(void) {
+    // The SIGCHLD handler walks the table, keep it out while we compact
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    
     for (int i = 0; i < process_count; i++) {
-        if (process_table[i].state == PROCESS_STATE_TERMINATED) {
-            // Free arguments
-            if (process_table[i].args) {
-                for (int j = 0; j < process_table[i].argc; j++) {
-                    free(process_table[i].args[j]);
-                }
-                free(process_table[i].args);
-            }
+        if (process_table[i].state == PROCESS_STATE_TERMINATED &&
+            (process_table[i].foreground || process_table[i].reported)) {
+            process_free_entry(&process_table[i]);
             
             // Move last process to this slot
             if (i < process_count - 1) {
@@ -314,4 +992,6 @@ void process_reap_zombies(void) {
             process_count--;
         }
     }
-} 
\ No newline at end of file
+    
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
@@ -1,4 +1,11 @@
-#include "../include/shell/shell.h"
+#include "../../include/shell/shell.h"
+#include "../../include/shell/process.h"
+#include "../../include/shell/env.h"
+#include "../../include/shell/ai.h"
+#include "../../include/shell/coproc.h"
+#include "../../include/shell/shvar.h"
+#include "../../include/shell/arith.h"
+#include "../../include/shell/sysmon.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +16,9 @@
 #include <pwd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
 
 // Color definitions
 #define COLOR_RESET     "\033[0m"
@@ -37,6 +47,12 @@ static const char *LOGO =
 #define MAX_USERNAME_LENGTH 256
 #define MAX_HOSTNAME_LENGTH 256
 
+// Shell function: name() { body; }
+typedef struct {
+    char name[SHELL_MAX_FUNCTION_NAME];
+    char body[SHELL_MAX_INPUT];
+} ShellFunction;
+
 // Global shell variables
 static char current_dir[MAX_PATH_LENGTH];
 static char home_dir[MAX_PATH_LENGTH];
@@ -45,11 +61,14 @@ static char hostname[MAX_HOSTNAME_LENGTH];
 static char history[SHELL_MAX_HISTORY][SHELL_MAX_INPUT];
 static int history_count = 0;
 static int running = 0;
+static ShellFunction functions[SHELL_MAX_FUNCTIONS];
+static int function_count = 0;
 
 // Forward declarations
 void shell_setup_signals(void);
 void shell_parse_command(char *line, char **argv, int *argc);
 void shell_handle_signal(int sig);
+static int shell_execute_segment(char *segment);
 
 // Initialize the shell
 int shell_init(void) {
@@ -111,7 +130,10 @@ int shell_init(void) {
 // Clean up shell resources
 void shell_cleanup(void) {
     ai_cleanup();
+    coproc_cleanup();
+    sysmon_cleanup();
     process_cleanup();
+    shvar_cleanup();
     env_cleanup();
     running = 0;
 }
@@ -133,6 +155,14 @@ int shell_run(void) {
     char input[SHELL_MAX_INPUT];
     
     while (running) {
+        // Keep coprocess pipes moving between commands
+        coproc_service();
+        
+        // Drop jobs announced at the last prompt, then announce new ones,
+        // which leaves one command to look at a finished job's output
+        process_reap_zombies();
+        process_report_done();
+        
         // Display prompt
         shell_display_prompt();
         
@@ -158,23 +188,872 @@ int shell_run(void) {
     return 0;
 }
 
-// Parse and execute a command
+// Parse and execute a command line. Commands separated by ';' run in
+// turn; ';' inside ( ... ), { ... } or for ... done belongs to the group.
 int shell_parse_and_execute(char *input) {
     if (!input || input[0] == '\0') {
         return 0;
     }
     
+    int status = 0;
+    int depth = 0;
+    int loops = 0;
+    bool command_start = true;
+    char *start = input;
+    for (char *p = input; ; p++) {
+        // "for" and "done" only count where a command starts
+        bool word_start = p == input || isspace((unsigned char)p[-1]) || p[-1] == ';' || p[-1] == '\0';
+        if (depth == 0 && word_start && *p && *p != ';' && !isspace((unsigned char)*p)) {
+            size_t word_len = strcspn(p, " \t;");
+            if (command_start && word_len == 3 && strncmp(p, "for", 3) == 0) {
+                loops++;
+            } else if (command_start && word_len == 4 && strncmp(p, "done", 4) == 0 && loops > 0) {
+                loops--;
+            }
+            command_start = word_len == 2 && strncmp(p, "do", 2) == 0;
+        }
+        
+        if (*p == '(' || *p == '{') {
+            depth++;
+        } else if ((*p == ')' || *p == '}') && depth > 0) {
+            depth--;
+        } else if (*p == ';' && (depth > 0 || loops > 0)) {
+            command_start = true;
+        } else if (*p == '\0' || *p == ';') {
+            bool last = *p == '\0';
+            *p = '\0';
+            status = shell_execute_segment(start);
+            if (last) {
+                break;
+            }
+            start = p + 1;
+            command_start = true;
+        }
+    }
+    
+    return status;
+}
+
+// Does open, the first character of s, close at the last one
+static bool shell_is_group(const char *s, size_t len, char open, char close) {
+    if (len < 2 || s[0] != open || s[len - 1] != close) {
+        return false;
+    }
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == open) {
+            depth++;
+        } else if (s[i] == close && --depth == 0) {
+            return i == len - 1;
+        }
+    }
+    return false;
+}
+
+// Run commands in a subshell. Variables it sets live in a scope that is
+// dropped afterwards, and the working directory is put back, so nothing
+// is copied going in.
+static int shell_run_subshell(char *commands) {
+    if (env_scope_push(ENV_SCOPE_SUBSHELL) != 0) {
+        fprintf(stderr, COLOR_RED "Error: subshells nested too deeply\n" COLOR_RESET);
+        return 1;
+    }
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    
+    int status = shell_parse_and_execute(commands);
+    env_scope_pop();
+    
+    // PWD goes into the enclosing scope, the way cd sets it
+    if (cwd >= 0) {
+        char dir[MAX_PATH_LENGTH];
+        if (fchdir(cwd) == 0 && getcwd(dir, sizeof(dir))) {
+            setenv("PWD", dir, 1);
+            env_set("PWD", dir);
+        }
+        close(cwd);
+    }
+    return status;
+}
+
+// Define name() { body }, replacing an earlier definition
+static int shell_define_function(const char *name, size_t name_len, const char *body) {
+    if (name_len == 0 || name_len >= SHELL_MAX_FUNCTION_NAME) {
+        fprintf(stderr, COLOR_RED "Error: invalid function name\n" COLOR_RESET);
+        return 1;
+    }
+    
+    ShellFunction *function = NULL;
+    for (int i = 0; i < function_count; i++) {
+        if (strlen(functions[i].name) == name_len && strncmp(functions[i].name, name, name_len) == 0) {
+            function = &functions[i];
+        }
+    }
+    if (!function) {
+        if (function_count >= SHELL_MAX_FUNCTIONS) {
+            fprintf(stderr, COLOR_RED "Error: too many functions\n" COLOR_RESET);
+            return 1;
+        }
+        function = &functions[function_count++];
+        memcpy(function->name, name, name_len);
+        function->name[name_len] = '\0';
+    }
+    strncpy(function->body, body, SHELL_MAX_INPUT - 1);
+    function->body[SHELL_MAX_INPUT - 1] = '\0';
+    return 0;
+}
+
+// Call a function in its own scope, which holds its locals
+static int shell_call_function(const ShellFunction *function) {
+    if (env_scope_push(ENV_SCOPE_FUNCTION) != 0) {
+        fprintf(stderr, COLOR_RED "Error: %s: functions nested too deeply\n" COLOR_RESET, function->name);
+        return 1;
+    }
+    
+    // Parsing writes into the line, so run a copy
+    char body[SHELL_MAX_INPUT];
+    strcpy(body, function->body);
+    int status = shell_parse_and_execute(body);
+    
+    env_scope_pop();
+    return status;
+}
+
+// Growable string for expansions
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} ShellBuf;
+
+static int shell_buf_add(ShellBuf *buf, const char *s, size_t n) {
+    if (buf->len + n + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 64;
+        while (cap < buf->len + n + 1) {
+            cap *= 2;
+        }
+        char *data = (char *)realloc(buf->data, cap);
+        if (!data) {
+            return -1;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+// Words being expanded. In join mode everything lands in one string and
+// arrays are joined by spaces, as in $((...)) and subscripts.
+typedef struct {
+    char **fields;
+    int count;
+    int capacity;
+    int max;
+    bool join;
+    ShellBuf cur;
+} ShellExpansion;
+
+static int shell_expand_into(ShellExpansion *x, const char *word);
+
+// Close the field being built
+static int shell_field_end(ShellExpansion *x) {
+    if (x->count >= x->max) {
+        fprintf(stderr, COLOR_RED "Error: too many arguments\n" COLOR_RESET);
+        return -1;
+    }
+    if (x->count + 1 >= x->capacity) {
+        int capacity = x->capacity ? x->capacity * 2 : SHELL_MAX_ARGS;
+        char **fields = (char **)realloc(x->fields, (size_t)capacity * sizeof(char *));
+        if (!fields) {
+            return -1;
+        }
+        x->fields = fields;
+        x->capacity = capacity;
+    }
+    char *field = x->cur.data ? x->cur.data : strdup("");
+    if (!field) {
+        return -1;
+    }
+    x->fields[x->count++] = field;
+    memset(&x->cur, 0, sizeof(x->cur));
+    return 0;
+}
+
+// Add values as separate fields: the first joins what came before it and
+// the last is continued by what follows
+static int shell_add_values(ShellExpansion *x, const char **values, int count, bool join) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && (join || x->join)) {
+            if (shell_buf_add(&x->cur, " ", 1) != 0) {
+                return -1;
+            }
+        } else if (i > 0 && shell_field_end(x) != 0) {
+            return -1;
+        }
+        if (shell_buf_add(&x->cur, values[i], strlen(values[i])) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int shell_add_number(ShellExpansion *x, int64_t number) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%" PRId64, number);
+    return shell_buf_add(&x->cur, buf, (size_t)n);
+}
+
+// Expand a string into one malloc'd string
+static char *shell_expand_string(const char *s) {
+    ShellExpansion x = { NULL, 0, 0, 0, true, { NULL, 0, 0 } };
+    if (shell_expand_into(&x, s) != 0) {
+        free(x.cur.data);
+        return NULL;
+    }
+    return x.cur.data ? x.cur.data : strdup("");
+}
+
+// Evaluate an arithmetic expression after expanding $ in it
+static int shell_arith(const char *expr, int64_t *result) {
+    char *expanded = shell_expand_string(expr);
+    if (!expanded) {
+        return -1;
+    }
+    char err[128];
+    int rc = arith_eval(expanded, result, err, sizeof(err));
+    if (rc != 0) {
+        fprintf(stderr, COLOR_RED "Error: %s: %s\n" COLOR_RESET, expanded, err);
+    }
+    free(expanded);
+    return rc;
+}
+
+// The element key a subscript names: the text itself for an associative
+// array, an arithmetic index otherwise
+static int shell_subscript(const char *name, const char *sub, char *key, size_t size) {
+    if (shvar_type(name) == SHVAR_ASSOC) {
+        char *expanded = shell_expand_string(sub);
+        if (!expanded) {
+            return -1;
+        }
+        snprintf(key, size, "%s", expanded);
+        free(expanded);
+        return 0;
+    }
+    
+    int64_t index;
+    if (shell_arith(sub, &index) != 0) {
+        return -1;
+    }
+    if (index < 0) {
+        fprintf(stderr, COLOR_RED "Error: %s[%s]: bad array subscript\n" COLOR_RESET, name, sub);
+        return -1;
+    }
+    snprintf(key, size, "%" PRId64, index);
+    return 0;
+}
+
+static bool shell_is_name(const char *s) {
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') {
+        return false;
+    }
+    for (s++; *s; s++) {
+        if (!isalnum((unsigned char)*s) && *s != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ${NAME}, ${NAME[SUB]}, ${NAME[@]}, ${NAME[*]}, ${#NAME}, ${#NAME[@]},
+// ${!NAME[@]}. Typed variables are read in place; nothing is parsed back
+// from a joined string.
+static int shell_expand_braced(ShellExpansion *x, const char *text, size_t len) {
+    char spec[SHELL_MAX_INPUT];
+    if (len >= sizeof(spec)) {
+        fprintf(stderr, COLOR_RED "Error: bad substitution\n" COLOR_RESET);
+        return -1;
+    }
+    memcpy(spec, text, len);
+    spec[len] = '\0';
+    
+    char *name = spec;
+    char mode = '\0';
+    if ((name[0] == '#' || name[0] == '!') && name[1]) {
+        mode = *name++;
+    }
+    char *sub = strchr(name, '[');
+    if (sub) {
+        size_t sub_len = strlen(sub);
+        if (sub[sub_len - 1] != ']') {
+            sub = NULL;
+            name[0] = '\0';
+        } else {
+            *sub++ = '\0';
+            sub[sub_len - 2] = '\0';
+        }
+    }
+    bool all = sub && (strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0);
+    if (!shell_is_name(name) || (mode == '!' && !all)) {
+        fprintf(stderr, COLOR_RED "Error: ${%s}: bad substitution\n" COLOR_RESET, spec);
+        return -1;
+    }
+    
+    ShVarType type = shvar_type(name);
+    const char *string = type == SHVAR_NONE ? env_get(name) : NULL;
+    
+    if (mode == '!') {
+        if (type == SHVAR_NONE) {
+            const char *zero = "0";
+            return string ? shell_add_values(x, &zero, 1, false) : 0;
+        }
+        int count;
+        char **keys = shvar_keys(name, &count);
+        int rc = keys || count == 0 ? shell_add_values(x, (const char **)keys, count, *sub == '*') : -1;
+        for (int i = 0; i < count; i++) {
+            free(keys[i]);
+        }
+        free(keys);
+        return rc;
+    }
+    
+    if (all) {
+        if (mode == '#') {
+            return shell_add_number(x, type == SHVAR_NONE ? (string != NULL) : shvar_count(name));
+        }
+        if (type == SHVAR_NONE) {
+            return string ? shell_add_values(x, &string, 1, false) : 0;
+        }
+        int count;
+        const char **values = shvar_values(name, &count);
+        return values || count == 0 ? shell_add_values(x, values, count, *sub == '*') : -1;
+    }
+    
+    char buf[32];
+    const char *value;
+    if (sub) {
+        char key[256];
+        if (shell_subscript(name, sub, key, sizeof(key)) != 0) {
+            return -1;
+        }
+        if (type == SHVAR_NONE) {
+            value = strcmp(key, "0") == 0 ? env_get(name) : NULL;
+        } else {
+            value = shvar_get_element(name, key);
+        }
+    } else {
+        value = shvar_scalar(name, buf, sizeof(buf));
+    }
+    
+    if (mode == '#') {
+        return shell_add_number(x, value ? (int64_t)strlen(value) : 0);
+    }
+    return value ? shell_buf_add(&x->cur, value, strlen(value)) : 0;
+}
+
+// Expand $NAME, ${...} and $((...)) in word
+static int shell_expand_into(ShellExpansion *x, const char *word) {
+    const char *p = word;
+    while (*p) {
+        const char *dollar = strchr(p, '$');
+        size_t plain = dollar ? (size_t)(dollar - p) : strlen(p);
+        if (shell_buf_add(&x->cur, p, plain) != 0) {
+            return -1;
+        }
+        if (!dollar) {
+            break;
+        }
+        p = dollar + 1;
+        
+        if (p[0] == '(' && p[1] == '(') {
+            // $((EXPR)): up to the parenthesis closing the outer one
+            int depth = 0;
+            const char *end = p;
+            for (; *end; end++) {
+                if (*end == '(') {
+                    depth++;
+                } else if (*end == ')' && --depth == 0) {
+                    break;
+                }
+            }
+            if (!*end || end[-1] != ')' || end - p < 3) {
+                fprintf(stderr, COLOR_RED "Error: missing ))\n" COLOR_RESET);
+                return -1;
+            }
+            char expr[SHELL_MAX_INPUT];
+            size_t expr_len = (size_t)(end - 1 - (p + 2));
+            memcpy(expr, p + 2, expr_len);
+            expr[expr_len] = '\0';
+            int64_t value;
+            if (shell_arith(expr, &value) != 0 || shell_add_number(x, value) != 0) {
+                return -1;
+            }
+            p = end + 1;
+        } else if (p[0] == '{') {
+            int depth = 0;
+            const char *end = p;
+            for (; *end; end++) {
+                if (*end == '{') {
+                    depth++;
+                } else if (*end == '}' && --depth == 0) {
+                    break;
+                }
+            }
+            if (!*end) {
+                fprintf(stderr, COLOR_RED "Error: missing }\n" COLOR_RESET);
+                return -1;
+            }
+            if (shell_expand_braced(x, p + 1, (size_t)(end - p - 1)) != 0) {
+                return -1;
+            }
+            p = end + 1;
+        } else if (isalpha((unsigned char)p[0]) || p[0] == '_') {
+            const char *end = p + 1;
+            while (isalnum((unsigned char)*end) || *end == '_') {
+                end++;
+            }
+            if (shell_expand_braced(x, p, (size_t)(end - p)) != 0) {
+                return -1;
+            }
+            p = end;
+        } else if (shell_buf_add(&x->cur, "$", 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Expand each word into at most max fields. A word that expanded to
+// nothing is dropped. Returns a NULL-terminated table for
+// shell_free_words, or NULL.
+static char **shell_expand_words(int argc, char **argv, int max, int *count) {
+    ShellExpansion x = { NULL, 0, 0, max, false, { NULL, 0, 0 } };
+    for (int i = 0; i < argc; i++) {
+        int before = x.count;
+        if (shell_expand_into(&x, argv[i]) != 0) {
+            goto fail;
+        }
+        if (x.cur.len == 0 && x.count == before && strchr(argv[i], '$')) {
+            free(x.cur.data);
+            memset(&x.cur, 0, sizeof(x.cur));
+        } else if (shell_field_end(&x) != 0) {
+            goto fail;
+        }
+    }
+    if (!x.fields) {
+        x.fields = (char **)malloc(sizeof(char *));
+        if (!x.fields) {
+            return NULL;
+        }
+    }
+    x.fields[x.count] = NULL;
+    *count = x.count;
+    return x.fields;
+    
+fail:
+    free(x.cur.data);
+    for (int i = 0; i < x.count; i++) {
+        free(x.fields[i]);
+    }
+    free(x.fields);
+    return NULL;
+}
+
+static void shell_free_words(char **words, int count) {
+    for (int i = 0; i < count; i++) {
+        free(words[i]);
+    }
+    free(words);
+}
+
+// NAME=VALUE, NAME+=VALUE, NAME[SUB]=VALUE or the first word of
+// NAME=(...), with a valid variable name
+static bool shell_is_assignment(const char *word) {
+    if (!isalpha((unsigned char)word[0]) && word[0] != '_') {
+        return false;
+    }
+    const char *p = word + 1;
+    while (isalnum((unsigned char)*p) || *p == '_') {
+        p++;
+    }
+    if (*p == '[') {
+        p = strchr(p, ']');
+        if (!p) {
+            return false;
+        }
+        p++;
+    }
+    if (*p == '+') {
+        p++;
+    }
+    return *p == '=';
+}
+
+// Words an assignment takes: NAME=(a b c) runs to the word closing it
+static int shell_assignment_words(int argc, char **argv) {
+    char *eq = strchr(argv[0], '=');
+    if (eq[1] != '(' || eq[-1] == ']') {
+        return 1;
+    }
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        if (len > 0 && argv[i][len - 1] == ')') {
+            return i + 1;
+        }
+    }
+    return argc;
+}
+
+// Set one element, making name an indexed array if it is a string
+static int shell_assign_element(const char *name, const char *key, const char *value, bool append) {
+    if (shvar_type(name) == SHVAR_NONE && shvar_declare(name, SHVAR_ARRAY) != 0) {
+        return 1;
+    }
+    
+    char *joined = NULL;
+    const char *old = shvar_get_element(name, key);
+    if (append && old) {
+        joined = (char *)malloc(strlen(old) + strlen(value) + 1);
+        if (!joined) {
+            return 1;
+        }
+        strcpy(joined, old);
+        strcat(joined, value);
+        value = joined;
+    }
+    int rc = shvar_set_element(name, key, value);
+    free(joined);
+    if (rc != 0) {
+        fprintf(stderr, COLOR_RED "Error: %s[%s]: cannot assign %s\n" COLOR_RESET, name, key, value);
+        return 1;
+    }
+    return 0;
+}
+
+// NAME=VALUE or NAME+=VALUE. An integer evaluates the value, an array
+// sets element 0, anything else is a string in the environment.
+static int shell_assign_scalar(const char *name, const char *value, bool append) {
+    ShVarType type = shvar_type(name);
+    if (type == SHVAR_INT) {
+        int64_t number;
+        if (shell_arith(value, &number) != 0) {
+            return 1;
+        }
+        if (append) {
+            number = (int64_t)((uint64_t)number + (uint64_t)shvar_get_int(name));
+        }
+        return shvar_set_int(name, number) == 0 ? 0 : 1;
+    }
+    if (type != SHVAR_NONE) {
+        return shell_assign_element(name, "0", value, append);
+    }
+    
+    const char *old = env_get(name);
+    if (append && old) {
+        size_t old_len = strlen(old);
+        char *joined = (char *)malloc(old_len + strlen(value) + 1);
+        if (!joined) {
+            return 1;
+        }
+        memcpy(joined, old, old_len);
+        strcpy(joined + old_len, value);
+        int rc = env_set(name, joined);
+        free(joined);
+        return rc == 0 ? 0 : 1;
+    }
+    return env_set(name, value) == 0 ? 0 : 1;
+}
+
+// NAME=(a b [k]=v ...) or NAME+=(...) over words, the last ending in ')'
+static int shell_assign_compound(const char *name, bool append, int count, char **words) {
+    ShVarType type = shvar_type(name);
+    if (!append && type == SHVAR_ASSOC) {
+        shvar_clear(name);
+    } else if (!append || type != SHVAR_ARRAY) {
+        if (type == SHVAR_INT || (type == SHVAR_NONE && !append)) {
+            shvar_unset(name);
+            env_unset(name);
+        }
+        if (shvar_type(name) == SHVAR_NONE && shvar_declare(name, SHVAR_ARRAY) != 0) {
+            fprintf(stderr, COLOR_RED "Error: %s: not a valid array name\n" COLOR_RESET, name);
+            return 1;
+        }
+        if (!append) {
+            shvar_clear(name);
+        }
+    }
+    
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        char *word = words[i];
+        char *eq = word[0] == '[' ? strstr(word, "]=") : NULL;
+        if (eq) {
+            char sub[256];
+            char key[256];
+            size_t sub_len = (size_t)(eq - word - 1);
+            if (sub_len >= sizeof(sub)) {
+                status = 1;
+                continue;
+            }
+            memcpy(sub, word + 1, sub_len);
+            sub[sub_len] = '\0';
+            if (shell_subscript(name, sub, key, sizeof(key)) != 0 ||
+                shell_assign_element(name, key, eq + 2, false) != 0) {
+                status = 1;
+            }
+        } else if (shvar_type(name) == SHVAR_ASSOC) {
+            fprintf(stderr, COLOR_RED "Error: %s: %s: must use [key]=value\n" COLOR_RESET, name, word);
+            status = 1;
+        } else if (shvar_append(name, word) != 0) {
+            fprintf(stderr, COLOR_RED "Error: %s: cannot append %s\n" COLOR_RESET, name, word);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Apply the assignment starting at argv[0], which takes words words
+static int shell_assign(int words, char **argv) {
+    char *word = argv[0];
+    char *end = word + 1;
+    while (isalnum((unsigned char)*end) || *end == '_') {
+        end++;
+    }
+    char name[256];
+    size_t name_len = (size_t)(end - word);
+    if (name_len >= sizeof(name)) {
+        fprintf(stderr, COLOR_RED "Error: variable name too long\n" COLOR_RESET);
+        return 1;
+    }
+    memcpy(name, word, name_len);
+    name[name_len] = '\0';
+    
+    char sub[256];
+    bool element = *end == '[';
+    if (element) {
+        char *close = strchr(end, ']');
+        size_t sub_len = (size_t)(close - end - 1);
+        if (sub_len >= sizeof(sub)) {
+            fprintf(stderr, COLOR_RED "Error: subscript too long\n" COLOR_RESET);
+            return 1;
+        }
+        memcpy(sub, end + 1, sub_len);
+        sub[sub_len] = '\0';
+        end = close + 1;
+    }
+    bool append = *end == '+';
+    char *value = end + append + 1;
+    
+    if (element) {
+        char key[256];
+        if (shell_subscript(name, sub, key, sizeof(key)) != 0) {
+            return 1;
+        }
+        return shell_assign_element(name, key, value, append);
+    }
+    
+    if (value[0] != '(') {
+        return shell_assign_scalar(name, value, append);
+    }
+    
+    // The parentheses come off the first and last words
+    size_t last_len = strlen(argv[words - 1]);
+    if (last_len == 0 || argv[words - 1][last_len - 1] != ')') {
+        fprintf(stderr, COLOR_RED "Error: %s: missing )\n" COLOR_RESET, name);
+        return 1;
+    }
+    argv[words - 1][last_len - 1] = '\0';
+    char *elements[SHELL_MAX_ARGS];
+    int count = 0;
+    if (value[1]) {
+        elements[count++] = value + 1;
+    }
+    for (int i = 1; i < words; i++) {
+        elements[count++] = argv[i];
+    }
+    if (count > 0 && elements[count - 1][0] == '\0') {
+        count--;
+    }
+    return shell_assign_compound(name, append, count, elements);
+}
+
+// for NAME in WORDS; do BODY; done
+// for ((INIT; COND; STEP)); do BODY; done
+// The word list is expanded once, so looping over an array walks its
+// elements without joining and splitting them. The body is parsed again
+// on every pass.
+static int shell_run_for(char *loop) {
+    // Header up to the first top-level ';', then "do", then the body up
+    // to the closing "done"
+    int depth = 0;
+    char *semi = loop;
+    for (; *semi; semi++) {
+        if (*semi == '(') {
+            depth++;
+        } else if (*semi == ')') {
+            depth--;
+        } else if (*semi == ';' && depth == 0) {
+            break;
+        }
+    }
+    char *body = semi + (*semi == ';');
+    while (isspace((unsigned char)*body)) {
+        body++;
+    }
+    size_t body_len = strlen(body);
+    if (!*semi || strncmp(body, "do", 2) != 0 || !isspace((unsigned char)body[2]) ||
+        body_len < 8 || strcmp(body + body_len - 4, "done") != 0 ||
+        (!isspace((unsigned char)body[body_len - 5]) && body[body_len - 5] != ';')) {
+        fprintf(stderr, COLOR_RED "Error: for: expected '; do ...; done'\n" COLOR_RESET);
+        return 1;
+    }
+    *semi = '\0';
+    body[body_len - 5] = '\0';
+    body += 3;
+    
+    char *header = loop;
+    while (isspace((unsigned char)*header)) {
+        header++;
+    }
+    
+    int status = 0;
+    char pass[SHELL_MAX_INPUT];
+    
+    size_t header_len = strlen(header);
+    while (header_len > 0 && isspace((unsigned char)header[header_len - 1])) {
+        header[--header_len] = '\0';
+    }
+    if (header_len >= 4 && strncmp(header, "((", 2) == 0 && strcmp(header + header_len - 2, "))") == 0) {
+        header[header_len - 2] = '\0';
+        char *init = header + 2;
+        char *cond = strchr(init, ';');
+        char *step = cond ? strchr(cond + 1, ';') : NULL;
+        if (!step) {
+            fprintf(stderr, COLOR_RED "Error: for: expected ((init; condition; step))\n" COLOR_RESET);
+            return 1;
+        }
+        *cond++ = '\0';
+        *step++ = '\0';
+        
+        int64_t value;
+        if (strspn(init, " \t") != strlen(init) && shell_arith(init, &value) != 0) {
+            return 1;
+        }
+        bool always = strspn(cond, " \t") == strlen(cond);
+        bool has_step = strspn(step, " \t") != strlen(step);
+        for (;;) {
+            if (!always) {
+                if (shell_arith(cond, &value) != 0) {
+                    return 1;
+                }
+                if (value == 0) {
+                    break;
+                }
+            }
+            strcpy(pass, body);
+            status = shell_parse_and_execute(pass);
+            if (has_step && shell_arith(step, &value) != 0) {
+                return 1;
+            }
+        }
+        return status;
+    }
+    
+    char *words[SHELL_MAX_ARGS];
+    int count = 0;
+    shell_parse_command(header, words, &count);
+    if (count < 2 || !shell_is_name(words[0]) || strcmp(words[1], "in") != 0) {
+        fprintf(stderr, COLOR_RED "Error: for: expected NAME in WORDS\n" COLOR_RESET);
+        return 1;
+    }
+    
+    int value_count;
+    char **values = shell_expand_words(count - 2, words + 2, INT_MAX - 1, &value_count);
+    if (!values) {
+        return 1;
+    }
+    for (int i = 0; i < value_count; i++) {
+        if (shell_assign_scalar(words[0], values[i], false) != 0) {
+            status = 1;
+            break;
+        }
+        strcpy(pass, body);
+        status = shell_parse_and_execute(pass);
+    }
+    shell_free_words(values, value_count);
+    return status;
+}
+
+// Execute one command, subshell or function definition
+static int shell_execute_segment(char *segment) {
+    while (isspace((unsigned char)*segment)) {
+        segment++;
+    }
+    size_t len = strlen(segment);
+    while (len > 0 && isspace((unsigned char)segment[len - 1])) {
+        segment[--len] = '\0';
+    }
+    if (len == 0) {
+        return 0;
+    }
+    
+    // ((EXPR)) succeeds when EXPR is not zero
+    if (shell_is_group(segment, len, '(', ')') && shell_is_group(segment + 1, len - 2, '(', ')')) {
+        segment[len - 2] = '\0';
+        int64_t value;
+        return shell_arith(segment + 2, &value) == 0 && value != 0 ? 0 : 1;
+    }
+    
+    if (strncmp(segment, "for", 3) == 0 && (isspace((unsigned char)segment[3]) || segment[3] == '(')) {
+        return shell_run_for(segment + 3);
+    }
+    
+    if (shell_is_group(segment, len, '(', ')')) {
+        segment[len - 1] = '\0';
+        return shell_run_subshell(segment + 1);
+    }
+    
+    // name() { body }
+    char *parens = strstr(segment, "()");
+    if (parens) {
+        char *brace = parens + 2;
+        while (isspace((unsigned char)*brace)) {
+            brace++;
+        }
+        if (shell_is_group(brace, strlen(brace), '{', '}')) {
+            size_t name_len = (size_t)(parens - segment);
+            while (name_len > 0 && isspace((unsigned char)segment[name_len - 1])) {
+                name_len--;
+            }
+            if (strcspn(segment, " \t") >= name_len) {
+                brace[strlen(brace) - 1] = '\0';
+                return shell_define_function(segment, name_len, brace + 1);
+            }
+        }
+    }
+    
     // Parse input into command and arguments
     char *argv[SHELL_MAX_ARGS];
     int argc = 0;
     
-    shell_parse_command(input, argv, &argc);
+    shell_parse_command(segment, argv, &argc);
+    
+    // Expand variables; the expanded words are freed once the command returns
+    int count;
+    char **words = shell_expand_words(argc, argv, SHELL_MAX_ARGS - 1, &count);
+    if (!words) {
+        return 1;
+    }
     
-    if (argc > 0) {
-        return shell_execute_command(argc, argv);
+    int status = 0;
+    if (count > 0) {
+        status = shell_execute_command(count, words);
     }
+    shell_free_words(words, count);
     
-    return 0;
+    return status;
 }
 
 // Parse command line into arguments
@@ -196,6 +1075,42 @@ int shell_execute_command(int argc, char **argv) {
         return 0;
     }
     
+    // Leading NAME=VALUE words set variables; in front of a command they
+    // only hold for that command, in a scope dropped when it returns
+    int assignments = 0;
+    while (assignments < argc && shell_is_assignment(argv[assignments])) {
+        assignments += shell_assignment_words(argc - assignments, argv + assignments);
+    }
+    if (assignments > 0) {
+        bool scoped = assignments < argc;
+        if (scoped && env_scope_push(ENV_SCOPE_COMMAND) != 0) {
+            fprintf(stderr, COLOR_RED "Error: too many nested scopes\n" COLOR_RESET);
+            return 1;
+        }
+        // Typed variables are not scoped; only strings go in the scope
+        int status = 0;
+        for (int i = 0; i < assignments; ) {
+            int words = shell_assignment_words(assignments - i, argv + i);
+            if (shell_assign(words, argv + i) != 0) {
+                status = 1;
+            }
+            i += words;
+        }
+        
+        if (scoped) {
+            status = shell_execute_command(argc - assignments, argv + assignments);
+            env_scope_pop();
+        }
+        return status;
+    }
+    
+    // Functions come before built-ins
+    for (int i = 0; i < function_count; i++) {
+        if (strcmp(argv[0], functions[i].name) == 0) {
+            return shell_call_function(&functions[i]);
+        }
+    }
+    
     // Check for built-in commands
     for (int i = 0; builtin_commands[i].name != NULL; i++) {
         if (strcmp(argv[0], builtin_commands[i].name) == 0) {
@@ -203,12 +1118,47 @@ int shell_execute_command(int argc, char **argv) {
         }
     }
     
+    // Trailing "&" runs the command as a background job
+    bool background = false;
+    size_t last_len = strlen(argv[argc - 1]);
+    if (strcmp(argv[argc - 1], "&") == 0) {
+        argv[--argc] = NULL;
+        background = true;
+    } else if (last_len > 1 && argv[argc - 1][last_len - 1] == '&') {
+        argv[argc - 1][last_len - 1] = '\0';
+        background = true;
+    }
+    if (argc == 0) {
+        return 0;
+    }
+    
+    if (background) {
+        // Capture the job's output instead of letting it scribble over the prompt
+        size_t capture_size = 0;
+        char *size_var = env_get("CSHELL_JOB_BUFFER");
+        if (size_var) {
+            capture_size = (size_t)strtoull(size_var, NULL, 10);
+        }
+        
+        Process *process = process_create_captured(argv[0], argv, argc, capture_size);
+        if (!process) {
+            fprintf(stderr, COLOR_RED "Error: Failed to start job: %s: %s\n" COLOR_RESET,
+                    argv[0], strerror(errno));
+            return 1;
+        }
+        printf("[%d] %d\n", process->job_id, process->pid);
+        return 0;
+    }
+    
     // Execute external command
     Process *process = process_create(argv[0], argv, argc, true);
     if (!process) {
-        fprintf(stderr, COLOR_RED "Error: Command not found: %s\n" COLOR_RESET, argv[0]);
+        // process_spawn sets errno: ENOENT for an unknown command, EAGAIN
+        // for a full job table, or whatever fork or the spawn server hit
+        fprintf(stderr, COLOR_RED "Error: %s: %s\n" COLOR_RESET, argv[0], strerror(errno));
         return 1;
     }
+    process_release(process);
     
     return 0;
 }
@@ -0,0 +1,776 @@
+#include "../../include/shell/shvar.h"
+#include "../../include/shell/env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define SHVAR_MIN_ENTRIES 8
+
+// Largest indexed-array subscript; arrays are dense, so a[N] allocates N slots
+#define SHVAR_MAX_INDEX (1 << 24)
+
+// Associative array element
+typedef struct {
+    char *key;
+    char *value;
+    uint32_t hash;
+} ShAssocEntry;
+
+typedef struct {
+    char *name;
+    uint32_t hash;
+    ShVarType type;
+    bool exported;
+    bool dirty;                 // Changed since it was last written to the environment
+    int64_t number;             // SHVAR_INT
+    char **items;               // SHVAR_ARRAY, NULL for a hole
+    ShAssocEntry *entries;      // SHVAR_ASSOC
+    int count;                  // Items or entries, holes included
+    int capacity;
+    int live;                   // Set elements
+    uint32_t *index;            // SHVAR_ASSOC key index
+    uint32_t index_size;
+} ShVar;
+
+// Variables with an open-addressing index over them, the same scheme as
+// the environment store: a slot holds an entry number plus one
+static ShVar *shvars = NULL;
+static int shvar_count_total = 0;
+static int shvar_capacity = 0;
+static uint32_t *shvar_index = NULL;
+static uint32_t shvar_index_size = 0;
+
+// FNV-1a
+static uint32_t shvar_hash(const char *s, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Index of size slots over count hashes read through get
+static uint32_t *shvar_index_build(int count, uint32_t size, uint32_t (*get)(const void *, int),
+                                   const void *table) {
+    uint32_t *index = (uint32_t *)calloc(size, sizeof(uint32_t));
+    if (!index) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        uint32_t slot = get(table, i) & (size - 1);
+        while (index[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        index[slot] = (uint32_t)i + 1;
+    }
+    return index;
+}
+
+static uint32_t var_hash_at(const void *table, int i) {
+    return ((const ShVar *)table)[i].hash;
+}
+
+static uint32_t entry_hash_at(const void *table, int i) {
+    return ((const ShAssocEntry *)table)[i].hash;
+}
+
+// Index slot for name, or the empty slot where it would go
+static uint32_t shvar_slot(const char *name, uint32_t hash) {
+    uint32_t mask = shvar_index_size - 1;
+    uint32_t slot = hash & mask;
+    while (shvar_index[slot]) {
+        const ShVar *var = &shvars[shvar_index[slot] - 1];
+        if (var->hash == hash && strcmp(var->name, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static ShVar *shvar_find(const char *name) {
+    if (shvar_count_total == 0 || !name) {
+        return NULL;
+    }
+    uint32_t slot = shvar_slot(name, shvar_hash(name, strlen(name)));
+    return shvar_index[slot] ? &shvars[shvar_index[slot] - 1] : NULL;
+}
+
+// Rebuild the variable index so it stays at most half full
+static int shvar_reindex(void) {
+    uint32_t size = SHVAR_MIN_ENTRIES * 2;
+    while ((uint32_t)shvar_count_total * 2 > size) {
+        size *= 2;
+    }
+    uint32_t *index = shvar_index_build(shvar_count_total, size, var_hash_at, shvars);
+    if (!index) {
+        return -1;
+    }
+    free(shvar_index);
+    shvar_index = index;
+    shvar_index_size = size;
+    return 0;
+}
+
+// A valid variable name
+static bool shvar_valid_name(const char *name) {
+    if (!name || !(name[0] == '_' || (name[0] >= 'A' && name[0] <= 'Z') ||
+                   (name[0] >= 'a' && name[0] <= 'z'))) {
+        return false;
+    }
+    for (const char *p = name + 1; *p; p++) {
+        if (!(*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') ||
+              (*p >= '0' && *p <= '9'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static ShVar *shvar_create(const char *name, ShVarType type) {
+    if (!shvar_valid_name(name)) {
+        return NULL;
+    }
+    if (shvar_count_total == shvar_capacity) {
+        int capacity = shvar_capacity ? shvar_capacity * 2 : SHVAR_MIN_ENTRIES;
+        ShVar *vars = (ShVar *)realloc(shvars, (size_t)capacity * sizeof(ShVar));
+        if (!vars) {
+            return NULL;
+        }
+        shvars = vars;
+        shvar_capacity = capacity;
+    }
+
+    ShVar *var = &shvars[shvar_count_total];
+    memset(var, 0, sizeof(*var));
+    var->name = strdup(name);
+    if (!var->name) {
+        return NULL;
+    }
+    var->hash = shvar_hash(name, strlen(name));
+    var->type = type;
+    shvar_count_total++;
+
+    if ((uint32_t)shvar_count_total * 2 > shvar_index_size) {
+        if (shvar_reindex() != 0) {
+            shvar_count_total--;
+            free(var->name);
+            return NULL;
+        }
+    } else {
+        shvar_index[shvar_slot(name, var->hash)] = (uint32_t)shvar_count_total;
+    }
+    return var;
+}
+
+// Free a variable's elements, leaving it empty
+static void shvar_free_elements(ShVar *var) {
+    for (int i = 0; i < var->count; i++) {
+        if (var->type == SHVAR_ARRAY) {
+            free(var->items[i]);
+        } else if (var->type == SHVAR_ASSOC) {
+            free(var->entries[i].key);
+            free(var->entries[i].value);
+        }
+    }
+    free(var->items);
+    free(var->entries);
+    free(var->index);
+    var->items = NULL;
+    var->entries = NULL;
+    var->index = NULL;
+    var->index_size = 0;
+    var->count = 0;
+    var->capacity = 0;
+    var->live = 0;
+}
+
+static void shvar_changed(ShVar *var) {
+    var->dirty = true;
+}
+
+ShVarType shvar_type(const char *name) {
+    ShVar *var = shvar_find(name);
+    return var ? var->type : SHVAR_NONE;
+}
+
+const char *shvar_type_name(ShVarType type) {
+    switch (type) {
+        case SHVAR_INT:   return "integer";
+        case SHVAR_ARRAY: return "array";
+        case SHVAR_ASSOC: return "associative array";
+        default:          return "string";
+    }
+}
+
+// Parse a whole string as a decimal integer
+static bool shvar_parse_int(const char *s, int64_t *value) {
+    char *end;
+    errno = 0;
+    long long parsed = strtoll(s, &end, 10);
+    if (errno != 0 || end == s) {
+        return false;
+    }
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// Assoc entry for key, or the empty slot where it would go
+static uint32_t assoc_slot(const ShVar *var, const char *key, uint32_t hash) {
+    uint32_t mask = var->index_size - 1;
+    uint32_t slot = hash & mask;
+    while (var->index[slot]) {
+        const ShAssocEntry *entry = &var->entries[var->index[slot] - 1];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static ShAssocEntry *assoc_find(const ShVar *var, const char *key) {
+    if (var->count == 0) {
+        return NULL;
+    }
+    uint32_t slot = assoc_slot(var, key, shvar_hash(key, strlen(key)));
+    return var->index[slot] ? &var->entries[var->index[slot] - 1] : NULL;
+}
+
+static int assoc_reindex(ShVar *var) {
+    uint32_t size = SHVAR_MIN_ENTRIES * 2;
+    while ((uint32_t)var->count * 2 > size) {
+        size *= 2;
+    }
+    uint32_t *index = shvar_index_build(var->count, size, entry_hash_at, var->entries);
+    if (!index) {
+        return -1;
+    }
+    free(var->index);
+    var->index = index;
+    var->index_size = size;
+    return 0;
+}
+
+static int assoc_set(ShVar *var, const char *key, const char *value) {
+    char *copy = strdup(value);
+    if (!copy) {
+        return -1;
+    }
+
+    ShAssocEntry *entry = assoc_find(var, key);
+    if (entry) {
+        free(entry->value);
+        entry->value = copy;
+        return 0;
+    }
+
+    if (var->count == var->capacity) {
+        int capacity = var->capacity ? var->capacity * 2 : SHVAR_MIN_ENTRIES;
+        ShAssocEntry *entries = (ShAssocEntry *)realloc(var->entries, (size_t)capacity * sizeof(ShAssocEntry));
+        if (!entries) {
+            free(copy);
+            return -1;
+        }
+        var->entries = entries;
+        var->capacity = capacity;
+    }
+    entry = &var->entries[var->count];
+    entry->key = strdup(key);
+    if (!entry->key) {
+        free(copy);
+        return -1;
+    }
+    entry->value = copy;
+    entry->hash = shvar_hash(key, strlen(key));
+    var->count++;
+    var->live++;
+
+    if ((uint32_t)var->count * 2 > var->index_size) {
+        return assoc_reindex(var);
+    }
+    var->index[assoc_slot(var, key, entry->hash)] = (uint32_t)var->count;
+    return 0;
+}
+
+// Index of an indexed array from a key
+static bool array_index(const char *key, int64_t *index) {
+    return shvar_parse_int(key, index) && *index >= 0 && *index <= SHVAR_MAX_INDEX;
+}
+
+static int array_set(ShVar *var, int64_t index, const char *value) {
+    if (index < 0 || index > SHVAR_MAX_INDEX) {
+        errno = ERANGE;
+        return -1;
+    }
+    char *copy = strdup(value);
+    if (!copy) {
+        return -1;
+    }
+    if (index >= var->capacity) {
+        size_t capacity = var->capacity ? (size_t)var->capacity : SHVAR_MIN_ENTRIES;
+        while (capacity <= (size_t)index) {
+            capacity *= 2;
+        }
+        char **items = (char **)realloc(var->items, (size_t)capacity * sizeof(char *));
+        if (!items) {
+            free(copy);
+            return -1;
+        }
+        memset(items + var->capacity, 0, (capacity - (size_t)var->capacity) * sizeof(char *));
+        var->items = items;
+        var->capacity = (int)capacity;
+    }
+    if (index >= var->count) {
+        var->count = (int)index + 1;
+    }
+    if (var->items[index]) {
+        free(var->items[index]);
+    } else {
+        var->live++;
+    }
+    var->items[index] = copy;
+    return 0;
+}
+
+int shvar_declare(const char *name, ShVarType type) {
+    ShVar *var = shvar_find(name);
+    if (var) {
+        return var->type == type ? 0 : -1;
+    }
+
+    var = shvar_create(name, type);
+    if (!var) {
+        return -1;
+    }
+
+    // A string variable of the same name carries over and stays exported
+    const char *value = env_get(name);
+    if (value) {
+        var->exported = true;
+        var->dirty = true;
+        if (type == SHVAR_INT) {
+            int64_t number = 0;
+            shvar_parse_int(value, &number);
+            var->number = number;
+        } else if (type == SHVAR_ARRAY) {
+            array_set(var, 0, value);
+        } else {
+            assoc_set(var, "0", value);
+        }
+    }
+    return 0;
+}
+
+int shvar_unset(const char *name) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        return -1;
+    }
+    if (var->exported) {
+        env_unset_global(var->name);
+    }
+
+    shvar_free_elements(var);
+    free(var->name);
+    int i = (int)(var - shvars);
+    if (i != shvar_count_total - 1) {
+        shvars[i] = shvars[shvar_count_total - 1];
+    }
+    shvar_count_total--;
+    return shvar_reindex();
+}
+
+int shvar_set_int(const char *name, int64_t value) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        var = shvar_create(name, SHVAR_INT);
+        if (!var) {
+            return -1;
+        }
+    }
+
+    if (var->type == SHVAR_INT) {
+        var->number = value;
+    } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%" PRId64, value);
+        if (var->type == SHVAR_ARRAY ? array_set(var, 0, buf) : assoc_set(var, "0", buf)) {
+            return -1;
+        }
+    }
+    shvar_changed(var);
+    return 0;
+}
+
+int64_t shvar_get_int(const char *name) {
+    ShVar *var = shvar_find(name);
+    int64_t value = 0;
+    if (!var) {
+        const char *str = env_get(name);
+        if (str) {
+            shvar_parse_int(str, &value);
+        }
+        return value;
+    }
+
+    if (var->type == SHVAR_INT) {
+        return var->number;
+    }
+    const char *str = shvar_get_element(name, "0");
+    if (str) {
+        shvar_parse_int(str, &value);
+    }
+    return value;
+}
+
+int shvar_set_element(const char *name, const char *key, const char *value) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        var = shvar_create(name, SHVAR_ARRAY);
+        if (!var) {
+            return -1;
+        }
+    }
+
+    int rc;
+    if (var->type == SHVAR_ASSOC) {
+        rc = assoc_set(var, key, value);
+    } else if (var->type == SHVAR_ARRAY) {
+        int64_t index;
+        rc = array_index(key, &index) ? array_set(var, index, value) : -1;
+    } else {
+        // Only element 0 of an integer exists
+        int64_t index, number;
+        rc = array_index(key, &index) && index == 0 && shvar_parse_int(value, &number) ? 0 : -1;
+        if (rc == 0) {
+            var->number = number;
+        }
+    }
+    if (rc == 0) {
+        shvar_changed(var);
+    }
+    return rc;
+}
+
+const char *shvar_get_element(const char *name, const char *key) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        // A string variable is its own element 0
+        int64_t index;
+        return array_index(key, &index) && index == 0 ? env_get(name) : NULL;
+    }
+
+    if (var->type == SHVAR_ASSOC) {
+        ShAssocEntry *entry = assoc_find(var, key);
+        return entry ? entry->value : NULL;
+    }
+    if (var->type == SHVAR_ARRAY) {
+        int64_t index;
+        return array_index(key, &index) && index < var->count ? var->items[index] : NULL;
+    }
+    return NULL;
+}
+
+int shvar_unset_element(const char *name, const char *key) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        return -1;
+    }
+
+    if (var->type == SHVAR_ARRAY) {
+        int64_t index;
+        if (!array_index(key, &index) || index >= var->count || !var->items[index]) {
+            return -1;
+        }
+        free(var->items[index]);
+        var->items[index] = NULL;
+        var->live--;
+        while (var->count > 0 && !var->items[var->count - 1]) {
+            var->count--;
+        }
+    } else if (var->type == SHVAR_ASSOC) {
+        ShAssocEntry *entry = assoc_find(var, key);
+        if (!entry) {
+            return -1;
+        }
+        // Keep insertion order: close the gap, then rebuild the index
+        int i = (int)(entry - var->entries);
+        free(entry->key);
+        free(entry->value);
+        memmove(entry, entry + 1, (size_t)(var->count - i - 1) * sizeof(ShAssocEntry));
+        var->count--;
+        var->live--;
+        if (assoc_reindex(var) != 0) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    shvar_changed(var);
+    return 0;
+}
+
+// Add an element after the last one; an integer adds value to itself
+int shvar_append(const char *name, const char *value) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        var = shvar_create(name, SHVAR_ARRAY);
+        if (!var) {
+            return -1;
+        }
+    }
+
+    int rc;
+    if (var->type == SHVAR_ARRAY) {
+        rc = array_set(var, var->count, value);
+    } else if (var->type == SHVAR_ASSOC) {
+        char key[32];
+        snprintf(key, sizeof(key), "%d", var->count);
+        rc = assoc_set(var, key, value);
+    } else {
+        int64_t number;
+        rc = shvar_parse_int(value, &number) ? 0 : -1;
+        if (rc == 0) {
+            var->number = (int64_t)((uint64_t)var->number + (uint64_t)number);
+        }
+    }
+    if (rc == 0) {
+        shvar_changed(var);
+    }
+    return rc;
+}
+
+// Drop every element, keeping the type
+int shvar_clear(const char *name) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        return -1;
+    }
+    if (var->type == SHVAR_INT) {
+        var->number = 0;
+    } else {
+        shvar_free_elements(var);
+    }
+    shvar_changed(var);
+    return 0;
+}
+
+int shvar_count(const char *name) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        return env_get(name) ? 1 : 0;
+    }
+    return var->type == SHVAR_INT ? 1 : var->live;
+}
+
+const char **shvar_values(const char *name, int *count) {
+    *count = 0;
+    ShVar *var = shvar_find(name);
+    if (!var || var->type == SHVAR_INT) {
+        return NULL;
+    }
+
+    // Reuse one table; values are only read until the next change
+    static const char **table = NULL;
+    static int table_size = 0;
+    if (var->live + 1 > table_size) {
+        const char **grown = (const char **)realloc(table, (size_t)(var->live + 1) * sizeof(char *));
+        if (!grown) {
+            return NULL;
+        }
+        table = grown;
+        table_size = var->live + 1;
+    }
+
+    int n = 0;
+    for (int i = 0; i < var->count; i++) {
+        if (var->type == SHVAR_ARRAY) {
+            if (var->items[i]) {
+                table[n++] = var->items[i];
+            }
+        } else {
+            table[n++] = var->entries[i].value;
+        }
+    }
+    table[n] = NULL;
+    *count = n;
+    return table;
+}
+
+char **shvar_keys(const char *name, int *count) {
+    *count = 0;
+    ShVar *var = shvar_find(name);
+    if (!var || var->type == SHVAR_INT) {
+        return NULL;
+    }
+
+    char **keys = (char **)malloc((size_t)(var->live + 1) * sizeof(char *));
+    if (!keys) {
+        return NULL;
+    }
+    int n = 0;
+    for (int i = 0; i < var->count; i++) {
+        char buf[32];
+        const char *key = NULL;
+        if (var->type == SHVAR_ARRAY) {
+            if (var->items[i]) {
+                snprintf(buf, sizeof(buf), "%d", i);
+                key = buf;
+            }
+        } else {
+            key = var->entries[i].key;
+        }
+        if (!key) {
+            continue;
+        }
+        keys[n] = strdup(key);
+        if (!keys[n]) {
+            while (n > 0) {
+                free(keys[--n]);
+            }
+            free(keys);
+            return NULL;
+        }
+        n++;
+    }
+    keys[n] = NULL;
+    *count = n;
+    return keys;
+}
+
+const char *shvar_scalar(const char *name, char *buf, size_t size) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        return env_get(name);
+    }
+    if (var->type == SHVAR_INT) {
+        snprintf(buf, size, "%" PRId64, var->number);
+        return buf;
+    }
+    return shvar_get_element(name, "0");
+}
+
+int shvar_export(const char *name) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        return -1;
+    }
+    var->exported = true;
+    var->dirty = true;
+    return 0;
+}
+
+// The string a variable exports as
+static char *shvar_to_string(const ShVar *var) {
+    if (var->type == SHVAR_INT) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%" PRId64, var->number);
+        return strdup(buf);
+    }
+
+    int count;
+    const char **values = shvar_values(var->name, &count);
+    size_t len = 1;
+    for (int i = 0; i < count; i++) {
+        len += strlen(values[i]) + 1;
+    }
+    char *str = (char *)malloc(len);
+    if (!str) {
+        return NULL;
+    }
+    char *p = str;
+    for (int i = 0; i < count; i++) {
+        size_t n = strlen(values[i]);
+        if (i > 0) {
+            *p++ = ' ';
+        }
+        memcpy(p, values[i], n);
+        p += n;
+    }
+    *p = '\0';
+    return str;
+}
+
+void shvar_sync_exports(void) {
+    for (int i = 0; i < shvar_count_total; i++) {
+        ShVar *var = &shvars[i];
+        if (!var->exported || !var->dirty) {
+            continue;
+        }
+        char *str = shvar_to_string(var);
+        if (str && env_set_global(var->name, str) == 0) {
+            var->dirty = false;
+        }
+        free(str);
+    }
+}
+
+void shvar_print(const char *name) {
+    ShVar *var = shvar_find(name);
+    if (!var) {
+        const char *value = env_get(name);
+        if (value) {
+            printf("declare -x %s=\"%s\"\n", name, value);
+        }
+        return;
+    }
+
+    const char *flags = var->type == SHVAR_INT ? "i" : var->type == SHVAR_ARRAY ? "a" : "A";
+    printf("declare -%s%s %s", flags, var->exported ? "x" : "", var->name);
+    if (var->type == SHVAR_INT) {
+        printf("=%" PRId64 "\n", var->number);
+        return;
+    }
+
+    printf("=(");
+    bool first = true;
+    for (int i = 0; i < var->count; i++) {
+        const char *key = NULL;
+        const char *value = NULL;
+        char buf[32];
+        if (var->type == SHVAR_ARRAY) {
+            if (!var->items[i]) {
+                continue;
+            }
+            snprintf(buf, sizeof(buf), "%d", i);
+            key = buf;
+            value = var->items[i];
+        } else {
+            key = var->entries[i].key;
+            value = var->entries[i].value;
+        }
+        printf("%s[%s]=\"%s\"", first ? "" : " ", key, value);
+        first = false;
+    }
+    printf(")\n");
+}
+
+void shvar_print_all(void) {
+    for (int i = 0; i < shvar_count_total; i++) {
+        shvar_print(shvars[i].name);
+    }
+}
+
+void shvar_cleanup(void) {
+    for (int i = 0; i < shvar_count_total; i++) {
+        shvar_free_elements(&shvars[i]);
+        free(shvars[i].name);
+    }
+    free(shvars);
+    free(shvar_index);
+    shvars = NULL;
+    shvar_index = NULL;
+    shvar_count_total = 0;
+    shvar_capacity = 0;
+    shvar_index_size = 0;
+}
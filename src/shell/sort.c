@@ -0,0 +1,1041 @@
+#define _GNU_SOURCE
+#include "../../include/shell/sort.h"
+#include "../../include/shell/textutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define SORT_MIN_CHUNK (64 * 1024)
+#define SORT_MAX_CHUNK (32 * 1024 * 1024)
+#define SORT_STREAM_CHUNK (8 * 1024 * 1024)  // Largest chunk when the input size is unknown
+#define SORT_MERGE_WAY 64                     // Spilled runs merged in one pass
+#define SORT_FILE_BUFFER (128 * 1024)
+
+extern char **environ;
+
+// A line of a run; text[len] is always its newline
+typedef struct {
+    const char *text;
+    size_t len;
+    uint64_t prefix;    // First key packed into eight bytes that order like it
+} SortLine;
+
+// A sorted run, held in memory or spilled to an unlinked temp file
+typedef struct {
+    char *data;
+    SortLine *lines;
+    size_t count;
+    size_t memory;      // Bytes counted against the budget while held
+    FILE *file;
+} SortRun;
+
+// Whole lines waiting for a worker
+typedef struct SortChunk {
+    struct SortChunk *next;
+    char *data;
+    size_t len;
+    size_t index;       // Input order, which is also the run's
+} SortChunk;
+
+// State shared by the reader and the workers of one sort
+typedef struct {
+    const SortOptions *opts;
+    SortKey keys[SORT_MAX_KEYS];
+    int key_count;
+    bool last_resort;   // Compare whole lines when all keys tie
+    const char *temp_dir;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;   // A chunk was queued or the input ended
+    pthread_cond_t room;    // A worker finished a chunk
+    SortChunk *head;
+    SortChunk *tail;
+    int queued;         // Chunks queued or being sorted
+    bool done;
+    SortRun *runs;
+    size_t run_count;
+    size_t run_capacity;
+    size_t held;        // Bytes of runs kept in memory
+    int error;          // First errno from a spill
+} Sort;
+
+size_t sort_default_memory(void) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return 256 * 1024 * 1024;
+    }
+    return (size_t)pages * (size_t)page_size / 8;
+}
+
+static bool sort_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Start of field (counting from 1) of the line [p, end)
+static const char *sort_field(const Sort *sort, const char *p, const char *end, int field) {
+    char sep = sort->opts->separator;
+    for (int i = 1; i < field && p < end; i++) {
+        if (sep) {
+            const char *next = (const char *)memchr(p, sep, (size_t)(end - p));
+            p = next ? next + 1 : end;
+        } else {
+            while (p < end && sort_blank(*p)) {
+                p++;
+            }
+            while (p < end && !sort_blank(*p)) {
+                p++;
+            }
+        }
+    }
+    return p;
+}
+
+static void sort_key_bounds(const Sort *sort, const SortKey *key, const char *text, size_t len,
+                            const char **start, const char **stop) {
+    const char *end = text + len;
+    const char *s = sort_field(sort, text, end, key->start_field);
+    if (key->blanks) {
+        while (s < end && sort_blank(*s)) {
+            s++;
+        }
+    }
+    if (key->start_char > 1) {
+        s = end - s > key->start_char - 1 ? s + key->start_char - 1 : end;
+    }
+
+    const char *e = end;
+    if (key->end_field > 0) {
+        e = sort_field(sort, text, end, key->end_field);
+        if (key->end_char == 0) {
+            if (sort->opts->separator) {
+                const char *next = (const char *)memchr(e, sort->opts->separator, (size_t)(end - e));
+                e = next ? next : end;
+            } else {
+                while (e < end && sort_blank(*e)) {
+                    e++;
+                }
+                while (e < end && !sort_blank(*e)) {
+                    e++;
+                }
+            }
+        } else {
+            if (key->end_blanks) {
+                while (e < end && sort_blank(*e)) {
+                    e++;
+                }
+            }
+            e = end - e > key->end_char ? e + key->end_char : end;
+        }
+    }
+    *start = s;
+    *stop = e < s ? s : e;
+}
+
+static int sort_text_compare(const char *a, size_t alen, const char *b, size_t blen, bool fold) {
+    size_t n = alen < blen ? alen : blen;
+    if (fold) {
+        for (size_t i = 0; i < n; i++) {
+            int c = toupper((unsigned char)a[i]) - toupper((unsigned char)b[i]);
+            if (c) {
+                return c;
+            }
+        }
+    } else {
+        int c = memcmp(a, b, n);
+        if (c) {
+            return c;
+        }
+    }
+    return alen < blen ? -1 : alen > blen;
+}
+
+// A -n number: blanks, an optional '-', digits and a fraction
+typedef struct {
+    bool negative;
+    const char *digits;     // Integer part without leading zeros
+    size_t digit_count;
+    const char *fraction;   // Without trailing zeros
+    size_t fraction_count;
+} SortNumber;
+
+static void sort_parse_number(const char *p, const char *end, SortNumber *num) {
+    while (p < end && sort_blank(*p)) {
+        p++;
+    }
+    num->negative = p < end && *p == '-';
+    p += num->negative;
+    while (p < end && *p == '0') {
+        p++;
+    }
+    num->digits = p;
+    while (p < end && isdigit((unsigned char)*p)) {
+        p++;
+    }
+    num->digit_count = (size_t)(p - num->digits);
+    num->fraction = p;
+    num->fraction_count = 0;
+    if (p < end && *p == '.') {
+        num->fraction = ++p;
+        while (p < end && isdigit((unsigned char)*p)) {
+            p++;
+        }
+        num->fraction_count = (size_t)(p - num->fraction);
+        while (num->fraction_count > 0 && num->fraction[num->fraction_count - 1] == '0') {
+            num->fraction_count--;
+        }
+    }
+}
+
+// Exact comparison of the decimal strings, however long they are
+static int sort_numeric_compare(const char *a, const char *a_end, const char *b, const char *b_end) {
+    SortNumber x, y;
+    sort_parse_number(a, a_end, &x);
+    sort_parse_number(b, b_end, &y);
+    bool x_zero = x.digit_count == 0 && x.fraction_count == 0;
+    bool y_zero = y.digit_count == 0 && y.fraction_count == 0;
+    if (x_zero || y_zero) {
+        if (x_zero && y_zero) {
+            return 0;
+        }
+        return x_zero ? (y.negative ? 1 : -1) : (x.negative ? -1 : 1);
+    }
+    if (x.negative != y.negative) {
+        return x.negative ? -1 : 1;
+    }
+
+    int c;
+    if (x.digit_count != y.digit_count) {
+        c = x.digit_count < y.digit_count ? -1 : 1;
+    } else {
+        c = memcmp(x.digits, y.digits, x.digit_count);
+        if (c == 0) {
+            size_t n = x.fraction_count < y.fraction_count ? x.fraction_count : y.fraction_count;
+            c = memcmp(x.fraction, y.fraction, n);
+            if (c == 0) {
+                c = x.fraction_count < y.fraction_count ? -1 : x.fraction_count > y.fraction_count;
+            }
+        }
+    }
+    return x.negative ? -c : c;
+}
+
+// An order-preserving summary of a -n key: sign class, integer digit
+// count and the first twelve digits as BCD. Negative numbers complement
+// everything after the class, so larger magnitudes come first.
+static uint64_t sort_numeric_prefix(const char *s, const char *e) {
+    SortNumber num;
+    sort_parse_number(s, e, &num);
+    if (num.digit_count == 0 && num.fraction_count == 0) {
+        return 1ULL << 56;
+    }
+    uint64_t bits = 0;
+    // Counts too big for the byte tie, leaving the order to the full compare
+    if (num.digit_count < 255) {
+        bits = (uint64_t)num.digit_count << 48;
+        for (int i = 0; i < 12; i++) {
+            size_t at = (size_t)i;
+            unsigned digit = 0;
+            if (at < num.digit_count) {
+                digit = (unsigned)(num.digits[at] - '0');
+            } else if (at - num.digit_count < num.fraction_count) {
+                digit = (unsigned)(num.fraction[at - num.digit_count] - '0');
+            }
+            bits |= (uint64_t)digit << (44 - 4 * i);
+        }
+    } else {
+        bits = 255ULL << 48;
+    }
+    return num.negative ? ~bits & ((1ULL << 56) - 1) : (2ULL << 56) | bits;
+}
+
+static uint64_t sort_prefix(const Sort *sort, const char *text, size_t len) {
+    const SortKey *key = &sort->keys[0];
+    const char *s, *e;
+    sort_key_bounds(sort, key, text, len, &s, &e);
+    if (key->numeric) {
+        return sort_numeric_prefix(s, e);
+    }
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++) {
+        unsigned c = s + i < e ? (unsigned char)s[i] : 0;
+        prefix = prefix << 8 | (key->fold ? (unsigned)toupper((int)c) : c);
+    }
+    return prefix;
+}
+
+static int sort_compare(const Sort *sort, const SortLine *a, const SortLine *b, bool last_resort) {
+    // Different prefixes decide the first key without finding it
+    if (a->prefix != b->prefix) {
+        int c = a->prefix < b->prefix ? -1 : 1;
+        return sort->keys[0].reverse ? -c : c;
+    }
+    for (int k = 0; k < sort->key_count; k++) {
+        const SortKey *key = &sort->keys[k];
+        const char *as, *ae, *bs, *be;
+        sort_key_bounds(sort, key, a->text, a->len, &as, &ae);
+        sort_key_bounds(sort, key, b->text, b->len, &bs, &be);
+        int c = key->numeric ? sort_numeric_compare(as, ae, bs, be) :
+                sort_text_compare(as, (size_t)(ae - as), bs, (size_t)(be - bs), key->fold);
+        if (c) {
+            return key->reverse ? -c : c;
+        }
+    }
+    if (!last_resort) {
+        return 0;
+    }
+    int c = sort_text_compare(a->text, a->len, b->text, b->len, false);
+    return sort->opts->reverse ? -c : c;
+}
+
+// Stable merge sort; tmp holds at least count / 2 lines
+static void sort_lines(const Sort *sort, SortLine *lines, SortLine *tmp, size_t count) {
+    if (count <= 16) {
+        for (size_t i = 1; i < count; i++) {
+            SortLine line = lines[i];
+            size_t j = i;
+            for (; j > 0 && sort_compare(sort, &line, &lines[j - 1], sort->last_resort) < 0; j--) {
+                lines[j] = lines[j - 1];
+            }
+            lines[j] = line;
+        }
+        return;
+    }
+
+    size_t half = count / 2;
+    sort_lines(sort, lines, tmp, half);
+    sort_lines(sort, lines + half, tmp, count - half);
+    if (sort_compare(sort, &lines[half - 1], &lines[half], sort->last_resort) <= 0) {
+        return;
+    }
+
+    memcpy(tmp, lines, half * sizeof(SortLine));
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < count) {
+        if (sort_compare(sort, &lines[j], &tmp[i], sort->last_resort) < 0) {
+            lines[k++] = lines[j++];
+        } else {
+            lines[k++] = tmp[i++];
+        }
+    }
+    memcpy(lines + k, tmp + i, (half - i) * sizeof(SortLine));
+}
+
+static FILE *sort_temp_file(Sort *sort) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cshell-sort-XXXXXX", sort->temp_dir);
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    // Nothing is left behind, however the sort ends
+    unlink(path);
+    FILE *file = fdopen(fd, "w+");
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, SORT_FILE_BUFFER);
+    return file;
+}
+
+static void sort_set_error(Sort *sort, int err) {
+    pthread_mutex_lock(&sort->lock);
+    if (!sort->error) {
+        sort->error = err;
+    }
+    pthread_mutex_unlock(&sort->lock);
+}
+
+static void sort_free_run(Sort *sort, SortRun *run) {
+    if (run->file) {
+        fclose(run->file);
+    }
+    if (run->data) {
+        sort->held -= run->memory;
+    }
+    free(run->data);
+    free(run->lines);
+    memset(run, 0, sizeof(*run));
+}
+
+// Split a chunk into lines and sort them
+static bool sort_chunk(Sort *sort, SortChunk *chunk, SortRun *run) {
+    size_t count = (size_t)text_count_lines(chunk->data, chunk->len);
+    SortLine *lines = (SortLine *)malloc((count ? count : 1) * sizeof(SortLine));
+    SortLine *tmp = (SortLine *)malloc((count / 2 + 1) * sizeof(SortLine));
+    if (!lines || !tmp) {
+        free(lines);
+        free(tmp);
+        return false;
+    }
+
+    const char *p = chunk->data;
+    for (size_t i = 0; i < count; i++) {
+        const char *newline = (const char *)memchr(p, '\n', (size_t)(chunk->data + chunk->len - p));
+        lines[i].text = p;
+        lines[i].len = (size_t)(newline - p);
+        lines[i].prefix = sort_prefix(sort, p, lines[i].len);
+        p = newline + 1;
+    }
+    sort_lines(sort, lines, tmp, count);
+    free(tmp);
+
+    // -u keeps the first line of each run of equal keys
+    if (sort->opts->unique && count > 1) {
+        size_t kept = 1;
+        for (size_t i = 1; i < count; i++) {
+            if (sort_compare(sort, &lines[kept - 1], &lines[i], false) != 0) {
+                lines[kept++] = lines[i];
+            }
+        }
+        count = kept;
+    }
+
+    run->data = chunk->data;
+    run->lines = lines;
+    run->count = count;
+    run->memory = chunk->len + count * sizeof(SortLine);
+    return true;
+}
+
+// Write a sorted run out and drop it from memory
+static bool sort_spill(Sort *sort, SortRun *run) {
+    FILE *file = sort_temp_file(sort);
+    if (!file) {
+        return false;
+    }
+    for (size_t i = 0; i < run->count; i++) {
+        fwrite(run->lines[i].text, 1, run->lines[i].len + 1, file);
+    }
+    if (fflush(file) != 0 || ferror(file)) {
+        fclose(file);
+        return false;
+    }
+    free(run->data);
+    free(run->lines);
+    run->data = NULL;
+    run->lines = NULL;
+    run->file = file;
+    return true;
+}
+
+static void *sort_worker(void *arg) {
+    Sort *sort = (Sort *)arg;
+    for (;;) {
+        pthread_mutex_lock(&sort->lock);
+        while (!sort->head && !sort->done) {
+            pthread_cond_wait(&sort->ready, &sort->lock);
+        }
+        SortChunk *chunk = sort->head;
+        if (!chunk) {
+            pthread_mutex_unlock(&sort->lock);
+            break;
+        }
+        sort->head = chunk->next;
+        if (!sort->head) {
+            sort->tail = NULL;
+        }
+        pthread_mutex_unlock(&sort->lock);
+
+        SortRun run;
+        memset(&run, 0, sizeof(run));
+        if (!sort_chunk(sort, chunk, &run)) {
+            sort_set_error(sort, ENOMEM);
+            free(chunk->data);
+        } else {
+            // Keep the run while half the budget has room for it
+            pthread_mutex_lock(&sort->lock);
+            bool keep = sort->held + run.memory <= sort->opts->memory / 2;
+            if (keep) {
+                sort->held += run.memory;
+            }
+            pthread_mutex_unlock(&sort->lock);
+            if (!keep && !sort_spill(sort, &run)) {
+                sort_set_error(sort, errno ? errno : EIO);
+            }
+        }
+
+        pthread_mutex_lock(&sort->lock);
+        sort->runs[chunk->index] = run;
+        sort->queued--;
+        pthread_cond_signal(&sort->room);
+        pthread_mutex_unlock(&sort->lock);
+        free(chunk);
+    }
+    return NULL;
+}
+
+// Hand a chunk of whole lines to the workers, waiting while they all have one
+static bool sort_queue(Sort *sort, char *data, size_t len) {
+    SortChunk *chunk = (SortChunk *)malloc(sizeof(SortChunk));
+    if (!chunk) {
+        free(data);
+        return false;
+    }
+    chunk->next = NULL;
+    chunk->data = data;
+    chunk->len = len;
+
+    pthread_mutex_lock(&sort->lock);
+    while (sort->queued >= sort->opts->jobs) {
+        pthread_cond_wait(&sort->room, &sort->lock);
+    }
+    if (sort->run_count == sort->run_capacity) {
+        size_t capacity = sort->run_capacity ? sort->run_capacity * 2 : 64;
+        SortRun *runs = (SortRun *)realloc(sort->runs, capacity * sizeof(SortRun));
+        if (!runs) {
+            pthread_mutex_unlock(&sort->lock);
+            free(data);
+            free(chunk);
+            return false;
+        }
+        memset(runs + sort->run_capacity, 0, (capacity - sort->run_capacity) * sizeof(SortRun));
+        sort->runs = runs;
+        sort->run_capacity = capacity;
+    }
+    chunk->index = sort->run_count++;
+    if (sort->tail) {
+        sort->tail->next = chunk;
+    } else {
+        sort->head = chunk;
+    }
+    sort->tail = chunk;
+    sort->queued++;
+    pthread_cond_signal(&sort->ready);
+    pthread_mutex_unlock(&sort->lock);
+    return true;
+}
+
+// Enough chunks to keep every thread busy when the input size is known,
+// small enough that jobs of them fit in a quarter of the budget otherwise
+static size_t sort_chunk_size(const SortOptions *opts, char **files, int count) {
+    size_t size = opts->memory / 4 / (size_t)opts->jobs;
+    if (size > SORT_STREAM_CHUNK) {
+        size = SORT_STREAM_CHUNK;
+    }
+    off_t total = 0;
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        if (strcmp(files[i], "-") == 0 || stat(files[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+            total = -1;
+            break;
+        }
+        total += st.st_size;
+    }
+    if (total > 0 && (size_t)total <= opts->memory / 2) {
+        size = (size_t)total / (size_t)opts->jobs + 1;
+    }
+    if (size > SORT_MAX_CHUNK) {
+        size = SORT_MAX_CHUNK;
+    }
+    return size < SORT_MIN_CHUNK ? SORT_MIN_CHUNK : size;
+}
+
+// Read every file into chunks that end at a line boundary
+static int sort_read(Sort *sort, char **files, int count) {
+    size_t chunk_size = sort_chunk_size(sort->opts, files, count);
+    size_t capacity = chunk_size;
+    size_t len = 0;
+    char *data = (char *)malloc(capacity);
+    if (!data) {
+        return ENOMEM;
+    }
+
+    for (int i = 0; i < count; i++) {
+        bool is_stdin = strcmp(files[i], "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO : open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            int err = errno;
+            printf(COLOR_RED "sort: cannot read: %s: %s\n" COLOR_RESET, files[i], strerror(err));
+            free(data);
+            return err;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        for (;;) {
+            if (len == capacity) {
+                const char *last = (const char *)memrchr(data, '\n', len);
+                size_t used = last ? (size_t)(last + 1 - data) : 0;
+                size_t rest = len - used;
+                // One line longer than the chunk: let the chunk grow
+                size_t next_capacity = rest * 2 > chunk_size ? rest * 2 : chunk_size;
+                char *next = (char *)malloc(next_capacity);
+                if (!next) {
+                    free(data);
+                    if (!is_stdin) {
+                        close(fd);
+                    }
+                    return ENOMEM;
+                }
+                memcpy(next, data + used, rest);
+                if (used > 0) {
+                    if (!sort_queue(sort, data, used)) {
+                        free(next);
+                        if (!is_stdin) {
+                            close(fd);
+                        }
+                        return ENOMEM;
+                    }
+                } else {
+                    free(data);
+                }
+                data = next;
+                len = rest;
+                capacity = next_capacity;
+            }
+            ssize_t n = read(fd, data + len, capacity - len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                int err = errno;
+                printf(COLOR_RED "sort: read failed: %s: %s\n" COLOR_RESET, files[i], strerror(err));
+                free(data);
+                if (!is_stdin) {
+                    close(fd);
+                }
+                return err;
+            }
+            if (n == 0) {
+                break;
+            }
+            len += (size_t)n;
+        }
+        if (!is_stdin) {
+            close(fd);
+        }
+
+        // The last line of a file always ends with a newline
+        if (len > 0 && data[len - 1] != '\n') {
+            if (len == capacity) {
+                char *grown = (char *)realloc(data, capacity + 1);
+                if (!grown) {
+                    free(data);
+                    return ENOMEM;
+                }
+                data = grown;
+                capacity++;
+            }
+            data[len++] = '\n';
+        }
+    }
+
+    if (len > 0) {
+        return sort_queue(sort, data, len) ? 0 : ENOMEM;
+    }
+    free(data);
+    return 0;
+}
+
+// Where a run is in the merge
+typedef struct {
+    SortRun *run;
+    size_t next;        // Next line of a run in memory
+    char *buf;          // Line read back from a spilled run
+    size_t buf_size;
+    SortLine line;
+    bool done;
+} MergeSource;
+
+static void merge_advance(const Sort *sort, MergeSource *src) {
+    if (src->run->file) {
+        ssize_t n = getline(&src->buf, &src->buf_size, src->run->file);
+        if (n <= 0) {
+            src->done = true;
+            return;
+        }
+        src->line.text = src->buf;
+        src->line.len = (size_t)n - 1;
+        src->line.prefix = sort_prefix(sort, src->buf, src->line.len);
+    } else if (src->next < src->run->count) {
+        src->line = src->run->lines[src->next++];
+    } else {
+        src->done = true;
+    }
+}
+
+// Whether source a comes out before b; count stands for a source below
+// everything while the tree is built. Ties go to the earlier run, which
+// keeps the merge stable.
+static bool merge_beats(const Sort *sort, const MergeSource *src, int count, int a, int b) {
+    if (a == count) {
+        return true;
+    }
+    if (b == count) {
+        return false;
+    }
+    if (src[a].done || src[b].done) {
+        return !src[a].done;
+    }
+    int c = sort_compare(sort, &src[a].line, &src[b].line, sort->last_resort);
+    return c < 0 || (c == 0 && a < b);
+}
+
+// Replay source s from its leaf to the root; tree[0] is the winner and
+// the other nodes hold the loser of the match played there
+static void merge_adjust(const Sort *sort, const MergeSource *src, int *tree, int count, int s) {
+    for (int t = (s + count) / 2; t > 0; t /= 2) {
+        if (merge_beats(sort, src, count, tree[t], s)) {
+            int loser = s;
+            s = tree[t];
+            tree[t] = loser;
+        }
+    }
+    tree[0] = s;
+}
+
+// k-way merge of runs into out through a loser tree
+static int sort_merge(Sort *sort, SortRun *runs, int count, FILE *out) {
+    MergeSource *src = (MergeSource *)calloc((size_t)count, sizeof(MergeSource));
+    int *tree = (int *)malloc((size_t)count * sizeof(int));
+    if (!src || !tree) {
+        free(src);
+        free(tree);
+        return ENOMEM;
+    }
+    for (int i = 0; i < count; i++) {
+        src[i].run = &runs[i];
+        if (runs[i].file) {
+            rewind(runs[i].file);
+        }
+        merge_advance(sort, &src[i]);
+        tree[i] = count;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        merge_adjust(sort, src, tree, count, i);
+    }
+
+    // -u compares against a copy, since a spilled run reuses its buffer
+    SortLine last = { NULL, 0, 0 };
+    char *last_text = NULL;
+    size_t last_size = 0;
+    bool have_last = false;
+    int err = 0;
+    while (count > 0 && !src[tree[0]].done) {
+        int w = tree[0];
+        const SortLine *line = &src[w].line;
+        if (!sort->opts->unique || !have_last || sort_compare(sort, &last, line, false) != 0) {
+            fwrite(line->text, 1, line->len + 1, out);
+            if (sort->opts->unique) {
+                if (line->len + 1 > last_size) {
+                    char *grown = (char *)realloc(last_text, line->len + 1);
+                    if (!grown) {
+                        err = ENOMEM;
+                        break;
+                    }
+                    last_text = grown;
+                    last_size = line->len + 1;
+                }
+                memcpy(last_text, line->text, line->len + 1);
+                last.text = last_text;
+                last.len = line->len;
+                last.prefix = line->prefix;
+                have_last = true;
+            }
+        }
+        merge_advance(sort, &src[w]);
+        merge_adjust(sort, src, tree, count, w);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (src[i].run->file && ferror(src[i].run->file)) {
+            err = EIO;
+        }
+        free(src[i].buf);
+    }
+    free(last_text);
+    free(src);
+    free(tree);
+    if (fflush(out) != 0 || ferror(out)) {
+        err = errno ? errno : EIO;
+    }
+    return err;
+}
+
+// Merge groups of runs into spilled runs until few enough are files
+static int sort_reduce(Sort *sort) {
+    for (;;) {
+        size_t files = 0;
+        for (size_t i = 0; i < sort->run_count; i++) {
+            files += sort->runs[i].file != NULL;
+        }
+        if (files <= SORT_MERGE_WAY) {
+            return 0;
+        }
+
+        size_t groups = 0;
+        for (size_t start = 0; start < sort->run_count; start += SORT_MERGE_WAY, groups++) {
+            size_t n = sort->run_count - start < SORT_MERGE_WAY ? sort->run_count - start : SORT_MERGE_WAY;
+            FILE *file = sort_temp_file(sort);
+            if (!file) {
+                return errno;
+            }
+            int err = sort_merge(sort, sort->runs + start, (int)n, file);
+            if (err) {
+                fclose(file);
+                return err;
+            }
+            for (size_t i = start; i < start + n; i++) {
+                sort_free_run(sort, &sort->runs[i]);
+            }
+            sort->runs[groups].file = file;
+        }
+        sort->run_count = groups;
+    }
+}
+
+int sort_run(const SortOptions *opts, char **files, int count, FILE *out) {
+    static char *standard_input[] = { "-" };
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+
+    Sort sort;
+    memset(&sort, 0, sizeof(sort));
+    sort.opts = opts;
+    if (opts->key_count > 0) {
+        memcpy(sort.keys, opts->keys, (size_t)opts->key_count * sizeof(SortKey));
+        sort.key_count = opts->key_count;
+    } else {
+        // The whole line is the key
+        SortKey *key = &sort.keys[0];
+        key->start_field = 1;
+        key->numeric = opts->numeric;
+        key->reverse = opts->reverse;
+        key->fold = opts->fold;
+        key->blanks = opts->blanks;
+        sort.key_count = 1;
+    }
+    sort.last_resort = !opts->stable && !opts->unique &&
+                       (opts->key_count > 0 || opts->numeric || opts->fold || opts->blanks);
+    sort.temp_dir = opts->temp_dir ? opts->temp_dir : getenv("TMPDIR");
+    if (!sort.temp_dir || !*sort.temp_dir) {
+        sort.temp_dir = "/tmp";
+    }
+    pthread_mutex_init(&sort.lock, NULL);
+    pthread_cond_init(&sort.ready, NULL);
+    pthread_cond_init(&sort.room, NULL);
+
+    int jobs = opts->jobs > 0 ? opts->jobs : 1;
+    pthread_t *threads = (pthread_t *)malloc((size_t)jobs * sizeof(pthread_t));
+    int started = 0;
+    for (; threads && started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, sort_worker, &sort) != 0) {
+            break;
+        }
+    }
+
+    int err = started > 0 ? sort_read(&sort, files, count) : EAGAIN;
+
+    pthread_mutex_lock(&sort.lock);
+    sort.done = true;
+    pthread_cond_broadcast(&sort.ready);
+    pthread_mutex_unlock(&sort.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    bool reported = err != 0 && err != ENOMEM && err != EAGAIN;
+    if (!err) {
+        err = sort.error;
+    }
+    if (!err) {
+        err = sort_reduce(&sort);
+    }
+    if (!err) {
+        // The output is opened only now, so -o can name an input
+        FILE *dest = out;
+        if (opts->output && strcmp(opts->output, "-") != 0) {
+            dest = fopen(opts->output, "w");
+            if (!dest) {
+                printf(COLOR_RED "sort: cannot create '%s': %s\n" COLOR_RESET, opts->output, strerror(errno));
+                err = errno;
+                reported = true;
+            }
+        }
+        if (dest) {
+            err = sort_merge(&sort, sort.runs, (int)sort.run_count, dest);
+            if (dest != out && fclose(dest) != 0 && !err) {
+                err = errno;
+            }
+        }
+    }
+    if (err && !reported) {
+        printf(COLOR_RED "sort: %s\n" COLOR_RESET, strerror(err));
+    }
+
+    for (size_t i = 0; i < sort.run_count; i++) {
+        sort_free_run(&sort, &sort.runs[i]);
+    }
+    free(sort.runs);
+    pthread_mutex_destroy(&sort.lock);
+    pthread_cond_destroy(&sort.ready);
+    pthread_cond_destroy(&sort.room);
+    return err ? 2 : 0;
+}
+
+static double sort_elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Run the system sort on src into /dev/null in the C locale
+static double sort_time_system(const char *src, const char *const *args) {
+    char *argv[16];
+    int argc = 0;
+    argv[argc++] = (char *)"sort";
+    for (; args[argc - 1] && argc < 14; argc++) {
+        argv[argc] = (char *)args[argc - 1];
+    }
+    argv[argc++] = (char *)src;
+    argv[argc] = NULL;
+
+    size_t env_count = 0;
+    while (environ[env_count]) {
+        env_count++;
+    }
+    char **envp = (char **)malloc((env_count + 2) * sizeof(char *));
+    if (!envp) {
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < env_count; i++) {
+        if (strncmp(environ[i], "LC_ALL=", 7) != 0) {
+            envp[n++] = environ[i];
+        }
+    }
+    envp[n++] = (char *)"LC_ALL=C";
+    envp[n] = NULL;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid;
+    int status = -1;
+    if (posix_spawnp(&pid, "sort", &actions, NULL, argv, envp) == 0) {
+        waitpid(pid, &status, 0);
+    }
+    double seconds = sort_elapsed(&start);
+    posix_spawn_file_actions_destroy(&actions);
+    free(envp);
+    return status == 0 ? seconds : -1;
+}
+
+static double sort_time_builtin(const char *src, const SortOptions *opts) {
+    FILE *null = fopen("/dev/null", "w");
+    if (!null) {
+        return -1;
+    }
+    char *files[] = { (char *)src };
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = sort_run(opts, files, 1, null);
+    double seconds = sort_elapsed(&start);
+    fclose(null);
+    return status == 0 ? seconds : -1;
+}
+
+void sort_benchmark(size_t size_mb, FILE *out) {
+    char src[] = "/tmp/cshell-sort-src-XXXXXX";
+    int fd = mkstemp(src);
+    FILE *gen = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!gen) {
+        fprintf(out, "sort: cannot create scratch file: %s\n", strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(src);
+        }
+        return;
+    }
+
+    // Lines of a random word, a tab and a random number
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    size_t size = size_mb * 1024 * 1024;
+    for (size_t written = 0; written < size; ) {
+        char line[64];
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int word = 4 + (int)(state % 13);
+        int len = 0;
+        for (int i = 0; i < word; i++) {
+            line[len++] = (char)('a' + (state >> (i * 4 % 60)) % 26);
+        }
+        len += snprintf(line + len, sizeof(line) - (size_t)len, "\t%u\n", (unsigned)(state >> 40) % 1000000);
+        fwrite(line, 1, (size_t)len, gen);
+        written += (size_t)len;
+    }
+    fclose(gen);
+
+    static const char *const plain_args[] = { NULL };
+    static const char *const numeric_args[] = { "-t", "\t", "-k2,2n", NULL };
+    char spill_size[32];
+    snprintf(spill_size, sizeof(spill_size), "%zuK", size_mb * 1024 / 8 ? size_mb * 1024 / 8 : 1);
+    const char *const spill_args[] = { "-S", spill_size, NULL };
+
+    SortOptions plain;
+    memset(&plain, 0, sizeof(plain));
+    plain.memory = sort_default_memory();
+    plain.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (plain.jobs < 1) {
+        plain.jobs = 1;
+    }
+    SortOptions numeric = plain;
+    numeric.separator = '\t';
+    numeric.key_count = 1;
+    numeric.keys[0].start_field = 2;
+    numeric.keys[0].end_field = 2;
+    numeric.keys[0].numeric = true;
+    SortOptions spill = plain;
+    spill.memory = size / 8 ? size / 8 : 1;
+
+    struct {
+        const char *name;
+        const SortOptions *opts;
+        const char *const *args;
+    } cases[] = {
+        { "lines", &plain, plain_args },
+        { "-k2,2n", &numeric, numeric_args },
+        { "spilled", &spill, spill_args },
+    };
+
+    fprintf(out, "%zu MB, %d threads, best of 3 (seconds)\n", size_mb, plain.jobs);
+    fprintf(out, "  %-10s %10s %10s\n", "case", "builtin", "sort(1)");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        double best_builtin = -1, best_system = -1;
+        for (int run = 0; run < 3; run++) {
+            double s = sort_time_builtin(src, cases[c].opts);
+            if (s > 0 && (best_builtin < 0 || s < best_builtin)) {
+                best_builtin = s;
+            }
+            s = sort_time_system(src, cases[c].args);
+            if (s > 0 && (best_system < 0 || s < best_system)) {
+                best_system = s;
+            }
+        }
+        fprintf(out, "  %-10s %10.3f %10.3f\n", cases[c].name, best_builtin, best_system);
+    }
+    unlink(src);
+}
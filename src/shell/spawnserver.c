@@ -0,0 +1,664 @@
+#define _GNU_SOURCE
+#include "../../include/shell/spawnserver.h"
+#include "../../include/shell/env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+// Message types sent to the helper
+#define SPAWN_MSG_ENV   1       // Replace the helper's base envp
+#define SPAWN_MSG_SPAWN 2       // Start a process
+
+// Flags on a spawn message
+#define SPAWN_FD_PROCS  0x1     // A cgroup.procs fd follows the standard ones
+#define SPAWN_NEW_GROUP 0x2     // Put the child in a process group of its own
+
+// stdin, stdout, stderr, cwd and an optional cgroup.procs
+#define SPAWN_MAX_FDS 5
+
+// Fixed part of every message, followed by length bytes of NUL-separated strings
+typedef struct {
+    uint32_t type;
+    uint32_t length;
+    int32_t count;              // argc (path not included) or number of env entries
+    int32_t env_count;          // Scope overlay entries after argv
+    int32_t flags;
+    int32_t qos;
+    JobLimits limits;
+    JobCpuSet cpus;
+} SpawnHeader;
+
+// Reply to a spawn message, with the pidfd attached when there is one
+typedef struct {
+    int32_t pid;
+    int32_t err;
+} SpawnReply;
+
+// Shell side state
+static pid_t server_pid = -1;
+static int ctl_fd = -1;
+static int event_fd = -1;
+static unsigned long sent_env_generation = 0;
+
+// Write all of buf, attaching fds to the first chunk
+static int send_all(int fd, const void *buf, size_t len, const int *fds, int nfds) {
+    const char *p = (const char *)buf;
+    size_t off = 0;
+
+    if (nfds > 0) {
+        char control[CMSG_SPACE(sizeof(int) * SPAWN_MAX_FDS)];
+        memset(control, 0, sizeof(control));
+        struct iovec iov = { (void *)p, len };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+        ssize_t n;
+        do {
+            n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            return -1;
+        }
+        off = (size_t)n;
+    }
+
+    while (off < len) {
+        ssize_t n = send(fd, p + off, len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    return 0;
+}
+
+// Read exactly len bytes, collecting any fds sent with the first chunk
+static int recv_all(int fd, void *buf, size_t len, int *fds, int *nfds) {
+    char *p = (char *)buf;
+    size_t off = 0;
+    int max_fds = nfds ? *nfds : 0;
+
+    if (nfds) {
+        *nfds = 0;
+    }
+
+    while (off < len) {
+        char control[CMSG_SPACE(sizeof(int) * SPAWN_MAX_FDS)];
+        struct iovec iov = { p + off, len - off };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            int *received = (int *)CMSG_DATA(cmsg);
+            for (int i = 0; i < count; i++) {
+                if (nfds && *nfds < max_fds) {
+                    fds[(*nfds)++] = received[i];
+                } else {
+                    close(received[i]);
+                }
+            }
+        }
+        off += (size_t)n;
+    }
+    return 0;
+}
+
+// exec with envp; #!-less scripts run under /bin/sh as with execvp
+void spawn_exec(const char *path, char **args, int argc, char **envp) {
+    extern char **environ;
+    if (!envp) {
+        envp = environ;
+    }
+
+    execve(path, args, envp);
+
+    if (errno == ENOEXEC) {
+        char *sh_args[argc + 2];
+        sh_args[0] = "/bin/sh";
+        sh_args[1] = (char *)path;
+        for (int i = 1; i <= argc; i++) {
+            sh_args[i + 1] = args[i];
+        }
+        execve(sh_args[0], sh_args, envp);
+    }
+    _exit(EXIT_FAILURE);
+}
+
+// Split count NUL-terminated strings in data into a NULL-terminated table
+static char **split_strings(char *data, size_t len, int count) {
+    char **table = (char **)malloc((size_t)(count + 1) * sizeof(char *));
+    if (!table) {
+        return NULL;
+    }
+
+    char *p = data;
+    for (int i = 0; i < count; i++) {
+        if (p >= data + len) {
+            free(table);
+            return NULL;
+        }
+        table[i] = p;
+        p += strlen(p) + 1;
+    }
+    table[count] = NULL;
+    return table;
+}
+
+// Child side: envp with a scope overlay applied. Overlay entries are
+// NAME=VALUE to set or a bare NAME to remove.
+static char **apply_overlay(char **envp, char **overlay, int count) {
+    int base = 0;
+    while (envp && envp[base]) {
+        base++;
+    }
+    char **merged = (char **)malloc((size_t)(base + count + 1) * sizeof(char *));
+    if (!merged) {
+        return envp;
+    }
+    if (base > 0) {
+        memcpy(merged, envp, (size_t)base * sizeof(char *));
+    }
+
+    int n = base;
+    for (int k = 0; k < count; k++) {
+        size_t len = strcspn(overlay[k], "=");
+        int i = 0;
+        while (i < n && !(strncmp(merged[i], overlay[k], len) == 0 && merged[i][len] == '=')) {
+            i++;
+        }
+        if (overlay[k][len] == '=') {
+            merged[i < n ? i : n++] = overlay[k];
+        } else if (i < n) {
+            merged[i] = merged[--n];
+        }
+    }
+    merged[n] = NULL;
+    return merged;
+}
+
+// Helper: start one process described by a spawn message
+static void server_spawn(int ctl, const SpawnHeader *hdr, char *data, int *fds, int nfds,
+                         char **envp) {
+    SpawnReply reply = { -1, 0 };
+    int pidfd = -1;
+
+    // data holds the path, argv, then the env overlay
+    char **strings = NULL;
+    if (nfds >= 4 && (hdr->flags & SPAWN_FD_PROCS ? nfds == 5 : nfds == 4) &&
+        hdr->count >= 0 && hdr->env_count >= 0) {
+        strings = split_strings(data, hdr->length, hdr->count + 1 + hdr->env_count);
+    }
+
+    if (!strings) {
+        reply.err = EINVAL;
+    } else {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Background jobs leave the terminal's group so Ctrl-C misses them
+            if (hdr->flags & SPAWN_NEW_GROUP) {
+                setpgid(0, 0);
+            }
+            dup2(fds[0], STDIN_FILENO);
+            dup2(fds[1], STDOUT_FILENO);
+            dup2(fds[2], STDERR_FILENO);
+            if (fchdir(fds[3]) != 0) {
+                _exit(EXIT_FAILURE);
+            }
+
+            // Give the program the dispositions a shell child would have
+            signal(SIGINT, SIG_DFL);
+            signal(SIGQUIT, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            sigset_t none;
+            sigemptyset(&none);
+            sigprocmask(SIG_SETMASK, &none, NULL);
+
+            JobLimitHandle handle = { NULL, (hdr->flags & SPAWN_FD_PROCS) ? fds[4] : -1 };
+            job_limits_apply_child(&hdr->limits, &handle);
+            job_affinity_apply_child(&hdr->cpus);
+            job_qos_apply_child((JobQos)hdr->qos);
+            if (hdr->env_count > 0) {
+                envp = apply_overlay(envp, strings + hdr->count + 1, hdr->env_count);
+            }
+            // argv ends where the overlay starts
+            strings[hdr->count + 1] = NULL;
+            spawn_exec(strings[0], strings + 1, hdr->count, envp);
+        }
+
+        if (pid < 0) {
+            reply.err = errno;
+        } else {
+            // Also from this side, so the group exists before anyone signals it
+            if (hdr->flags & SPAWN_NEW_GROUP) {
+                setpgid(pid, pid);
+            }
+            reply.pid = pid;
+#ifdef SYS_pidfd_open
+            pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#endif
+        }
+        free(strings);
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+
+    send_all(ctl, &reply, sizeof(reply), &pidfd, pidfd >= 0 ? 1 : 0);
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+}
+
+// Exit reports waiting for room in the event pipe
+typedef struct {
+    SpawnExit *items;
+    size_t count;
+    size_t capacity;
+} ExitQueue;
+
+// Helper: write queued exit reports until the pipe is full. Reports are
+// smaller than PIPE_BUF, so each write moves one whole report or none.
+// Returns true if any was written.
+static bool flush_exits(int events, ExitQueue *queue) {
+    size_t sent = 0;
+    while (sent < queue->count &&
+           write(events, &queue->items[sent], sizeof(SpawnExit)) == sizeof(SpawnExit)) {
+        sent++;
+    }
+    if (sent > 0) {
+        memmove(queue->items, queue->items + sent, (queue->count - sent) * sizeof(SpawnExit));
+        queue->count -= sent;
+    }
+    return sent > 0;
+}
+
+// Helper main loop: serve spawn requests and report exits. The event pipe
+// is non-blocking: the shell drains it only from its main loop, and a
+// server stuck writing exits while the shell waits for a spawn reply
+// would deadlock both.
+static void spawn_server_main(int ctl, int events, pid_t shell_pid) {
+    // Keyboard signals are for the foreground job, not for us
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    int sfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sfd < 0) {
+        _exit(EXIT_FAILURE);
+    }
+
+    fcntl(events, F_SETFL, fcntl(events, F_GETFL) | O_NONBLOCK);
+    ExitQueue exits = { NULL, 0, 0 };
+
+    char *env_data = NULL;
+    char **envp = NULL;
+
+    for (;;) {
+        struct pollfd pfds[3] = {
+            { ctl, POLLIN, 0 }, { sfd, POLLIN, 0 }, { events, POLLOUT, 0 }
+        };
+        if (poll(pfds, exits.count > 0 ? 3 : 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // Reap children and queue their status and rusage
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                // Signals coalesce, one wait4 loop covers all of them
+            }
+
+            for (;;) {
+                // Make room first; without it the child stays a zombie
+                // until the next SIGCHLD rather than being lost
+                if (exits.count == exits.capacity) {
+                    size_t capacity = exits.capacity ? exits.capacity * 2 : 64;
+                    SpawnExit *items = (SpawnExit *)realloc(exits.items, capacity * sizeof(SpawnExit));
+                    if (!items) {
+                        break;
+                    }
+                    exits.items = items;
+                    exits.capacity = capacity;
+                }
+                SpawnExit *report = &exits.items[exits.count];
+                report->pid = wait4(-1, &report->status, WNOHANG, &report->usage);
+                if (report->pid <= 0) {
+                    break;
+                }
+                exits.count++;
+            }
+        }
+
+        // Forward what fits in the pipe, the rest once it drains
+        if (exits.count > 0 && flush_exits(events, &exits)) {
+            kill(shell_pid, SIGCHLD);
+        }
+
+        if (!(pfds[0].revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+
+        SpawnHeader hdr;
+        int fds[SPAWN_MAX_FDS];
+        int nfds = SPAWN_MAX_FDS;
+        if (recv_all(ctl, &hdr, sizeof(hdr), fds, &nfds) != 0) {
+            break;  // Shell went away
+        }
+
+        char *data = (char *)malloc(hdr.length + 1);
+        if (!data || recv_all(ctl, data, hdr.length, NULL, NULL) != 0) {
+            break;
+        }
+        data[hdr.length] = '\0';
+
+        if (hdr.type == SPAWN_MSG_ENV) {
+            char **table = split_strings(data, hdr.length, hdr.count);
+            if (table) {
+                free(envp);
+                free(env_data);
+                envp = table;
+                env_data = data;
+            } else {
+                free(data);
+            }
+        } else {
+            server_spawn(ctl, &hdr, data, fds, nfds, envp);
+            free(data);
+        }
+    }
+
+    _exit(0);
+}
+
+// Fork the helper
+int spawn_server_start(void) {
+    if (server_pid > 0) {
+        return 0;
+    }
+
+    int sv[2];
+    int ev[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return -1;
+    }
+    if (pipe2(ev, O_CLOEXEC) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    pid_t shell_pid = getpid();
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        close(ev[0]);
+        close(ev[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        close(ev[0]);
+        spawn_server_main(sv[1], ev[1], shell_pid);
+    }
+
+    close(sv[1]);
+    close(ev[1]);
+    fcntl(ev[0], F_SETFL, fcntl(ev[0], F_GETFL) | O_NONBLOCK);
+
+    server_pid = pid;
+    ctl_fd = sv[0];
+    event_fd = ev[0];
+    sent_env_generation = 0;
+    return 0;
+}
+
+// Shut the helper down; it exits when its socket closes
+void spawn_server_stop(void) {
+    if (server_pid <= 0) {
+        return;
+    }
+
+    close(ctl_fd);
+    waitpid(server_pid, NULL, 0);
+    close(event_fd);
+    ctl_fd = -1;
+    event_fd = -1;
+    server_pid = -1;
+}
+
+// Is the helper still there? Notices a helper that died on its own.
+bool spawn_server_running(void) {
+    if (server_pid > 0 && waitpid(server_pid, NULL, WNOHANG) == server_pid) {
+        close(ctl_fd);
+        ctl_fd = -1;
+        server_pid = -1;
+    }
+    return server_pid > 0;
+}
+
+// Forget a helper that stopped answering; callers fall back to fork
+static void spawn_server_lost(void) {
+    close(ctl_fd);
+    ctl_fd = -1;
+    kill(server_pid, SIGKILL);
+    waitpid(server_pid, NULL, 0);
+    server_pid = -1;
+    // event_fd stays open so exits already queued are still delivered
+}
+
+// Push the shell's base envp to the helper if it changed since the last
+// spawn. Scope overrides travel with each spawn instead, so VAR=x cmd
+// does not resend the whole environment.
+static int spawn_server_sync_env(void) {
+    unsigned long generation = env_get_base_generation();
+    if (generation == sent_env_generation) {
+        return 0;
+    }
+
+    char **envp = env_get_base_envp();
+    if (!envp) {
+        return -1;
+    }
+
+    size_t length = 0;
+    int count = 0;
+    for (; envp[count]; count++) {
+        length += strlen(envp[count]) + 1;
+    }
+
+    // Pack the strings back to back for one write
+    char *strings = (char *)malloc(length ? length : 1);
+    if (!strings) {
+        return -1;
+    }
+    char *p = strings;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(envp[i]) + 1;
+        memcpy(p, envp[i], len);
+        p += len;
+    }
+
+    SpawnHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SPAWN_MSG_ENV;
+    hdr.length = (uint32_t)length;
+    hdr.count = count;
+
+    int rc = send_all(ctl_fd, &hdr, sizeof(hdr), NULL, 0);
+    if (rc == 0) {
+        rc = send_all(ctl_fd, strings, length, NULL, 0);
+    }
+    free(strings);
+    if (rc != 0) {
+        return -1;
+    }
+
+    sent_env_generation = generation;
+    return 0;
+}
+
+// Launch a process through the helper
+pid_t spawn_server_spawn(const SpawnRequest *req, int *pidfd) {
+    *pidfd = -1;
+    if (server_pid <= 0) {
+        return -1;
+    }
+
+    if (spawn_server_sync_env() != 0) {
+        spawn_server_lost();
+        return -1;
+    }
+
+    int env_count;
+    char **overlay = env_get_overlay(&env_count);
+    if (!overlay) {
+        return -1;
+    }
+
+    // path, argv and the overlay as NUL-separated strings
+    size_t length = strlen(req->path) + 1;
+    for (int i = 0; i < req->argc; i++) {
+        length += strlen(req->args[i]) + 1;
+    }
+    for (int i = 0; i < env_count; i++) {
+        length += strlen(overlay[i]) + 1;
+    }
+    char *data = (char *)malloc(length);
+    if (!data) {
+        free(overlay);
+        return -1;
+    }
+    char *p = data;
+    size_t len = strlen(req->path) + 1;
+    memcpy(p, req->path, len);
+    p += len;
+    for (int i = 0; i < req->argc; i++) {
+        len = strlen(req->args[i]) + 1;
+        memcpy(p, req->args[i], len);
+        p += len;
+    }
+    for (int i = 0; i < env_count; i++) {
+        len = strlen(overlay[i]) + 1;
+        memcpy(p, overlay[i], len);
+        p += len;
+    }
+    free(overlay);
+
+    SpawnHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SPAWN_MSG_SPAWN;
+    hdr.length = (uint32_t)length;
+    hdr.count = req->argc;
+    hdr.env_count = env_count;
+    hdr.qos = req->qos;
+    if (req->limits) {
+        hdr.limits = *req->limits;
+    }
+    if (req->cpus) {
+        hdr.cpus = *req->cpus;
+    }
+
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    int in = req->in_fd >= 0 ? req->in_fd : STDIN_FILENO;
+    int out = req->out_fd >= 0 ? req->out_fd : STDOUT_FILENO;
+    int err = req->err_fd >= 0 ? req->err_fd : req->out_fd >= 0 ? req->out_fd : STDERR_FILENO;
+    int fds[SPAWN_MAX_FDS] = { in, out, err, cwd, -1 };
+    int nfds = 4;
+    if (req->limit_handle && req->limit_handle->procs_fd >= 0) {
+        fds[nfds++] = req->limit_handle->procs_fd;
+        hdr.flags |= SPAWN_FD_PROCS;
+    }
+    if (req->new_group) {
+        hdr.flags |= SPAWN_NEW_GROUP;
+    }
+
+    int rc = cwd < 0 ? -1 : 0;
+    if (rc == 0) {
+        rc = send_all(ctl_fd, &hdr, sizeof(hdr), fds, nfds);
+    }
+    if (rc == 0) {
+        rc = send_all(ctl_fd, data, length, NULL, 0);
+    }
+    free(data);
+    if (cwd >= 0) {
+        close(cwd);
+    }
+
+    SpawnReply reply;
+    int reply_fds[1];
+    int reply_nfds = 1;
+    if (rc != 0 || recv_all(ctl_fd, &reply, sizeof(reply), reply_fds, &reply_nfds) != 0) {
+        spawn_server_lost();
+        return -1;
+    }
+
+    if (reply.pid <= 0) {
+        errno = reply.err;
+        return -1;
+    }
+
+    if (reply_nfds > 0) {
+        *pidfd = reply_fds[0];
+    }
+    return reply.pid;
+}
+
+// Read one exit report
+int spawn_server_read_exit(SpawnExit *exit_report) {
+    if (event_fd < 0) {
+        return 0;
+    }
+    return read(event_fd, exit_report, sizeof(*exit_report)) == (ssize_t)sizeof(*exit_report);
+}
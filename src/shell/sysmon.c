@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include "../../include/shell/sysmon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+#define COLOR_GREEN     "\033[32m"
+#define COLOR_YELLOW    "\033[33m"
+
+#define SYSMON_BAR_WIDTH 30
+
+// A /proc file kept open and read again from offset 0
+typedef struct {
+    const char *path;
+    int fd;
+    char *buf;
+    size_t cap;
+} SysmonFile;
+
+enum {
+    SYSMON_STAT,
+    SYSMON_MEMINFO,
+    SYSMON_LOADAVG,
+    SYSMON_MOUNTS,
+    SYSMON_FILES
+};
+
+static SysmonFile sysmon_files[SYSMON_FILES] = {
+    { "/proc/stat", -1, NULL, 0 },
+    { "/proc/meminfo", -1, NULL, 0 },
+    { "/proc/loadavg", -1, NULL, 0 },
+    { "/proc/self/mounts", -1, NULL, 0 },
+};
+
+static int sysmon_proc_fd = -1;
+static volatile sig_atomic_t sysmon_interrupted = 0;
+
+// Whole file, NUL-terminated. The buffer grows until one pread takes it
+// all, since /proc/stat is long on machines with many interrupts.
+static const char *sysmon_read(int which) {
+    SysmonFile *f = &sysmon_files[which];
+    if (f->fd < 0) {
+        f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+        if (f->fd < 0) {
+            return NULL;
+        }
+    }
+
+    for (;;) {
+        if (!f->buf) {
+            f->cap = 16384;
+            f->buf = (char *)malloc(f->cap);
+            if (!f->buf) {
+                return NULL;
+            }
+        }
+        ssize_t n = pread(f->fd, f->buf, f->cap - 1, 0);
+        if (n < 0) {
+            return NULL;
+        }
+        if ((size_t)n < f->cap - 1) {
+            f->buf[n] = '\0';
+            return f->buf;
+        }
+        char *buf = (char *)realloc(f->buf, f->cap * 2);
+        if (!buf) {
+            return NULL;
+        }
+        f->buf = buf;
+        f->cap *= 2;
+    }
+}
+
+#ifdef SYS_getdents64
+struct sysmon_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Numeric entries of /proc, read in bulk from a descriptor kept open
+static int sysmon_count_processes(void) {
+    if (sysmon_proc_fd < 0) {
+        sysmon_proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sysmon_proc_fd < 0) {
+            return -1;
+        }
+    }
+    if (lseek(sysmon_proc_fd, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    char buf[32768];
+    int count = 0;
+    long n;
+    while ((n = syscall(SYS_getdents64, sysmon_proc_fd, buf, sizeof(buf))) > 0) {
+        for (long pos = 0; pos < n; ) {
+            struct sysmon_dirent64 *d = (struct sysmon_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+            count += d->d_name[0] >= '1' && d->d_name[0] <= '9';
+        }
+    }
+    return n < 0 ? -1 : count;
+}
+#else
+static int sysmon_count_processes(void) {
+    return -1;
+}
+#endif
+
+static uint64_t sysmon_meminfo_kb(const char *text, const char *key) {
+    const char *p = strstr(text, key);
+    return p ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+int sysmon_sample(SysmonSample *sample) {
+    const char *stat = sysmon_read(SYSMON_STAT);
+    if (!stat) {
+        return -1;
+    }
+
+    sample->cpu_count = 0;
+    sample->running = 0;
+    for (const char *line = stat; *line; ) {
+        if (strncmp(line, "cpu", 3) == 0) {
+            // cpu  user nice system idle iowait irq softirq steal
+            const char *p = line + 3;
+            int index = *p == ' ' ? 0 : (int)strtol(p, (char **)&p, 10) + 1;
+            while (*p && *p != ' ') {
+                p++;
+            }
+            uint64_t v[8] = { 0 };
+            for (int i = 0; i < 8; i++) {
+                v[i] = strtoull(p, (char **)&p, 10);
+            }
+
+            if (index >= sample->cpu_capacity) {
+                int capacity = sample->cpu_capacity ? sample->cpu_capacity * 2 : 64;
+                while (capacity <= index) {
+                    capacity *= 2;
+                }
+                SysmonCpu *cpus = (SysmonCpu *)realloc(sample->cpus, (size_t)capacity * sizeof(SysmonCpu));
+                if (!cpus) {
+                    return -1;
+                }
+                memset(cpus + sample->cpu_capacity, 0, (size_t)(capacity - sample->cpu_capacity) * sizeof(SysmonCpu));
+                sample->cpus = cpus;
+                sample->cpu_capacity = capacity;
+            }
+            SysmonCpu *cpu = &sample->cpus[index];
+            cpu->user = v[0] + v[1];
+            cpu->system = v[2] + v[5] + v[6];
+            cpu->iowait = v[4];
+            cpu->total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+            cpu->busy = cpu->total - v[3] - v[4];
+            if (index > sample->cpu_count) {
+                sample->cpu_count = index;
+            }
+        } else if (strncmp(line, "procs_running ", 14) == 0) {
+            sample->running = atoi(line + 14);
+        }
+        const char *next = strchr(line, '\n');
+        if (!next) {
+            break;
+        }
+        line = next + 1;
+    }
+
+    const char *meminfo = sysmon_read(SYSMON_MEMINFO);
+    if (meminfo) {
+        sample->mem_total = sysmon_meminfo_kb(meminfo, "MemTotal:") * 1024;
+        sample->mem_free = sysmon_meminfo_kb(meminfo, "MemFree:") * 1024;
+        sample->mem_available = sysmon_meminfo_kb(meminfo, "MemAvailable:") * 1024;
+        sample->swap_total = sysmon_meminfo_kb(meminfo, "SwapTotal:") * 1024;
+        sample->swap_free = sysmon_meminfo_kb(meminfo, "SwapFree:") * 1024;
+    }
+
+    const char *loadavg = sysmon_read(SYSMON_LOADAVG);
+    if (loadavg) {
+        sscanf(loadavg, "%lf %lf %lf", &sample->load[0], &sample->load[1], &sample->load[2]);
+    }
+
+    sample->processes = sysmon_count_processes();
+    return 0;
+}
+
+void sysmon_sample_free(SysmonSample *sample) {
+    free(sample->cpus);
+    memset(sample, 0, sizeof(*sample));
+}
+
+static const char *sysmon_size(uint64_t bytes, char *buf, size_t size) {
+    static const char units[] = "BKMGTPE";
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 6) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(buf, size, unit == 0 ? "%.0f%c" : "%.1f%c", value, units[unit]);
+    return buf;
+}
+
+// Device mounted on path, from /proc/self/mounts; the last match wins
+static void sysmon_mount_source(const char *path, char *source, size_t size) {
+    snprintf(source, size, "-");
+    const char *mounts = sysmon_read(SYSMON_MOUNTS);
+    if (!mounts) {
+        return;
+    }
+    char device[256], point[256];
+    for (const char *line = mounts; *line; ) {
+        if (sscanf(line, "%255s %255s", device, point) == 2 && strcmp(point, path) == 0) {
+            snprintf(source, size, "%s", device);
+        }
+        const char *next = strchr(line, '\n');
+        if (!next) {
+            break;
+        }
+        line = next + 1;
+    }
+}
+
+int sysmon_report(FILE *out) {
+    SysmonSample sample = { 0 };
+    if (sysmon_sample(&sample) != 0) {
+        fprintf(out, COLOR_RED "sysmon: cannot read /proc/stat: %s\n" COLOR_RESET, strerror(errno));
+        sysmon_sample_free(&sample);
+        return 1;
+    }
+
+    char a[32], b[32], c[32];
+    fprintf(out, "CPU Cores: %d\n", sample.cpu_count);
+
+    if (sample.mem_total > 0) {
+        uint64_t used = sample.mem_total - sample.mem_available;
+        fprintf(out, "\nMemory Usage: %.1f%%\n", 100.0 * (double)used / (double)sample.mem_total);
+        fprintf(out, "Total Memory: %s\n", sysmon_size(sample.mem_total, a, sizeof(a)));
+        fprintf(out, "Used Memory: %s\n", sysmon_size(used, a, sizeof(a)));
+        fprintf(out, "Available Memory: %s\n", sysmon_size(sample.mem_available, a, sizeof(a)));
+        fprintf(out, "Free Memory: %s\n", sysmon_size(sample.mem_free, a, sizeof(a)));
+        if (sample.swap_total > 0) {
+            fprintf(out, "Swap: %s used of %s\n",
+                    sysmon_size(sample.swap_total - sample.swap_free, a, sizeof(a)),
+                    sysmon_size(sample.swap_total, b, sizeof(b)));
+        }
+    }
+
+    struct statvfs vfs;
+    if (statvfs("/", &vfs) == 0 && vfs.f_blocks > 0) {
+        uint64_t total = (uint64_t)vfs.f_blocks * vfs.f_frsize;
+        uint64_t avail = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+        uint64_t used = total - (uint64_t)vfs.f_bfree * vfs.f_frsize;
+        char source[256];
+        sysmon_mount_source("/", source, sizeof(source));
+        fprintf(out, "\nDisk Usage:\n");
+        fprintf(out, "Filesystem: %s\n", source);
+        fprintf(out, "Size: %s\n", sysmon_size(total, a, sizeof(a)));
+        fprintf(out, "Used: %s\n", sysmon_size(used, b, sizeof(b)));
+        fprintf(out, "Available: %s\n", sysmon_size(avail, c, sizeof(c)));
+        // Like df: used out of what non-root users can reach, rounded up
+        uint64_t reachable = used + avail;
+        fprintf(out, "Use%%: %" PRIu64 "%%\n", reachable > 0 ? (used * 100 + reachable - 1) / reachable : 0);
+        fprintf(out, "Mounted on: /\n");
+    }
+
+    fprintf(out, "\nLoad Average (1/5/15 min): %.2f %.2f %.2f\n", sample.load[0], sample.load[1], sample.load[2]);
+    if (sample.processes >= 0) {
+        fprintf(out, "Total Processes: %d (%d running)\n", sample.processes, sample.running);
+    }
+
+    sysmon_sample_free(&sample);
+    return 0;
+}
+
+static void sysmon_handle_interrupt(int sig) {
+    (void)sig;
+    sysmon_interrupted = 1;
+}
+
+// Percent of the interval spent in part, from two readings
+static double sysmon_percent(uint64_t now, uint64_t before, uint64_t total) {
+    return total > 0 && now >= before ? 100.0 * (double)(now - before) / (double)total : 0.0;
+}
+
+static void sysmon_bar(FILE *out, double percent) {
+    int filled = (int)(percent / 100.0 * SYSMON_BAR_WIDTH + 0.5);
+    if (filled > SYSMON_BAR_WIDTH) {
+        filled = SYSMON_BAR_WIDTH;
+    }
+    const char *color = percent >= 90 ? COLOR_RED : percent >= 60 ? COLOR_YELLOW : COLOR_GREEN;
+    fprintf(out, "[%s", color);
+    for (int i = 0; i < SYSMON_BAR_WIDTH; i++) {
+        fputc(i < filled ? '|' : ' ', out);
+    }
+    fprintf(out, COLOR_RESET "]");
+}
+
+static void sysmon_cpu_line(FILE *out, const char *label, const SysmonCpu *now, const SysmonCpu *before) {
+    uint64_t total = now->total >= before->total ? now->total - before->total : 0;
+    double busy = sysmon_percent(now->busy, before->busy, total);
+    fprintf(out, "%-6s", label);
+    sysmon_bar(out, busy);
+    fprintf(out, " %5.1f%%  usr %5.1f  sys %5.1f  iow %5.1f\033[K\n", busy,
+            sysmon_percent(now->user, before->user, total),
+            sysmon_percent(now->system, before->system, total),
+            sysmon_percent(now->iowait, before->iowait, total));
+}
+
+int sysmon_watch(double interval, int count, FILE *out) {
+    SysmonSample samples[2] = { { 0 }, { 0 } };
+    if (sysmon_sample(&samples[0]) != 0) {
+        fprintf(out, COLOR_RED "sysmon: cannot read /proc/stat: %s\n" COLOR_RESET, strerror(errno));
+        return 1;
+    }
+
+    // Ctrl-C ends the watch instead of reaching the shell's handler
+    struct sigaction sa, old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sysmon_handle_interrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+    sysmon_interrupted = 0;
+
+    struct timespec delay;
+    delay.tv_sec = (time_t)interval;
+    delay.tv_nsec = (long)((interval - (double)delay.tv_sec) * 1e9);
+
+    fprintf(out, "\033[2J");
+    int status = 0;
+    for (int frame = 0; !sysmon_interrupted && (count == 0 || frame < count); frame++) {
+        struct timespec left = delay;
+        while (nanosleep(&left, &left) != 0 && errno == EINTR && !sysmon_interrupted) {
+        }
+        if (sysmon_interrupted) {
+            break;
+        }
+
+        SysmonSample *before = &samples[frame % 2];
+        SysmonSample *now = &samples[(frame + 1) % 2];
+        if (sysmon_sample(now) != 0) {
+            status = 1;
+            break;
+        }
+
+        fprintf(out, "\033[H");
+        fprintf(out, "sysmon: every %.1fs, Ctrl-C to stop\033[K\n\033[K\n", interval);
+        sysmon_cpu_line(out, "CPU", &now->cpus[0], &before->cpus[0]);
+        for (int i = 1; i <= now->cpu_count; i++) {
+            char label[16];
+            snprintf(label, sizeof(label), "cpu%d", i - 1);
+            SysmonCpu none = { 0 };
+            sysmon_cpu_line(out, label, &now->cpus[i], i <= before->cpu_count ? &before->cpus[i] : &none);
+        }
+
+        char a[32], b[32], c[32];
+        if (now->mem_total > 0) {
+            uint64_t used = now->mem_total - now->mem_available;
+            double percent = 100.0 * (double)used / (double)now->mem_total;
+            fprintf(out, "\033[K\n%-6s", "Mem");
+            sysmon_bar(out, percent);
+            fprintf(out, " %5.1f%%  %s used of %s, %s available\033[K\n", percent,
+                    sysmon_size(used, a, sizeof(a)), sysmon_size(now->mem_total, b, sizeof(b)),
+                    sysmon_size(now->mem_available, c, sizeof(c)));
+        }
+        fprintf(out, "Load  %.2f %.2f %.2f   processes %d (%d running)\033[K\n\033[J",
+                now->load[0], now->load[1], now->load[2], now->processes, now->running);
+        fflush(out);
+    }
+
+    sigaction(SIGINT, &old_sa, NULL);
+    sysmon_sample_free(&samples[0]);
+    sysmon_sample_free(&samples[1]);
+    return status;
+}
+
+void sysmon_cleanup(void) {
+    for (int i = 0; i < SYSMON_FILES; i++) {
+        if (sysmon_files[i].fd >= 0) {
+            close(sysmon_files[i].fd);
+            sysmon_files[i].fd = -1;
+        }
+        free(sysmon_files[i].buf);
+        sysmon_files[i].buf = NULL;
+        sysmon_files[i].cap = 0;
+    }
+    if (sysmon_proc_fd >= 0) {
+        close(sysmon_proc_fd);
+        sysmon_proc_fd = -1;
+    }
+}
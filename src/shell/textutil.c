@@ -0,0 +1,613 @@
+#define _GNU_SOURCE
+#include "../../include/shell/textutil.h"
+#include "../../include/shell/filecopy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Color definitions
+#define COLOR_RESET     "\033[0m"
+#define COLOR_RED       "\033[31m"
+
+#define TEXT_BUFFER (256 * 1024)
+#define TEXT_TAIL_BLOCK (64 * 1024)
+
+static volatile sig_atomic_t text_interrupted = 0;
+
+uint64_t text_count_lines(const char *p, size_t len) {
+    const char *end = p + len;
+    uint64_t count = 0;
+#ifdef __SSE2__
+    // Byte counters that each take up to 255 blocks, then get summed
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    while (end - p >= 16) {
+        size_t blocks = (size_t)(end - p) / 16;
+        if (blocks > 255) {
+            blocks = 255;
+        }
+        __m128i counters = zero;
+        for (size_t i = 0; i < blocks; i++, p += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)p);
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, newline));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(counters, zero));
+    }
+    count = (uint64_t)_mm_cvtsi128_si64(total) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+#endif
+    for (; p < end; p++) {
+        count += *p == '\n';
+    }
+    return count;
+}
+
+static bool text_is_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Words are counted where a non-space byte follows a space; *in_space
+// carries the state from one buffer to the next
+static uint64_t text_count_words(const char *p, size_t len, bool *in_space) {
+    const char *end = p + len;
+    uint64_t count = 0;
+    unsigned carry = *in_space ? 1 : 0;
+#ifdef __SSE2__
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        // \t through \r are the bytes with c - '\t' <= 4, unsigned
+        __m128i shifted = _mm_sub_epi8(block, tab);
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, four), shifted);
+        unsigned space = (unsigned)_mm_movemask_epi8(_mm_or_si128(control, _mm_cmpeq_epi8(block, blank)));
+        unsigned starts = ~space & ((space << 1) | carry) & 0xFFFF;
+        count += (uint64_t)__builtin_popcount(starts);
+        carry = (space >> 15) & 1;
+    }
+#endif
+    for (; p < end; p++) {
+        unsigned space = text_is_space((unsigned char)*p);
+        count += !space && carry;
+        carry = space;
+    }
+    *in_space = carry != 0;
+    return count;
+}
+
+static uint64_t text_count_chars(const char *p, size_t len) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += ((unsigned char)p[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+static int text_open(const char *cmd, const char *path) {
+    if (strcmp(path, "-") == 0) {
+        return STDIN_FILENO;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf(COLOR_RED "%s: cannot open '%s' for reading: %s\n" COLOR_RESET, cmd, path, strerror(errno));
+    }
+    return fd;
+}
+
+static void text_close(int fd) {
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+}
+
+static ssize_t text_read(int fd, char *buf, size_t size) {
+    ssize_t n;
+    do {
+        n = read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static bool text_write(FILE *out, const char *data, size_t len) {
+    return fwrite(data, 1, len, out) == len;
+}
+
+// wc
+
+typedef struct {
+    uint64_t lines;
+    uint64_t words;
+    uint64_t chars;
+    uint64_t bytes;
+} WcCounts;
+
+static int wc_count(const WcOptions *opts, int fd, char *buf, WcCounts *counts) {
+    struct stat st;
+    if (!opts->lines && !opts->words && !opts->chars && fstat(fd, &st) == 0 &&
+        S_ISREG(st.st_mode) && fd != STDIN_FILENO) {
+        counts->bytes = (uint64_t)st.st_size;
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    bool in_space = true;
+    ssize_t n;
+    while ((n = text_read(fd, buf, TEXT_BUFFER)) > 0) {
+        counts->bytes += (uint64_t)n;
+        if (opts->lines) {
+            counts->lines += text_count_lines(buf, (size_t)n);
+        }
+        if (opts->words) {
+            counts->words += text_count_words(buf, (size_t)n, &in_space);
+        }
+        if (opts->chars) {
+            counts->chars += text_count_chars(buf, (size_t)n);
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+static void wc_print(const WcOptions *opts, const WcCounts *counts, int width, const char *name, FILE *out) {
+    const char *sep = "";
+    if (opts->lines) {
+        fprintf(out, "%s%*" PRIu64, sep, width, counts->lines);
+        sep = " ";
+    }
+    if (opts->words) {
+        fprintf(out, "%s%*" PRIu64, sep, width, counts->words);
+        sep = " ";
+    }
+    if (opts->chars) {
+        fprintf(out, "%s%*" PRIu64, sep, width, counts->chars);
+        sep = " ";
+    }
+    if (opts->bytes) {
+        fprintf(out, "%s%*" PRIu64, sep, width, counts->bytes);
+    }
+    if (name) {
+        fprintf(out, " %s", name);
+    }
+    fputc('\n', out);
+}
+
+int wc_run(const WcOptions *opts, char **files, int count, FILE *out) {
+    WcOptions shown = *opts;
+    if (!shown.lines && !shown.words && !shown.chars && !shown.bytes) {
+        shown.lines = shown.words = shown.bytes = true;
+    }
+    static char *standard_input[] = { "-" };
+    bool named = count > 0;
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+
+    // Column width from the sizes involved, as wc does
+    int counters = shown.lines + shown.words + shown.chars + shown.bytes;
+    int width = 1;
+    if (counters > 1 || count > 1) {
+        uint64_t total_size = 0;
+        for (int i = 0; i < count; i++) {
+            struct stat st;
+            if (strcmp(files[i], "-") == 0 || stat(files[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+                width = 7;
+            } else {
+                total_size += (uint64_t)st.st_size;
+            }
+        }
+        int digits = 1;
+        for (uint64_t n = total_size; n >= 10; n /= 10) {
+            digits++;
+        }
+        if (digits > width) {
+            width = digits;
+        }
+    }
+
+    char *buf = (char *)malloc(TEXT_BUFFER);
+    if (!buf) {
+        return 1;
+    }
+    WcCounts total = { 0, 0, 0, 0 };
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        int fd = text_open("wc", files[i]);
+        if (fd < 0) {
+            status = 1;
+            continue;
+        }
+        WcCounts counts = { 0, 0, 0, 0 };
+        if (wc_count(&shown, fd, buf, &counts) != 0) {
+            printf(COLOR_RED "wc: %s: %s\n" COLOR_RESET, files[i], strerror(errno));
+            status = 1;
+        }
+        text_close(fd);
+        wc_print(&shown, &counts, width, named ? files[i] : NULL, out);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.chars += counts.chars;
+        total.bytes += counts.bytes;
+    }
+    if (count > 1) {
+        wc_print(&shown, &total, width, "total", out);
+    }
+    free(buf);
+    return status;
+}
+
+// head
+
+static void text_header(const HeadTailOptions *opts, int count, const char *path, bool *first, FILE *out) {
+    if (opts->headers == 1 || (opts->headers < 0 && count > 1)) {
+        fprintf(out, "%s==> %s <==\n", *first ? "" : "\n",
+                strcmp(path, "-") == 0 ? "standard input" : path);
+    }
+    *first = false;
+}
+
+static int head_fd(const HeadTailOptions *opts, int fd, char *buf, FILE *out) {
+    int64_t left = opts->count;
+    ssize_t n = 0;
+    while (left > 0 && (n = text_read(fd, buf, TEXT_BUFFER)) > 0) {
+        size_t take = (size_t)n;
+        if (opts->bytes) {
+            if ((int64_t)take > left) {
+                take = (size_t)left;
+            }
+            left -= (int64_t)take;
+        } else {
+            // Up to and including the left-th newline
+            const char *p = buf;
+            const char *end = buf + n;
+            while (left > 0 && p < end) {
+                const char *newline = (const char *)memchr(p, '\n', (size_t)(end - p));
+                if (!newline) {
+                    p = end;
+                    break;
+                }
+                p = newline + 1;
+                left--;
+            }
+            take = (size_t)(p - buf);
+        }
+        if (!text_write(out, buf, take)) {
+            return -1;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+int head_run(const HeadTailOptions *opts, char **files, int count, FILE *out) {
+    static char *standard_input[] = { "-" };
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+    char *buf = (char *)malloc(TEXT_BUFFER);
+    if (!buf) {
+        return 1;
+    }
+
+    int status = 0;
+    bool first = true;
+    for (int i = 0; i < count; i++) {
+        int fd = text_open("head", files[i]);
+        if (fd < 0) {
+            status = 1;
+            continue;
+        }
+        text_header(opts, count, files[i], &first, out);
+        if (head_fd(opts, fd, buf, out) != 0) {
+            printf(COLOR_RED "head: error reading '%s': %s\n" COLOR_RESET, files[i], strerror(errno));
+            status = 1;
+        }
+        text_close(fd);
+    }
+    fflush(out);
+    free(buf);
+    return status;
+}
+
+// tail
+
+// Where the last count lines of a size-byte file start, reading backward
+// from the end a block at a time
+static off_t tail_line_offset(int fd, off_t size, int64_t count, char *buf) {
+    off_t pos = size;
+    int64_t seen = 0;
+    bool last = true;
+    while (pos > 0) {
+        size_t chunk = pos < TEXT_TAIL_BLOCK ? (size_t)pos : TEXT_TAIL_BLOCK;
+        pos -= (off_t)chunk;
+        ssize_t n = pread(fd, buf, chunk, pos);
+        if (n != (ssize_t)chunk) {
+            return -1;
+        }
+        for (ssize_t i = n - 1; i >= 0; i--) {
+            if (buf[i] != '\n') {
+                continue;
+            }
+            // The newline ending the file does not start a line
+            if (last && pos + i == size - 1) {
+                continue;
+            }
+            if (++seen == count) {
+                return pos + i + 1;
+            }
+        }
+        last = false;
+    }
+    return 0;
+}
+
+// Skip to line or byte count (counting from 1), then copy the rest
+static int tail_from_start(const HeadTailOptions *opts, int fd, char *buf, FILE *out) {
+    int64_t skip = opts->count > 0 ? opts->count - 1 : 0;
+    ssize_t n;
+    while ((n = text_read(fd, buf, TEXT_BUFFER)) > 0) {
+        const char *p = buf;
+        const char *end = buf + n;
+        if (opts->bytes) {
+            size_t drop = (int64_t)n < skip ? (size_t)n : (size_t)skip;
+            p += drop;
+            skip -= (int64_t)drop;
+        } else {
+            while (skip > 0 && p < end) {
+                const char *newline = (const char *)memchr(p, '\n', (size_t)(end - p));
+                if (!newline) {
+                    p = end;
+                    break;
+                }
+                p = newline + 1;
+                skip--;
+            }
+        }
+        if (p < end && !text_write(out, p, (size_t)(end - p))) {
+            return -1;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+// A pipe or terminal: keep only enough of the end in memory
+static int tail_stream(const HeadTailOptions *opts, int fd, FILE *out) {
+    size_t cap = TEXT_BUFFER, len = 0;
+    char *data = (char *)malloc(cap);
+    if (!data) {
+        return -1;
+    }
+
+    ssize_t n;
+    for (;;) {
+        if (len == cap) {
+            // Drop what can no longer be part of the tail
+            size_t keep = len;
+            if (opts->bytes) {
+                keep = (int64_t)len > opts->count ? (size_t)opts->count : len;
+            } else {
+                int64_t seen = 0;
+                for (size_t i = len; i-- > 0; ) {
+                    if (data[i] == '\n' && i != len - 1 && ++seen == opts->count) {
+                        keep = len - i - 1;
+                        break;
+                    }
+                }
+            }
+            if (keep < len) {
+                memmove(data, data + len - keep, keep);
+                len = keep;
+            }
+            if (len == cap) {
+                char *grown = (char *)realloc(data, cap * 2);
+                if (!grown) {
+                    free(data);
+                    return -1;
+                }
+                data = grown;
+                cap *= 2;
+            }
+        }
+        n = text_read(fd, data + len, cap - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+
+    size_t start = 0;
+    if (opts->bytes) {
+        start = (int64_t)len > opts->count ? len - (size_t)opts->count : 0;
+    } else {
+        int64_t seen = 0;
+        for (size_t i = len; i-- > 0; ) {
+            if (data[i] == '\n' && i != len - 1 && ++seen == opts->count) {
+                start = i + 1;
+                break;
+            }
+        }
+    }
+    bool ok = opts->count == 0 || text_write(out, data + start, len - start);
+    free(data);
+    return n < 0 || !ok ? -1 : 0;
+}
+
+// Print the tail of fd; leaves a regular file's offset at its end
+static int tail_fd(const HeadTailOptions *opts, int fd, char *buf, FILE *out) {
+    if (opts->from_start) {
+        return tail_from_start(opts, fd, buf, out);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || lseek(fd, 0, SEEK_CUR) < 0) {
+        return tail_stream(opts, fd, out);
+    }
+    off_t start;
+    if (opts->bytes) {
+        start = st.st_size > opts->count ? st.st_size - (off_t)opts->count : 0;
+    } else {
+        start = opts->count > 0 ? tail_line_offset(fd, st.st_size, opts->count, buf) : st.st_size;
+    }
+    if (start < 0 || lseek(fd, start, SEEK_SET) < 0) {
+        return -1;
+    }
+    fflush(out);
+    return filecopy_fd(fd, fileno(out), NULL) < 0 ? -1 : 0;
+}
+
+static void text_handle_interrupt(int sig) {
+    (void)sig;
+    text_interrupted = 1;
+}
+
+// A file being followed
+typedef struct {
+    const char *path;
+    int fd;
+    int wd;
+    off_t offset;
+} TailFollow;
+
+// Print whatever was appended since the last read
+static void tail_drain(TailFollow *file, char *buf, bool show_header, int *last_shown, int index, FILE *out) {
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) {
+        return;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size < file->offset) {
+        printf(COLOR_RED "tail: %s: file truncated\n" COLOR_RESET, file->path);
+        file->offset = 0;
+    }
+
+    ssize_t n;
+    while ((n = pread(file->fd, buf, TEXT_BUFFER, file->offset)) > 0) {
+        if (show_header && *last_shown != index) {
+            fprintf(out, "\n==> %s <==\n", file->path);
+            *last_shown = index;
+        }
+        text_write(out, buf, (size_t)n);
+        file->offset += n;
+    }
+    fflush(out);
+}
+
+static int tail_follow(TailFollow *files, int count, bool show_header, char *buf, FILE *out) {
+    struct sigaction sa, old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = text_handle_interrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+    text_interrupted = 0;
+
+    // Only the last file printed so far needs no header
+    int last_shown = count - 1;
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    for (int i = 0; ifd >= 0 && i < count; i++) {
+        files[i].wd = inotify_add_watch(ifd, files[i].path, IN_MODIFY | IN_ATTRIB);
+    }
+
+    // Without inotify, look once a second
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!text_interrupted) {
+        struct pollfd pfd = { ifd, POLLIN, 0 };
+        int ready = poll(&pfd, ifd >= 0 ? 1 : 0, ifd >= 0 ? -1 : 1000);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (ifd < 0) {
+            for (int i = 0; i < count; i++) {
+                tail_drain(&files[i], buf, show_header, &last_shown, i, out);
+            }
+            continue;
+        }
+
+        ssize_t len;
+        while ((len = read(ifd, events, sizeof(events))) > 0) {
+            for (char *p = events; p < events + len; ) {
+                struct inotify_event *event = (struct inotify_event *)p;
+                for (int i = 0; i < count; i++) {
+                    if (files[i].wd == event->wd) {
+                        tail_drain(&files[i], buf, show_header, &last_shown, i, out);
+                    }
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    if (ifd >= 0) {
+        close(ifd);
+    }
+    sigaction(SIGINT, &old_sa, NULL);
+    return 0;
+}
+
+int tail_run(const HeadTailOptions *opts, char **files, int count, FILE *out) {
+    static char *standard_input[] = { "-" };
+    if (count == 0) {
+        files = standard_input;
+        count = 1;
+    }
+    char *buf = (char *)malloc(TEXT_BUFFER);
+    TailFollow *follow = (TailFollow *)calloc((size_t)count, sizeof(TailFollow));
+    if (!buf || !follow) {
+        free(buf);
+        free(follow);
+        return 1;
+    }
+
+    int status = 0;
+    int following = 0;
+    bool first = true;
+    for (int i = 0; i < count; i++) {
+        int fd = text_open("tail", files[i]);
+        if (fd < 0) {
+            status = 1;
+            continue;
+        }
+        text_header(opts, count, files[i], &first, out);
+        if (tail_fd(opts, fd, buf, out) != 0) {
+            printf(COLOR_RED "tail: error reading '%s': %s\n" COLOR_RESET, files[i], strerror(errno));
+            status = 1;
+        }
+        fflush(out);
+
+        // Only regular files can grow under us; pipes are done at EOF
+        struct stat st;
+        if (opts->follow && fd != STDIN_FILENO && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            follow[following].path = files[i];
+            follow[following].fd = fd;
+            follow[following].wd = -1;
+            follow[following].offset = lseek(fd, 0, SEEK_CUR);
+            following++;
+        } else {
+            text_close(fd);
+        }
+    }
+
+    if (following > 0) {
+        bool show_header = opts->headers == 1 || (opts->headers < 0 && count > 1);
+        tail_follow(follow, following, show_header, buf, out);
+        for (int i = 0; i < following; i++) {
+            close(follow[i].fd);
+        }
+    }
+    free(follow);
+    free(buf);
+    return status;
+}